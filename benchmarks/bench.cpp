@@ -0,0 +1,242 @@
+// Microbenchmarks of the codecs and of the hot paths of the library.
+// Usage: bgcode_bench [filter] [--time=seconds]
+// Only the benchmarks whose name contains filter are run.
+
+#include "core/core_impl.hpp"
+#include "binarize/binarize_impl.hpp"
+#include "convert/gcode_reader.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace bgcode::core;
+using namespace bgcode::binarize;
+using namespace bgcode::convert;
+
+// Allocations counter, to report the allocations per operation
+static std::atomic<size_t> s_allocations{ 0 };
+
+void* operator new(size_t size)
+{
+    s_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* ptr = std::malloc(size == 0 ? 1 : size))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+
+static const std::vector<size_t> BLOCK_SIZES = { 4 * 1024, 16 * 1024, 64 * 1024, 256 * 1024, 1024 * 1024 };
+
+struct BenchConfig
+{
+    std::string filter;
+    double min_time{ 0.2 };
+};
+
+// Runs op() until config.min_time elapsed and prints the throughput, computed over bytes processed per operation
+static void run_bench(const BenchConfig& config, const std::string& name, size_t block_size, size_t bytes,
+    const std::function<bool()>& op)
+{
+    if (!config.filter.empty() && name.find(config.filter) == std::string::npos)
+        return;
+
+    // warm up, and check that the operation succeeds
+    if (!op()) {
+        std::cout << name << " failed\n";
+        return;
+    }
+
+    using clock = std::chrono::steady_clock;
+    size_t iterations = 0;
+    const size_t allocations = s_allocations.load();
+    const clock::time_point start = clock::now();
+    double elapsed = 0.0;
+    do {
+        op();
+        ++iterations;
+        elapsed = std::chrono::duration<double>(clock::now() - start).count();
+    } while (elapsed < config.min_time);
+    const size_t op_allocations = s_allocations.load() - allocations;
+
+    const double mb_per_s = double(bytes) * double(iterations) / elapsed / (1024.0 * 1024.0);
+    char line[256];
+    std::snprintf(line, sizeof(line), "%-28s %8zuK %12.1f MB/s %10.1f allocs/op", name.c_str(), block_size / 1024, mb_per_s,
+        double(op_allocations) / double(iterations));
+    std::cout << line << "\n";
+}
+
+static std::string load_gcode()
+{
+    const std::string filename = std::string(BENCH_DATA_DIR) + "/mini_cube_b_ref.gcode";
+    FILE* file = std::fopen(filename.c_str(), "rb");
+    if (file == nullptr)
+        return std::string();
+    std::string data;
+    char buffer[65536];
+    size_t count;
+    while ((count = std::fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        data.append(buffer, count);
+    }
+    std::fclose(file);
+    return data;
+}
+
+// Returns about size bytes of gcode, repeating the given source, cut at the end of a line.
+// The comments at the head of the source are skipped, so that the small blocks contain moves too.
+static std::string make_gcode(const std::string& source, size_t size)
+{
+    const size_t first_command = source.find("\nG");
+    const std::string_view body = (first_command != std::string::npos) ? std::string_view(source).substr(first_command + 1) :
+        std::string_view(source);
+    std::string data;
+    data.reserve(size);
+    while (data.size() < size) {
+        data.append(body.substr(0, std::min(body.size(), size - data.size())));
+    }
+    const size_t last_eol = data.rfind('\n');
+    if (last_eol != std::string::npos)
+        data.resize(last_eol + 1);
+    return data;
+}
+
+// Returns metadata made of the "; key = value" lines of the given source, of about size bytes
+static std::vector<std::pair<std::string, std::string>> make_metadata(const std::string& source, size_t size)
+{
+    std::vector<std::pair<std::string, std::string>> config;
+    size_t pos = 0;
+    while (pos < source.size()) {
+        size_t end = source.find('\n', pos);
+        if (end == std::string::npos)
+            end = source.size();
+        const std::string_view line(source.data() + pos, end - pos);
+        const size_t equal = line.find(" = ");
+        if (line.size() > 2 && line[0] == ';' && line[1] == ' ' && equal != std::string_view::npos)
+            config.emplace_back(line.substr(2, equal - 2), line.substr(equal + 3));
+        pos = end + 1;
+    }
+
+    std::vector<std::pair<std::string, std::string>> metadata;
+    if (config.empty())
+        return metadata;
+    size_t bytes = 0;
+    for (size_t i = 0; bytes < size; ++i) {
+        const auto& [key, value] = config[i % config.size()];
+        // keys are kept unique
+        metadata.emplace_back(key + "_" + std::to_string(i / config.size()), value);
+        bytes += metadata.back().first.size() + metadata.back().second.size() + 2;
+    }
+    return metadata;
+}
+
+static void bench_checksum(const BenchConfig& config, const std::string& gcode, size_t size)
+{
+    run_bench(config, "crc32", size, gcode.size(), [&gcode]() {
+        Checksum checksum(EChecksumType::CRC32);
+        checksum.append(gcode.data(), gcode.size());
+        // keeps the checksum from being optimized out
+        const std::byte expected[4] = {};
+        return !checksum.matches(expected, sizeof(expected)) || true;
+    });
+}
+
+// Benchmarks the encoding and the decoding of a gcode block with the given codec
+static void bench_gcode_codec(const BenchConfig& config, const std::string& name, const std::string& gcode, size_t size,
+    EGCodeEncodingType encoding, ECompressionType compression)
+{
+    GCodeBlock block;
+    block.encoding_type = (uint16_t)encoding;
+    block.raw_data = gcode;
+    BlockHeader block_header;
+    std::vector<std::byte> payload;
+    run_bench(config, name + "_encode", size, gcode.size(), [&]() {
+        return encode_gcode_block(block, compression, block_header, payload) == EResult::Success;
+    });
+    if (encode_gcode_block(block, compression, block_header, payload) != EResult::Success)
+        return;
+
+    GCodeBlock decoded;
+    run_bench(config, name + "_decode", size, gcode.size(), [&]() {
+        decoded.raw_data.clear();
+        return decoded.read_data(block_header, payload.data(), payload.size()) == EResult::Success;
+    });
+}
+
+static void bench_metadata(const BenchConfig& config, const std::string& gcode, size_t size)
+{
+    BaseMetadataBlock block;
+    block.encoding_type = (uint16_t)EMetadataEncodingType::INI;
+    block.raw_data = make_metadata(gcode, size);
+    BlockHeader block_header;
+    std::vector<std::byte> payload;
+    if (encode_metadata_block(block, EBlockType::SlicerMetadata, ECompressionType::None, 0, block_header, payload) != EResult::Success)
+        return;
+    const size_t bytes = block_header.uncompressed_size;
+    run_bench(config, "metadata_encode", size, bytes, [&]() {
+        return encode_metadata_block(block, EBlockType::SlicerMetadata, ECompressionType::None, 0, block_header, payload) ==
+            EResult::Success;
+    });
+
+    BaseMetadataBlock decoded;
+    run_bench(config, "metadata_decode", size, bytes, [&]() {
+        decoded.raw_data.clear();
+        return decoded.read_data(block_header, payload.data(), payload.size()) == EResult::Success;
+    });
+}
+
+static void bench_gcode_reader(const BenchConfig& config, const std::string& gcode, size_t size)
+{
+    FILE* file = std::tmpfile();
+    if (file == nullptr)
+        return;
+    if (std::fwrite(gcode.data(), 1, gcode.size(), file) == gcode.size()) {
+        run_bench(config, "gcode_reader", size, gcode.size(), [file]() {
+            std::rewind(file);
+            size_t lines_count = 0;
+            GCodeReader reader(*file);
+            return reader.parse([&lines_count](GCodeReader&, const GCodeReader::GCodeLine&) { ++lines_count; }) && lines_count > 0;
+        });
+    }
+    std::fclose(file);
+}
+
+int main(int argc, const char* argv[])
+{
+    BenchConfig config;
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view arg(argv[i]);
+        if (arg.substr(0, 7) == "--time=")
+            config.min_time = std::atof(argv[i] + 7);
+        else
+            config.filter = arg;
+    }
+
+    const std::string source = load_gcode();
+    if (source.empty()) {
+        std::cout << "Unable to load the gcode from " << BENCH_DATA_DIR << "\n";
+        return EXIT_FAILURE;
+    }
+
+    for (size_t size : BLOCK_SIZES) {
+        const std::string gcode = make_gcode(source, size);
+        bench_checksum(config, gcode, size);
+        bench_gcode_codec(config, "meatpack", gcode, size, EGCodeEncodingType::MeatPack, ECompressionType::None);
+        bench_gcode_codec(config, "meatpack_comments", gcode, size, EGCodeEncodingType::MeatPackComments, ECompressionType::None);
+        bench_gcode_codec(config, "deflate", gcode, size, EGCodeEncodingType::None, ECompressionType::Deflate);
+        bench_gcode_codec(config, "heatshrink_11_4", gcode, size, EGCodeEncodingType::None, ECompressionType::Heatshrink_11_4);
+        bench_gcode_codec(config, "heatshrink_12_4", gcode, size, EGCodeEncodingType::None, ECompressionType::Heatshrink_12_4);
+        bench_metadata(config, gcode, size);
+        bench_gcode_reader(config, gcode, size);
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -68,6 +68,7 @@ PYBIND11_MODULE(MODULE_NAME, m) {
            get_config
            from_ascii_to_binary
            from_binary_to_ascii
+           generate_gcode
     )pbdoc";
 
     // Auxiliary FILE API:
@@ -157,6 +158,8 @@ PYBIND11_MODULE(MODULE_NAME, m) {
         .value("MissingPrinterMetadata", core::EResult::MissingPrinterMetadata)
         .value("MissingPrintMetadata", core::EResult::MissingPrintMetadata)
         .value("MissingSlicerMetadat", core::EResult::MissingSlicerMetadata)
+        .value("MemoryLimitExceeded", core::EResult::MemoryLimitExceeded)
+        .value("IndexMismatch", core::EResult::IndexMismatch)
         ;
 
     py::enum_<core::ECompressionType>(m, "CompressionType")
@@ -479,7 +482,10 @@ PYBIND11_MODULE(MODULE_NAME, m) {
         .def_readwrite("compression", &binarize::BinarizerConfig::compression)
         .def_readwrite("gcode_encoding", &binarize::BinarizerConfig::gcode_encoding)
         .def_readwrite("metadata_encoding", &binarize::BinarizerConfig::metadata_encoding)
-        .def_readwrite("checksum", &binarize::BinarizerConfig::checksum);
+        .def_readwrite("checksum", &binarize::BinarizerConfig::checksum)
+        .def_readwrite("layer_aligned_gcode_blocks", &binarize::BinarizerConfig::layer_aligned_gcode_blocks)
+        .def_readwrite("min_gcode_block_size", &binarize::BinarizerConfig::min_gcode_block_size)
+        .def_readwrite("late_metadata_capacity", &binarize::BinarizerConfig::late_metadata_capacity);
 
     py::class_<binarize::BinaryData>(m, "BinaryData")
         .def(py::init<>())
@@ -507,22 +513,105 @@ PYBIND11_MODULE(MODULE_NAME, m) {
         .def("append_gcode", &binarize::Binarizer::append_gcode)
         .def("finalize", &binarize::Binarizer::finalize);
 
+    py::class_<binarize::PrintStatistics::Feature>(m, "PrintStatisticsFeature")
+        .def(py::init<>())
+        .def_readonly("name", &binarize::PrintStatistics::Feature::name)
+        .def_readonly("time", &binarize::PrintStatistics::Feature::time)
+        .def_readonly("extrusion", &binarize::PrintStatistics::Feature::extrusion);
+
+    py::class_<binarize::PrintStatistics>(m, "PrintStatistics")
+        .def(py::init<>())
+        .def_readonly("moves_count", &binarize::PrintStatistics::moves_count)
+        .def_readonly("extruded_length", &binarize::PrintStatistics::extruded_length)
+        .def_readonly("retracted_length", &binarize::PrintStatistics::retracted_length)
+        .def_readonly("extrusion_distance", &binarize::PrintStatistics::extrusion_distance)
+        .def_readonly("travel_distance", &binarize::PrintStatistics::travel_distance)
+        .def_readonly("time", &binarize::PrintStatistics::time)
+        .def_readonly("min", &binarize::PrintStatistics::min)
+        .def_readonly("max", &binarize::PrintStatistics::max)
+        .def_readonly("tool_changes", &binarize::PrintStatistics::tool_changes)
+        .def_readonly("features", &binarize::PrintStatistics::features);
+
+    m.def("compute_print_statistics", [](FILEWrapper &file, binarize::PrintStatistics &stats, bool verify_checksum) {
+            return binarize::compute_print_statistics(*file.fptr, stats, verify_checksum);
+        },
+        R"pbdoc(
+            Computes the statistics of the print (extrusion, distances, per feature time, bounding box, tool changes),
+            scanning the gcode blocks in parallel.
+        )pbdoc",
+        py::arg("file"), py::arg("stats"), py::arg("verify_checksum") = false
+    );
+
     // Convert API:
 
     m.def("get_config", &get_config,  R"pbdoc(Create a default configuration for ascii to binary gcode conversion)pbdoc");
 
-    m.def("from_ascii_to_binary", [](FILEWrapper &infile, FILEWrapper &outfile, const binarize::BinarizerConfig &config) {
-            return convert::from_ascii_to_binary(*infile.fptr, *outfile.fptr, config);
+    py::enum_<core::ConversionStats::EStage>(m, "ConversionStage")
+        .value("Parse", core::ConversionStats::EStage::Parse)
+        .value("MeatPack", core::ConversionStats::EStage::MeatPack)
+        .value("Compression", core::ConversionStats::EStage::Compression)
+        .value("Checksum", core::ConversionStats::EStage::Checksum)
+        .value("IO", core::ConversionStats::EStage::IO);
+
+    py::class_<core::ConversionStats::Blocks>(m, "ConversionStatsBlocks")
+        .def(py::init<>())
+        .def_readonly("count", &core::ConversionStats::Blocks::count)
+        .def_readonly("compressed_size", &core::ConversionStats::Blocks::compressed_size)
+        .def_readonly("uncompressed_size", &core::ConversionStats::Blocks::uncompressed_size);
+
+    py::class_<core::ConversionStats>(m, "ConversionStats")
+        .def(py::init<>())
+        .def_readonly("bytes_read", &core::ConversionStats::bytes_read)
+        .def_readonly("bytes_written", &core::ConversionStats::bytes_written)
+        .def_readonly("blocks", &core::ConversionStats::blocks)
+        .def_readonly("stage_times", &core::ConversionStats::stage_times)
+        .def_readonly("total_time", &core::ConversionStats::total_time)
+        .def_readonly("peak_compressed_size", &core::ConversionStats::peak_compressed_size)
+        .def_readonly("peak_uncompressed_size", &core::ConversionStats::peak_uncompressed_size)
+        .def("compression_ratio", &core::ConversionStats::compression_ratio);
+
+    m.def("from_ascii_to_binary", [](FILEWrapper &infile, FILEWrapper &outfile, const binarize::BinarizerConfig &config,
+        core::ConversionStats *stats) {
+            return convert::from_ascii_to_binary(*infile.fptr, *outfile.fptr, config, stats);
         },
-        R"pbdoc(Convert ascii gcode to binary format)pbdoc",
-        py::arg("infile"), py::arg("outfile"), py::arg("config") = get_config()
+        R"pbdoc(Convert ascii gcode to binary format, optionally filling the statistics of the conversion)pbdoc",
+        py::arg("infile"), py::arg("outfile"), py::arg("config") = get_config(), py::arg("stats") = nullptr
     );
 
-    m.def("from_binary_to_ascii", [] (FILEWrapper &infile, FILEWrapper &outfile, bool verify_checksum) {
-            return convert::from_binary_to_ascii(*infile.fptr, *outfile.fptr, verify_checksum);
+    m.def("from_binary_to_ascii", [] (FILEWrapper &infile, FILEWrapper &outfile, bool verify_checksum, core::ConversionStats *stats) {
+            return convert::from_binary_to_ascii(*infile.fptr, *outfile.fptr, verify_checksum, stats);
+        },
+        R"pbdoc(Convert binary gcode to textual format, optionally filling the statistics of the conversion)pbdoc",
+        py::arg("infile"), py::arg("outfile"), py::arg("verify_checksum") = true, py::arg("stats") = nullptr
+    );
+
+    py::class_<convert::GeneratorConfig>(m, "GeneratorConfig")
+        .def(py::init<>())
+        .def_readwrite("size", &convert::GeneratorConfig::size)
+        .def_readwrite("seed", &convert::GeneratorConfig::seed)
+        .def_readwrite("moves_per_layer", &convert::GeneratorConfig::moves_per_layer)
+        .def_readwrite("long_line_length", &convert::GeneratorConfig::long_line_length)
+        .def_readwrite("long_lines_interval", &convert::GeneratorConfig::long_lines_interval)
+        .def_readwrite("crlf", &convert::GeneratorConfig::crlf)
+        // thumbnails as a list of (format, width, height) tuples
+        .def_property("thumbnails",
+            [](const convert::GeneratorConfig &self) {
+                std::vector<std::tuple<core::EThumbnailFormat, uint16_t, uint16_t>> ret;
+                for (const core::ThumbnailParams &params : self.thumbnails)
+                    ret.emplace_back((core::EThumbnailFormat)params.format, params.width, params.height);
+                return ret;
+            },
+            [](convert::GeneratorConfig &self, const std::vector<std::tuple<core::EThumbnailFormat, uint16_t, uint16_t>> &thumbnails) {
+                self.thumbnails.clear();
+                for (const auto &[format, width, height] : thumbnails)
+                    self.thumbnails.push_back({ (uint16_t)format, width, height });
+            });
+
+    m.def("generate_gcode", [](FILEWrapper &outfile, const convert::GeneratorConfig &config) {
+            return convert::generate_gcode(*outfile.fptr, config);
         },
-        R"pbdoc(Convert binary gcode to textual format)pbdoc",
-        py::arg("infile"), py::arg("outfile"), py::arg("verify_checksum") = true
+        R"pbdoc(Write a synthetic ascii gcode file, in the format produced by PrusaSlicer)pbdoc",
+        py::arg("outfile"), py::arg("config") = convert::GeneratorConfig()
     );
 
 #ifdef VERSION_INFO
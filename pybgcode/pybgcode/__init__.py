@@ -4,19 +4,25 @@ from typing import Type, Union
 from ._bgcode import (  # type: ignore
     BlockHeader,
     CompressionType,
+    ConversionStage,
+    ConversionStats,
     EBlockType,
     EResult,
     EThumbnailFormat,
     FileHeader,
     FILEWrapper,
+    GeneratorConfig,
     PrintMetadataBlock,
+    PrintStatistics,
     PrinterMetadataBlock,
     SlicerMetadataBlock,
     FileMetadataBlock,
     ThumbnailBlock,
     close,
+    compute_print_statistics,
     from_ascii_to_binary,
     from_binary_to_ascii,
+    generate_gcode,
     get_config,
     is_open,
     open,
@@ -33,17 +39,23 @@ __version__ = version()
 __all__ = [
         "BlockHeader",
         "CompressionType",
+        "ConversionStage",
+        "ConversionStats",
         "EBlockType",
         "EResult",
         "EThumbnailFormat",
         "FileHeader",
         "FileMetadataBlock",
+        "GeneratorConfig",
         "PrintMetadataBlock",
+        "PrintStatistics",
         "PrinterMetadataBlock",
         "ThumbnailBlock",
         "close",
+        "compute_print_statistics",
         "from_ascii_to_binary",
         "from_binary_to_ascii",
+        "generate_gcode",
         "get_config",
         "is_open",
         "open",
@@ -1,4 +1,5 @@
 #include "binarize.hpp"
+#include "binarize_impl.hpp"
 #include "meatpack.hpp"
 
 #include "core/core_impl.hpp"
@@ -11,6 +12,8 @@ extern "C" {
 
 #include <cstring>
 #include <cassert>
+#include <algorithm>
+#include <string_view>
 
 namespace bgcode {
 
@@ -18,22 +21,6 @@ using namespace core;
 
 namespace binarize {
 
-template<class T>
-static bool write_to_file(FILE& file, const T* data, size_t data_size)
-{
-    const size_t wsize = fwrite(static_cast<const void*>(data), 1, data_size, &file);
-    return !ferror(&file) && wsize == data_size;
-}
-
-template<class T>
-static bool read_from_file(FILE& file, T *data, size_t data_size)
-{
-    static_assert(!std::is_const_v<T>, "Type of output buffer cannot be const!");
-
-    const size_t rsize = fread(static_cast<void *>(data), 1, data_size, &file);
-    return !ferror(&file) && rsize == data_size;
-}
-
 void update_checksum(Checksum& checksum, const ThumbnailBlock &th)
 {
     checksum.append(th.params.format);
@@ -42,13 +29,6 @@ void update_checksum(Checksum& checksum, const ThumbnailBlock &th)
     checksum.append(th.data);
 }
 
-static std::vector<uint8_t> encode(const std::byte* data, size_t data_size)
-{
-    std::vector<uint8_t> ret(data_size);
-    memcpy(ret.data(), data, data_size);
-    return ret;
-}
-
 static uint16_t metadata_encoding_types_count() { return 1 + (uint16_t)EMetadataEncodingType::INI; }
 static uint16_t thumbnail_formats_count()       { return 1 + (uint16_t)EThumbnailFormat::QOI; }
 static uint16_t gcode_encoding_types_count()    { return 1 + (uint16_t)EGCodeEncodingType::MeatPackComments; }
@@ -101,6 +81,7 @@ static bool decode_metadata(const std::vector<uint8_t>& src, std::vector<std::pa
 
 static bool encode_gcode(const std::string& src, std::vector<uint8_t>& dst, EGCodeEncodingType encoding_type)
 {
+    BGCODE_TRACE_SCOPE("encode_gcode");
     switch (encoding_type)
     {
     case EGCodeEncodingType::None:
@@ -111,6 +92,7 @@ static bool encode_gcode(const std::string& src, std::vector<uint8_t>& dst, EGCo
     case EGCodeEncodingType::MeatPack:
     case EGCodeEncodingType::MeatPackComments:
     {
+        const ScopedConversionStage stage(ConversionStats::EStage::MeatPack);
         uint8_t binarizer_flags = (encoding_type == EGCodeEncodingType::MeatPack) ? MeatPack::Flag_RemoveComments : 0;
         binarizer_flags |= MeatPack::Flag_OmitWhitespaces;
         MeatPack::MPBinarizer binarizer(binarizer_flags);
@@ -121,7 +103,10 @@ static bool encode_gcode(const std::string& src, std::vector<uint8_t>& dst, EGCo
             while (end_it != src.end() && *end_it != '\n') {
                 ++end_it;
             }
-            const std::string line(begin_it, ++end_it);
+            // the last line may miss its newline
+            if (end_it != src.end())
+                ++end_it;
+            const std::string line(begin_it, end_it);
             binarizer.binarize_line(line, dst);
             begin_it = end_it;
         }
@@ -132,19 +117,21 @@ static bool encode_gcode(const std::string& src, std::vector<uint8_t>& dst, EGCo
     return true;
 }
 
-static bool decode_gcode(const std::vector<uint8_t>& src, std::string& dst, EGCodeEncodingType encoding_type)
+static bool decode_gcode(const uint8_t* src, size_t src_size, std::string& dst, EGCodeEncodingType encoding_type)
 {
+    BGCODE_TRACE_SCOPE("decode_gcode");
     switch (encoding_type)
     {
     case EGCodeEncodingType::None:
     {
-        dst.insert(dst.end(), src.begin(), src.end());
+        dst.insert(dst.end(), src, src + src_size);
         break;
     }
     case EGCodeEncodingType::MeatPack:
     case EGCodeEncodingType::MeatPackComments:
     {
-        MeatPack::unbinarize(src, dst);
+        const ScopedConversionStage stage(ConversionStats::EStage::MeatPack);
+        MeatPack::unbinarize(src, src_size, dst);
         break;
     }
     }
@@ -153,6 +140,8 @@ static bool decode_gcode(const std::vector<uint8_t>& src, std::string& dst, EGCo
 
 static bool compress(std::vector<uint8_t>& src, std::vector<uint8_t>& dst, ECompressionType compression_type)
 {
+    BGCODE_TRACE_SCOPE("compress");
+    const ScopedConversionStage stage(ConversionStats::EStage::Compression);
     switch (compression_type)
     {
     case ECompressionType::Deflate:
@@ -276,8 +265,10 @@ static bool compress(std::vector<uint8_t>& src, std::vector<uint8_t>& dst, EComp
     return true;
 }
 
-static bool uncompress(const std::vector<uint8_t>& src, std::vector<uint8_t>& dst, ECompressionType compression_type, size_t uncompressed_size)
+static bool uncompress(const uint8_t* src, size_t src_size, std::vector<uint8_t>& dst, ECompressionType compression_type, size_t uncompressed_size)
 {
+    BGCODE_TRACE_SCOPE("uncompress");
+    const ScopedConversionStage stage(ConversionStats::EStage::Compression);
     switch (compression_type)
     {
     case ECompressionType::Deflate:
@@ -289,8 +280,8 @@ static bool uncompress(const std::vector<uint8_t>& src, std::vector<uint8_t>& ds
         std::vector<uint8_t> temp_buffer(BUFSIZE);
 
         z_stream strm{};
-        strm.next_in = const_cast<uint8_t*>(src.data());
-        strm.avail_in = (uInt)src.size();
+        strm.next_in = const_cast<uint8_t*>(src);
+        strm.avail_in = (uInt)src_size;
         strm.next_out = temp_buffer.data();
         strm.avail_out = BUFSIZE;
         int res = inflateInit(&strm);
@@ -304,6 +295,11 @@ static bool uncompress(const std::vector<uint8_t>& src, std::vector<uint8_t>& ds
                 return false;
             }
             if (strm.avail_out == 0) {
+                // never grow past the size declared into the block header
+                if (dst.size() + BUFSIZE > uncompressed_size) {
+                    inflateEnd(&strm);
+                    return false;
+                }
                 dst.insert(dst.end(), temp_buffer.data(), temp_buffer.data() + BUFSIZE);
                 strm.next_out = temp_buffer.data();
                 strm.avail_out = BUFSIZE;
@@ -313,6 +309,11 @@ static bool uncompress(const std::vector<uint8_t>& src, std::vector<uint8_t>& ds
         int inflate_res = Z_OK;
         while (inflate_res == Z_OK) {
             if (strm.avail_out == 0) {
+                // never grow past the size declared into the block header
+                if (dst.size() + BUFSIZE > uncompressed_size) {
+                    inflateEnd(&strm);
+                    return false;
+                }
                 dst.insert(dst.end(), temp_buffer.data(), temp_buffer.data() + BUFSIZE);
                 strm.next_out = temp_buffer.data();
                 strm.avail_out = BUFSIZE;
@@ -320,7 +321,7 @@ static bool uncompress(const std::vector<uint8_t>& src, std::vector<uint8_t>& ds
             inflate_res = inflate(&strm, Z_FINISH);
         }
 
-        if (inflate_res != Z_STREAM_END) {
+        if (inflate_res != Z_STREAM_END || dst.size() + BUFSIZE - strm.avail_out > uncompressed_size) {
             inflateEnd(&strm);
             return false;
         }
@@ -341,13 +342,13 @@ static bool uncompress(const std::vector<uint8_t>& src, std::vector<uint8_t>& ds
 
         dst.resize(uncompressed_size);
 
-        uint8_t* buf = const_cast<uint8_t*>(src.data());
+        uint8_t* buf = const_cast<uint8_t*>(src);
         uint8_t* outbuf = dst.data();
 
         uint32_t sunk = 0;
         uint32_t polled = 0;
 
-        const size_t compressed_size = src.size();
+        const size_t compressed_size = src_size;
         while (sunk < compressed_size) {
             size_t count = 0;
             const HSD_sink_res sink_res = heatshrink_decoder_sink(decoder, &buf[sunk], compressed_size - sunk, &count);
@@ -389,19 +390,21 @@ static bool uncompress(const std::vector<uint8_t>& src, std::vector<uint8_t>& ds
 }
 
 
-// write block header and data in encoded format
-core::EResult write(const BaseMetadataBlock &block, FILE& file, core::EBlockType block_type, core::ECompressionType compression_type, core::Checksum &checksum)
+EResult encode_metadata_block(const BaseMetadataBlock& block, EBlockType block_type, ECompressionType compression_type, size_t padding,
+    BlockHeader& block_header, std::vector<std::byte>& payload)
 {
     if (block.encoding_type > metadata_encoding_types_count())
         return EResult::InvalidMetadataEncodingType;
 
-    BlockHeader block_header((uint16_t)block_type, (uint16_t)compression_type, (uint32_t)0);
+    block_header = BlockHeader((uint16_t)block_type, (uint16_t)compression_type, (uint32_t)0);
     std::vector<uint8_t> out_data;
-    if (!block.raw_data.empty()) {
+    if (!block.raw_data.empty() || padding > 0) {
         // process payload encoding
         std::vector<uint8_t> uncompressed_data;
         if (!encode_metadata(block.raw_data, uncompressed_data, (EMetadataEncodingType)block.encoding_type))
             return EResult::MetadataEncodingError;
+        // trailing spaces, without newline, are ignored by decode_metadata()
+        uncompressed_data.insert(uncompressed_data.end(), padding, ' ');
         // process payload compression
         block_header.uncompressed_size = (uint32_t)uncompressed_data.size();
         std::vector<uint8_t> compressed_data;
@@ -413,56 +416,80 @@ core::EResult write(const BaseMetadataBlock &block, FILE& file, core::EBlockType
         out_data.swap((compression_type == ECompressionType::None) ? uncompressed_data : compressed_data);
     }
 
+    // block payload: parameters + data
+    payload.resize(sizeof(block.encoding_type) + out_data.size());
+    memcpy(payload.data(), &block.encoding_type, sizeof(block.encoding_type));
+    if (!out_data.empty())
+        memcpy(payload.data() + sizeof(block.encoding_type), out_data.data(), out_data.size());
+    return EResult::Success;
+}
+
+// write block header and data in encoded format
+core::EResult write(const BaseMetadataBlock &block, FILE& file, core::EBlockType block_type, core::ECompressionType compression_type, core::Checksum &checksum)
+{
+    BGCODE_TRACE_SCOPE("write_metadata_block");
+    BlockHeader block_header;
+    std::vector<std::byte> payload;
+    EResult res = encode_metadata_block(block, block_type, compression_type, 0, block_header, payload);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+
     // write block header
-    EResult res = block_header.write(file);
+    res = block_header.write(file);
     if (res != EResult::Success)
         // propagate error
         return res;
 
     // write block payload
-    if (!write_to_file(file, &block.encoding_type, sizeof(block.encoding_type)))
+    if (!write_to_file(file, payload.data(), payload.size()))
         return EResult::WriteError;
-    if (!out_data.empty()) {
-        if (!write_to_file(file, out_data.data(), out_data.size()))
-            return EResult::WriteError;
-    }
+    add_conversion_block(block_header);
 
     if (checksum.get_type() != EChecksumType::None) {
+        const ScopedConversionStage stage(ConversionStats::EStage::Checksum);
         // update checksum with block header
         update_checksum(checksum, block_header);
         // update checksum with block payload
-        checksum.append(block.encoding_type);
-        if (!out_data.empty())
-            checksum.append(static_cast<unsigned char*>(out_data.data()), out_data.size());
+        checksum.append(payload);
     }
 
     return EResult::Success;
 }
 
 EResult BaseMetadataBlock::read_data(FILE& file, const BlockHeader& block_header)
+{
+    std::vector<std::byte> payload;
+    const EResult res = read_block_payload(file, block_header, payload);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+
+    return read_data(block_header, payload.data(), payload.size());
+}
+
+EResult BaseMetadataBlock::read_data(const BlockHeader& block_header, const std::byte* payload, size_t payload_size)
 {
     const ECompressionType compression_type = (ECompressionType)block_header.compression;
 
-    if (!read_from_file(file, (void*)&encoding_type, sizeof(encoding_type)))
-        return EResult::ReadError;
+    if (payload_size != block_payload_size(block_header))
+        return EResult::InvalidBuffer;
+    add_conversion_block(block_header);
+
+    encoding_type = load_integer<uint16_t>(payload, payload + sizeof(encoding_type));
     if (encoding_type > metadata_encoding_types_count())
         return EResult::InvalidMetadataEncodingType;
 
-    std::vector<uint8_t> data;
-    const size_t data_size = (compression_type == ECompressionType::None) ? block_header.uncompressed_size : block_header.compressed_size;
-    if (data_size > 0) {
-        data.resize(data_size);
-        if (!read_from_file(file, (void*)data.data(), data_size))
-            return EResult::ReadError;
-    }
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(payload + sizeof(encoding_type));
+    const size_t data_size = payload_size - sizeof(encoding_type);
 
     std::vector<uint8_t> uncompressed_data;
-    if (compression_type != ECompressionType::None) {
-        if (!uncompress(data, uncompressed_data, compression_type, block_header.uncompressed_size))
-            return EResult::DataUncompressionError;
-    }
+    if (compression_type == ECompressionType::None)
+        uncompressed_data.assign(data, data + data_size);
+    else if (!uncompress(data, data_size, uncompressed_data, compression_type, block_header.uncompressed_size))
+        return EResult::DataUncompressionError;
 
-    if (!decode_metadata((compression_type == ECompressionType::None) ? data : uncompressed_data, raw_data, (EMetadataEncodingType)encoding_type))
+    if (!decode_metadata(uncompressed_data, raw_data, (EMetadataEncodingType)encoding_type))
         return EResult::MetadataDecodingError;
 
     return EResult::Success;
@@ -581,6 +608,7 @@ EResult PrinterMetadataBlock::read_data(FILE& file, const FileHeader& file_heade
 
 EResult ThumbnailBlock::write(FILE& file, EChecksumType checksum_type)
 {
+    BGCODE_TRACE_SCOPE("write_thumbnail_block");
     if (params.format >= thumbnail_formats_count())
         return EResult::InvalidThumbnailFormat;
     if (params.width == 0)
@@ -605,13 +633,17 @@ EResult ThumbnailBlock::write(FILE& file, EChecksumType checksum_type)
 
     if (!write_to_file(file, data.data(), data.size()))
         return EResult::WriteError;
+    add_conversion_block(block_header);
 
     if (checksum_type != EChecksumType::None) {
         Checksum cs(checksum_type);
-        // update checksum with block header
-        update_checksum(cs, block_header);
-        // update checksum with block payload
-        update_checksum(cs, *this);
+        {
+            const ScopedConversionStage stage(ConversionStats::EStage::Checksum);
+            // update checksum with block header
+            update_checksum(cs, block_header);
+            // update checksum with block payload
+            update_checksum(cs, *this);
+        }
         // write block checksum
         res = cs.write(file);
         if (res != EResult::Success)
@@ -624,28 +656,22 @@ EResult ThumbnailBlock::write(FILE& file, EChecksumType checksum_type)
 EResult ThumbnailBlock::read_data(FILE& file, const FileHeader& file_header, const BlockHeader& block_header)
 {
     // read block payload
-    EResult res = params.read(file);
+    std::vector<std::byte> payload;
+    EResult res = read_block_payload(file, block_header, payload);
     if (res != EResult::Success)
         // propagate error
         return res;
-    if (params.format >= thumbnail_formats_count())
-        return EResult::InvalidThumbnailFormat;
-    if (params.width == 0)
-        return EResult::InvalidThumbnailWidth;
-    if (params.height == 0)
-        return EResult::InvalidThumbnailHeight;
-    if (block_header.uncompressed_size == 0)
-        return EResult::InvalidThumbnailDataSize;
 
-    data.resize(block_header.uncompressed_size);
-    if (!read_from_file(file, (void*)data.data(), block_header.uncompressed_size))
-        return EResult::ReadError;
+    res = read_data(block_header, payload.data(), payload.size());
+    if (res != EResult::Success)
+        // propagate error
+        return res;
 
     const EChecksumType checksum_type = (EChecksumType)file_header.checksum_type;
     if (checksum_type != EChecksumType::None) {
         // read block checksum
         Checksum cs(checksum_type);
-        const EResult res = cs.read(file);
+        res = cs.read(file);
         if (res != EResult::Success)
             // propagate error
             return res;
@@ -653,17 +679,57 @@ EResult ThumbnailBlock::read_data(FILE& file, const FileHeader& file_header, con
     return EResult::Success;
 }
 
+EResult ThumbnailBlock::read_data(const BlockHeader& block_header, const std::byte* payload, size_t payload_size)
+{
+    if (payload_size != block_payload_size(block_header))
+        return EResult::InvalidBuffer;
+    add_conversion_block(block_header);
+
+    const std::byte* it = payload;
+    params.format = load_integer<uint16_t>(it, it + sizeof(params.format));
+    it += sizeof(params.format);
+    params.width = load_integer<uint16_t>(it, it + sizeof(params.width));
+    it += sizeof(params.width);
+    params.height = load_integer<uint16_t>(it, it + sizeof(params.height));
+    it += sizeof(params.height);
+    if (params.format >= thumbnail_formats_count())
+        return EResult::InvalidThumbnailFormat;
+    if (params.width == 0)
+        return EResult::InvalidThumbnailWidth;
+    if (params.height == 0)
+        return EResult::InvalidThumbnailHeight;
+    if (block_header.uncompressed_size == 0)
+        return EResult::InvalidThumbnailDataSize;
+
+    data.assign(it, payload + payload_size);
+    return EResult::Success;
+}
+
 EResult GCodeBlock::write(FILE& file, ECompressionType compression_type, EChecksumType checksum_type) const
 {
-    if (encoding_type > gcode_encoding_types_count())
+    BlockHeader block_header;
+    std::vector<std::byte> payload;
+    const EResult res = encode_gcode_block(*this, compression_type, block_header, payload);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+
+    add_conversion_block(block_header);
+    return write_block(file, block_header, payload, checksum_type);
+}
+
+EResult encode_gcode_block(const GCodeBlock& block, ECompressionType compression_type, BlockHeader& block_header,
+    std::vector<std::byte>& payload)
+{
+    if (block.encoding_type > gcode_encoding_types_count())
         return EResult::InvalidGCodeEncodingType;
 
-    BlockHeader block_header((uint16_t)EBlockType::GCode, (uint16_t)compression_type, (uint32_t)0);
+    block_header = BlockHeader((uint16_t)EBlockType::GCode, (uint16_t)compression_type, (uint32_t)0);
     std::vector<uint8_t> out_data;
-    if (!raw_data.empty()) {
+    if (!block.raw_data.empty()) {
         // process payload encoding
         std::vector<uint8_t> uncompressed_data;
-        if (!encode_gcode(raw_data, uncompressed_data, (EGCodeEncodingType)encoding_type))
+        if (!encode_gcode(block.raw_data, uncompressed_data, (EGCodeEncodingType)block.encoding_type))
             return EResult::GCodeEncodingError;
         // process payload compression
         block_header.uncompressed_size = (uint32_t)uncompressed_data.size();
@@ -676,6 +742,17 @@ EResult GCodeBlock::write(FILE& file, ECompressionType compression_type, EChecks
         out_data.swap((compression_type == ECompressionType::None) ? uncompressed_data : compressed_data);
     }
 
+    // block payload: parameters + data
+    payload.resize(sizeof(block.encoding_type) + out_data.size());
+    memcpy(payload.data(), &block.encoding_type, sizeof(block.encoding_type));
+    if (!out_data.empty())
+        memcpy(payload.data() + sizeof(block.encoding_type), out_data.data(), out_data.size());
+    return EResult::Success;
+}
+
+EResult write_block(FILE& file, BlockHeader block_header, const std::vector<std::byte>& payload, EChecksumType checksum_type)
+{
+    BGCODE_TRACE_SCOPE("write_block");
     // write block header
     EResult res = block_header.write(file);
     if (res != EResult::Success)
@@ -683,24 +760,21 @@ EResult GCodeBlock::write(FILE& file, ECompressionType compression_type, EChecks
         return res;
 
     // write block payload
-    if (!write_to_file(file, &encoding_type, sizeof(encoding_type)))
-        return EResult::WriteError;
-    if (!out_data.empty()) {
-        if (!write_to_file(file, out_data.data(), out_data.size()))
+    if (!payload.empty()) {
+        if (!write_to_file(file, payload.data(), payload.size()))
             return EResult::WriteError;
     }
 
     // write checksum
     if (checksum_type != EChecksumType::None) {
         Checksum cs(checksum_type);
-        // update checksum with block header
-        update_checksum(cs, block_header);
-        // update checksum with block payload
-        std::vector<uint8_t> data_to_encode =
-            encode(reinterpret_cast<const std::byte*>(&encoding_type), sizeof(encoding_type));
-        cs.append(data_to_encode.data(), data_to_encode.size());
-        if (!out_data.empty())
-            cs.append(static_cast<unsigned char *>(out_data.data()), out_data.size());
+        {
+            const ScopedConversionStage stage(ConversionStats::EStage::Checksum);
+            // update checksum with block header
+            update_checksum(cs, block_header);
+            // update checksum with block payload
+            cs.append(payload);
+        }
         res = cs.write(file);
         if (res != EResult::Success)
             // propagate error
@@ -710,40 +784,57 @@ EResult GCodeBlock::write(FILE& file, ECompressionType compression_type, EChecks
 }
 
 EResult GCodeBlock::read_data(FILE& file, const FileHeader& file_header, const BlockHeader& block_header)
+{
+    std::vector<std::byte> payload;
+    EResult res = read_block_payload(file, block_header, payload);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+
+    res = read_data(block_header, payload.data(), payload.size());
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+
+    const EChecksumType checksum_type = (EChecksumType)file_header.checksum_type;
+    if (checksum_type != EChecksumType::None) {
+        // read block checksum
+        Checksum cs(checksum_type);
+        res = cs.read(file);
+        if (res != EResult::Success)
+            // propagate error
+            return res;
+    }
+    return EResult::Success;
+}
+
+EResult GCodeBlock::read_data(const BlockHeader& block_header, const std::byte* payload, size_t payload_size)
 {
     const ECompressionType compression_type = (ECompressionType)block_header.compression;
 
-    if (!read_from_file(file, (void*)&encoding_type, sizeof(encoding_type)))
-        return EResult::ReadError;
+    if (payload_size != block_payload_size(block_header))
+        return EResult::InvalidBuffer;
+    add_conversion_block(block_header);
+
+    encoding_type = load_integer<uint16_t>(payload, payload + sizeof(encoding_type));
     if (encoding_type > gcode_encoding_types_count())
         return EResult::InvalidGCodeEncodingType;
 
-    std::vector<uint8_t> data;
-    const size_t data_size = (compression_type == ECompressionType::None) ? block_header.uncompressed_size : block_header.compressed_size;
-    if (data_size > 0) {
-        data.resize(data_size);
-        if (!read_from_file(file, (void*)data.data(), data_size))
-            return EResult::ReadError;
-    }
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(payload + sizeof(encoding_type));
+    const size_t data_size = payload_size - sizeof(encoding_type);
 
     std::vector<uint8_t> uncompressed_data;
     if (compression_type != ECompressionType::None) {
-        if (!uncompress(data, uncompressed_data, compression_type, block_header.uncompressed_size))
+        if (!uncompress(data, data_size, uncompressed_data, compression_type, block_header.uncompressed_size))
             return EResult::DataUncompressionError;
     }
 
-    if (!decode_gcode((compression_type == ECompressionType::None) ? data : uncompressed_data, raw_data, (EGCodeEncodingType)encoding_type))
+    const bool decoded = (compression_type == ECompressionType::None) ?
+        decode_gcode(data, data_size, raw_data, (EGCodeEncodingType)encoding_type) :
+        decode_gcode(uncompressed_data.data(), uncompressed_data.size(), raw_data, (EGCodeEncodingType)encoding_type);
+    if (!decoded)
         return EResult::GCodeDecodingError;
 
-    const EChecksumType checksum_type = (EChecksumType)file_header.checksum_type;
-    if (checksum_type != EChecksumType::None) {
-        // read block checksum
-        Checksum cs(checksum_type);
-        const EResult res = cs.read(file);
-        if (res != EResult::Success)
-            // propagate error
-            return res;
-    }
     return EResult::Success;
 }
 
@@ -791,6 +882,73 @@ const BinaryData& Binarizer::get_binary_data() const { return m_binary_data; }
 size_t Binarizer::get_max_gcode_cache_size() const { return m_gcode_cache_size; }
 void Binarizer::set_max_gcode_cache_size(size_t size) { m_gcode_cache_size = size; }
 
+// Returns the size of the block with the given header, once written to file
+static size_t written_block_size(const BlockHeader& block_header, EChecksumType checksum_type)
+{
+    return block_header.get_size() + block_payload_size(block_header) + checksum_size(checksum_type);
+}
+
+// Writes the given metadata block, reserving the padding required by the config for uncompressed blocks.
+// position is advanced by the count of written bytes.
+static EResult write_metadata_block(FILE& file, const BaseMetadataBlock& block, EBlockType block_type, ECompressionType compression_type,
+    const BinarizerConfig& config, size_t& position)
+{
+    const size_t padding = (compression_type == ECompressionType::None) ? config.metadata_padding : 0;
+    BlockHeader block_header;
+    std::vector<std::byte> payload;
+    EResult res = encode_metadata_block(block, block_type, compression_type, padding, block_header, payload);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+
+    add_conversion_block(block_header);
+    res = write_block(file, block_header, payload, config.checksum);
+    if (res == EResult::Success)
+        position += written_block_size(block_header, config.checksum);
+    return res;
+}
+
+EResult Binarizer::write_reserved_block(ReservedBlock& block, bool reserve)
+{
+    BaseMetadataBlock* metadata = nullptr;
+    switch (block.type)
+    {
+    case EBlockType::PrinterMetadata: { metadata = &m_binary_data.printer_metadata; break; }
+    case EBlockType::PrintMetadata:   { metadata = &m_binary_data.print_metadata; break; }
+    case EBlockType::SlicerMetadata:  { metadata = &m_binary_data.slicer_metadata; break; }
+    default:                          { return EResult::InvalidBlockType; }
+    }
+    metadata->encoding_type = (uint16_t)m_config.metadata_encoding;
+
+    BlockHeader block_header;
+    std::vector<std::byte> payload;
+    EResult res = encode_metadata_block(*metadata, block.type, ECompressionType::None, 0, block_header, payload);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+
+    const size_t size = block_header.uncompressed_size;
+    if (reserve) {
+        block.position = m_position;
+        block.capacity = std::max(size, m_config.late_metadata_capacity);
+    }
+    else if (size > block.capacity)
+        return EResult::MetadataEncodingError;
+
+    // fill the reserved size with padding
+    res = encode_metadata_block(*metadata, block.type, ECompressionType::None, block.capacity - size, block_header, payload);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+    // back-patched blocks were already counted when reserved
+    if (reserve)
+        add_conversion_block(block_header);
+    res = write_block(*m_file, block_header, payload, m_config.checksum);
+    if (res == EResult::Success && reserve)
+        m_position += written_block_size(block_header, m_config.checksum);
+    return res;
+}
+
 EResult Binarizer::initialize(FILE& file, const BinarizerConfig& config)
 {
     if (!m_enabled)
@@ -798,6 +956,8 @@ EResult Binarizer::initialize(FILE& file, const BinarizerConfig& config)
 
     m_file = &file;
     m_config = config;
+    m_reserved_blocks.clear();
+    const bool late_metadata = m_config.late_metadata_capacity > 0;
 
     // save header
     FileHeader file_header;
@@ -806,21 +966,27 @@ EResult Binarizer::initialize(FILE& file, const BinarizerConfig& config)
     if (res != EResult::Success)
         // propagate error
         return res;
+    m_position = file_header.get_size();
 
     // save file metadata block, if present
     if (!m_binary_data.file_metadata.raw_data.empty()) {
         m_binary_data.file_metadata.encoding_type = (uint16_t)config.metadata_encoding;
-        res = m_binary_data.file_metadata.write(*m_file, m_config.compression.file_metadata, m_config.checksum);
+        res = write_metadata_block(*m_file, m_binary_data.file_metadata, EBlockType::FileMetadata, m_config.compression.file_metadata, m_config, m_position);
         if (res != EResult::Success)
             // propagate error
             return res;
     }
 
     // save printer metadata block
-    if (m_binary_data.printer_metadata.raw_data.empty())
-        return EResult::MissingPrinterMetadata;
-    m_binary_data.printer_metadata.encoding_type = (uint16_t)config.metadata_encoding;
-    res = m_binary_data.printer_metadata.write(*m_file, m_config.compression.printer_metadata, m_config.checksum);
+    if (late_metadata) {
+        res = write_reserved_block(m_reserved_blocks.emplace_back(ReservedBlock{ EBlockType::PrinterMetadata }), true);
+    }
+    else {
+        if (m_binary_data.printer_metadata.raw_data.empty())
+            return EResult::MissingPrinterMetadata;
+        m_binary_data.printer_metadata.encoding_type = (uint16_t)config.metadata_encoding;
+        res = write_metadata_block(*m_file, m_binary_data.printer_metadata, EBlockType::PrinterMetadata, m_config.compression.printer_metadata, m_config, m_position);
+    }
     if (res != EResult::Success)
         // propagate error
         return res;
@@ -831,22 +997,34 @@ EResult Binarizer::initialize(FILE& file, const BinarizerConfig& config)
         if (res != EResult::Success)
             // propagate error
             return res;
+        const BlockHeader block_header((uint16_t)EBlockType::Thumbnail, (uint16_t)ECompressionType::None, (uint32_t)block.data.size());
+        m_position += written_block_size(block_header, m_config.checksum);
     }
 
     // save print metadata block
-    if (m_binary_data.print_metadata.raw_data.empty())
-        return EResult::MissingPrintMetadata;
-    m_binary_data.print_metadata.encoding_type = (uint16_t)config.metadata_encoding;
-    res = m_binary_data.print_metadata.write(*m_file, m_config.compression.print_metadata, m_config.checksum);
+    if (late_metadata) {
+        res = write_reserved_block(m_reserved_blocks.emplace_back(ReservedBlock{ EBlockType::PrintMetadata }), true);
+    }
+    else {
+        if (m_binary_data.print_metadata.raw_data.empty())
+            return EResult::MissingPrintMetadata;
+        m_binary_data.print_metadata.encoding_type = (uint16_t)config.metadata_encoding;
+        res = write_metadata_block(*m_file, m_binary_data.print_metadata, EBlockType::PrintMetadata, m_config.compression.print_metadata, m_config, m_position);
+    }
     if (res != EResult::Success)
         // propagate error
         return res;
 
     // save slicer metadata block
-    if (m_binary_data.slicer_metadata.raw_data.empty())
-        return EResult::MissingSlicerMetadata;
-    m_binary_data.slicer_metadata.encoding_type = (uint16_t)config.metadata_encoding;
-    res = m_binary_data.slicer_metadata.write(*m_file, m_config.compression.slicer_metadata, m_config.checksum);
+    if (late_metadata) {
+        res = write_reserved_block(m_reserved_blocks.emplace_back(ReservedBlock{ EBlockType::SlicerMetadata }), true);
+    }
+    else {
+        if (m_binary_data.slicer_metadata.raw_data.empty())
+            return EResult::MissingSlicerMetadata;
+        m_binary_data.slicer_metadata.encoding_type = (uint16_t)config.metadata_encoding;
+        res = write_metadata_block(*m_file, m_binary_data.slicer_metadata, EBlockType::SlicerMetadata, m_config.compression.slicer_metadata, m_config, m_position);
+    }
     if (res != EResult::Success)
         // propagate error
         return res;
@@ -854,12 +1032,94 @@ EResult Binarizer::initialize(FILE& file, const BinarizerConfig& config)
     return EResult::Success;
 }
 
-static EResult write_gcode_block(FILE& file, const std::string& raw_data, const BinarizerConfig& config)
+EResult Binarizer::initialize_append(FILE& file)
+{
+    if (!m_enabled)
+        return EResult::Success;
+
+    fseek(&file, 0, SEEK_END);
+    const long file_size = ftell(&file);
+    rewind(&file);
+
+    FileHeader file_header;
+    EResult res = read_header(file, file_header, nullptr);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+
+    BinarizerConfig config = m_config;
+    config.checksum = (EChecksumType)file_header.checksum_type;
+
+    // walk the blocks up to the end of the file
+    BlockHeader block_header;
+    BlockHeader last_block_header;
+    bool has_blocks = false;
+    while (ftell(&file) < file_size) {
+        res = read_next_block_header(file, file_header, block_header);
+        if (res != EResult::Success)
+            // propagate error
+            return res;
+
+        if ((EBlockType)block_header.type == EBlockType::GCode) {
+            uint16_t encoding_type;
+            if (!read_from_file(file, &encoding_type, sizeof(encoding_type)))
+                return EResult::ReadError;
+            if (encoding_type > (uint16_t)EGCodeEncodingType::MeatPackComments)
+                return EResult::InvalidGCodeEncodingType;
+            config.gcode_encoding = (EGCodeEncodingType)encoding_type;
+            config.compression.gcode = (ECompressionType)block_header.compression;
+        }
+
+        res = skip_block(file, file_header, block_header);
+        if (res != EResult::Success)
+            // propagate error
+            return res;
+        last_block_header = block_header;
+        has_blocks = true;
+    }
+
+    // validate the tail
+    if (!has_blocks || ftell(&file) != file_size)
+        return EResult::InvalidBinaryGCodeFile;
+    if ((EBlockType)last_block_header.type != EBlockType::GCode && (EBlockType)last_block_header.type != EBlockType::SlicerMetadata)
+        return EResult::InvalidSequenceOfBlocks;
+    std::array<std::byte, 2048> cs_buffer;
+    res = verify_block_checksum(file, file_header, last_block_header, cs_buffer.data(), cs_buffer.size());
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+
+    if (fseek(&file, 0, SEEK_END) != 0)
+        return EResult::WriteError;
+
+    m_file = &file;
+    m_config = config;
+    m_gcode_cache.clear();
+    m_reserved_blocks.clear();
+    m_position = (size_t)file_size;
+    return EResult::Success;
+}
+
+static constexpr const std::string_view LAYER_CHANGE_TAG = ";LAYER_CHANGE";
+
+// Writes a gcode block with the given data, position is advanced by the count of written bytes
+static EResult write_gcode_block(FILE& file, const std::string& raw_data, const BinarizerConfig& config, size_t& position)
 {
     GCodeBlock block;
     block.encoding_type = (uint16_t)config.gcode_encoding;
     block.raw_data = raw_data;
-    return block.write(file, config.compression.gcode, config.checksum);
+    BlockHeader block_header;
+    std::vector<std::byte> payload;
+    EResult res = encode_gcode_block(block, config.compression.gcode, block_header, payload);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+
+    add_conversion_block(block_header);
+    res = write_block(file, block_header, payload, config.checksum);
+    if (res == EResult::Success)
+        position += written_block_size(block_header, config.checksum);
+    return res;
 }
 
 EResult Binarizer::append_gcode(const std::string& gcode)
@@ -879,9 +1139,12 @@ EResult Binarizer::append_gcode(const std::string& gcode)
             return EResult::WriteError;
 
         const size_t line_size = 1 + end_line_pos - begin_pos;
-        if (line_size + m_gcode_cache.length() > m_gcode_cache_size) {
+        const bool layer_change = m_config.layer_aligned_gcode_blocks &&
+            m_gcode_cache.length() >= std::max<size_t>(1, m_config.min_gcode_block_size) &&
+            gcode.compare(begin_pos, LAYER_CHANGE_TAG.size(), LAYER_CHANGE_TAG) == 0;
+        if (layer_change || line_size + m_gcode_cache.length() > m_gcode_cache_size) {
             if (!m_gcode_cache.empty()) {
-                const EResult res = write_gcode_block(*m_file, m_gcode_cache, m_config);
+                const EResult res = write_gcode_block(*m_file, m_gcode_cache, m_config, m_position);
                 if (res != EResult::Success)
                     // propagate error
                     return res;
@@ -906,10 +1169,38 @@ EResult Binarizer::finalize()
 
     // save gcode cache, if not empty
     if (!m_gcode_cache.empty()) {
-        const EResult res = write_gcode_block(*m_file, m_gcode_cache, m_config);
+        const EResult res = write_gcode_block(*m_file, m_gcode_cache, m_config, m_position);
         if (res != EResult::Success)
             // propagate error
             return res;
+        m_gcode_cache.clear();
+    }
+
+    // back-patch late metadata
+    if (!m_reserved_blocks.empty()) {
+        if (m_binary_data.printer_metadata.raw_data.empty())
+            return EResult::MissingPrinterMetadata;
+        if (m_binary_data.print_metadata.raw_data.empty())
+            return EResult::MissingPrintMetadata;
+        if (m_binary_data.slicer_metadata.raw_data.empty())
+            return EResult::MissingSlicerMetadata;
+
+        // positions are relative to the start of the binary gcode, which may not be the start of the file
+        const long end_position = ftell(m_file);
+        if (end_position < (long)m_position)
+            return EResult::WriteError;
+        const long start_position = end_position - (long)m_position;
+        for (ReservedBlock& block : m_reserved_blocks) {
+            if (fseek(m_file, start_position + (long)block.position, SEEK_SET) != 0)
+                return EResult::WriteError;
+            const EResult res = write_reserved_block(block, false);
+            if (res != EResult::Success)
+                // propagate error
+                return res;
+        }
+        m_reserved_blocks.clear();
+        if (fseek(m_file, end_position, SEEK_SET) != 0)
+            return EResult::WriteError;
     }
 
     return EResult::Success;
@@ -4,6 +4,10 @@
 #include "binarize/export.h"
 #include "core/core.hpp"
 
+#include <functional>
+#include <map>
+#include <optional>
+
 namespace bgcode { namespace binarize {
 
 struct BGCODE_BINARIZE_EXPORT BaseMetadataBlock
@@ -15,10 +19,14 @@ struct BGCODE_BINARIZE_EXPORT BaseMetadataBlock
 
     // read block data in encoded format
     core::EResult read_data(FILE& file, const core::BlockHeader& block_header);
+    // read block data from the given payload (parameters + data), as returned by core::read_block_payload()
+    core::EResult read_data(const core::BlockHeader& block_header, const std::byte* payload, size_t payload_size);
 };
 
 struct BGCODE_BINARIZE_EXPORT FileMetadataBlock : public BaseMetadataBlock
 {
+    using BaseMetadataBlock::read_data;
+
     // write block header and data
     core::EResult write(FILE& file, core::ECompressionType compression_type, core::EChecksumType checksum_type) const;
     // read block data
@@ -27,6 +35,8 @@ struct BGCODE_BINARIZE_EXPORT FileMetadataBlock : public BaseMetadataBlock
 
 struct BGCODE_BINARIZE_EXPORT PrintMetadataBlock : public BaseMetadataBlock
 {
+    using BaseMetadataBlock::read_data;
+
     // write block header and data
     core::EResult write(FILE& file, core::ECompressionType compression_type, core::EChecksumType checksum_type) const;
     // read block data
@@ -35,6 +45,8 @@ struct BGCODE_BINARIZE_EXPORT PrintMetadataBlock : public BaseMetadataBlock
 
 struct BGCODE_BINARIZE_EXPORT PrinterMetadataBlock : public BaseMetadataBlock
 {
+    using BaseMetadataBlock::read_data;
+
     // write block header and data
     core::EResult write(FILE& file, core::ECompressionType compression_type, core::EChecksumType checksum_type) const;
     // read block data
@@ -50,6 +62,8 @@ struct BGCODE_BINARIZE_EXPORT ThumbnailBlock
     core::EResult write(FILE& file, core::EChecksumType checksum_type);
     // read block data
     core::EResult read_data(FILE& file, const core::FileHeader& file_header, const core::BlockHeader& block_header);
+    // read block data from the given payload (parameters + data), as returned by core::read_block_payload()
+    core::EResult read_data(const core::BlockHeader& block_header, const std::byte* payload, size_t payload_size);
 };
 
 struct BGCODE_BINARIZE_EXPORT GCodeBlock
@@ -61,10 +75,15 @@ struct BGCODE_BINARIZE_EXPORT GCodeBlock
     core::EResult write(FILE& file, core::ECompressionType compression_type, core::EChecksumType checksum_type) const;
     // read block data
     core::EResult read_data(FILE& file, const core::FileHeader& file_header, const core::BlockHeader& block_header);
+    // read block data from the given payload (parameters + data), as returned by core::read_block_payload()
+    // decoded data are appended to raw_data
+    core::EResult read_data(const core::BlockHeader& block_header, const std::byte* payload, size_t payload_size);
 };
 
 struct BGCODE_BINARIZE_EXPORT SlicerMetadataBlock : public BaseMetadataBlock
 {
+    using BaseMetadataBlock::read_data;
+
     // write block header and data
     core::EResult write(FILE& file, core::ECompressionType compression_type, core::EChecksumType checksum_type) const;
     // read block data
@@ -85,6 +104,17 @@ struct BinarizerConfig
     core::EGCodeEncodingType gcode_encoding{ core::EGCodeEncodingType::None };
     core::EMetadataEncodingType metadata_encoding{ core::EMetadataEncodingType::INI };
     core::EChecksumType checksum{ core::EChecksumType::CRC32 };
+    // when true, gcode blocks are ended at layer changes (;LAYER_CHANGE), so that each layer starts at a block boundary,
+    // unless the block would be smaller than min_gcode_block_size (max size is Binarizer::get_max_gcode_cache_size())
+    bool layer_aligned_gcode_blocks{ false };
+    size_t min_gcode_block_size{ 4096 };
+    // count of spaces reserved at the end of the uncompressed metadata blocks, so that later edits
+    // by update_metadata() growing a block up to this size don't need to shift the rest of the file
+    size_t metadata_padding{ 0 };
+    // when not zero, Binarizer::initialize() writes printer, print and slicer metadata blocks uncompressed, reserving at least
+    // this count of bytes for their encoded data, and Binarizer::finalize() rewrites them in place (late metadata).
+    // Metadata can then be completed while the gcode is streamed, the file must be seekable.
+    size_t late_metadata_capacity{ 0 };
 };
 
 struct BGCODE_BINARIZE_EXPORT BinaryData
@@ -109,16 +139,452 @@ public:
     void set_max_gcode_cache_size(size_t size);
 
     core::EResult initialize(FILE& file, const BinarizerConfig& config);
+    // Prepares to append gcode blocks to the existing binary gcode file, which must be opened in "rb+" mode.
+    // The blocks of the file are walked to validate its tail (the last block must be a gcode or slicer metadata block
+    // with a valid checksum, ending at the end of the file). Existing blocks are left untouched.
+    // Checksum type is taken from the file header, gcode compression and encoding from the last gcode block,
+    // the other settings from the current config.
+    // If return == EResult::Success:
+    // - file position will be set at the end of the file, ready for append_gcode() and finalize().
+    core::EResult initialize_append(FILE& file);
     core::EResult append_gcode(const std::string& gcode);
     core::EResult finalize();
 
 private:
+    // metadata block reserved by initialize() for late metadata
+    struct ReservedBlock
+    {
+        core::EBlockType type;
+        // position of the block header, relative to the start of the binary gcode
+        size_t position{ 0 };
+        // size reserved for the encoded data, in bytes
+        size_t capacity{ 0 };
+    };
+
+    core::EResult write_reserved_block(ReservedBlock& block, bool reserve);
+
     FILE* m_file{ nullptr };
     bool m_enabled{ false };
     BinarizerConfig m_config;
     BinaryData m_binary_data;
     std::string m_gcode_cache;
     size_t m_gcode_cache_size{ 65536 };
+    std::vector<ReservedBlock> m_reserved_blocks;
+    // count of bytes written since the start of the binary gcode.
+    // Tracked here instead of querying the file, to support non-seekable outputs (pipes, sockets).
+    size_t m_position{ 0 };
+};
+
+// Position into the decoded gcode stream of a binary gcode file.
+// The decoded gcode stream is the concatenation, in file order, of the decoded data of all the gcode blocks.
+struct GCodePosition
+{
+    // index of the gcode block (only gcode blocks are counted)
+    size_t block{ 0 };
+    // offset into the decoded data of the gcode block, in bytes
+    size_t offset{ 0 };
+};
+
+// Line of the decoded gcode stream matching a search pattern.
+struct GCodeMatch
+{
+    // position of the start of the line
+    GCodePosition position;
+    // index of the line into the decoded gcode stream
+    size_t line{ 0 };
+    // text of the line, without the terminating newline
+    std::string text;
+};
+
+// Index of the gcode blocks of a binary gcode file, allowing to translate
+// offsets and lines of the decoded gcode stream into positions and viceversa.
+struct BGCODE_BINARIZE_EXPORT GCodeIndex
+{
+    struct Block
+    {
+        // position of the block header in the file
+        long position{ 0 };
+        // offset of the first byte of the block into the decoded gcode stream
+        size_t offset{ 0 };
+        // size of the decoded data of the block, in bytes
+        size_t size{ 0 };
+        // index of the first line of the block into the decoded gcode stream
+        size_t first_line{ 0 };
+        // count of lines contained into the block
+        size_t lines_count{ 0 };
+    };
+
+    // size of the indexed file, in bytes, used to detect stale sidecar files
+    size_t file_size{ 0 };
+    // hash of the file header and of the headers and checksums of all the blocks of the indexed file,
+    // used to detect files modified without changing their size
+    uint64_t fingerprint{ 0 };
+    std::vector<Block> blocks;
+    // cached results of search_gcode(), by pattern
+    std::map<std::string, std::vector<GCodeMatch>> searches;
+
+    // Returns the size of the decoded gcode stream, in bytes
+    size_t gcode_size() const;
+    // Returns the count of lines of the decoded gcode stream
+    size_t lines_count() const;
+
+    // Converts an offset into the decoded gcode stream into a position.
+    // Returns false if the offset lies outside of the decoded gcode stream.
+    bool offset_to_position(size_t offset, GCodePosition& position) const;
+    // Converts a position into an offset into the decoded gcode stream.
+    // Returns false if the position is not valid.
+    bool position_to_offset(const GCodePosition& position, size_t& offset) const;
+
+    // write the index into a sidecar file
+    core::EResult write(FILE& file) const;
+    // read the index from a sidecar file
+    core::EResult read(FILE& file);
+};
+
+// Builds the index of the gcode blocks of the given binary gcode file, decoding all of them.
+// Caller is responsible for providing buffer for checksum calculation, if needed.
+// The file position is not restored.
+extern BGCODE_BINARIZE_EXPORT core::EResult build_gcode_index(FILE& file, GCodeIndex& index, std::byte* cs_buffer = nullptr,
+    size_t cs_buffer_size = 0);
+
+// Checks that the given index was built from the given file, comparing the size and the fingerprint of the file.
+// Only the block headers and the checksums are read. Returns EResult::IndexMismatch if the index does not match the file.
+// The file position is not restored.
+extern BGCODE_BINARIZE_EXPORT core::EResult verify_gcode_index(FILE& file, const GCodeIndex& index);
+
+// Reads and decodes the gcode block with the given index.
+// If return == EResult::Success:
+// - file position will be set at the start of the next block header.
+extern BGCODE_BINARIZE_EXPORT core::EResult read_gcode_block(FILE& file, const GCodeIndex& index, size_t block_id, GCodeBlock& block);
+
+// Converts the index of a line of the decoded gcode stream into the position of the start of the line.
+// Only the gcode block containing the line is decoded. Returns EResult::IndexMismatch if the index was not built from the file.
+extern BGCODE_BINARIZE_EXPORT core::EResult line_to_position(FILE& file, const GCodeIndex& index, size_t line, GCodePosition& position);
+
+// Converts a position into the index of the line of the decoded gcode stream containing it.
+// Only the gcode block containing the position is decoded. Returns EResult::IndexMismatch if the index was not built from the file.
+extern BGCODE_BINARIZE_EXPORT core::EResult position_to_line(FILE& file, const GCodeIndex& index, const GCodePosition& position, size_t& line);
+
+// Searches the lines of the decoded gcode stream starting with any of the given patterns (as "M600" or "T"),
+// decoding the gcode blocks in parallel. Patterns ending with a digit do not match lines where the number continues,
+// so "M60" does not match "M600". Matches are returned in file order, once per line.
+extern BGCODE_BINARIZE_EXPORT core::EResult search_gcode(FILE& file, const std::vector<std::string>& patterns,
+    std::vector<GCodeMatch>& matches, bool verify_checksum = false);
+
+// As above, using the results cached into the given index and caching into it the results of the patterns not searched before.
+// Returns EResult::IndexMismatch if the index was not built from the given file.
+extern BGCODE_BINARIZE_EXPORT core::EResult search_gcode(FILE& file, GCodeIndex& index, const std::vector<std::string>& patterns,
+    std::vector<GCodeMatch>& matches, bool verify_checksum = false);
+
+// Transcodes the binary gcode contained into src_file to the compression, encoding and checksum settings of the given config,
+// saving the results into dst_file.
+// Blocks are processed without converting the file to ascii: metadata and gcode blocks whose settings already match the config,
+// and thumbnail blocks, are copied unchanged, the other gcode blocks are decoded and encoded again in parallel.
+// If max_gcode_block_size is not zero, the gcode is re-chunked into blocks of at most that size, at line boundaries.
+// The checksums of the source blocks are always verified.
+extern BGCODE_BINARIZE_EXPORT core::EResult transcode(FILE& src_file, FILE& dst_file, const BinarizerConfig& config,
+    size_t max_gcode_block_size = 0);
+
+// Replaces the metadata of the block with the given type (file, printer, print or slicer metadata) of the binary gcode file,
+// which must be opened in "rb+" mode. Compression and encoding of the block are kept, gcode blocks are not decoded.
+// If the new data fit into the existing uncompressed block (see BinarizerConfig::metadata_padding), the block is rewritten in place.
+// Otherwise the rest of the file is shifted, with raw copies, and the given padding is reserved into the new block, if uncompressed.
+extern BGCODE_BINARIZE_EXPORT core::EResult update_metadata(FILE& file, core::EBlockType block_type,
+    const std::vector<std::pair<std::string, std::string>>& metadata, size_t padding = 0);
+
+// Table of the layers of a binary gcode file, allowing to seek to the start of any layer.
+struct BGCODE_BINARIZE_EXPORT LayerTable
+{
+    struct Layer
+    {
+        // z of the layer, in mm
+        float z{ 0.0f };
+        // position of the start of the layer into the decoded gcode stream
+        GCodePosition position;
+        // index of the first line of the layer into the decoded gcode stream
+        size_t line{ 0 };
+        // print progress at the start of the layer, in percent, from M73 P (-1 if unknown)
+        int progress{ -1 };
+        // remaining print time at the start of the layer, in minutes, from M73 R (-1 if unknown)
+        int remaining_time{ -1 };
+    };
+
+    // size of the scanned file, in bytes, used to detect stale sidecar files
+    size_t file_size{ 0 };
+    // fingerprint of the scanned file, as GCodeIndex::fingerprint
+    uint64_t fingerprint{ 0 };
+    // layers[i] is the i-th layer, in print order
+    std::vector<Layer> layers;
+
+    // Returns the index of the layer containing the given line of the decoded gcode stream,
+    // or -1 if the line precedes the first layer
+    int line_to_layer(size_t line) const;
+
+    // write the table into a sidecar file
+    core::EResult write(FILE& file) const;
+    // read the table from a sidecar file
+    core::EResult read(FILE& file);
+};
+
+// Builds the layer table of the given binary gcode file, in a single pass over the gcode blocks,
+// decoding and scanning them in parallel.
+// Layers start at the ;LAYER_CHANGE markers, their z is taken from the following ;Z: marker or z move.
+// Files without markers fall back to layers starting at any move to a higher z (absolute positioning is assumed).
+// The file position is not restored.
+extern BGCODE_BINARIZE_EXPORT core::EResult build_layer_table(FILE& file, LayerTable& table, bool verify_checksum = false);
+
+// Statistics of the print described by the gcode of a binary gcode file
+struct BGCODE_BINARIZE_EXPORT PrintStatistics
+{
+    struct Feature
+    {
+        // name of the feature, from the ;TYPE: comments, empty for the gcode preceding the first one
+        std::string name;
+        // estimated time, in seconds
+        double time{ 0.0 };
+        // filament extruded, in mm
+        double extrusion{ 0.0 };
+    };
+
+    // count of G0/G1/G2/G3 moves
+    size_t moves_count{ 0 };
+    // filament pushed and pulled by the extruder, in mm
+    double extruded_length{ 0.0 };
+    double retracted_length{ 0.0 };
+    // length of the extruding moves and of the other moves, in mm
+    double extrusion_distance{ 0.0 };
+    double travel_distance{ 0.0 };
+    // estimated time, in seconds, from the feedrates only (accelerations are ignored)
+    double time{ 0.0 };
+    // bounding box of the extruding moves, in mm, zero if none
+    std::array<double, 3> min{ 0.0, 0.0, 0.0 };
+    std::array<double, 3> max{ 0.0, 0.0, 0.0 };
+    // count of switches to a different tool
+    size_t tool_changes{ 0 };
+    // per feature statistics, in order of first appearance
+    std::vector<Feature> features;
+};
+
+// Computes the statistics of the print described by the given binary gcode file, in a single pass over the gcode blocks,
+// decoding and scanning them in parallel. Each block is scanned without knowing the state left by the previous ones,
+// which is combined with the results of the scan afterwards.
+// The file position is not restored.
+extern BGCODE_BINARIZE_EXPORT core::EResult compute_print_statistics(FILE& file, PrintStatistics& stats, bool verify_checksum = false);
+
+// Extrusion moves of a binary gcode file, as structure of arrays ready to be uploaded by previewers.
+// Points are grouped into polylines of consecutive extrusions: each point, except the first one of its polyline,
+// ends the segment starting at the previous point.
+struct BGCODE_BINARIZE_EXPORT Toolpath
+{
+    // coordinates of the points, in mm
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+    // filament extruded by the segment ending at the point, in mm (0 for the first point of a polyline)
+    std::vector<float> e;
+    // index into features of the feature of the segment ending at the point
+    std::vector<uint16_t> feature;
+    // count of ;LAYER_CHANGE markers preceding the point
+    std::vector<uint32_t> layer;
+    // index of the first point of each polyline
+    std::vector<uint32_t> polylines;
+    // names of the features, from the ;TYPE: comments, [0] is empty and stands for the gcode preceding the first one
+    std::vector<std::string> features;
+
+    size_t points_count() const { return x.size(); }
+    // Clears all the arrays, keeping their memory for the next extraction
+    void clear();
+};
+
+// Extracts the toolpath of the given binary gcode file, parsing G0/G1/G2/G3 moves directly from the decoded gcode blocks,
+// scanned in parallel. Arcs are split into segments. The given toolpath is cleared first, its buffers are reused.
+// If min_segment_length is not zero, consecutive segments of a polyline are merged until they are at least that long.
+// The file position is not restored.
+extern BGCODE_BINARIZE_EXPORT core::EResult extract_toolpath(FILE& file, Toolpath& toolpath, float min_segment_length = 0.0f,
+    bool verify_checksum = false);
+
+// Saves into dst_file a new binary gcode file containing the lines [first_line, last_line) of the decoded gcode stream
+// of src_file, indexed by the given index. Metadata and thumbnails are carried over.
+// Returns EResult::IndexMismatch if the index was not built from src_file.
+// Gcode blocks fully inside the range are copied as raw bytes, the boundary ones are re-encoded with their own settings.
+extern BGCODE_BINARIZE_EXPORT core::EResult split(FILE& src_file, FILE& dst_file, const GCodeIndex& index, size_t first_line,
+    size_t last_line);
+
+// Saves into dst_file a new binary gcode file containing the layers [first_layer, last_layer) of src_file,
+// as listed into the given layer table.
+// Returns EResult::IndexMismatch if the index or the layer table were not built from src_file.
+extern BGCODE_BINARIZE_EXPORT core::EResult split(FILE& src_file, FILE& dst_file, const GCodeIndex& index, const LayerTable& table,
+    size_t first_layer, size_t last_layer);
+
+// Merges the given binary gcode files into dst_file, as a single print running them in sequence.
+// File metadata, printer metadata, thumbnails and slicer metadata are taken from the first file. Print metadata are merged,
+// summing the values of the additive keys (filament used, cost, estimated printing time), the others are taken from the first file.
+// Gcode blocks are copied as raw bytes, the given glue gcode, if any, is inserted between consecutive files
+// using the gcode settings of the first file.
+extern BGCODE_BINARIZE_EXPORT core::EResult merge(const std::vector<FILE*>& src_files, FILE& dst_file,
+    const std::string& glue_gcode = std::string());
+
+// Writes into patch_file the differences between old_file and new_file, compared by per block content hashes.
+// Blocks of new_file found into old_file (same hash and same bytes) are referenced by their index into old_file,
+// the others are stored as raw bytes.
+extern BGCODE_BINARIZE_EXPORT core::EResult make_patch(FILE& old_file, FILE& new_file, FILE& patch_file);
+
+// Rebuilds into new_file the file described by the given patch, made by make_patch() from old_file.
+// Returns EResult::InvalidChecksum if old_file is not the file the patch was made from, or if the rebuilt file
+// does not match the hash of new_file stored into the patch. In that case the content of new_file must be discarded.
+extern BGCODE_BINARIZE_EXPORT core::EResult apply_patch(FILE& old_file, FILE& patch_file, FILE& new_file);
+
+// Push parser, validating a binary gcode file while its bytes arrive (f.e. during an upload).
+// The bytes are passed to feed(), in any number of chunks of any size, and the parser reports, through the given events,
+// the blocks as soon as they are complete. The whole file is never needed, nor any seek.
+// Errors (invalid header, invalid sequence of blocks, checksum mismatch, metadata decoding error) are returned by feed()
+// as soon as the offending bytes are received, then the parser stops: further calls return the same error.
+class BGCODE_BINARIZE_EXPORT PushParser
+{
+public:
+    struct Events
+    {
+        // the file header has been received and validated
+        std::function<void(const core::FileHeader& file_header)> file_header;
+        // a block has been received, position is the position of its header into the file
+        // and payload contains its parameters and data, as stored into the file
+        std::function<void(const core::BlockHeader& block_header, size_t position, const std::vector<std::byte>& payload)> block;
+        // the checksum of the block at the given position matches its content (not called if the file has no checksum)
+        std::function<void(const core::BlockHeader& block_header, size_t position)> checksum_ok;
+        // a metadata block has been decoded
+        std::function<void(core::EBlockType type, const BaseMetadataBlock& metadata)> metadata;
+    };
+
+    explicit PushParser(Events events = Events());
+
+    // Parses the given bytes, which follow the ones passed to the previous calls
+    core::EResult feed(const std::byte* data, size_t size);
+    // To be called once all the bytes have been fed.
+    // Returns EResult::InvalidBinaryGCodeFile if the last block is incomplete, EResult::InvalidSequenceOfBlocks
+    // if the file does not end with gcode blocks.
+    core::EResult finish();
+    // Restarts the parsing of a new file, keeping the events
+    void reset();
+
+    // Returns the count of bytes fed so far
+    size_t get_position() const { return m_position; }
+    // Returns the count of blocks received so far
+    size_t get_blocks_count() const { return m_blocks_count; }
+
+private:
+    enum class EState : uint8_t
+    {
+        FileHeader,
+        BlockHeader,
+        Payload,
+        Checksum,
+        Error
+    };
+
+    // Processes the bytes collected into m_buffer, once all the ones required by the current state are available
+    core::EResult process();
+
+    Events m_events;
+    EState m_state{ EState::FileHeader };
+    core::EResult m_error{ core::EResult::Success };
+    core::FileHeader m_file_header;
+    core::BlockHeader m_block_header;
+    // type of the last complete block, if any
+    std::optional<core::EBlockType> m_previous_type;
+    // bytes of the current state (file header, block header, payload, checksum)
+    std::vector<std::byte> m_buffer;
+    // count of bytes required by the current state
+    size_t m_required_size{ 0 };
+    std::vector<std::byte> m_payload;
+    size_t m_block_position{ 0 };
+    size_t m_position{ 0 };
+    size_t m_blocks_count{ 0 };
+};
+
+// Reader of a binary gcode file using positional reads (pread() on POSIX, overlapped ReadFile() with offset
+// through a private handle on Windows), which never move the position of the file, so that the FILE passed to open()
+// can still be used by the caller.
+// Once open() returns, all the const methods are safe to be called from many threads at once,
+// so that the same file can serve parallel decoders and a viewer simultaneously.
+class BGCODE_BINARIZE_EXPORT Reader
+{
+public:
+    struct Block
+    {
+        core::BlockHeader header;
+        // position of the block header into the file
+        size_t position{ 0 };
+    };
+
+    // Bounds of the memory used to decode the blocks, 0 stands for unlimited
+    struct MemoryLimits
+    {
+        // max size of the payload (parameters + data) of a block read into memory
+        size_t max_block_size{ 0 };
+        // max uncompressed size of a block decoded into memory
+        size_t max_uncompressed_size{ 0 };
+        // max size of the blocks decoded at once by for_each_gcode_block(), counting payloads and uncompressed data
+        size_t max_in_flight_size{ 0 };
+    };
+
+    Reader() = default;
+    ~Reader();
+    Reader(const Reader&) = delete;
+    Reader& operator=(const Reader&) = delete;
+
+    // Reads the file header and the headers of all the blocks of the given file.
+    // The file must stay open, and must not be written, while this reader is in use.
+    // If verify_checksum is true, the checksum of every block is verified when the block is read.
+    core::EResult open(FILE& file, bool verify_checksum = false);
+
+    const core::FileHeader& get_file_header() const { return m_file_header; }
+    const std::vector<Block>& get_blocks() const { return m_blocks; }
+    size_t get_file_size() const { return m_file_size; }
+
+    // Returns the index into get_blocks() of the first block with the given type, or -1 if not found
+    int find_block(core::EBlockType type) const;
+
+    // Reads the payload (parameters + data) of the block with the given index into get_blocks()
+    core::EResult read_block_payload(size_t block_id, std::vector<std::byte>& payload) const;
+    // Reads and decodes the block with the given index into get_blocks(), which must be of the matching type
+    core::EResult read_block(size_t block_id, BaseMetadataBlock& block) const;
+    core::EResult read_block(size_t block_id, ThumbnailBlock& block) const;
+    core::EResult read_block(size_t block_id, GCodeBlock& block) const;
+
+    // Sets the limits used by read_block_payload(), read_block() and for_each_gcode_block().
+    // Blocks exceeding the limits are not read and MemoryLimitExceeded is returned.
+    // Must be called before the reader is shared among threads.
+    void set_memory_limits(const MemoryLimits& limits) { m_limits = limits; }
+    const MemoryLimits& get_memory_limits() const { return m_limits; }
+
+    // Decodes the gcode block with the given index into get_blocks() streaming it from the file,
+    // so that only buffers of about chunk_size bytes are kept in memory, whatever the size of the block.
+    // callback(gcode) is called, in order, with consecutive pieces of the decoded gcode.
+    core::EResult read_gcode_block_chunked(size_t block_id, const std::function<void(const std::string& gcode)>& callback,
+        size_t chunk_size = 65536) const;
+    // Decodes all the gcode blocks, in parallel batches bounded by MemoryLimits::max_in_flight_size.
+    // callback(block_id, gcode) is called sequentially, in file order.
+    // Blocks exceeding the memory limits are decoded by read_gcode_block_chunked() instead,
+    // and their gcode is passed to callback() in several pieces, with the same block_id.
+    core::EResult for_each_gcode_block(const std::function<void(size_t block_id, const std::string& gcode)>& callback) const;
+
+private:
+    // Reads size bytes starting at the given position of the file
+    bool read_at(size_t position, void* data, size_t size) const;
+    // Returns true if the block with the given index into get_blocks() can be decoded into memory within the memory limits
+    bool fits_memory_limits(size_t block_id) const;
+
+#ifdef _WIN32
+    // private handle opened for overlapped reads
+    void* m_handle{ nullptr };
+#else
+    int m_fd{ -1 };
+#endif // _WIN32
+    bool m_verify_checksum{ false };
+    size_t m_file_size{ 0 };
+    core::FileHeader m_file_header;
+    std::vector<Block> m_blocks;
+    MemoryLimits m_limits;
 };
 
 } // namespace binarize
@@ -0,0 +1,389 @@
+#ifndef BINARIZE_IMPL_HPP
+#define BINARIZE_IMPL_HPP
+
+#include "binarize.hpp"
+
+#include "core/core_impl.hpp"
+
+#include <atomic>
+#include <thread>
+#include <string_view>
+
+namespace bgcode { namespace binarize {
+
+// Writes the given bytes, counted into the statistics of the current conversion, if any
+template<class T>
+bool write_to_file(FILE& file, const T* data, size_t data_size)
+{
+    BGCODE_TRACE_SCOPE("write_to_file");
+    const core::ScopedConversionStage stage(core::ConversionStats::EStage::IO);
+    const size_t wsize = fwrite(static_cast<const void*>(data), 1, data_size, &file);
+    core::add_conversion_bytes_written(wsize);
+    return !ferror(&file) && wsize == data_size;
+}
+
+// Reads the given bytes, counted into the statistics of the current conversion, if any
+template<class T>
+bool read_from_file(FILE& file, T* data, size_t data_size)
+{
+    static_assert(!std::is_const_v<T>, "Type of output buffer cannot be const!");
+
+    BGCODE_TRACE_SCOPE("read_from_file");
+    const core::ScopedConversionStage stage(core::ConversionStats::EStage::IO);
+    const size_t rsize = fread(static_cast<void*>(data), 1, data_size, &file);
+    core::add_conversion_bytes_read(rsize);
+    return !ferror(&file) && rsize == data_size;
+}
+
+// 64 bit FNV-1a hash, used for the hashes of the patches and for the fingerprints of the indices
+static constexpr const uint64_t FNV_OFFSET_BASIS = 14695981039346656037ull;
+static constexpr const uint64_t FNV_PRIME = 1099511628211ull;
+
+inline uint64_t fnv1a(uint64_t hash, const std::byte* data, size_t size)
+{
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= (uint64_t)data[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+// Max size of the encoded gcode blocks kept in memory at once by scan_gcode_blocks(), in bytes
+static constexpr const size_t DEFAULT_SCAN_BATCH_SIZE = 16 * 1024 * 1024;
+
+// Encodes and compresses the given gcode block into memory.
+// If return == EResult::Success:
+// - block_header will contain the header of the encoded block.
+// - payload will contain the parameters and the data of the encoded block, as they are stored into the file.
+BGCODE_BINARIZE_EXPORT core::EResult encode_gcode_block(const GCodeBlock& block, core::ECompressionType compression_type, core::BlockHeader& block_header,
+    std::vector<std::byte>& payload);
+
+// Encodes and compresses the given metadata block into memory, appending the given count of padding spaces to the encoded data.
+// If return == EResult::Success:
+// - block_header will contain the header of the encoded block.
+// - payload will contain the parameters and the data of the encoded block, as they are stored into the file.
+BGCODE_BINARIZE_EXPORT core::EResult encode_metadata_block(const BaseMetadataBlock& block, core::EBlockType block_type, core::ECompressionType compression_type,
+    size_t padding, core::BlockHeader& block_header, std::vector<std::byte>& payload);
+
+// Writes a block, made of the given header and payload (parameters + data), followed by its checksum.
+core::EResult write_block(FILE& file, core::BlockHeader block_header, const std::vector<std::byte>& payload,
+    core::EChecksumType checksum_type);
+
+// Hashes the file header and the headers and checksums of all the blocks of the given file, without reading the block contents.
+// The file position is not restored.
+core::EResult compute_fingerprint(FILE& file, uint64_t& fingerprint);
+
+// Returns true if a block of the given type can follow a block of the given previous type.
+// previous_type == std::nullopt stands for the start of the file.
+inline bool is_valid_block_sequence(std::optional<core::EBlockType> previous_type, core::EBlockType type)
+{
+    if (!previous_type.has_value())
+        return type == core::EBlockType::FileMetadata || type == core::EBlockType::PrinterMetadata;
+
+    switch (*previous_type)
+    {
+    case core::EBlockType::FileMetadata:    { return type == core::EBlockType::PrinterMetadata; }
+    case core::EBlockType::PrinterMetadata:
+    case core::EBlockType::Thumbnail:       { return type == core::EBlockType::Thumbnail || type == core::EBlockType::PrintMetadata; }
+    case core::EBlockType::PrintMetadata:   { return type == core::EBlockType::SlicerMetadata; }
+    case core::EBlockType::SlicerMetadata:
+    case core::EBlockType::GCode:           { return type == core::EBlockType::GCode; }
+    default:                                { return false; }
+    }
+}
+
+// Calls task(i) for each i in [0, count), spreading the calls over the available hardware threads.
+// The calls are not ordered, task must be safe to be called concurrently.
+template<class Fn>
+void parallel_for(size_t count, Fn&& task)
+{
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+    const size_t threads_count = 1;
+#else
+    const size_t threads_count = std::min<size_t>(count, std::max(1u, std::thread::hardware_concurrency()));
+#endif
+    if (threads_count <= 1) {
+        for (size_t i = 0; i < count; ++i) {
+            task(i);
+        }
+        return;
+    }
+
+    std::atomic<size_t> next{ 0 };
+    auto worker = [&]() {
+        for (size_t i = next++; i < count; i = next++) {
+            task(i);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(threads_count - 1);
+    for (size_t i = 1; i < threads_count; ++i) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (std::thread& t : threads) {
+        t.join();
+    }
+}
+
+// Reads the gcode blocks of the given binary gcode file sequentially, in batches of about max_batch_size bytes,
+// and decodes them in parallel.
+// For each gcode block (block_id counts gcode blocks only):
+// - scan(block_id, decoded_gcode, result) is called concurrently, on any thread
+// - merge(block_id, block_header, result) is then called sequentially, in file order
+// The file position is not restored.
+template<class Result, class ScanFn, class MergeFn>
+core::EResult scan_gcode_blocks(FILE& file, bool verify_checksum, ScanFn&& scan, MergeFn&& merge,
+    size_t max_batch_size = DEFAULT_SCAN_BATCH_SIZE)
+{
+    using namespace core;
+
+    struct Item
+    {
+        BlockHeader header;
+        std::vector<std::byte> payload;
+        Checksum checksum{ EChecksumType::None };
+        Result result;
+        EResult res{ EResult::Success };
+    };
+
+    fseek(&file, 0, SEEK_END);
+    const long file_size = ftell(&file);
+    rewind(&file);
+
+    FileHeader file_header;
+    EResult res = read_header(file, file_header, nullptr);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+
+    const EChecksumType checksum_type = (EChecksumType)file_header.checksum_type;
+    size_t block_id = 0;
+    std::vector<Item> batch;
+    size_t batch_size = 0;
+
+    auto process_batch = [&]() {
+        parallel_for(batch.size(), [&](size_t i) {
+            Item& item = batch[i];
+            if (verify_checksum && checksum_type != EChecksumType::None) {
+                Checksum cs(checksum_type);
+                update_checksum(cs, item.header);
+                cs.append(item.payload);
+                if (!cs.matches(item.checksum)) {
+                    item.res = EResult::InvalidChecksum;
+                    return;
+                }
+            }
+            GCodeBlock block;
+            item.res = block.read_data(item.header, item.payload.data(), item.payload.size());
+            if (item.res != EResult::Success)
+                return;
+            // release the encoded data as soon as possible
+            std::vector<std::byte>().swap(item.payload);
+            scan(block_id + i, static_cast<const std::string&>(block.raw_data), item.result);
+        });
+
+        for (Item& item : batch) {
+            if (item.res != EResult::Success)
+                return item.res;
+            merge(block_id++, static_cast<const BlockHeader&>(item.header), item.result);
+        }
+
+        batch.clear();
+        batch_size = 0;
+        return EResult::Success;
+    };
+
+    while (ftell(&file) < file_size) {
+        BlockHeader block_header;
+        res = read_next_block_header(file, file_header, block_header);
+        if (res != EResult::Success)
+            // propagate error
+            return res;
+
+        if ((EBlockType)block_header.type != EBlockType::GCode) {
+            res = skip_block(file, file_header, block_header);
+            if (res != EResult::Success)
+                // propagate error
+                return res;
+            continue;
+        }
+
+        Item& item = batch.emplace_back();
+        item.header = block_header;
+        res = read_block_payload(file, block_header, item.payload);
+        if (res != EResult::Success)
+            // propagate error
+            return res;
+        item.checksum = Checksum(checksum_type);
+        res = item.checksum.read(file);
+        if (res != EResult::Success)
+            // propagate error
+            return res;
+
+        batch_size += item.payload.size();
+        if (batch_size >= max_batch_size) {
+            res = process_batch();
+            if (res != EResult::Success)
+                // propagate error
+                return res;
+        }
+    }
+
+    return process_batch();
+}
+
+// Calls visitor(line, offset) for each line of the given decoded gcode, where offset is the position of the
+// start of the line into data. Lines are passed without the terminating newline.
+template<class Fn>
+void for_each_line(const std::string& data, Fn&& visitor)
+{
+    size_t begin = 0;
+    while (begin < data.size()) {
+        size_t end = data.find('\n', begin);
+        if (end == std::string::npos)
+            end = data.size();
+        visitor(std::string_view(data.data() + begin, end - begin), begin);
+        begin = end + 1;
+    }
+}
+
+// Parses a decimal number, as found into gcode words (no exponent), starting at the given position.
+// Returns the position after the last parsed character, or begin if no number was found.
+inline const char* parse_number(const char* begin, const char* end, double& out)
+{
+    const char* c = begin;
+    bool negative = false;
+    if (c != end && (*c == '-' || *c == '+')) {
+        negative = *c == '-';
+        ++c;
+    }
+
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    bool digits = false;
+    for (; c != end && *c >= '0' && *c <= '9'; ++c) {
+        if (mantissa < (UINT64_MAX - 9) / 10)
+            mantissa = mantissa * 10 + (*c - '0');
+        else
+            ++exponent;
+        digits = true;
+    }
+    if (c != end && *c == '.') {
+        ++c;
+        for (; c != end && *c >= '0' && *c <= '9'; ++c) {
+            if (mantissa < (UINT64_MAX - 9) / 10) {
+                mantissa = mantissa * 10 + (*c - '0');
+                --exponent;
+            }
+            digits = true;
+        }
+    }
+    if (!digits)
+        return begin;
+
+    static constexpr const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+        1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20 };
+    double value = (double)mantissa;
+    if (exponent < 0)
+        value = (-exponent <= 20) ? value / powers[-exponent] : 0.0;
+    else if (exponent > 0)
+        value = (exponent <= 20) ? value * powers[exponent] : value * 1e20;
+    out = negative ? -value : value;
+    return c;
+}
+
+// Searches the gcode line for the parameter with the given letter (before any comment) and parses its value.
+// Returns false if the parameter is not present or has no valid value.
+inline bool find_parameter(std::string_view line, char letter, double& value)
+{
+    const size_t comment = line.find(';');
+    if (comment != std::string_view::npos)
+        line = line.substr(0, comment);
+
+    // skip the command
+    size_t pos = line.find(' ');
+    while (pos != std::string_view::npos && pos + 1 < line.size()) {
+        ++pos;
+        if (line[pos] == letter) {
+            const char* begin = line.data() + pos + 1;
+            const char* end = line.data() + line.size();
+            return parse_number(begin, end, value) != begin;
+        }
+        pos = line.find(' ', pos);
+    }
+    return false;
+}
+
+// Returns true if the gcode line starts with the given command (ex. "G1"), followed by a separator
+inline bool is_command(std::string_view line, std::string_view command)
+{
+    if (line.size() < command.size() || line.compare(0, command.size(), command) != 0)
+        return false;
+    return line.size() == command.size() || line[command.size()] == ' ' || line[command.size()] == ';' ||
+        line[command.size()] == '\t' || line[command.size()] == '\r';
+}
+
+// Words of a gcode line, after the command
+struct GCodeWords
+{
+    std::array<double, 26> values;
+    // bit i is set if the word with letter 'A' + i is present
+    uint32_t letters{ 0 };
+
+    bool has(char letter) const { return (letters & (1u << (letter - 'A'))) != 0; }
+    double get(char letter) const { return values[letter - 'A']; }
+};
+
+// Parses, in a single pass, the words found into [begin, end) up to the comment, if any
+inline void parse_words(const char* begin, const char* end, GCodeWords& words)
+{
+    words.letters = 0;
+    const char* c = begin;
+    while (c != end && *c != ';') {
+        if (*c >= 'A' && *c <= 'Z') {
+            double value;
+            const char* next = parse_number(c + 1, end, value);
+            if (next != c + 1) {
+                words.letters |= 1u << (*c - 'A');
+                words.values[*c - 'A'] = value;
+                c = next;
+                continue;
+            }
+        }
+        ++c;
+    }
+}
+
+// Parses the integer code of the command of the given line (ex. 1 for "G1").
+// Returns the position after the code, or nullptr if the command has no plain integer code.
+inline const char* parse_command_code(std::string_view line, int& code)
+{
+    const char* c = line.data() + 1;
+    const char* end = line.data() + line.size();
+    if (c == end || *c < '0' || *c > '9')
+        return nullptr;
+    code = 0;
+    for (; c != end && *c >= '0' && *c <= '9'; ++c) {
+        code = code * 10 + (*c - '0');
+    }
+    return (c == end || *c == ' ' || *c == ';' || *c == '\t' || *c == '\r') ? c : nullptr;
+}
+
+// Value depending on the state at the start of a gcode block, which is not known while the block is scanned in parallel
+// with the others: either known, or equal to the value at the start of the block plus the given offset
+struct SymbolicValue
+{
+    bool known{ false };
+    double value{ 0.0 };
+
+    double resolve(double entry) const { return known ? value : entry + value; }
+};
+
+// Symbolic X, Y, Z, E
+using SymbolicPosition = std::array<SymbolicValue, 4>;
+
+}} // namespace bgcode::binarize
+
+#endif // BINARIZE_IMPL_HPP
@@ -0,0 +1,509 @@
+#include "binarize_impl.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif // _WIN32
+
+namespace bgcode {
+
+using namespace core;
+
+namespace binarize {
+
+// Truncates the file at the given size
+static bool truncate_file(FILE& file, long size)
+{
+    if (fflush(&file) != 0)
+        return false;
+#ifdef _WIN32
+    return _chsize_s(_fileno(&file), size) == 0;
+#else
+    return ftruncate(fileno(&file), (off_t)size) == 0;
+#endif // _WIN32
+}
+
+// Moves the size bytes starting at src_position of the file to dst_position, in chunks.
+// Ranges may overlap: chunks are copied from back to front when moving toward the end of the file, front to back otherwise.
+static EResult move_file_bytes(FILE& file, long src_position, long dst_position, size_t size)
+{
+    if (src_position == dst_position || size == 0)
+        return EResult::Success;
+
+    std::vector<std::byte> buffer(std::min<size_t>(size, 65536));
+    const bool backward = dst_position > src_position;
+    size_t moved = 0;
+    while (moved < size) {
+        const size_t chunk_size = std::min(size - moved, buffer.size());
+        const long offset = (long)(backward ? size - moved - chunk_size : moved);
+        if (fseek(&file, src_position + offset, SEEK_SET) != 0)
+            return EResult::ReadError;
+        if (!read_from_file(file, buffer.data(), chunk_size))
+            return EResult::ReadError;
+        if (fseek(&file, dst_position + offset, SEEK_SET) != 0)
+            return EResult::WriteError;
+        if (!write_to_file(file, buffer.data(), chunk_size))
+            return EResult::WriteError;
+        moved += chunk_size;
+    }
+    return EResult::Success;
+}
+
+// Replaces the bytes [position, position + old_size) of the file with the given block, shifting the rest of the file
+// in place and truncating the file if the block shrinks.
+static EResult replace_block(FILE& file, long file_size, long position, size_t old_size, const BlockHeader& block_header,
+    const std::vector<std::byte>& payload, EChecksumType checksum_type)
+{
+    const size_t new_size = block_header.get_size() + payload.size() + checksum_size(checksum_type);
+    const long tail_position = position + (long)old_size;
+    const size_t tail_size = (size_t)(file_size - tail_position);
+
+    EResult res = move_file_bytes(file, tail_position, position + (long)new_size, tail_size);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+    if (fseek(&file, position, SEEK_SET) != 0)
+        return EResult::WriteError;
+    res = write_block(file, block_header, payload, checksum_type);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+
+    const long new_file_size = position + (long)(new_size + tail_size);
+    if (new_file_size < file_size && !truncate_file(file, new_file_size))
+        return EResult::WriteError;
+
+    return (fflush(&file) == 0) ? EResult::Success : EResult::WriteError;
+}
+
+BGCODE_BINARIZE_EXPORT EResult update_metadata(FILE& file, EBlockType block_type,
+    const std::vector<std::pair<std::string, std::string>>& metadata, size_t padding)
+{
+    if (block_type != EBlockType::FileMetadata && block_type != EBlockType::PrinterMetadata &&
+        block_type != EBlockType::PrintMetadata && block_type != EBlockType::SlicerMetadata)
+        return EResult::InvalidBlockType;
+
+    fseek(&file, 0, SEEK_END);
+    const long file_size = ftell(&file);
+    rewind(&file);
+
+    FileHeader file_header;
+    EResult res = read_header(file, file_header, nullptr);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+
+    BlockHeader old_header;
+    res = read_next_block_header(file, file_header, old_header, block_type);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+
+    // keep compression and encoding of the existing block
+    BaseMetadataBlock block;
+    if (fread(&block.encoding_type, 1, sizeof(block.encoding_type), &file) != sizeof(block.encoding_type))
+        return EResult::ReadError;
+    block.raw_data = metadata;
+    const ECompressionType compression_type = (ECompressionType)old_header.compression;
+    const EChecksumType checksum_type = (EChecksumType)file_header.checksum_type;
+
+    BlockHeader block_header;
+    std::vector<std::byte> payload;
+    res = encode_metadata_block(block, block_type, compression_type, 0, block_header, payload);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+
+    const long position = old_header.get_position();
+    const size_t old_size = old_header.get_size() + block_content_size(file_header, old_header);
+    const size_t new_size = block_header.get_size() + payload.size() + checksum_size(checksum_type);
+
+    if (compression_type == ECompressionType::None && new_size <= old_size) {
+        // fill the existing block, using padding
+        res = encode_metadata_block(block, block_type, compression_type, old_size - new_size, block_header, payload);
+        if (res != EResult::Success)
+            // propagate error
+            return res;
+        if (fseek(&file, position, SEEK_SET) != 0)
+            return EResult::WriteError;
+        res = write_block(file, block_header, payload, checksum_type);
+        if (res != EResult::Success)
+            // propagate error
+            return res;
+        return (fflush(&file) == 0) ? EResult::Success : EResult::WriteError;
+    }
+
+    if (compression_type == ECompressionType::None && padding > 0) {
+        res = encode_metadata_block(block, block_type, compression_type, padding, block_header, payload);
+        if (res != EResult::Success)
+            // propagate error
+            return res;
+    }
+
+    return replace_block(file, file_size, position, old_size, block_header, payload, checksum_type);
+}
+
+// Returns the offset of the start of the given line into the decoded gcode, or the size of the gcode if the line does not exist
+static size_t line_offset(const std::string& gcode, size_t line)
+{
+    size_t offset = 0;
+    for (size_t i = 0; i < line && offset < gcode.size(); ++i) {
+        offset = gcode.find('\n', offset);
+        offset = (offset == std::string::npos) ? gcode.size() : offset + 1;
+    }
+    return offset;
+}
+
+BGCODE_BINARIZE_EXPORT EResult split(FILE& src_file, FILE& dst_file, const GCodeIndex& index, size_t first_line, size_t last_line)
+{
+    EResult res = verify_gcode_index(src_file, index);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+    last_line = std::min(last_line, index.lines_count());
+    if (first_line >= last_line)
+        return EResult::BlockNotFound;
+
+    fseek(&src_file, 0, SEEK_END);
+    const long file_size = ftell(&src_file);
+    rewind(&src_file);
+
+    FileHeader file_header;
+    res = read_header(src_file, file_header, nullptr);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+    res = file_header.write(dst_file);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+
+    size_t block_id = 0;
+    while (ftell(&src_file) < file_size) {
+        BlockHeader block_header;
+        res = read_next_block_header(src_file, file_header, block_header);
+        if (res != EResult::Success)
+            // propagate error
+            return res;
+
+        // metadata and thumbnails are carried over
+        if ((EBlockType)block_header.type != EBlockType::GCode) {
+            res = copy_block(src_file, file_header, block_header, dst_file);
+            if (res != EResult::Success)
+                // propagate error
+                return res;
+            continue;
+        }
+
+        if (block_id >= index.blocks.size())
+            return EResult::InvalidBinaryGCodeFile;
+        const GCodeIndex::Block& block = index.blocks[block_id++];
+        const size_t block_last_line = block.first_line + block.lines_count;
+        if (block_last_line <= first_line || block.first_line >= last_line) {
+            // outside of the range
+            res = skip_block(src_file, file_header, block_header);
+        }
+        else if (first_line <= block.first_line && block_last_line <= last_line) {
+            // fully inside of the range
+            res = copy_block(src_file, file_header, block_header, dst_file);
+        }
+        else {
+            // boundary block, re-encoded with its own settings
+            GCodeBlock gcode_block;
+            res = gcode_block.read_data(src_file, file_header, block_header);
+            if (res != EResult::Success)
+                // propagate error
+                return res;
+            const size_t begin = line_offset(gcode_block.raw_data, first_line - std::min(first_line, block.first_line));
+            const size_t end = line_offset(gcode_block.raw_data, last_line - block.first_line);
+            gcode_block.raw_data = gcode_block.raw_data.substr(begin, end - begin);
+            res = gcode_block.write(dst_file, (ECompressionType)block_header.compression, (EChecksumType)file_header.checksum_type);
+        }
+        if (res != EResult::Success)
+            // propagate error
+            return res;
+    }
+
+    return EResult::Success;
+}
+
+BGCODE_BINARIZE_EXPORT EResult split(FILE& src_file, FILE& dst_file, const GCodeIndex& index, const LayerTable& table,
+    size_t first_layer, size_t last_layer)
+{
+    // the index is verified against src_file by the split of the lines
+    if (table.file_size != index.file_size || table.fingerprint != index.fingerprint)
+        return EResult::IndexMismatch;
+    last_layer = std::min(last_layer, table.layers.size());
+    if (first_layer >= last_layer)
+        return EResult::BlockNotFound;
+
+    const size_t first_line = table.layers[first_layer].line;
+    const size_t last_line = (last_layer < table.layers.size()) ? table.layers[last_layer].line : index.lines_count();
+    return split(src_file, dst_file, index, first_line, last_line);
+}
+
+// Parses a duration in the form used by the slicer (ex. "1d 2h 3m 4s"), in seconds
+static bool parse_duration(const std::string& str, uint64_t& seconds)
+{
+    seconds = 0;
+    size_t count = 0;
+    const char* c = str.c_str();
+    const char* end = c + str.size();
+    while (c != end) {
+        if (*c == ' ') {
+            ++c;
+            continue;
+        }
+        uint64_t value = 0;
+        const char* begin = c;
+        for (; c != end && *c >= '0' && *c <= '9'; ++c) {
+            value = value * 10 + (*c - '0');
+        }
+        if (c == begin || c == end)
+            return false;
+        switch (*c++)
+        {
+        case 'd': { seconds += value * 86400; break; }
+        case 'h': { seconds += value * 3600; break; }
+        case 'm': { seconds += value * 60; break; }
+        case 's': { seconds += value; break; }
+        default:  { return false; }
+        }
+        ++count;
+    }
+    return count > 0;
+}
+
+static std::string format_duration(uint64_t seconds)
+{
+    const uint64_t days = seconds / 86400;
+    const uint64_t hours = (seconds / 3600) % 24;
+    const uint64_t minutes = (seconds / 60) % 60;
+    seconds %= 60;
+    std::string ret;
+    if (days > 0)
+        ret += std::to_string(days) + "d ";
+    if (days > 0 || hours > 0)
+        ret += std::to_string(hours) + "h ";
+    if (days > 0 || hours > 0 || minutes > 0)
+        ret += std::to_string(minutes) + "m ";
+    return ret + std::to_string(seconds) + "s";
+}
+
+// Parses a number, or a comma separated list of numbers (one per extruder), also returning the max count of decimals
+static bool parse_numbers(const std::string& str, std::vector<double>& values, int& decimals)
+{
+    values.clear();
+    decimals = 0;
+    size_t begin = 0;
+    while (begin <= str.size()) {
+        size_t end = str.find(',', begin);
+        if (end == std::string::npos)
+            end = str.size();
+        const char* first = str.data() + begin;
+        const char* last = str.data() + end;
+        while (first != last && *first == ' ') ++first;
+        while (last != first && *(last - 1) == ' ') --last;
+        double value;
+        if (first == last || parse_number(first, last, value) != last)
+            return false;
+        values.push_back(value);
+        const char* dot = std::find(first, last, '.');
+        if (dot != last)
+            decimals = std::max(decimals, (int)(last - dot - 1));
+        begin = end + 1;
+    }
+    return !values.empty();
+}
+
+// Keys of the print metadata whose values add up over prints run in sequence
+static constexpr const std::string_view AdditivePrintMetadataKeys[] = {
+    "filament used [mm]", "filament used [cm3]", "filament used [g]", "filament cost",
+    "total filament used [g]", "total filament cost",
+    "estimated printing time (normal mode)", "estimated printing time (silent mode)"
+};
+
+// Sums the values of the additive keys of the print metadata of src into dst:
+// numbers (or lists of numbers, element wise) and durations are summed, other values are taken from dst.
+static void merge_print_metadata(std::vector<std::pair<std::string, std::string>>& dst,
+    const std::vector<std::pair<std::string, std::string>>& src)
+{
+    for (const auto& [key, value] : src) {
+        auto it = std::find_if(dst.begin(), dst.end(), [&key](const auto& item) { return item.first == key; });
+        if (it == dst.end()) {
+            dst.emplace_back(key, value);
+            continue;
+        }
+        if (std::find(std::begin(AdditivePrintMetadataKeys), std::end(AdditivePrintMetadataKeys), key) ==
+            std::end(AdditivePrintMetadataKeys))
+            continue;
+
+        uint64_t dst_seconds;
+        uint64_t src_seconds;
+        if (parse_duration(it->second, dst_seconds) && parse_duration(value, src_seconds)) {
+            it->second = format_duration(dst_seconds + src_seconds);
+            continue;
+        }
+
+        std::vector<double> dst_values;
+        std::vector<double> src_values;
+        int dst_decimals;
+        int src_decimals;
+        if (parse_numbers(it->second, dst_values, dst_decimals) && parse_numbers(value, src_values, src_decimals) &&
+            dst_values.size() == src_values.size()) {
+            std::string sum;
+            for (size_t i = 0; i < dst_values.size(); ++i) {
+                char buffer[64];
+                snprintf(buffer, sizeof(buffer), "%.*f", std::max(dst_decimals, src_decimals), dst_values[i] + src_values[i]);
+                if (i > 0)
+                    sum += ", ";
+                sum += buffer;
+            }
+            it->second = sum;
+        }
+    }
+}
+
+// Copies the given block as raw bytes, recalculating the checksum only if its type differs
+static EResult copy_block_with_checksum(FILE& src_file, const FileHeader& file_header, const BlockHeader& block_header, FILE& dst_file,
+    EChecksumType checksum_type)
+{
+    if ((EChecksumType)file_header.checksum_type == checksum_type)
+        return copy_block(src_file, file_header, block_header, dst_file);
+
+    if (fseek(&src_file, block_header.get_position() + (long)block_header.get_size(), SEEK_SET) != 0)
+        return EResult::ReadError;
+    std::vector<std::byte> payload;
+    EResult res = read_block_payload(src_file, block_header, payload);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+    res = write_block(dst_file, block_header, payload, checksum_type);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+    return skip_block(src_file, file_header, block_header);
+}
+
+BGCODE_BINARIZE_EXPORT EResult merge(const std::vector<FILE*>& src_files, FILE& dst_file, const std::string& glue_gcode)
+{
+    if (src_files.empty())
+        return EResult::InvalidBuffer;
+
+    struct Source
+    {
+        FileHeader file_header;
+        std::vector<BlockHeader> blocks;
+    };
+    std::vector<Source> sources(src_files.size());
+
+    // collect the blocks of all the files, merging the print metadata
+    PrintMetadataBlock print_metadata;
+    ECompressionType print_metadata_compression = ECompressionType::None;
+    GCodeBlock glue_block;
+    ECompressionType gcode_compression = ECompressionType::None;
+    for (size_t i = 0; i < src_files.size(); ++i) {
+        if (src_files[i] == nullptr)
+            return EResult::InvalidBuffer;
+        FILE& file = *src_files[i];
+        Source& source = sources[i];
+        fseek(&file, 0, SEEK_END);
+        const long file_size = ftell(&file);
+        rewind(&file);
+
+        EResult res = read_header(file, source.file_header, nullptr);
+        if (res != EResult::Success)
+            // propagate error
+            return res;
+
+        bool gcode_found = false;
+        while (ftell(&file) < file_size) {
+            BlockHeader& block_header = source.blocks.emplace_back();
+            res = read_next_block_header(file, source.file_header, block_header);
+            if (res != EResult::Success)
+                // propagate error
+                return res;
+
+            const EBlockType type = (EBlockType)block_header.type;
+            if (type == EBlockType::PrintMetadata) {
+                PrintMetadataBlock block;
+                res = block.read_data(file, source.file_header, block_header);
+                if (res != EResult::Success)
+                    // propagate error
+                    return res;
+                if (i == 0) {
+                    print_metadata = std::move(block);
+                    print_metadata_compression = (ECompressionType)block_header.compression;
+                }
+                else
+                    merge_print_metadata(print_metadata.raw_data, block.raw_data);
+                continue;
+            }
+            if (type == EBlockType::GCode && i == 0 && !gcode_found) {
+                // glue gcode uses the settings of the first gcode block
+                if (fread(&glue_block.encoding_type, 1, sizeof(glue_block.encoding_type), &file) != sizeof(glue_block.encoding_type))
+                    return EResult::ReadError;
+                gcode_compression = (ECompressionType)block_header.compression;
+                gcode_found = true;
+            }
+            res = skip_block(file, source.file_header, block_header);
+            if (res != EResult::Success)
+                // propagate error
+                return res;
+        }
+    }
+
+    const EChecksumType checksum_type = (EChecksumType)sources.front().file_header.checksum_type;
+    EResult res = sources.front().file_header.write(dst_file);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+
+    // metadata and thumbnails from the first file, with merged print metadata
+    for (const BlockHeader& block_header : sources.front().blocks) {
+        const EBlockType type = (EBlockType)block_header.type;
+        if (type == EBlockType::GCode)
+            continue;
+        if (type == EBlockType::PrintMetadata) {
+            BlockHeader new_header;
+            std::vector<std::byte> payload;
+            res = encode_metadata_block(print_metadata, type, print_metadata_compression, 0, new_header, payload);
+            if (res == EResult::Success)
+                res = write_block(dst_file, new_header, payload, checksum_type);
+        }
+        else
+            res = copy_block_with_checksum(*src_files.front(), sources.front().file_header, block_header, dst_file, checksum_type);
+        if (res != EResult::Success)
+            // propagate error
+            return res;
+    }
+
+    // gcode blocks of all the files, with glue gcode in between
+    glue_block.raw_data = glue_gcode;
+    if (!glue_block.raw_data.empty() && glue_block.raw_data.back() != '\n')
+        glue_block.raw_data += '\n';
+    for (size_t i = 0; i < src_files.size(); ++i) {
+        if (i > 0 && !glue_block.raw_data.empty()) {
+            res = glue_block.write(dst_file, gcode_compression, checksum_type);
+            if (res != EResult::Success)
+                // propagate error
+                return res;
+        }
+        for (const BlockHeader& block_header : sources[i].blocks) {
+            if ((EBlockType)block_header.type != EBlockType::GCode)
+                continue;
+            res = copy_block_with_checksum(*src_files[i], sources[i].file_header, block_header, dst_file, checksum_type);
+            if (res != EResult::Success)
+                // propagate error
+                return res;
+        }
+    }
+
+    return EResult::Success;
+}
+
+}} // namespace bgcode
@@ -0,0 +1,396 @@
+#include "binarize_impl.hpp"
+
+#include <algorithm>
+
+namespace bgcode {
+
+using namespace core;
+
+namespace binarize {
+
+static constexpr const std::array<char, 4> INDEX_MAGIC{ 'B', 'G', 'C', 'I' };
+// version 2: cached searches
+// version 3: fingerprint of the indexed file, older sidecar files must be rebuilt
+static constexpr const uint32_t INDEX_VERSION = 3;
+
+static bool write_string(FILE& file, const std::string& str)
+{
+    const uint64_t size = str.size();
+    return write_to_file(file, &size, sizeof(size)) && write_to_file(file, str.data(), str.size());
+}
+
+// Reads a string saved by write_string(), returns false if its size exceeds the remaining bytes of the given file
+static bool read_string(FILE& file, size_t file_size, std::string& str)
+{
+    uint64_t size;
+    if (!read_from_file(file, &size, sizeof(size)))
+        return false;
+    const long position = ftell(&file);
+    if (position < 0 || (size_t)position > file_size || size > file_size - (size_t)position)
+        return false;
+    str.resize((size_t)size);
+    return read_from_file(file, str.data(), str.size());
+}
+
+EResult compute_fingerprint(FILE& file, uint64_t& fingerprint)
+{
+    fseek(&file, 0, SEEK_END);
+    const long file_size = ftell(&file);
+    rewind(&file);
+
+    FileHeader file_header;
+    EResult res = read_header(file, file_header, nullptr);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+
+    std::vector<std::byte> buffer(file_header.get_size());
+    rewind(&file);
+    if (!read_from_file(file, buffer.data(), buffer.size()))
+        return EResult::ReadError;
+    fingerprint = fnv1a(FNV_OFFSET_BASIS, buffer.data(), buffer.size());
+
+    const size_t cs_size = checksum_size((EChecksumType)file_header.checksum_type);
+    while (ftell(&file) < file_size) {
+        BlockHeader block_header;
+        res = read_next_block_header(file, file_header, block_header);
+        if (res != EResult::Success)
+            // propagate error
+            return res;
+
+        const long position = block_header.get_position();
+        const long end_position = position + (long)(block_header.get_size() + block_content_size(file_header, block_header));
+        if (end_position > file_size)
+            return EResult::InvalidBinaryGCodeFile;
+
+        buffer.resize(block_header.get_size());
+        if (fseek(&file, position, SEEK_SET) != 0 || !read_from_file(file, buffer.data(), buffer.size()))
+            return EResult::ReadError;
+        fingerprint = fnv1a(fingerprint, buffer.data(), buffer.size());
+        if (cs_size > 0) {
+            buffer.resize(cs_size);
+            if (fseek(&file, end_position - (long)cs_size, SEEK_SET) != 0 || !read_from_file(file, buffer.data(), buffer.size()))
+                return EResult::ReadError;
+            fingerprint = fnv1a(fingerprint, buffer.data(), buffer.size());
+        }
+        if (fseek(&file, end_position, SEEK_SET) != 0)
+            return EResult::ReadError;
+    }
+
+    return EResult::Success;
+}
+
+static size_t count_lines(const std::string& data)
+{
+    size_t ret = std::count(data.begin(), data.end(), '\n');
+    // last line may miss the terminating newline
+    if (!data.empty() && data.back() != '\n')
+        ++ret;
+    return ret;
+}
+
+size_t GCodeIndex::gcode_size() const
+{
+    return blocks.empty() ? 0 : blocks.back().offset + blocks.back().size;
+}
+
+size_t GCodeIndex::lines_count() const
+{
+    return blocks.empty() ? 0 : blocks.back().first_line + blocks.back().lines_count;
+}
+
+bool GCodeIndex::offset_to_position(size_t offset, GCodePosition& position) const
+{
+    if (offset >= gcode_size())
+        return false;
+
+    // search the last block starting at or before the given offset
+    auto it = std::upper_bound(blocks.begin(), blocks.end(), offset,
+        [](size_t offset, const Block& block) { return offset < block.offset; });
+    --it;
+    position.block = std::distance(blocks.begin(), it);
+    position.offset = offset - it->offset;
+    return true;
+}
+
+bool GCodeIndex::position_to_offset(const GCodePosition& position, size_t& offset) const
+{
+    if (position.block >= blocks.size() || position.offset >= blocks[position.block].size)
+        return false;
+
+    offset = blocks[position.block].offset + position.offset;
+    return true;
+}
+
+EResult GCodeIndex::write(FILE& file) const
+{
+    if (!write_to_file(file, INDEX_MAGIC.data(), INDEX_MAGIC.size()))
+        return EResult::WriteError;
+    if (!write_to_file(file, &INDEX_VERSION, sizeof(INDEX_VERSION)))
+        return EResult::WriteError;
+
+    const uint64_t size = file_size;
+    if (!write_to_file(file, &size, sizeof(size)))
+        return EResult::WriteError;
+    if (!write_to_file(file, &fingerprint, sizeof(fingerprint)))
+        return EResult::WriteError;
+    const uint64_t count = blocks.size();
+    if (!write_to_file(file, &count, sizeof(count)))
+        return EResult::WriteError;
+
+    for (const Block& block : blocks) {
+        const std::array<uint64_t, 5> data = { (uint64_t)block.position, block.offset, block.size, block.first_line, block.lines_count };
+        if (!write_to_file(file, data.data(), data.size() * sizeof(uint64_t)))
+            return EResult::WriteError;
+    }
+
+    const uint64_t searches_count = searches.size();
+    if (!write_to_file(file, &searches_count, sizeof(searches_count)))
+        return EResult::WriteError;
+    for (const auto& [pattern, matches] : searches) {
+        if (!write_string(file, pattern))
+            return EResult::WriteError;
+        const uint64_t matches_count = matches.size();
+        if (!write_to_file(file, &matches_count, sizeof(matches_count)))
+            return EResult::WriteError;
+        for (const GCodeMatch& match : matches) {
+            const std::array<uint64_t, 3> data = { match.position.block, match.position.offset, match.line };
+            if (!write_to_file(file, data.data(), data.size() * sizeof(uint64_t)))
+                return EResult::WriteError;
+            if (!write_string(file, match.text))
+                return EResult::WriteError;
+        }
+    }
+
+    return EResult::Success;
+}
+
+EResult GCodeIndex::read(FILE& file)
+{
+    // size of the sidecar file, to validate the sizes read from it
+    const long start_position = ftell(&file);
+    fseek(&file, 0, SEEK_END);
+    const long sidecar_size = ftell(&file);
+    if (start_position < 0 || sidecar_size < 0 || fseek(&file, start_position, SEEK_SET) != 0)
+        return EResult::ReadError;
+
+    std::array<char, 4> magic;
+    if (!read_from_file(file, magic.data(), magic.size()))
+        return EResult::ReadError;
+    if (magic != INDEX_MAGIC)
+        return EResult::InvalidMagicNumber;
+
+    uint32_t version;
+    if (!read_from_file(file, &version, sizeof(version)))
+        return EResult::ReadError;
+    if (version < 3 || version > INDEX_VERSION)
+        return EResult::InvalidVersionNumber;
+
+    uint64_t size;
+    if (!read_from_file(file, &size, sizeof(size)))
+        return EResult::ReadError;
+    uint64_t new_fingerprint;
+    if (!read_from_file(file, &new_fingerprint, sizeof(new_fingerprint)))
+        return EResult::ReadError;
+    uint64_t count;
+    if (!read_from_file(file, &count, sizeof(count)))
+        return EResult::ReadError;
+
+    std::vector<Block> new_blocks;
+    for (uint64_t i = 0; i < count; ++i) {
+        std::array<uint64_t, 5> data;
+        if (!read_from_file(file, data.data(), data.size() * sizeof(uint64_t)))
+            return EResult::ReadError;
+        new_blocks.push_back({ (long)data[0], (size_t)data[1], (size_t)data[2], (size_t)data[3], (size_t)data[4] });
+    }
+
+    std::map<std::string, std::vector<GCodeMatch>> new_searches;
+    uint64_t searches_count;
+    if (!read_from_file(file, &searches_count, sizeof(searches_count)))
+        return EResult::ReadError;
+    for (uint64_t i = 0; i < searches_count; ++i) {
+        std::string pattern;
+        if (!read_string(file, (size_t)sidecar_size, pattern))
+            return EResult::ReadError;
+        uint64_t matches_count;
+        if (!read_from_file(file, &matches_count, sizeof(matches_count)))
+            return EResult::ReadError;
+        std::vector<GCodeMatch>& matches = new_searches[pattern];
+        for (uint64_t j = 0; j < matches_count; ++j) {
+            std::array<uint64_t, 3> data;
+            if (!read_from_file(file, data.data(), data.size() * sizeof(uint64_t)))
+                return EResult::ReadError;
+            GCodeMatch& match = matches.emplace_back();
+            match.position = { (size_t)data[0], (size_t)data[1] };
+            match.line = (size_t)data[2];
+            if (!read_string(file, (size_t)sidecar_size, match.text))
+                return EResult::ReadError;
+        }
+    }
+
+    file_size = (size_t)size;
+    fingerprint = new_fingerprint;
+    blocks = std::move(new_blocks);
+    searches = std::move(new_searches);
+    return EResult::Success;
+}
+
+BGCODE_BINARIZE_EXPORT EResult build_gcode_index(FILE& file, GCodeIndex& index, std::byte* cs_buffer, size_t cs_buffer_size)
+{
+    fseek(&file, 0, SEEK_END);
+    const long file_size = ftell(&file);
+    rewind(&file);
+
+    FileHeader file_header;
+    EResult res = read_header(file, file_header, nullptr);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+
+    index.file_size = (size_t)file_size;
+    index.blocks.clear();
+
+    size_t offset = 0;
+    size_t first_line = 0;
+    while (ftell(&file) < file_size) {
+        BlockHeader block_header;
+        res = read_next_block_header(file, file_header, block_header, cs_buffer, cs_buffer_size);
+        if (res != EResult::Success)
+            // propagate error
+            return res;
+
+        if ((EBlockType)block_header.type != EBlockType::GCode) {
+            res = skip_block(file, file_header, block_header);
+            if (res != EResult::Success)
+                // propagate error
+                return res;
+            continue;
+        }
+
+        GCodeBlock block;
+        res = block.read_data(file, file_header, block_header);
+        if (res != EResult::Success)
+            // propagate error
+            return res;
+
+        GCodeIndex::Block& item = index.blocks.emplace_back();
+        item.position = block_header.get_position();
+        item.offset = offset;
+        item.size = block.raw_data.size();
+        item.first_line = first_line;
+        item.lines_count = count_lines(block.raw_data);
+
+        offset += item.size;
+        first_line += item.lines_count;
+    }
+
+    return compute_fingerprint(file, index.fingerprint);
+}
+
+BGCODE_BINARIZE_EXPORT EResult verify_gcode_index(FILE& file, const GCodeIndex& index)
+{
+    fseek(&file, 0, SEEK_END);
+    const long file_size = ftell(&file);
+    if (file_size < 0)
+        return EResult::ReadError;
+    if ((size_t)file_size != index.file_size)
+        return EResult::IndexMismatch;
+
+    uint64_t fingerprint;
+    const EResult res = compute_fingerprint(file, fingerprint);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+    return (fingerprint == index.fingerprint) ? EResult::Success : EResult::IndexMismatch;
+}
+
+BGCODE_BINARIZE_EXPORT EResult read_gcode_block(FILE& file, const GCodeIndex& index, size_t block_id, GCodeBlock& block)
+{
+    if (block_id >= index.blocks.size())
+        return EResult::BlockNotFound;
+
+    FileHeader file_header;
+    EResult res = read_header(file, file_header, nullptr);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+
+    if (fseek(&file, index.blocks[block_id].position, SEEK_SET) != 0)
+        return EResult::ReadError;
+
+    BlockHeader block_header;
+    res = read_next_block_header(file, file_header, block_header);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+    if ((EBlockType)block_header.type != EBlockType::GCode)
+        return EResult::InvalidBlockType;
+
+    block.raw_data.clear();
+    return block.read_data(file, file_header, block_header);
+}
+
+BGCODE_BINARIZE_EXPORT EResult line_to_position(FILE& file, const GCodeIndex& index, size_t line, GCodePosition& position)
+{
+    EResult res = verify_gcode_index(file, index);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+
+    if (line >= index.lines_count())
+        return EResult::BlockNotFound;
+
+    // search the last block starting at or before the given line
+    auto it = std::upper_bound(index.blocks.begin(), index.blocks.end(), line,
+        [](size_t line, const GCodeIndex::Block& block) { return line < block.first_line; });
+    --it;
+    // skip empty blocks
+    while (it->lines_count == 0) {
+        ++it;
+    }
+
+    const size_t block_id = std::distance(index.blocks.begin(), it);
+    GCodeBlock block;
+    res = read_gcode_block(file, index, block_id, block);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+
+    size_t offset = 0;
+    for (size_t i = it->first_line; i < line; ++i) {
+        offset = block.raw_data.find('\n', offset);
+        if (offset == std::string::npos)
+            return EResult::InvalidBinaryGCodeFile;
+        ++offset;
+    }
+
+    position.block = block_id;
+    position.offset = offset;
+    return EResult::Success;
+}
+
+BGCODE_BINARIZE_EXPORT EResult position_to_line(FILE& file, const GCodeIndex& index, const GCodePosition& position, size_t& line)
+{
+    EResult res = verify_gcode_index(file, index);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+
+    size_t offset;
+    if (!index.position_to_offset(position, offset))
+        return EResult::BlockNotFound;
+
+    GCodeBlock block;
+    res = read_gcode_block(file, index, position.block, block);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+    if (position.offset >= block.raw_data.size())
+        return EResult::InvalidBinaryGCodeFile;
+
+    line = index.blocks[position.block].first_line +
+        std::count(block.raw_data.begin(), block.raw_data.begin() + position.offset, '\n');
+    return EResult::Success;
+}
+
+}} // namespace bgcode
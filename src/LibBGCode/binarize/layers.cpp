@@ -0,0 +1,277 @@
+#include "binarize_impl.hpp"
+
+#include <algorithm>
+
+namespace bgcode {
+
+using namespace core;
+
+namespace binarize {
+
+static constexpr const std::array<char, 4> LAYERS_MAGIC{ 'B', 'G', 'C', 'L' };
+// version 2: fingerprint of the scanned file, older sidecar files must be rebuilt
+static constexpr const uint32_t LAYERS_VERSION = 2;
+static constexpr const float Z_EPSILON = 0.0001f;
+
+// Layer related event found into a gcode block
+struct LayerEvent
+{
+    enum class EType : uint8_t
+    {
+        // ;LAYER_CHANGE
+        LayerChange,
+        // ;Z:
+        ZMarker,
+        // G0/G1 with Z
+        ZMove,
+        // first extrusion following a z move (or the start of the block)
+        Extrusion,
+        // M73 with P and/or R
+        Progress
+    };
+
+    EType type;
+    // offset of the line into the decoded data of the block
+    size_t offset{ 0 };
+    // index of the line into the block
+    size_t line{ 0 };
+    // z for ZMarker and ZMove
+    float z{ 0.0f };
+    // values for Progress, -1 if missing
+    int progress{ -1 };
+    int remaining_time{ -1 };
+};
+
+struct BlockLayerEvents
+{
+    std::vector<LayerEvent> events;
+    size_t lines_count{ 0 };
+};
+
+static void scan_block(size_t, const std::string& gcode, BlockLayerEvents& result)
+{
+    bool extrusion_found = false;
+    size_t line_id = 0;
+    for_each_line(gcode, [&](std::string_view line, size_t offset) {
+        const size_t id = line_id++;
+        if (line.empty())
+            return;
+
+        double value;
+        if (line[0] == ';') {
+            if (line.compare(0, 13, ";LAYER_CHANGE") == 0)
+                result.events.push_back({ LayerEvent::EType::LayerChange, offset, id });
+            else if (line.compare(0, 3, ";Z:") == 0) {
+                const char* begin = line.data() + 3;
+                if (parse_number(begin, line.data() + line.size(), value) != begin)
+                    result.events.push_back({ LayerEvent::EType::ZMarker, offset, id, (float)value });
+            }
+        }
+        else if (line[0] == 'G') {
+            const bool linear = is_command(line, "G1") || is_command(line, "G0");
+            if (linear && find_parameter(line, 'Z', value)) {
+                result.events.push_back({ LayerEvent::EType::ZMove, offset, id, (float)value });
+                extrusion_found = false;
+            }
+            if (!extrusion_found && (linear || is_command(line, "G2") || is_command(line, "G3")) &&
+                find_parameter(line, 'E', value) && value > 0.0) {
+                result.events.push_back({ LayerEvent::EType::Extrusion, offset, id });
+                extrusion_found = true;
+            }
+        }
+        else if (is_command(line, "M73")) {
+            LayerEvent event{ LayerEvent::EType::Progress, offset, id };
+            if (find_parameter(line, 'P', value))
+                event.progress = (int)value;
+            if (find_parameter(line, 'R', value))
+                event.remaining_time = (int)value;
+            if (event.progress >= 0 || event.remaining_time >= 0)
+                result.events.push_back(event);
+        }
+    });
+    result.lines_count = line_id;
+}
+
+int LayerTable::line_to_layer(size_t line) const
+{
+    auto it = std::upper_bound(layers.begin(), layers.end(), line,
+        [](size_t line, const Layer& layer) { return line < layer.line; });
+    return (int)std::distance(layers.begin(), it) - 1;
+}
+
+EResult LayerTable::write(FILE& file) const
+{
+    if (!write_to_file(file, LAYERS_MAGIC.data(), LAYERS_MAGIC.size()))
+        return EResult::WriteError;
+    if (!write_to_file(file, &LAYERS_VERSION, sizeof(LAYERS_VERSION)))
+        return EResult::WriteError;
+
+    const uint64_t size = file_size;
+    if (!write_to_file(file, &size, sizeof(size)))
+        return EResult::WriteError;
+    if (!write_to_file(file, &fingerprint, sizeof(fingerprint)))
+        return EResult::WriteError;
+    const uint64_t count = layers.size();
+    if (!write_to_file(file, &count, sizeof(count)))
+        return EResult::WriteError;
+
+    for (const Layer& layer : layers) {
+        const std::array<uint64_t, 3> data = { layer.position.block, layer.position.offset, layer.line };
+        const std::array<int32_t, 2> time = { layer.progress, layer.remaining_time };
+        if (!write_to_file(file, &layer.z, sizeof(layer.z)))
+            return EResult::WriteError;
+        if (!write_to_file(file, data.data(), data.size() * sizeof(uint64_t)))
+            return EResult::WriteError;
+        if (!write_to_file(file, time.data(), time.size() * sizeof(int32_t)))
+            return EResult::WriteError;
+    }
+
+    return EResult::Success;
+}
+
+EResult LayerTable::read(FILE& file)
+{
+    std::array<char, 4> magic;
+    if (!read_from_file(file, magic.data(), magic.size()))
+        return EResult::ReadError;
+    if (magic != LAYERS_MAGIC)
+        return EResult::InvalidMagicNumber;
+
+    uint32_t version;
+    if (!read_from_file(file, &version, sizeof(version)))
+        return EResult::ReadError;
+    if (version < 2 || version > LAYERS_VERSION)
+        return EResult::InvalidVersionNumber;
+
+    uint64_t size;
+    if (!read_from_file(file, &size, sizeof(size)))
+        return EResult::ReadError;
+    uint64_t new_fingerprint;
+    if (!read_from_file(file, &new_fingerprint, sizeof(new_fingerprint)))
+        return EResult::ReadError;
+    uint64_t count;
+    if (!read_from_file(file, &count, sizeof(count)))
+        return EResult::ReadError;
+
+    std::vector<Layer> new_layers;
+    for (uint64_t i = 0; i < count; ++i) {
+        Layer& layer = new_layers.emplace_back();
+        std::array<uint64_t, 3> data;
+        std::array<int32_t, 2> time;
+        if (!read_from_file(file, &layer.z, sizeof(layer.z)))
+            return EResult::ReadError;
+        if (!read_from_file(file, data.data(), data.size() * sizeof(uint64_t)))
+            return EResult::ReadError;
+        if (!read_from_file(file, time.data(), time.size() * sizeof(int32_t)))
+            return EResult::ReadError;
+        layer.position = { (size_t)data[0], (size_t)data[1] };
+        layer.line = (size_t)data[2];
+        layer.progress = time[0];
+        layer.remaining_time = time[1];
+    }
+
+    file_size = (size_t)size;
+    fingerprint = new_fingerprint;
+    layers = std::move(new_layers);
+    return EResult::Success;
+}
+
+BGCODE_BINARIZE_EXPORT EResult build_layer_table(FILE& file, LayerTable& table, bool verify_checksum)
+{
+    fseek(&file, 0, SEEK_END);
+    const size_t file_size = (size_t)ftell(&file);
+
+    // layers from ;LAYER_CHANGE markers
+    std::vector<LayerTable::Layer> marker_layers;
+    bool marker_z_pending = false;
+    bool marker_progress_set = false;
+    // layers from z moves, used when no marker is found
+    std::vector<LayerTable::Layer> move_layers;
+    bool move_progress_set = false;
+    float current_z = -1.0f;
+    LayerTable::Layer last_z_move;
+
+    int progress = -1;
+    int remaining_time = -1;
+    size_t first_line = 0;
+
+    auto merge = [&](size_t block_id, const BlockHeader&, const BlockLayerEvents& result) {
+        for (const LayerEvent& event : result.events) {
+            const GCodePosition position{ block_id, event.offset };
+            const size_t line = first_line + event.line;
+            switch (event.type)
+            {
+            case LayerEvent::EType::LayerChange:
+            {
+                marker_layers.push_back({ 0.0f, position, line, progress, remaining_time });
+                marker_z_pending = true;
+                marker_progress_set = false;
+                break;
+            }
+            case LayerEvent::EType::ZMarker:
+            {
+                if (marker_z_pending) {
+                    marker_layers.back().z = event.z;
+                    marker_z_pending = false;
+                }
+                break;
+            }
+            case LayerEvent::EType::ZMove:
+            {
+                if (marker_z_pending) {
+                    marker_layers.back().z = event.z;
+                    marker_z_pending = false;
+                }
+                current_z = event.z;
+                last_z_move.position = position;
+                last_z_move.line = line;
+                break;
+            }
+            case LayerEvent::EType::Extrusion:
+            {
+                // a layer starts with the z move bringing the first extrusion above the previous layer
+                if (current_z >= 0.0f && (move_layers.empty() || current_z > move_layers.back().z + Z_EPSILON)) {
+                    move_layers.push_back({ current_z, last_z_move.position, last_z_move.line, progress, remaining_time });
+                    move_progress_set = false;
+                }
+                break;
+            }
+            case LayerEvent::EType::Progress:
+            {
+                if (event.progress >= 0)
+                    progress = event.progress;
+                if (event.remaining_time >= 0)
+                    remaining_time = event.remaining_time;
+                // the first M73 into a layer gives the time at its start
+                if (!marker_layers.empty() && !marker_progress_set) {
+                    marker_layers.back().progress = progress;
+                    marker_layers.back().remaining_time = remaining_time;
+                    marker_progress_set = true;
+                }
+                if (!move_layers.empty() && !move_progress_set) {
+                    move_layers.back().progress = progress;
+                    move_layers.back().remaining_time = remaining_time;
+                    move_progress_set = true;
+                }
+                break;
+            }
+            }
+        }
+        first_line += result.lines_count;
+    };
+
+    EResult res = scan_gcode_blocks<BlockLayerEvents>(file, verify_checksum, scan_block, merge);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+    res = compute_fingerprint(file, table.fingerprint);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+
+    table.file_size = file_size;
+    table.layers = marker_layers.empty() ? std::move(move_layers) : std::move(marker_layers);
+    return EResult::Success;
+}
+
+}} // namespace bgcode
@@ -229,208 +229,179 @@ void MPBinarizer::initialize_lookup_tables() {
 // See for reference: https://github.com/scottmudge/Prusa-Firmware-MeatPack/blob/MK3_sm_MeatPack/Firmware/meatpack.cpp
 void unbinarize(const std::vector<uint8_t>& src, std::string& dst)
 {
-    bool unbinarizing = false;
-    bool nospace_enabled = false;
-    bool cmd_active = false;             // Is a command pending
-    uint8_t char_buf = 0;                // Buffers a character if dealing with out-of-sequence pairs
-    size_t cmd_count = 0;                // Counts how many command bytes are received (need 2)
-    size_t full_char_queue = 0;          // Counts how many full-width characters are to be received
-    std::array<uint8_t, 2> char_out_buf; // Output buffer for caching up to 2 characters
-    size_t char_out_count = 0;           // Stores number of characters to be read out
-
-    auto handle_command = [&](uint8_t c) {
-        switch (c)
-        {
-        case Command_EnablePacking:   { unbinarizing = true; break; }
-        case Command_DisablePacking:  { unbinarizing = false; break; }
-        case Command_EnableNoSpaces:  { nospace_enabled = true; break; }
-        case Command_DisableNoSpaces: { nospace_enabled = false; break; }
-        case Command_ResetAll:        { unbinarizing = false; break; }
-        default:
-        case Command_QueryConfig:     { break; }
-        }
-    };
+    unbinarize(src.data(), src.size(), dst);
+}
 
-    auto handle_output_char = [&](uint8_t c) {
-        char_out_buf[char_out_count++] = c;
-    };
+void unbinarize(const uint8_t* src, size_t src_size, std::string& dst)
+{
+    MPUnbinarizer unbinarizer;
+    dst.reserve(dst.size() + 2 * src_size);
+    unbinarizer.unbinarize(src, src_size, dst);
+}
 
-    auto get_char = [&](uint8_t c) {
-        switch (c)
-        {
-        case 0b0000: { return '0'; }
-        case 0b0001: { return '1'; }
-        case 0b0010: { return '2'; }
-        case 0b0011: { return '3'; }
-        case 0b0100: { return '4'; }
-        case 0b0101: { return '5'; }
-        case 0b0110: { return '6'; }
-        case 0b0111: { return '7'; }
-        case 0b1000: { return '8'; }
-        case 0b1001: { return '9'; }
-        case 0b1010: { return '.'; }
-        case 0b1011: { return nospace_enabled ? 'E' : ' '; }
-        case 0b1100: { return '\n'; }
-        case 0b1101: { return 'G'; }
-        case 0b1110: { return 'X'; }
-        }
-        return '\0';
-    };
+void MPUnbinarizer::handle_command(uint8_t c)
+{
+    switch (c)
+    {
+    case Command_EnablePacking:   { m_unbinarizing = true; break; }
+    case Command_DisablePacking:  { m_unbinarizing = false; break; }
+    case Command_EnableNoSpaces:  { m_nospace_enabled = true; break; }
+    case Command_DisableNoSpaces: { m_nospace_enabled = false; break; }
+    case Command_ResetAll:        { m_unbinarizing = false; break; }
+    default:
+    case Command_QueryConfig:     { break; }
+    }
+}
+
+char MPUnbinarizer::get_char(uint8_t c) const
+{
+    switch (c)
+    {
+    case 0b0000: { return '0'; }
+    case 0b0001: { return '1'; }
+    case 0b0010: { return '2'; }
+    case 0b0011: { return '3'; }
+    case 0b0100: { return '4'; }
+    case 0b0101: { return '5'; }
+    case 0b0110: { return '6'; }
+    case 0b0111: { return '7'; }
+    case 0b1000: { return '8'; }
+    case 0b1001: { return '9'; }
+    case 0b1010: { return '.'; }
+    case 0b1011: { return m_nospace_enabled ? 'E' : ' '; }
+    case 0b1100: { return '\n'; }
+    case 0b1101: { return 'G'; }
+    case 0b1110: { return 'X'; }
+    }
+    return '\0';
+}
 
-    auto unpack_chars = [&](uint8_t pk, std::array<uint8_t, 2>& chars_out) {
-        uint8_t out = 0;
+uint8_t MPUnbinarizer::unpack_chars(uint8_t pk, std::array<uint8_t, 2>& chars_out) const
+{
+    uint8_t out = 0;
 
-        // If lower 4 bytes is 0b1111, the higher 4 are unused, and next char is full.
-        if ((pk & FirstNotPacked) == FirstNotPacked)
-            out |= NextPackedFirst;
-        else
-            chars_out[0] = get_char(pk & 0xF); // Assign lower char
+    // If lower 4 bytes is 0b1111, the higher 4 are unused, and next char is full.
+    if ((pk & FirstNotPacked) == FirstNotPacked)
+        out |= NextPackedFirst;
+    else
+        chars_out[0] = get_char(pk & 0xF); // Assign lower char
 
-        // Check if upper 4 bytes is 0b1111... if so, we don't need the second char.
-        if ((pk & SecondNotPacked) == SecondNotPacked)
-            out |= NextPackedSecond;
-        else
-            chars_out[1] = get_char((pk >> 4) & 0xF); // Assign upper char
+    // Check if upper 4 bytes is 0b1111... if so, we don't need the second char.
+    if ((pk & SecondNotPacked) == SecondNotPacked)
+        out |= NextPackedSecond;
+    else
+        chars_out[1] = get_char((pk >> 4) & 0xF); // Assign upper char
 
-        return out;
-    };
+    return out;
+}
 
-    auto handle_rx_char = [&](uint8_t c) {
-        if (unbinarizing) {
-            if (full_char_queue > 0) {
-                handle_output_char(c);
-                if (char_buf > 0) {
-                    handle_output_char(char_buf);
-                    char_buf = 0;
-                }
-                --full_char_queue;
+void MPUnbinarizer::handle_output_char(uint8_t c)
+{
+    m_char_out_buf[m_char_out_count++] = c;
+}
+
+void MPUnbinarizer::handle_rx_char(uint8_t c)
+{
+    if (m_unbinarizing) {
+        if (m_full_char_queue > 0) {
+            handle_output_char(c);
+            if (m_char_buf > 0) {
+                handle_output_char(m_char_buf);
+                m_char_buf = 0;
+            }
+            --m_full_char_queue;
+        }
+        else {
+            std::array<uint8_t, 2> buf = { 0, 0 };
+            const uint8_t res = unpack_chars(c, buf);
+
+            if ((res & NextPackedFirst) != 0) {
+                ++m_full_char_queue;
+                if ((res & NextPackedSecond) != 0)
+                    ++m_full_char_queue;
+                else
+                    m_char_buf = buf[1];
             }
             else {
-                std::array<uint8_t, 2> buf = { 0, 0 };
-                const uint8_t res = unpack_chars(c, buf);
-
-                if ((res & NextPackedFirst) != 0) {
-                    ++full_char_queue;
+                handle_output_char(buf[0]);
+                if (buf[0] != '\n') {
                     if ((res & NextPackedSecond) != 0)
-                        ++full_char_queue;
+                        ++m_full_char_queue;
                     else
-                        char_buf = buf[1];
-                }
-                else {
-                    handle_output_char(buf[0]);
-                    if (buf[0] != '\n') {
-                        if ((res & NextPackedSecond) != 0)
-                            ++full_char_queue;
-                        else
-                            handle_output_char(buf[1]);
-                    }
+                        handle_output_char(buf[1]);
                 }
             }
         }
-        else // Packing not enabled, just copy character to output
-            handle_output_char(c);
-    };
+    }
+    else // Packing not enabled, just copy character to output
+        handle_output_char(c);
+}
 
-    auto get_result_char = [&](std::array<char, 2>& chars_out) {
-        if (char_out_count > 0) {
-            const size_t res = char_out_count;
-            for (uint8_t i = 0; i < char_out_count; ++i) {
-                chars_out[i] = (char)char_out_buf[i];
-            }
-            char_out_count = 0;
-            return res;
-        }
-        return (size_t)0;
+void MPUnbinarizer::unbinarize(const uint8_t* src, size_t src_size, std::string& dst)
+{
+    auto is_gline_parameter = [](const char c) {
+        static const std::vector<char> parameters = {
+            // G0, G1
+            'X', 'Y', 'Z', 'E', 'F',
+            // G2, G3
+            'I', 'J', 'R',
+            // G4
+            'S',
+            // G29
+            'G', 'P', 'W', 'H', 'C', 'A'
+        };
+        return std::find(parameters.begin(), parameters.end(), c) != parameters.end();
     };
 
-    std::vector<uint8_t> unbin_buffer(2 * src.size(), 0);
-    auto it_unbin_end = unbin_buffer.begin();
-
-    bool add_space = false;
-
-    auto begin = src.begin();
-    auto end = src.end();
-
-    auto it_bin = begin;
-    while (it_bin != end) {
-        uint8_t c_bin = *it_bin;
+    for (const uint8_t* it_bin = src; it_bin != src + src_size; ++it_bin) {
+        const uint8_t c_bin = *it_bin;
         if (c_bin == Command_SignalByte) {
-            if (cmd_count > 0) {
-                cmd_active = true;
-                cmd_count = 0;
+            if (m_cmd_count > 0) {
+                m_cmd_active = true;
+                m_cmd_count = 0;
             }
             else
-              ++cmd_count;
+              ++m_cmd_count;
         }
         else {
-            if (cmd_active) {
+            if (m_cmd_active) {
                 handle_command(c_bin);
-                cmd_active = false;
+                m_cmd_active = false;
             }
             else {
-                if (cmd_count > 0) {
+                if (m_cmd_count > 0) {
                     handle_rx_char(Command_SignalByte);
-                    cmd_count = 0;
+                    m_cmd_count = 0;
                 }
 
                 handle_rx_char(c_bin);
             }
         }
 
-        auto is_gline_parameter = [](const char c) {
-            static const std::vector<char> parameters = {
-                // G0, G1
-                'X', 'Y', 'Z', 'E', 'F',
-                // G2, G3
-                'I', 'J', 'R',
-                // G4
-                'S',
-                // G29
-                'G', 'P', 'W', 'H', 'C', 'A'
-            };
-            return std::find(parameters.begin(), parameters.end(), c) != parameters.end();
-        };
-
-        std::array<char, 2> c_unbin{ 0, 0 };
-        const size_t char_count = get_result_char(c_unbin);
-        for (size_t i = 0; i < char_count; ++i) {
+        for (size_t i = 0; i < m_char_out_count; ++i) {
+            const char c_unbin = (char)m_char_out_buf[i];
             // GCodeReader::parse_line_internal() is unable to parse a G line where the data are not separated by spaces
             // so we add them where needed
-            const size_t curr_unbin_buffer_length = std::distance(unbin_buffer.begin(), it_unbin_end);
             bool new_line = false;
-            if (c_unbin[i] == 'G' && (curr_unbin_buffer_length == 0 || *std::prev(it_unbin_end, 1) == '\n')) {
-                add_space = true;
+            if (c_unbin == 'G' && (m_last_char == '\0' || m_last_char == '\n')) {
+                m_add_space = true;
                 new_line = true;
             }
-            else if (c_unbin[i] == '\n')
-                add_space = false;
-
-            if (!new_line && add_space && (curr_unbin_buffer_length == 0 || *std::prev(it_unbin_end, 1) != ' ') &&
-                is_gline_parameter(c_unbin[i])) {
-                *it_unbin_end = ' ';
-                ++it_unbin_end;
-                if (it_unbin_end == unbin_buffer.end()) {
-                    // the buffer is not big enough, resize it
-                    unbin_buffer.resize(2 * unbin_buffer.size(), 0);
-                    it_unbin_end = unbin_buffer.begin() + curr_unbin_buffer_length + 1;
-                }
+            else if (c_unbin == '\n')
+                m_add_space = false;
+
+            if (!new_line && m_add_space && (m_last_char == '\0' || m_last_char != ' ') && is_gline_parameter(c_unbin)) {
+                dst.push_back(' ');
+                m_last_char = ' ';
             }
 
-            if (c_unbin[i] != '\n' || std::distance(unbin_buffer.begin(), it_unbin_end) == 0 || *std::prev(it_unbin_end, 1) != '\n') {
-                *it_unbin_end = c_unbin[i];
-                ++it_unbin_end;
-                if (it_unbin_end == unbin_buffer.end()) {
-                    // the buffer is not big enough, resize it
-                    unbin_buffer.resize(2 * unbin_buffer.size(), 0);
-                    it_unbin_end = unbin_buffer.begin() + curr_unbin_buffer_length + 1;
-                }
+            if (c_unbin != '\n' || m_last_char == '\0' || m_last_char != '\n') {
+                dst.push_back(c_unbin);
+                m_last_char = c_unbin;
             }
         }
-
-        ++it_bin;
+        m_char_out_count = 0;
     }
-
-    dst.insert(dst.end(), unbin_buffer.begin(), it_unbin_end);
 }
 
 } //  namespace MeatPack
@@ -47,7 +47,41 @@ private:
     void initialize_lookup_tables();
 };
 
+// Decodes MeatPack data, which can be passed in chunks of any size
+class MPUnbinarizer
+{
+public:
+    // Appends to dst the characters decoded from the given data, which follow the ones passed to the previous calls
+    void unbinarize(const uint8_t* src, size_t src_size, std::string& dst);
+
+private:
+    bool m_unbinarizing{ false };
+    bool m_nospace_enabled{ false };
+    // Is a command pending
+    bool m_cmd_active{ false };
+    // Buffers a character if dealing with out-of-sequence pairs
+    uint8_t m_char_buf{ 0 };
+    // Counts how many command bytes are received (need 2)
+    size_t m_cmd_count{ 0 };
+    // Counts how many full-width characters are to be received
+    size_t m_full_char_queue{ 0 };
+    // Output buffer for caching up to 2 characters
+    std::array<uint8_t, 2> m_char_out_buf{ 0, 0 };
+    // Stores number of characters to be read out
+    size_t m_char_out_count{ 0 };
+    bool m_add_space{ false };
+    // Last character written to the output, '\0' if none
+    char m_last_char{ '\0' };
+
+    void handle_command(uint8_t c);
+    char get_char(uint8_t c) const;
+    uint8_t unpack_chars(uint8_t pk, std::array<uint8_t, 2>& chars_out) const;
+    void handle_output_char(uint8_t c);
+    void handle_rx_char(uint8_t c);
+};
+
 extern void unbinarize(const std::vector<uint8_t>& src, std::string& dst);
+extern void unbinarize(const uint8_t* src, size_t src_size, std::string& dst);
 
 } // namespace MeatPack
 
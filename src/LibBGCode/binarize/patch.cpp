@@ -0,0 +1,274 @@
+#include "binarize_impl.hpp"
+
+#include <cstring>
+#include <unordered_map>
+
+namespace bgcode {
+
+using namespace core;
+
+namespace binarize {
+
+static constexpr const std::array<char, 4> PATCH_MAGIC{ 'B', 'G', 'C', 'P' };
+// version 2: integers stored as little endian, hash of the new file stored and verified
+static constexpr const uint32_t PATCH_VERSION = 2;
+
+static constexpr const uint8_t PATCH_COPY = 0;
+static constexpr const uint8_t PATCH_LITERAL = 1;
+
+// Integers of the patch are stored as little endian, whatever the byte order of the host
+template<class T>
+static bool write_integer(FILE& file, T value)
+{
+    std::array<std::byte, sizeof(T)> bytes;
+    for (size_t i = 0; i < sizeof(T); ++i) {
+        bytes[i] = (std::byte)((uint64_t)value >> (8 * i));
+    }
+    return write_to_file(file, bytes.data(), bytes.size());
+}
+
+template<class T>
+static bool read_integer(FILE& file, T& value)
+{
+    std::array<std::byte, sizeof(T)> bytes;
+    if (!read_from_file(file, bytes.data(), bytes.size()))
+        return false;
+    uint64_t result = 0;
+    for (size_t i = 0; i < sizeof(T); ++i) {
+        result |= (uint64_t)bytes[i] << (8 * i);
+    }
+    value = (T)result;
+    return true;
+}
+
+// Block of a binary gcode file, as raw bytes
+struct RawBlock
+{
+    long position{ 0 };
+    // size of header + parameters + data + checksum
+    size_t size{ 0 };
+    uint64_t hash{ 0 };
+};
+
+// Collects the blocks of the given file, hashing their raw bytes.
+// header_size is set to the size of the file header, file_hash to the hash of the whole file.
+static EResult hash_blocks(FILE& file, size_t& header_size, std::vector<RawBlock>& blocks, uint64_t& file_hash)
+{
+    fseek(&file, 0, SEEK_END);
+    const long file_size = ftell(&file);
+    rewind(&file);
+
+    FileHeader file_header;
+    EResult res = read_header(file, file_header, nullptr);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+    header_size = (size_t)ftell(&file);
+
+    std::vector<std::byte> buffer(65536);
+    rewind(&file);
+    if (!read_from_file(file, buffer.data(), header_size))
+        return EResult::ReadError;
+    file_hash = fnv1a(FNV_OFFSET_BASIS, buffer.data(), header_size);
+
+    while (ftell(&file) < file_size) {
+        BlockHeader block_header;
+        res = read_next_block_header(file, file_header, block_header);
+        if (res != EResult::Success)
+            // propagate error
+            return res;
+
+        RawBlock& block = blocks.emplace_back();
+        block.position = block_header.get_position();
+        block.size = block_header.get_size() + block_content_size(file_header, block_header);
+        block.hash = FNV_OFFSET_BASIS;
+        if (fseek(&file, block.position, SEEK_SET) != 0)
+            return EResult::ReadError;
+        size_t remaining = block.size;
+        while (remaining > 0) {
+            const size_t size = std::min(remaining, buffer.size());
+            if (!read_from_file(file, buffer.data(), size))
+                return EResult::ReadError;
+            block.hash = fnv1a(block.hash, buffer.data(), size);
+            file_hash = fnv1a(file_hash, buffer.data(), size);
+            remaining -= size;
+        }
+    }
+
+    return EResult::Success;
+}
+
+// Returns true if the given ranges of the two files contain the same bytes
+static EResult equal_bytes(FILE& file1, long position1, FILE& file2, long position2, size_t size, bool& equal)
+{
+    if (fseek(&file1, position1, SEEK_SET) != 0 || fseek(&file2, position2, SEEK_SET) != 0)
+        return EResult::ReadError;
+    std::vector<std::byte> buffer1(std::min<size_t>(size, 65536));
+    std::vector<std::byte> buffer2(buffer1.size());
+    equal = false;
+    while (size > 0) {
+        const size_t chunk_size = std::min(size, buffer1.size());
+        if (!read_from_file(file1, buffer1.data(), chunk_size) || !read_from_file(file2, buffer2.data(), chunk_size))
+            return EResult::ReadError;
+        if (memcmp(buffer1.data(), buffer2.data(), chunk_size) != 0)
+            return EResult::Success;
+        size -= chunk_size;
+    }
+    equal = true;
+    return EResult::Success;
+}
+
+// Copies size bytes, starting at src_position of src_file, to the current position of dst_file, updating hash with them
+static EResult copy_hashed_bytes(FILE& src_file, long src_position, size_t size, FILE& dst_file, uint64_t& hash)
+{
+    if (fseek(&src_file, src_position, SEEK_SET) != 0)
+        return EResult::ReadError;
+    std::vector<std::byte> buffer(std::min<size_t>(size, 65536));
+    while (size > 0) {
+        const size_t chunk_size = std::min(size, buffer.size());
+        if (!read_from_file(src_file, buffer.data(), chunk_size))
+            return EResult::ReadError;
+        hash = fnv1a(hash, buffer.data(), chunk_size);
+        if (!write_to_file(dst_file, buffer.data(), chunk_size))
+            return EResult::WriteError;
+        size -= chunk_size;
+    }
+    return EResult::Success;
+}
+
+BGCODE_BINARIZE_EXPORT EResult make_patch(FILE& old_file, FILE& new_file, FILE& patch_file)
+{
+    size_t old_header_size;
+    std::vector<RawBlock> old_blocks;
+    uint64_t old_file_hash;
+    EResult res = hash_blocks(old_file, old_header_size, old_blocks, old_file_hash);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+    size_t new_header_size;
+    std::vector<RawBlock> new_blocks;
+    uint64_t new_file_hash;
+    res = hash_blocks(new_file, new_header_size, new_blocks, new_file_hash);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+
+    std::unordered_multimap<uint64_t, size_t> old_blocks_map;
+    for (size_t i = 0; i < old_blocks.size(); ++i) {
+        old_blocks_map.emplace(old_blocks[i].hash, i);
+    }
+
+    if (!write_to_file(patch_file, PATCH_MAGIC.data(), PATCH_MAGIC.size()))
+        return EResult::WriteError;
+    if (!write_integer(patch_file, PATCH_VERSION))
+        return EResult::WriteError;
+    if (!write_integer(patch_file, old_file_hash) || !write_integer(patch_file, new_file_hash) ||
+        !write_integer(patch_file, (uint64_t)new_header_size) || !write_integer(patch_file, (uint64_t)new_blocks.size()))
+        return EResult::WriteError;
+    // the file header is always stored
+    res = copy_file_bytes(new_file, 0, new_header_size, patch_file);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+
+    // blocks found into the old file are referenced by index, the others are stored.
+    // Blocks with matching hashes are compared byte by byte, so that hash collisions are not mistaken for copies
+    for (const RawBlock& block : new_blocks) {
+        std::optional<size_t> old_id;
+        const auto [begin, end] = old_blocks_map.equal_range(block.hash);
+        for (auto it = begin; it != end && !old_id.has_value(); ++it) {
+            const RawBlock& old_block = old_blocks[it->second];
+            if (old_block.size != block.size)
+                continue;
+            bool equal;
+            res = equal_bytes(old_file, old_block.position, new_file, block.position, block.size, equal);
+            if (res != EResult::Success)
+                // propagate error
+                return res;
+            if (equal)
+                old_id = it->second;
+        }
+
+        const uint8_t type = old_id.has_value() ? PATCH_COPY : PATCH_LITERAL;
+        const uint64_t value = old_id.has_value() ? (uint64_t)*old_id : (uint64_t)block.size;
+        if (!write_integer(patch_file, type) || !write_integer(patch_file, value))
+            return EResult::WriteError;
+        if (!old_id.has_value()) {
+            res = copy_file_bytes(new_file, block.position, block.size, patch_file);
+            if (res != EResult::Success)
+                // propagate error
+                return res;
+        }
+    }
+
+    return EResult::Success;
+}
+
+BGCODE_BINARIZE_EXPORT EResult apply_patch(FILE& old_file, FILE& patch_file, FILE& new_file)
+{
+    std::array<char, 4> magic;
+    if (!read_from_file(patch_file, magic.data(), magic.size()))
+        return EResult::ReadError;
+    if (magic != PATCH_MAGIC)
+        return EResult::InvalidMagicNumber;
+    uint32_t version;
+    if (!read_integer(patch_file, version))
+        return EResult::ReadError;
+    if (version != PATCH_VERSION)
+        return EResult::InvalidVersionNumber;
+    uint64_t old_file_hash;
+    uint64_t new_file_hash;
+    uint64_t new_header_size;
+    uint64_t blocks_count;
+    if (!read_integer(patch_file, old_file_hash) || !read_integer(patch_file, new_file_hash) ||
+        !read_integer(patch_file, new_header_size) || !read_integer(patch_file, blocks_count))
+        return EResult::ReadError;
+
+    // the patch must be applied to the file it was made from
+    size_t old_header_size;
+    std::vector<RawBlock> old_blocks;
+    uint64_t hash;
+    EResult res = hash_blocks(old_file, old_header_size, old_blocks, hash);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+    if (hash != old_file_hash)
+        return EResult::InvalidChecksum;
+
+    // the rebuilt file is hashed while written
+    hash = FNV_OFFSET_BASIS;
+    long position = ftell(&patch_file);
+    res = copy_hashed_bytes(patch_file, position, (size_t)new_header_size, new_file, hash);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+
+    for (uint64_t i = 0; i < blocks_count; ++i) {
+        uint8_t type;
+        uint64_t value;
+        if (!read_integer(patch_file, type) || !read_integer(patch_file, value))
+            return EResult::ReadError;
+        if (type == PATCH_COPY) {
+            if (value >= old_blocks.size())
+                return EResult::BlockNotFound;
+            res = copy_hashed_bytes(old_file, old_blocks[value].position, old_blocks[value].size, new_file, hash);
+        }
+        else if (type == PATCH_LITERAL) {
+            position = ftell(&patch_file);
+            res = copy_hashed_bytes(patch_file, position, (size_t)value, new_file, hash);
+        }
+        else
+            return EResult::InvalidBinaryGCodeFile;
+        if (res != EResult::Success)
+            // propagate error
+            return res;
+    }
+
+    // the rebuilt file must match the file the patch was made from
+    if (hash != new_file_hash)
+        return EResult::InvalidChecksum;
+
+    return EResult::Success;
+}
+
+}} // namespace bgcode
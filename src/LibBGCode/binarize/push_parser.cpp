@@ -0,0 +1,175 @@
+#include "binarize_impl.hpp"
+
+namespace bgcode {
+
+using namespace core;
+
+namespace binarize {
+
+// size of the block header fields always present (type, compression, uncompressed_size)
+static constexpr const size_t BLOCK_HEADER_BASE_SIZE = 2 * sizeof(uint16_t) + sizeof(uint32_t);
+
+PushParser::PushParser(Events events)
+  : m_events(std::move(events))
+{
+    reset();
+}
+
+void PushParser::reset()
+{
+    m_state = EState::FileHeader;
+    m_error = EResult::Success;
+    m_previous_type.reset();
+    m_buffer.clear();
+    m_required_size = m_file_header.get_size();
+    m_payload.clear();
+    m_block_position = 0;
+    m_position = 0;
+    m_blocks_count = 0;
+}
+
+EResult PushParser::feed(const std::byte* data, size_t size)
+{
+    if (m_state == EState::Error)
+        return m_error;
+
+    while (size > 0) {
+        const size_t size_to_copy = std::min(size, m_required_size - m_buffer.size());
+        m_buffer.insert(m_buffer.end(), data, data + size_to_copy);
+        data += size_to_copy;
+        size -= size_to_copy;
+        m_position += size_to_copy;
+
+        if (m_buffer.size() == m_required_size) {
+            const EResult res = process();
+            if (res != EResult::Success) {
+                m_state = EState::Error;
+                m_error = res;
+                return res;
+            }
+        }
+    }
+
+    return EResult::Success;
+}
+
+EResult PushParser::finish()
+{
+    if (m_state == EState::Error)
+        return m_error;
+    if (m_state != EState::BlockHeader || !m_buffer.empty())
+        return EResult::InvalidBinaryGCodeFile;
+    if (m_previous_type != EBlockType::GCode)
+        return EResult::InvalidSequenceOfBlocks;
+    return EResult::Success;
+}
+
+EResult PushParser::process()
+{
+    switch (m_state)
+    {
+    case EState::FileHeader:
+    {
+        auto it = m_buffer.begin();
+        m_file_header.magic = load_integer<uint32_t>(it, it + sizeof(m_file_header.magic));
+        it += sizeof(m_file_header.magic);
+        m_file_header.version = load_integer<uint32_t>(it, it + sizeof(m_file_header.version));
+        it += sizeof(m_file_header.version);
+        m_file_header.checksum_type = load_integer<uint16_t>(it, it + sizeof(m_file_header.checksum_type));
+        if (m_file_header.magic != MAGICi32)
+            return EResult::InvalidMagicNumber;
+        if (m_file_header.version > VERSION)
+            return EResult::InvalidVersionNumber;
+        if (m_file_header.checksum_type >= checksum_types_count())
+            return EResult::InvalidChecksumType;
+
+        if (m_events.file_header)
+            m_events.file_header(m_file_header);
+        m_state = EState::BlockHeader;
+        m_required_size = BLOCK_HEADER_BASE_SIZE;
+        break;
+    }
+    case EState::BlockHeader:
+    {
+        auto it = m_buffer.begin();
+        m_block_header.type = load_integer<uint16_t>(it, it + sizeof(m_block_header.type));
+        it += sizeof(m_block_header.type);
+        m_block_header.compression = load_integer<uint16_t>(it, it + sizeof(m_block_header.compression));
+        it += sizeof(m_block_header.compression);
+        m_block_header.uncompressed_size = load_integer<uint32_t>(it, it + sizeof(m_block_header.uncompressed_size));
+        it += sizeof(m_block_header.uncompressed_size);
+        if (m_block_header.type >= block_types_count())
+            return EResult::InvalidBlockType;
+        if (m_block_header.compression >= compression_types_count())
+            return EResult::InvalidCompressionType;
+        if (!is_valid_block_sequence(m_previous_type, (EBlockType)m_block_header.type))
+            return EResult::InvalidSequenceOfBlocks;
+
+        if (m_block_header.get_size() > m_buffer.size()) {
+            // wait for compressed_size
+            m_required_size = m_block_header.get_size();
+            return EResult::Success;
+        }
+        if (m_block_header.compression != (uint16_t)ECompressionType::None)
+            m_block_header.compressed_size = load_integer<uint32_t>(it, it + sizeof(m_block_header.compressed_size));
+        else
+            // not stored, reset the size of the previous block
+            m_block_header.compressed_size = 0;
+
+        m_block_position = m_position - m_buffer.size();
+        m_state = EState::Payload;
+        m_required_size = block_payload_size(m_block_header);
+        break;
+    }
+    case EState::Payload:
+    {
+        m_payload.swap(m_buffer);
+        m_state = EState::Checksum;
+        m_required_size = checksum_size((EChecksumType)m_file_header.checksum_type);
+        break;
+    }
+    case EState::Checksum:
+    {
+        const EChecksumType checksum_type = (EChecksumType)m_file_header.checksum_type;
+        if (checksum_type != EChecksumType::None) {
+            Checksum cs(checksum_type);
+            update_checksum(cs, m_block_header);
+            cs.append(m_payload);
+            if (!cs.matches(m_buffer.data(), m_buffer.size()))
+                return EResult::InvalidChecksum;
+            if (m_events.checksum_ok)
+                m_events.checksum_ok(m_block_header, m_block_position);
+        }
+
+        const EBlockType type = (EBlockType)m_block_header.type;
+        if (m_events.block)
+            m_events.block(m_block_header, m_block_position, m_payload);
+        // metadata blocks are always decoded, to validate them
+        if (type != EBlockType::GCode && type != EBlockType::Thumbnail) {
+            BaseMetadataBlock metadata;
+            const EResult res = metadata.read_data(m_block_header, m_payload.data(), m_payload.size());
+            if (res != EResult::Success)
+                // propagate error
+                return res;
+            if (m_events.metadata)
+                m_events.metadata(type, metadata);
+        }
+
+        m_previous_type = type;
+        ++m_blocks_count;
+        m_state = EState::BlockHeader;
+        m_required_size = BLOCK_HEADER_BASE_SIZE;
+        break;
+    }
+    case EState::Error:
+    {
+        return m_error;
+    }
+    }
+
+    m_buffer.clear();
+    // states without bytes (empty payload, no checksum) are processed immediately
+    return (m_required_size == 0) ? process() : EResult::Success;
+}
+
+}} // namespace bgcode
@@ -0,0 +1,539 @@
+#include "binarize_impl.hpp"
+#include "meatpack.hpp"
+
+extern "C" {
+#include <heatshrink/heatshrink_decoder.h>
+}
+
+#include <zlib.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <sys/stat.h>
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif // NOMINMAX
+#include <windows.h>
+#else
+#include <cerrno>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif // _WIN32
+
+namespace bgcode {
+
+using namespace core;
+
+namespace binarize {
+
+// Streaming decompressor of the data of a block.
+// The decompressed data are passed to the sink in pieces of at most chunk_size bytes,
+// and are never allowed to grow past the uncompressed size declared into the block header.
+class StreamDecompressor
+{
+public:
+    using Sink = std::function<void(const uint8_t* data, size_t size)>;
+
+    StreamDecompressor(ECompressionType type, size_t uncompressed_size, size_t chunk_size, Sink sink)
+      : m_type(type), m_uncompressed_size(uncompressed_size), m_buffer(chunk_size), m_sink(std::move(sink))
+    {}
+
+    ~StreamDecompressor()
+    {
+        if (m_inflate_initialized)
+            inflateEnd(&m_strm);
+        if (m_decoder != nullptr)
+            heatshrink_decoder_free(m_decoder);
+    }
+
+    bool init()
+    {
+        switch (m_type)
+        {
+        case ECompressionType::Deflate:
+        {
+            m_inflate_initialized = inflateInit(&m_strm) == Z_OK;
+            return m_inflate_initialized;
+        }
+        case ECompressionType::Heatshrink_11_4:
+        case ECompressionType::Heatshrink_12_4:
+        {
+            const uint8_t window_sz = (m_type == ECompressionType::Heatshrink_11_4) ? 11 : 12;
+            m_decoder = heatshrink_decoder_alloc(2048, window_sz, 4);
+            return m_decoder != nullptr;
+        }
+        case ECompressionType::None:
+        default:
+        {
+            return true;
+        }
+        }
+    }
+
+    bool push(const uint8_t* data, size_t size)
+    {
+        switch (m_type)
+        {
+        case ECompressionType::Deflate:
+        {
+            if (m_stream_end)
+                return size == 0;
+            m_strm.next_in = const_cast<uint8_t*>(data);
+            m_strm.avail_in = (uInt)size;
+            do {
+                m_strm.next_out = m_buffer.data();
+                m_strm.avail_out = (uInt)m_buffer.size();
+                const int res = inflate(&m_strm, Z_NO_FLUSH);
+                if (res != Z_OK && res != Z_STREAM_END && res != Z_BUF_ERROR)
+                    return false;
+                if (!output(m_buffer.size() - m_strm.avail_out))
+                    return false;
+                m_stream_end = res == Z_STREAM_END;
+            } while (!m_stream_end && m_strm.avail_out == 0);
+            return true;
+        }
+        case ECompressionType::Heatshrink_11_4:
+        case ECompressionType::Heatshrink_12_4:
+        {
+            size_t sunk = 0;
+            while (sunk < size) {
+                size_t count = 0;
+                if (heatshrink_decoder_sink(m_decoder, const_cast<uint8_t*>(data) + sunk, size - sunk, &count) < 0)
+                    return false;
+                sunk += count;
+                if (!poll())
+                    return false;
+            }
+            return true;
+        }
+        case ECompressionType::None:
+        default:
+        {
+            m_sink(data, size);
+            return true;
+        }
+        }
+    }
+
+    bool finish()
+    {
+        switch (m_type)
+        {
+        case ECompressionType::Deflate:
+        {
+            return m_stream_end;
+        }
+        case ECompressionType::Heatshrink_11_4:
+        case ECompressionType::Heatshrink_12_4:
+        {
+            HSD_finish_res res = heatshrink_decoder_finish(m_decoder);
+            while (res == HSDR_FINISH_MORE) {
+                if (!poll())
+                    return false;
+                res = heatshrink_decoder_finish(m_decoder);
+            }
+            return res == HSDR_FINISH_DONE;
+        }
+        case ECompressionType::None:
+        default:
+        {
+            return true;
+        }
+        }
+    }
+
+private:
+    ECompressionType m_type;
+    size_t m_uncompressed_size;
+    size_t m_output_size{ 0 };
+    std::vector<uint8_t> m_buffer;
+    Sink m_sink;
+    z_stream m_strm{};
+    bool m_inflate_initialized{ false };
+    bool m_stream_end{ false };
+    heatshrink_decoder* m_decoder{ nullptr };
+
+    bool output(size_t size)
+    {
+        m_output_size += size;
+        if (m_output_size > m_uncompressed_size)
+            return false;
+        if (size > 0)
+            m_sink(m_buffer.data(), size);
+        return true;
+    }
+
+    bool poll()
+    {
+        HSD_poll_res res;
+        do {
+            size_t count = 0;
+            res = heatshrink_decoder_poll(m_decoder, m_buffer.data(), m_buffer.size(), &count);
+            if (res < 0 || !output(count))
+                return false;
+        } while (res == HSDR_POLL_MORE);
+        return true;
+    }
+};
+
+Reader::~Reader()
+{
+#ifdef _WIN32
+    if (m_handle != nullptr)
+        CloseHandle((HANDLE)m_handle);
+#endif // _WIN32
+}
+
+bool Reader::read_at(size_t position, void* data, size_t size) const
+{
+    char* dst = static_cast<char*>(data);
+    while (size > 0) {
+#ifdef _WIN32
+        // the private handle is opened for overlapped I/O, so that the offset into OVERLAPPED is used
+        // and no file pointer is moved. Each read waits for its own event, to be safe when called concurrently
+        OVERLAPPED overlapped{};
+        overlapped.Offset = (DWORD)((uint64_t)position & 0xFFFFFFFF);
+        overlapped.OffsetHigh = (DWORD)((uint64_t)position >> 32);
+        overlapped.hEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+        if (overlapped.hEvent == nullptr)
+            return false;
+        DWORD rsize = 0;
+        const DWORD size_to_read = (DWORD)std::min<size_t>(size, 1 << 30);
+        bool ok = ReadFile((HANDLE)m_handle, dst, size_to_read, nullptr, &overlapped) || GetLastError() == ERROR_IO_PENDING;
+        ok = ok && GetOverlappedResult((HANDLE)m_handle, &overlapped, &rsize, TRUE);
+        CloseHandle(overlapped.hEvent);
+        if (!ok || rsize == 0)
+            return false;
+#else
+        const ssize_t rsize = pread(m_fd, dst, size, (off_t)position);
+        if (rsize < 0 && errno == EINTR)
+            continue;
+        if (rsize <= 0)
+            return false;
+#endif // _WIN32
+        dst += rsize;
+        position += (size_t)rsize;
+        size -= (size_t)rsize;
+    }
+    return true;
+}
+
+EResult Reader::open(FILE& file, bool verify_checksum)
+{
+    m_blocks.clear();
+#ifdef _WIN32
+    // reads through the handle of the given file would move its file pointer,
+    // a private handle is opened on the same file instead
+    if (m_handle != nullptr) {
+        CloseHandle((HANDLE)m_handle);
+        m_handle = nullptr;
+    }
+    const int fd = _fileno(&file);
+    struct _stat64 st;
+    if (fd < 0 || _fstat64(fd, &st) != 0)
+        return EResult::ReadError;
+    const HANDLE handle = ReOpenFile((HANDLE)_get_osfhandle(fd), GENERIC_READ,
+        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, FILE_FLAG_OVERLAPPED);
+    if (handle == INVALID_HANDLE_VALUE)
+        return EResult::ReadError;
+    m_handle = (void*)handle;
+#else
+    m_fd = fileno(&file);
+    struct stat st;
+    if (m_fd < 0 || fstat(m_fd, &st) != 0)
+        return EResult::ReadError;
+#endif // _WIN32
+    m_file_size = (size_t)st.st_size;
+    m_verify_checksum = verify_checksum;
+
+    // read file header
+    std::array<std::byte, 12> buffer;
+    const size_t file_header_size = m_file_header.get_size();
+    if (!read_at(0, buffer.data(), file_header_size))
+        return EResult::ReadError;
+    auto it = buffer.begin();
+    m_file_header.magic = load_integer<uint32_t>(it, it + sizeof(m_file_header.magic));
+    it += sizeof(m_file_header.magic);
+    m_file_header.version = load_integer<uint32_t>(it, it + sizeof(m_file_header.version));
+    it += sizeof(m_file_header.version);
+    m_file_header.checksum_type = load_integer<uint16_t>(it, it + sizeof(m_file_header.checksum_type));
+    if (m_file_header.magic != MAGICi32)
+        return EResult::InvalidMagicNumber;
+    if (m_file_header.checksum_type >= checksum_types_count())
+        return EResult::InvalidChecksumType;
+
+    // read block headers
+    size_t position = file_header_size;
+    while (position < m_file_size) {
+        Block block;
+        block.position = position;
+        BlockHeader& header = block.header;
+        static constexpr const size_t base_size = sizeof(header.type) + sizeof(header.compression) + sizeof(header.uncompressed_size);
+        if (!read_at(position, buffer.data(), base_size))
+            return EResult::ReadError;
+        it = buffer.begin();
+        header.type = load_integer<uint16_t>(it, it + sizeof(header.type));
+        it += sizeof(header.type);
+        header.compression = load_integer<uint16_t>(it, it + sizeof(header.compression));
+        it += sizeof(header.compression);
+        header.uncompressed_size = load_integer<uint32_t>(it, it + sizeof(header.uncompressed_size));
+        if (header.type >= block_types_count())
+            return EResult::InvalidBlockType;
+        if (header.compression >= compression_types_count())
+            return EResult::InvalidCompressionType;
+        if (header.compression != (uint16_t)ECompressionType::None) {
+            if (!read_at(position + base_size, buffer.data(), sizeof(header.compressed_size)))
+                return EResult::ReadError;
+            header.compressed_size = load_integer<uint32_t>(buffer.begin(), buffer.begin() + sizeof(header.compressed_size));
+        }
+
+        position += header.get_size() + block_content_size(m_file_header, header);
+        if (position > m_file_size)
+            return EResult::InvalidBinaryGCodeFile;
+        m_blocks.push_back(block);
+    }
+
+    return EResult::Success;
+}
+
+int Reader::find_block(EBlockType type) const
+{
+    for (size_t i = 0; i < m_blocks.size(); ++i) {
+        if ((EBlockType)m_blocks[i].header.type == type)
+            return (int)i;
+    }
+    return -1;
+}
+
+bool Reader::fits_memory_limits(size_t block_id) const
+{
+    const BlockHeader& header = m_blocks[block_id].header;
+    if (m_limits.max_block_size > 0 && block_payload_size(header) > m_limits.max_block_size)
+        return false;
+    if (m_limits.max_uncompressed_size > 0 && header.uncompressed_size > m_limits.max_uncompressed_size)
+        return false;
+    return true;
+}
+
+EResult Reader::read_block_payload(size_t block_id, std::vector<std::byte>& payload) const
+{
+    if (block_id >= m_blocks.size())
+        return EResult::BlockNotFound;
+
+    const Block& block = m_blocks[block_id];
+    if (m_limits.max_block_size > 0 && block_payload_size(block.header) > m_limits.max_block_size)
+        return EResult::MemoryLimitExceeded;
+    const size_t payload_position = block.position + block.header.get_size();
+    payload.resize(block_payload_size(block.header));
+    if (!read_at(payload_position, payload.data(), payload.size()))
+        return EResult::ReadError;
+
+    const EChecksumType checksum_type = (EChecksumType)m_file_header.checksum_type;
+    if (m_verify_checksum && checksum_type != EChecksumType::None) {
+        std::array<std::byte, MAX_CHECKSUM_SIZE> checksum;
+        const size_t size = checksum_size(checksum_type);
+        if (!read_at(payload_position + payload.size(), checksum.data(), size))
+            return EResult::ReadError;
+        Checksum cs(checksum_type);
+        update_checksum(cs, block.header);
+        cs.append(payload);
+        if (!cs.matches(checksum.data(), size))
+            return EResult::InvalidChecksum;
+    }
+    return EResult::Success;
+}
+
+EResult Reader::read_block(size_t block_id, BaseMetadataBlock& block) const
+{
+    if (block_id >= m_blocks.size())
+        return EResult::BlockNotFound;
+    const EBlockType type = (EBlockType)m_blocks[block_id].header.type;
+    if (type == EBlockType::GCode || type == EBlockType::Thumbnail)
+        return EResult::InvalidBlockType;
+
+    if (!fits_memory_limits(block_id))
+        return EResult::MemoryLimitExceeded;
+
+    std::vector<std::byte> payload;
+    const EResult res = read_block_payload(block_id, payload);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+    return block.read_data(m_blocks[block_id].header, payload.data(), payload.size());
+}
+
+EResult Reader::read_block(size_t block_id, ThumbnailBlock& block) const
+{
+    if (block_id >= m_blocks.size())
+        return EResult::BlockNotFound;
+    if ((EBlockType)m_blocks[block_id].header.type != EBlockType::Thumbnail)
+        return EResult::InvalidBlockType;
+
+    if (!fits_memory_limits(block_id))
+        return EResult::MemoryLimitExceeded;
+
+    std::vector<std::byte> payload;
+    const EResult res = read_block_payload(block_id, payload);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+    return block.read_data(m_blocks[block_id].header, payload.data(), payload.size());
+}
+
+EResult Reader::read_block(size_t block_id, GCodeBlock& block) const
+{
+    if (block_id >= m_blocks.size())
+        return EResult::BlockNotFound;
+    if ((EBlockType)m_blocks[block_id].header.type != EBlockType::GCode)
+        return EResult::InvalidBlockType;
+
+    if (!fits_memory_limits(block_id))
+        return EResult::MemoryLimitExceeded;
+
+    std::vector<std::byte> payload;
+    const EResult res = read_block_payload(block_id, payload);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+    block.raw_data.clear();
+    return block.read_data(m_blocks[block_id].header, payload.data(), payload.size());
+}
+
+EResult Reader::read_gcode_block_chunked(size_t block_id, const std::function<void(const std::string& gcode)>& callback,
+    size_t chunk_size) const
+{
+    if (block_id >= m_blocks.size())
+        return EResult::BlockNotFound;
+    const Block& block = m_blocks[block_id];
+    const BlockHeader& header = block.header;
+    if ((EBlockType)header.type != EBlockType::GCode)
+        return EResult::InvalidBlockType;
+    if (chunk_size == 0)
+        return EResult::InvalidBuffer;
+
+    size_t position = block.position + header.get_size();
+    const size_t payload_end = position + block_payload_size(header);
+    std::array<std::byte, sizeof(uint16_t)> parameters;
+    if (payload_end - position < parameters.size())
+        return EResult::InvalidBuffer;
+    if (!read_at(position, parameters.data(), parameters.size()))
+        return EResult::ReadError;
+    position += parameters.size();
+    const uint16_t encoding_type = load_integer<uint16_t>(parameters.begin(), parameters.end());
+    if (encoding_type > (uint16_t)EGCodeEncodingType::MeatPackComments)
+        return EResult::InvalidGCodeEncodingType;
+
+    const EChecksumType checksum_type = (EChecksumType)m_file_header.checksum_type;
+    const bool verify_checksum = m_verify_checksum && checksum_type != EChecksumType::None;
+    Checksum cs(checksum_type);
+    if (verify_checksum) {
+        update_checksum(cs, header);
+        cs.append(parameters.data(), parameters.size());
+    }
+
+    // decodes the decompressed data as they come, the MeatPack decoder keeps its state between the pieces
+    MeatPack::MPUnbinarizer unbinarizer;
+    std::string gcode;
+    auto decode = [&](const uint8_t* data, size_t size) {
+        gcode.clear();
+        if ((EGCodeEncodingType)encoding_type == EGCodeEncodingType::None)
+            gcode.assign(reinterpret_cast<const char*>(data), size);
+        else
+            unbinarizer.unbinarize(data, size, gcode);
+        if (!gcode.empty())
+            callback(gcode);
+    };
+
+    StreamDecompressor decompressor((ECompressionType)header.compression, header.uncompressed_size, chunk_size, decode);
+    if (!decompressor.init())
+        return EResult::DataUncompressionError;
+
+    std::vector<uint8_t> buffer(chunk_size);
+    while (position < payload_end) {
+        const size_t size = std::min(chunk_size, payload_end - position);
+        if (!read_at(position, buffer.data(), size))
+            return EResult::ReadError;
+        position += size;
+        if (verify_checksum)
+            cs.append(buffer.data(), size);
+        if (!decompressor.push(buffer.data(), size))
+            return EResult::DataUncompressionError;
+    }
+    if (!decompressor.finish())
+        return EResult::DataUncompressionError;
+
+    if (verify_checksum) {
+        std::array<std::byte, MAX_CHECKSUM_SIZE> checksum;
+        const size_t size = checksum_size(checksum_type);
+        if (!read_at(payload_end, checksum.data(), size))
+            return EResult::ReadError;
+        if (!cs.matches(checksum.data(), size))
+            return EResult::InvalidChecksum;
+    }
+    return EResult::Success;
+}
+
+EResult Reader::for_each_gcode_block(const std::function<void(size_t block_id, const std::string& gcode)>& callback) const
+{
+    struct Item
+    {
+        size_t block_id{ 0 };
+        GCodeBlock block;
+        EResult res{ EResult::Success };
+    };
+
+    // the buffers of the chunked decoding must fit into the in-flight budget too
+    static constexpr const size_t MIN_CHUNK_SIZE = 256;
+    size_t chunk_size = 65536;
+    if (m_limits.max_in_flight_size > 0)
+        chunk_size = std::max(MIN_CHUNK_SIZE, std::min(chunk_size, m_limits.max_in_flight_size / 4));
+
+    // without an in-flight limit, batches are capped as in scan_gcode_blocks()
+    const size_t max_batch_size = (m_limits.max_in_flight_size > 0) ? m_limits.max_in_flight_size : DEFAULT_SCAN_BATCH_SIZE;
+    std::vector<Item> batch;
+    size_t batch_size = 0;
+    auto process_batch = [&]() {
+        parallel_for(batch.size(), [&](size_t i) {
+            batch[i].res = read_block(batch[i].block_id, batch[i].block);
+        });
+        for (Item& item : batch) {
+            if (item.res != EResult::Success)
+                // propagate error
+                return item.res;
+            callback(item.block_id, item.block.raw_data);
+        }
+        batch.clear();
+        batch_size = 0;
+        return EResult::Success;
+    };
+
+    for (size_t i = 0; i < m_blocks.size(); ++i) {
+        const BlockHeader& header = m_blocks[i].header;
+        if ((EBlockType)header.type != EBlockType::GCode)
+            continue;
+
+        const size_t size = block_payload_size(header) + header.uncompressed_size;
+        const bool in_memory = fits_memory_limits(i) && (m_limits.max_in_flight_size == 0 || size <= m_limits.max_in_flight_size);
+        if (!batch.empty() && (!in_memory || batch_size + size > max_batch_size)) {
+            const EResult res = process_batch();
+            if (res != EResult::Success)
+                // propagate error
+                return res;
+        }
+
+        if (in_memory) {
+            batch.emplace_back().block_id = i;
+            batch_size += size;
+        }
+        else {
+            const EResult res = read_gcode_block_chunked(i, [&](const std::string& gcode) { callback(i, gcode); }, chunk_size);
+            if (res != EResult::Success)
+                // propagate error
+                return res;
+        }
+    }
+
+    return batch.empty() ? EResult::Success : process_batch();
+}
+
+}} // namespace bgcode
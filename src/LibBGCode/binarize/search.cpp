@@ -0,0 +1,149 @@
+#include "binarize_impl.hpp"
+
+#include <algorithm>
+
+namespace bgcode {
+
+using namespace core;
+
+namespace binarize {
+
+// Matcher of gcode lines against a set of patterns, rejecting most of the lines by their first character
+class LineMatcher
+{
+public:
+    explicit LineMatcher(const std::vector<std::string>& patterns)
+      : m_patterns(patterns)
+    {
+        for (const std::string& pattern : m_patterns) {
+            if (!pattern.empty())
+                m_first_chars[(unsigned char)pattern[0]] = true;
+        }
+    }
+
+    // Calls visitor(pattern_id) for each pattern matching the given line
+    template<class Fn>
+    void match(std::string_view line, Fn&& visitor) const
+    {
+        if (line.empty() || !m_first_chars[(unsigned char)line[0]])
+            return;
+        for (size_t i = 0; i < m_patterns.size(); ++i) {
+            const std::string& pattern = m_patterns[i];
+            if (pattern.empty() || line.size() < pattern.size() || line.compare(0, pattern.size(), pattern) != 0)
+                continue;
+            // "M60" must not match "M600"
+            if (is_digit(pattern.back()) && line.size() > pattern.size() && is_digit(line[pattern.size()]))
+                continue;
+            visitor(i);
+        }
+    }
+
+private:
+    const std::vector<std::string>& m_patterns;
+    std::array<bool, 256> m_first_chars{};
+
+    static bool is_digit(char c) { return c >= '0' && c <= '9'; }
+};
+
+struct BlockMatches
+{
+    // pattern id and match, with line relative to the block
+    std::vector<std::pair<size_t, GCodeMatch>> matches;
+    size_t lines_count{ 0 };
+};
+
+// Searches the given patterns, results[i] will contain the matches of patterns[i]
+static EResult search_patterns(FILE& file, const std::vector<std::string>& patterns, bool verify_checksum,
+    std::vector<std::vector<GCodeMatch>>& results)
+{
+    results.assign(patterns.size(), std::vector<GCodeMatch>());
+    const LineMatcher matcher(patterns);
+
+    auto scan = [&matcher](size_t block_id, const std::string& gcode, BlockMatches& result) {
+        size_t line_id = 0;
+        for_each_line(gcode, [&](std::string_view line, size_t offset) {
+            matcher.match(line, [&](size_t pattern_id) {
+                result.matches.push_back({ pattern_id, { { block_id, offset }, line_id, std::string(line) } });
+            });
+            ++line_id;
+        });
+        result.lines_count = line_id;
+    };
+
+    size_t first_line = 0;
+    auto merge = [&](size_t, const BlockHeader&, BlockMatches& result) {
+        for (auto& [pattern_id, match] : result.matches) {
+            match.line += first_line;
+            results[pattern_id].push_back(std::move(match));
+        }
+        first_line += result.lines_count;
+    };
+
+    return scan_gcode_blocks<BlockMatches>(file, verify_checksum, scan, merge);
+}
+
+// Collects into matches the lines found into any of the given lists, in file order
+static void join_matches(const std::vector<const std::vector<GCodeMatch>*>& lists, std::vector<GCodeMatch>& matches)
+{
+    matches.clear();
+    for (const std::vector<GCodeMatch>* list : lists) {
+        matches.insert(matches.end(), list->begin(), list->end());
+    }
+    // lines matching many patterns are returned once
+    std::stable_sort(matches.begin(), matches.end(), [](const GCodeMatch& a, const GCodeMatch& b) { return a.line < b.line; });
+    matches.erase(std::unique(matches.begin(), matches.end(), [](const GCodeMatch& a, const GCodeMatch& b) { return a.line == b.line; }),
+        matches.end());
+}
+
+BGCODE_BINARIZE_EXPORT EResult search_gcode(FILE& file, const std::vector<std::string>& patterns, std::vector<GCodeMatch>& matches,
+    bool verify_checksum)
+{
+    std::vector<std::vector<GCodeMatch>> results;
+    const EResult res = search_patterns(file, patterns, verify_checksum, results);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+
+    std::vector<const std::vector<GCodeMatch>*> lists;
+    for (const std::vector<GCodeMatch>& result : results) {
+        lists.push_back(&result);
+    }
+    join_matches(lists, matches);
+    return EResult::Success;
+}
+
+BGCODE_BINARIZE_EXPORT EResult search_gcode(FILE& file, GCodeIndex& index, const std::vector<std::string>& patterns,
+    std::vector<GCodeMatch>& matches, bool verify_checksum)
+{
+    EResult res = verify_gcode_index(file, index);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+
+    // only the patterns not searched before are searched into the file
+    std::vector<std::string> new_patterns;
+    for (const std::string& pattern : patterns) {
+        if (index.searches.find(pattern) == index.searches.end() &&
+            std::find(new_patterns.begin(), new_patterns.end(), pattern) == new_patterns.end())
+            new_patterns.push_back(pattern);
+    }
+    if (!new_patterns.empty()) {
+        std::vector<std::vector<GCodeMatch>> results;
+        res = search_patterns(file, new_patterns, verify_checksum, results);
+        if (res != EResult::Success)
+            // propagate error
+            return res;
+        for (size_t i = 0; i < new_patterns.size(); ++i) {
+            index.searches.emplace(new_patterns[i], std::move(results[i]));
+        }
+    }
+
+    std::vector<const std::vector<GCodeMatch>*> lists;
+    for (const std::string& pattern : patterns) {
+        lists.push_back(&index.searches[pattern]);
+    }
+    join_matches(lists, matches);
+    return EResult::Success;
+}
+
+}} // namespace bgcode
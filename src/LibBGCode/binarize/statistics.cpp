@@ -0,0 +1,420 @@
+#include "binarize_impl.hpp"
+
+#include <cmath>
+#include <limits>
+#include <unordered_map>
+
+namespace bgcode {
+
+using namespace core;
+
+namespace binarize {
+
+static constexpr const double PI = 3.14159265358979323846;
+
+// indices of the axes into the positions
+static constexpr const size_t X = 0;
+static constexpr const size_t Y = 1;
+static constexpr const size_t Z = 2;
+static constexpr const size_t E = 3;
+static constexpr const size_t AXES_COUNT = 4;
+
+struct Range
+{
+    double min{ std::numeric_limits<double>::max() };
+    double max{ std::numeric_limits<double>::lowest() };
+
+    bool empty() const { return min > max; }
+    void add(double value) {
+        min = std::min(min, value);
+        max = std::max(max, value);
+    }
+};
+
+// Parameters of G2/G3 moves
+struct Arc
+{
+    enum class EType : uint8_t
+    {
+        None,
+        CW,
+        CCW
+    };
+
+    EType type{ EType::None };
+    // center, relative to the start point
+    double i{ 0.0 };
+    double j{ 0.0 };
+};
+
+// Statistics accumulated for a feature
+struct FeatureSums
+{
+    double time{ 0.0 };
+    // length of the moves done at the feedrate active at the start of the block, unknown while the block is scanned
+    double entry_feedrate_length{ 0.0 };
+    double extrusion{ 0.0 };
+};
+
+struct Totals
+{
+    double extruded_length{ 0.0 };
+    double retracted_length{ 0.0 };
+    double extrusion_distance{ 0.0 };
+    double travel_distance{ 0.0 };
+};
+
+// Move whose length depends on the position at the start of the block (f.e. the first absolute move of the block)
+struct DeferredMove
+{
+    SymbolicPosition start;
+    SymbolicPosition end;
+    Arc arc;
+    // 0 for the feedrate active at the start of the block
+    double feedrate{ 0.0 };
+    // index into BlockStatistics::features, -1 for the feature active at the start of the block
+    int feature{ -1 };
+};
+
+// Statistics of a gcode block, assuming the given positioning modes at the start of the block
+struct BlockHypothesis
+{
+    bool absolute_xyz{ true };
+    bool absolute_e{ true };
+    SymbolicPosition position;
+    // [0] for the feature active at the start of the block, [i + 1] for BlockStatistics::features[i]
+    std::vector<FeatureSums> features;
+    Totals totals;
+    // bounding box of the extruding moves, split into known coordinates and offsets from the entry position
+    std::array<Range, 3> known_box;
+    std::array<Range, 3> offset_box;
+    std::vector<DeferredMove> deferred;
+};
+
+// Result of the scan of a gcode block, combined with the state at the start of the block once that is known.
+// The scan runs once for each combination of positioning modes (G90/G91, M82/M83) at the start of the block,
+// while positions are tracked as offsets from the unknown entry position, so that blocks are scanned in parallel.
+struct BlockStatistics
+{
+    // indexed by (absolute_xyz ? 1 : 0) | (absolute_e ? 2 : 0) at the start of the block
+    std::array<BlockHypothesis, 4> hypotheses;
+    // names of the features found into the block, from ;TYPE: comments
+    std::vector<std::string> features;
+    size_t moves_count{ 0 };
+    // first and last tool selected into the block, -1 if none
+    int first_tool{ -1 };
+    int last_tool{ -1 };
+    size_t tool_changes{ 0 };
+    // last feedrate set into the block, 0 if none
+    double feedrate{ 0.0 };
+    // last feature started into the block, -1 if none
+    int feature{ -1 };
+};
+
+static double move_length(const std::array<double, AXES_COUNT>& delta, const Arc& arc)
+{
+    if (arc.type == Arc::EType::None)
+        return std::sqrt(delta[X] * delta[X] + delta[Y] * delta[Y] + delta[Z] * delta[Z]);
+
+    // vectors from the center to the start and end points
+    const double x0 = -arc.i;
+    const double y0 = -arc.j;
+    const double x1 = delta[X] - arc.i;
+    const double y1 = delta[Y] - arc.j;
+    double angle = std::atan2(x0 * y1 - y0 * x1, x0 * x1 + y0 * y1);
+    if (arc.type == Arc::EType::CW)
+        angle = -angle;
+    // coincident start and end points make a full circle
+    if (angle <= 0.0)
+        angle += 2.0 * PI;
+    const double planar = std::sqrt(x0 * x0 + y0 * y0) * angle;
+    return std::sqrt(planar * planar + delta[Z] * delta[Z]);
+}
+
+static void add_move(const std::array<double, AXES_COUNT>& delta, const Arc& arc, double feedrate, FeatureSums& feature, Totals& totals)
+{
+    double length = move_length(delta, arc);
+    if (delta[E] > 0.0) {
+        totals.extruded_length += delta[E];
+        totals.extrusion_distance += length;
+        feature.extrusion += delta[E];
+    }
+    else {
+        totals.retracted_length -= delta[E];
+        totals.travel_distance += length;
+    }
+
+    // extruder only moves (retractions) take the time to move the filament
+    if (length == 0.0)
+        length = std::abs(delta[E]);
+    if (feedrate > 0.0)
+        feature.time += length * 60.0 / feedrate;
+    else
+        feature.entry_feedrate_length += length;
+}
+
+static void apply_move(BlockHypothesis& hypothesis, const GCodeWords& words, const Arc& arc, double feedrate, int feature)
+{
+    static constexpr const std::array<char, AXES_COUNT> letters = { 'X', 'Y', 'Z', 'E' };
+    const SymbolicPosition& start = hypothesis.position;
+    SymbolicPosition end = start;
+    for (size_t a = 0; a < AXES_COUNT; ++a) {
+        if (!words.has(letters[a]))
+            continue;
+        const bool absolute = (a == E) ? hypothesis.absolute_e : hypothesis.absolute_xyz;
+        end[a] = absolute ? SymbolicValue{ true, words.get(letters[a]) } : SymbolicValue{ start[a].known, start[a].value + words.get(letters[a]) };
+    }
+
+    // the length is known if start and end are both known or both relative to the entry position
+    std::array<double, AXES_COUNT> delta;
+    for (size_t a = 0; a < AXES_COUNT; ++a) {
+        if (start[a].known != end[a].known) {
+            hypothesis.deferred.push_back({ start, end, arc, feedrate, feature });
+            hypothesis.position = end;
+            return;
+        }
+        delta[a] = end[a].value - start[a].value;
+    }
+
+    add_move(delta, arc, feedrate, hypothesis.features[feature + 1], hypothesis.totals);
+    if (delta[E] > 0.0) {
+        for (size_t a = X; a <= Z; ++a) {
+            for (const SymbolicValue& v : { start[a], end[a] }) {
+                if (v.known)
+                    hypothesis.known_box[a].add(v.value);
+                else
+                    hypothesis.offset_box[a].add(v.value);
+            }
+        }
+    }
+    hypothesis.position = end;
+}
+
+static void scan_block(size_t, const std::string& gcode, BlockStatistics& result)
+{
+    for (size_t h = 0; h < result.hypotheses.size(); ++h) {
+        BlockHypothesis& hypothesis = result.hypotheses[h];
+        hypothesis.absolute_xyz = (h & 1) != 0;
+        hypothesis.absolute_e = (h & 2) != 0;
+        hypothesis.features.resize(1);
+    }
+
+    GCodeWords words;
+    for_each_line(gcode, [&](std::string_view line, size_t) {
+        if (line.empty())
+            return;
+
+        if (line[0] == ';') {
+            if (line.compare(0, 6, ";TYPE:") == 0) {
+                std::string_view name = line.substr(6);
+                if (!name.empty() && name.back() == '\r')
+                    name.remove_suffix(1);
+                result.features.emplace_back(name);
+                result.feature = (int)result.features.size() - 1;
+                for (BlockHypothesis& hypothesis : result.hypotheses) {
+                    hypothesis.features.emplace_back();
+                }
+            }
+            return;
+        }
+
+        int code;
+        const char* words_begin = parse_command_code(line, code);
+        if (words_begin == nullptr)
+            return;
+
+        const char* line_end = line.data() + line.size();
+        if (line[0] == 'G') {
+            switch (code)
+            {
+            case 0:
+            case 1:
+            case 2:
+            case 3:
+            {
+                parse_words(words_begin, line_end, words);
+                if (words.has('F'))
+                    result.feedrate = words.get('F');
+                Arc arc;
+                if (code >= 2 && (words.has('I') || words.has('J'))) {
+                    arc.type = (code == 2) ? Arc::EType::CW : Arc::EType::CCW;
+                    arc.i = words.has('I') ? words.get('I') : 0.0;
+                    arc.j = words.has('J') ? words.get('J') : 0.0;
+                }
+                for (BlockHypothesis& hypothesis : result.hypotheses) {
+                    apply_move(hypothesis, words, arc, result.feedrate, result.feature);
+                }
+                ++result.moves_count;
+                break;
+            }
+            case 4:
+            {
+                parse_words(words_begin, line_end, words);
+                const double time = words.has('P') ? words.get('P') * 0.001 : words.has('S') ? words.get('S') : 0.0;
+                for (BlockHypothesis& hypothesis : result.hypotheses) {
+                    hypothesis.features[result.feature + 1].time += time;
+                }
+                break;
+            }
+            case 28:
+            case 92:
+            {
+                // homing zeroes the given axes (all if none), G92 sets them
+                parse_words(words_begin, line_end, words);
+                const bool all = (words.letters & ((1u << ('X' - 'A')) | (1u << ('Y' - 'A')) | (1u << ('Z' - 'A')) | (1u << ('E' - 'A')))) == 0;
+                const std::string_view axes = (code == 28) ? "XYZ" : "XYZE";
+                for (BlockHypothesis& hypothesis : result.hypotheses) {
+                    for (size_t a = 0; a < axes.size(); ++a) {
+                        if (all || words.has(axes[a]))
+                            hypothesis.position[a] = { true, (code == 92 && !all) ? words.get(axes[a]) : 0.0 };
+                    }
+                }
+                break;
+            }
+            case 90:
+            case 91:
+            {
+                for (BlockHypothesis& hypothesis : result.hypotheses) {
+                    hypothesis.absolute_xyz = code == 90;
+                    hypothesis.absolute_e = code == 90;
+                }
+                break;
+            }
+            default:
+            {
+                break;
+            }
+            }
+        }
+        else if (line[0] == 'M' && (code == 82 || code == 83)) {
+            for (BlockHypothesis& hypothesis : result.hypotheses) {
+                hypothesis.absolute_e = code == 82;
+            }
+        }
+        else if (line[0] == 'T') {
+            if (result.first_tool < 0)
+                result.first_tool = code;
+            else if (code != result.last_tool)
+                ++result.tool_changes;
+            result.last_tool = code;
+        }
+    });
+}
+
+BGCODE_BINARIZE_EXPORT EResult compute_print_statistics(FILE& file, PrintStatistics& stats, bool verify_checksum)
+{
+    PrintStatistics new_stats;
+    std::unordered_map<std::string, size_t> features_map;
+    auto feature_index = [&](const std::string& name) {
+        auto [it, inserted] = features_map.emplace(name, new_stats.features.size());
+        if (inserted)
+            new_stats.features.push_back({ name });
+        return it->second;
+    };
+
+    // state at the start of the current block, the printer defaults to absolute positioning
+    bool absolute_xyz = true;
+    bool absolute_e = true;
+    std::array<double, AXES_COUNT> position = { 0.0, 0.0, 0.0, 0.0 };
+    double feedrate = 0.0;
+    size_t feature = feature_index(std::string());
+    int tool = -1;
+    std::array<Range, 3> box;
+
+    auto add_sums = [&](size_t id, const FeatureSums& sums) {
+        PrintStatistics::Feature& f = new_stats.features[id];
+        f.time += sums.time;
+        if (feedrate > 0.0)
+            f.time += sums.entry_feedrate_length * 60.0 / feedrate;
+        f.extrusion += sums.extrusion;
+    };
+    auto add_totals = [&](const Totals& totals) {
+        new_stats.extruded_length += totals.extruded_length;
+        new_stats.retracted_length += totals.retracted_length;
+        new_stats.extrusion_distance += totals.extrusion_distance;
+        new_stats.travel_distance += totals.travel_distance;
+    };
+
+    auto merge = [&](size_t, const BlockHeader&, const BlockStatistics& result) {
+        const BlockHypothesis& hypothesis = result.hypotheses[(absolute_xyz ? 1 : 0) | (absolute_e ? 2 : 0)];
+
+        std::vector<size_t> block_features(hypothesis.features.size());
+        block_features[0] = feature;
+        for (size_t i = 0; i < result.features.size(); ++i) {
+            block_features[i + 1] = feature_index(result.features[i]);
+        }
+        for (size_t i = 0; i < hypothesis.features.size(); ++i) {
+            add_sums(block_features[i], hypothesis.features[i]);
+        }
+        add_totals(hypothesis.totals);
+
+        for (const DeferredMove& move : hypothesis.deferred) {
+            std::array<double, AXES_COUNT> delta;
+            for (size_t a = 0; a < AXES_COUNT; ++a) {
+                delta[a] = move.end[a].resolve(position[a]) - move.start[a].resolve(position[a]);
+            }
+            FeatureSums sums;
+            Totals totals;
+            add_move(delta, move.arc, move.feedrate, sums, totals);
+            add_sums(block_features[move.feature + 1], sums);
+            add_totals(totals);
+            if (delta[E] > 0.0) {
+                for (size_t a = X; a <= Z; ++a) {
+                    box[a].add(move.start[a].resolve(position[a]));
+                    box[a].add(move.end[a].resolve(position[a]));
+                }
+            }
+        }
+
+        for (size_t a = X; a <= Z; ++a) {
+            if (!hypothesis.known_box[a].empty()) {
+                box[a].add(hypothesis.known_box[a].min);
+                box[a].add(hypothesis.known_box[a].max);
+            }
+            if (!hypothesis.offset_box[a].empty()) {
+                box[a].add(position[a] + hypothesis.offset_box[a].min);
+                box[a].add(position[a] + hypothesis.offset_box[a].max);
+            }
+        }
+
+        if (result.first_tool >= 0) {
+            if (tool >= 0 && result.first_tool != tool)
+                ++new_stats.tool_changes;
+            new_stats.tool_changes += result.tool_changes;
+            tool = result.last_tool;
+        }
+        new_stats.moves_count += result.moves_count;
+
+        // state at the end of the block
+        absolute_xyz = hypothesis.absolute_xyz;
+        absolute_e = hypothesis.absolute_e;
+        for (size_t a = 0; a < AXES_COUNT; ++a) {
+            position[a] = hypothesis.position[a].resolve(position[a]);
+        }
+        if (result.feedrate > 0.0)
+            feedrate = result.feedrate;
+        if (result.feature >= 0)
+            feature = block_features[result.feature + 1];
+    };
+
+    const EResult res = scan_gcode_blocks<BlockStatistics>(file, verify_checksum, scan_block, merge);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+
+    // gcode preceding the first feature, if it is not empty
+    if (new_stats.features[0].time == 0.0 && new_stats.features[0].extrusion == 0.0)
+        new_stats.features.erase(new_stats.features.begin());
+    for (const PrintStatistics::Feature& f : new_stats.features) {
+        new_stats.time += f.time;
+    }
+    if (!box[X].empty() && !box[Y].empty() && !box[Z].empty()) {
+        new_stats.min = { box[X].min, box[Y].min, box[Z].min };
+        new_stats.max = { box[X].max, box[Y].max, box[Z].max };
+    }
+
+    stats = std::move(new_stats);
+    return EResult::Success;
+}
+
+}} // namespace bgcode
@@ -0,0 +1,353 @@
+#include "binarize_impl.hpp"
+
+#include <cmath>
+#include <unordered_map>
+
+namespace bgcode {
+
+using namespace core;
+
+namespace binarize {
+
+static constexpr const double PI = 3.14159265358979323846;
+// max angle of the segments approximating G2/G3 arcs
+static constexpr const double ARC_STEP = PI / 36.0;
+
+// indices of the axes into the positions
+static constexpr const size_t X = 0;
+static constexpr const size_t Y = 1;
+static constexpr const size_t Z = 2;
+static constexpr const size_t E = 3;
+
+// Positioning modes assumed at the start of the blocks scanned in parallel (the ones used by PrusaSlicer).
+// Blocks whose toolpath depends on them are scanned again, if the actual modes differ.
+static constexpr const bool DEFAULT_ABSOLUTE_XYZ = true;
+static constexpr const bool DEFAULT_ABSOLUTE_E = false;
+
+// Toolpath of a gcode block
+struct BlockToolpath
+{
+    // points, the coordinates of the first entry_relative[axis] points are relative to the entry position
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+    std::vector<float> e;
+    // 0 for the feature active at the start of the block, i + 1 for features[i]
+    std::vector<uint16_t> feature;
+    // count of layer changes found into the block before the point
+    std::vector<uint32_t> layer;
+    std::vector<uint32_t> polylines;
+    std::array<size_t, 3> entry_relative{ 0, 0, 0 };
+    // names of the features found into the block, from ;TYPE: comments
+    std::vector<std::string> features;
+
+    // true if the first polyline starts at the entry position, with nothing breaking it before
+    bool continues_polyline{ false };
+    // true if the polyline open at the start of the block (if any) has been closed
+    bool broken{ false };
+    // true if the last polyline is still open at the end of the block
+    bool open{ false };
+
+    // state at the end of the block
+    bool absolute_xyz{ DEFAULT_ABSOLUTE_XYZ };
+    bool absolute_e{ DEFAULT_ABSOLUTE_E };
+    SymbolicPosition position;
+    uint16_t last_feature{ 0 };
+    uint32_t layers_count{ 0 };
+
+    // true if the toolpath depends on the positioning modes at the start of the block
+    bool depends_on_modes{ false };
+    // true if the toolpath depends on the position at the start of the block in ways not tracked by entry_relative
+    bool needs_rescan{ false };
+    // decoded gcode, kept for blocks which may have to be scanned again
+    std::string gcode;
+};
+
+static void add_point(BlockToolpath& result, const SymbolicPosition& p, double e, float min_segment_length)
+{
+    const size_t id = result.x.size();
+    // decimation, the last point of the polyline is moved when the segment ending at it would be too short
+    if (min_segment_length > 0.0f && id >= 2 && result.polylines.back() + 2 <= id) {
+        bool same_frame = true;
+        std::array<double, 3> delta;
+        const std::array<const std::vector<float>*, 3> coords = { &result.x, &result.y, &result.z };
+        for (size_t a = X; a <= Z; ++a) {
+            // coordinates must be all known or all relative to the entry position
+            const bool relative = !p[a].known;
+            if ((id - 2 < result.entry_relative[a]) != relative || (id - 1 < result.entry_relative[a]) != relative) {
+                same_frame = false;
+                break;
+            }
+            delta[a] = p[a].value - (*coords[a])[id - 2];
+        }
+        if (same_frame && delta[X] * delta[X] + delta[Y] * delta[Y] + delta[Z] * delta[Z] < (double)min_segment_length * (double)min_segment_length) {
+            result.x[id - 1] = (float)p[X].value;
+            result.y[id - 1] = (float)p[Y].value;
+            result.z[id - 1] = (float)p[Z].value;
+            result.e[id - 1] += (float)e;
+            return;
+        }
+    }
+
+    // once known, a coordinate never becomes relative again, so the relative ones are always the first ones
+    for (size_t a = X; a <= Z; ++a) {
+        if (!p[a].known)
+            result.entry_relative[a] = id + 1;
+    }
+    result.x.push_back((float)p[X].value);
+    result.y.push_back((float)p[Y].value);
+    result.z.push_back((float)p[Z].value);
+    result.e.push_back((float)e);
+    result.feature.push_back(result.last_feature);
+    result.layer.push_back(result.layers_count);
+}
+
+// Scans the given gcode block, starting with the given positioning modes.
+// If entry_position is nullptr, the position at the start of the block is unknown, and the toolpath is relative to it.
+static void scan_block(const std::string& gcode, bool absolute_xyz, bool absolute_e, const std::array<double, 4>* entry_position,
+    float min_segment_length, BlockToolpath& result)
+{
+    static constexpr const std::array<char, 4> letters = { 'X', 'Y', 'Z', 'E' };
+
+    result.absolute_xyz = absolute_xyz;
+    result.absolute_e = absolute_e;
+    if (entry_position != nullptr) {
+        for (size_t a = X; a <= E; ++a) {
+            result.position[a] = { true, (*entry_position)[a] };
+        }
+    }
+
+    bool xyz_mode_set = false;
+    bool e_mode_set = false;
+    auto close_polyline = [&]() {
+        result.open = false;
+        result.broken = true;
+    };
+
+    GCodeWords words;
+    for_each_line(gcode, [&](std::string_view line, size_t) {
+        if (line.empty() || result.needs_rescan)
+            return;
+
+        if (line[0] == ';') {
+            if (line.compare(0, 6, ";TYPE:") == 0) {
+                std::string_view name = line.substr(6);
+                if (!name.empty() && name.back() == '\r')
+                    name.remove_suffix(1);
+                result.features.emplace_back(name);
+                result.last_feature = (uint16_t)result.features.size();
+                close_polyline();
+            }
+            else if (line.compare(0, 13, ";LAYER_CHANGE") == 0) {
+                ++result.layers_count;
+                close_polyline();
+            }
+            return;
+        }
+
+        int code;
+        const char* words_begin = parse_command_code(line, code);
+        if (words_begin == nullptr)
+            return;
+
+        const char* line_end = line.data() + line.size();
+        if (line[0] == 'G') {
+            switch (code)
+            {
+            case 0:
+            case 1:
+            case 2:
+            case 3:
+            {
+                parse_words(words_begin, line_end, words);
+                const SymbolicPosition start = result.position;
+                SymbolicPosition end = start;
+                for (size_t a = X; a <= E; ++a) {
+                    if (!words.has(letters[a]))
+                        continue;
+                    const bool absolute = (a == E) ? result.absolute_e : result.absolute_xyz;
+                    end[a] = absolute ? SymbolicValue{ true, words.get(letters[a]) } :
+                        SymbolicValue{ start[a].known, start[a].value + words.get(letters[a]) };
+                    if (!((a == E) ? e_mode_set : xyz_mode_set))
+                        result.depends_on_modes = true;
+                }
+
+                // the extrusion decides between extrusion and travel, it must be known
+                const bool arc = code >= 2 && (words.has('I') || words.has('J'));
+                if (start[E].known != end[E].known || (arc && (start[X].known != end[X].known || start[Y].known != end[Y].known))) {
+                    result.needs_rescan = true;
+                    return;
+                }
+                result.position = end;
+
+                bool moved = false;
+                for (size_t a = X; a <= Z; ++a) {
+                    moved |= start[a].known != end[a].known || start[a].value != end[a].value;
+                }
+                if (!moved)
+                    // extruder only moves (retractions)
+                    break;
+
+                const double de = end[E].value - start[E].value;
+                if (de <= 0.0) {
+                    close_polyline();
+                    break;
+                }
+
+                if (!result.open) {
+                    if (result.polylines.empty() && !result.broken)
+                        result.continues_polyline = true;
+                    result.polylines.push_back((uint32_t)result.x.size());
+                    add_point(result, start, 0.0, 0.0f);
+                    result.open = true;
+                }
+
+                if (!arc) {
+                    add_point(result, end, de, min_segment_length);
+                    break;
+                }
+
+                // arcs are split into segments of at most ARC_STEP
+                const double i = words.has('I') ? words.get('I') : 0.0;
+                const double j = words.has('J') ? words.get('J') : 0.0;
+                const double dx = end[X].value - start[X].value;
+                const double dy = end[Y].value - start[Y].value;
+                double angle = std::atan2(-i * (dy - j) + j * (dx - i), i * (i - dx) + j * (j - dy));
+                if (code == 2)
+                    angle = -angle;
+                if (angle <= 0.0)
+                    angle += 2.0 * PI;
+                const size_t segments = std::max<size_t>(1, (size_t)std::ceil(angle / ARC_STEP));
+                const double step = ((code == 2) ? -angle : angle) / (double)segments;
+                for (size_t k = 1; k < segments; ++k) {
+                    const double a = step * (double)k;
+                    const double c = std::cos(a);
+                    const double s = std::sin(a);
+                    SymbolicPosition p = start;
+                    // rotation of the vector from the center to the start point
+                    p[X].value += i + (-i * c + j * s);
+                    p[Y].value += j + (-i * s - j * c);
+                    p[Z].value += (end[Z].value - start[Z].value) * (double)k / (double)segments;
+                    add_point(result, p, de / (double)segments, min_segment_length);
+                }
+                add_point(result, end, de / (double)segments, min_segment_length);
+                break;
+            }
+            case 28:
+            case 92:
+            {
+                // homing zeroes the given axes (all if none), G92 sets them
+                parse_words(words_begin, line_end, words);
+                const bool all = (words.letters & ((1u << ('X' - 'A')) | (1u << ('Y' - 'A')) | (1u << ('Z' - 'A')) | (1u << ('E' - 'A')))) == 0;
+                const size_t axes_count = (code == 28) ? 3 : 4;
+                for (size_t a = X; a < axes_count; ++a) {
+                    if (all || words.has(letters[a]))
+                        result.position[a] = { true, (code == 92 && !all) ? words.get(letters[a]) : 0.0 };
+                }
+                break;
+            }
+            case 90:
+            case 91:
+            {
+                result.absolute_xyz = code == 90;
+                result.absolute_e = code == 90;
+                xyz_mode_set = true;
+                e_mode_set = true;
+                break;
+            }
+            default:
+            {
+                break;
+            }
+            }
+        }
+        else if (line[0] == 'M' && (code == 82 || code == 83)) {
+            result.absolute_e = code == 82;
+            e_mode_set = true;
+        }
+    });
+}
+
+void Toolpath::clear()
+{
+    x.clear();
+    y.clear();
+    z.clear();
+    e.clear();
+    feature.clear();
+    layer.clear();
+    polylines.clear();
+    features.clear();
+}
+
+BGCODE_BINARIZE_EXPORT EResult extract_toolpath(FILE& file, Toolpath& toolpath, float min_segment_length, bool verify_checksum)
+{
+    toolpath.clear();
+    std::unordered_map<std::string, uint16_t> features_map;
+    auto feature_index = [&](const std::string& name) {
+        auto [it, inserted] = features_map.emplace(name, (uint16_t)toolpath.features.size());
+        if (inserted)
+            toolpath.features.push_back(name);
+        return it->second;
+    };
+
+    // state at the start of the current block, the printer defaults to absolute positioning
+    bool absolute_xyz = true;
+    bool absolute_e = true;
+    std::array<double, 4> position = { 0.0, 0.0, 0.0, 0.0 };
+    uint16_t feature = feature_index(std::string());
+    uint32_t layer = 0;
+    bool open = false;
+
+    auto scan = [min_segment_length](size_t, const std::string& gcode, BlockToolpath& result) {
+        scan_block(gcode, DEFAULT_ABSOLUTE_XYZ, DEFAULT_ABSOLUTE_E, nullptr, min_segment_length, result);
+        if (result.needs_rescan || result.depends_on_modes)
+            result.gcode = gcode;
+    };
+
+    auto merge = [&](size_t, const BlockHeader&, BlockToolpath& result) {
+        BlockToolpath rescanned;
+        const BlockToolpath* block = &result;
+        if (result.needs_rescan || (result.depends_on_modes && (absolute_xyz != DEFAULT_ABSOLUTE_XYZ || absolute_e != DEFAULT_ABSOLUTE_E))) {
+            scan_block(result.gcode, absolute_xyz, absolute_e, &position, min_segment_length, rescanned);
+            block = &rescanned;
+        }
+        std::string().swap(result.gcode);
+
+        std::vector<uint16_t> block_features(block->features.size() + 1);
+        block_features[0] = feature;
+        for (size_t i = 0; i < block->features.size(); ++i) {
+            block_features[i + 1] = feature_index(block->features[i]);
+        }
+
+        // the first point of a polyline continuing the last one of the previous block is already there
+        const size_t first = (block->continues_polyline && open) ? 1 : 0;
+        const size_t base = toolpath.x.size();
+        for (size_t k = first; k < block->polylines.size(); ++k) {
+            toolpath.polylines.push_back((uint32_t)(base + block->polylines[k] - first));
+        }
+        const size_t count = block->x.size();
+        for (size_t i = first; i < count; ++i) {
+            toolpath.x.push_back((i < block->entry_relative[X]) ? (float)position[X] + block->x[i] : block->x[i]);
+            toolpath.y.push_back((i < block->entry_relative[Y]) ? (float)position[Y] + block->y[i] : block->y[i]);
+            toolpath.z.push_back((i < block->entry_relative[Z]) ? (float)position[Z] + block->z[i] : block->z[i]);
+            toolpath.e.push_back(block->e[i]);
+            toolpath.feature.push_back(block_features[block->feature[i]]);
+            toolpath.layer.push_back(layer + block->layer[i]);
+        }
+
+        // state at the end of the block
+        absolute_xyz = block->absolute_xyz;
+        absolute_e = block->absolute_e;
+        for (size_t a = X; a <= E; ++a) {
+            position[a] = block->position[a].resolve(position[a]);
+        }
+        feature = block_features[block->last_feature];
+        layer += block->layers_count;
+        open = block->open || (open && !block->broken);
+    };
+
+    return scan_gcode_blocks<BlockToolpath>(file, verify_checksum, scan, merge);
+}
+
+}} // namespace bgcode
@@ -0,0 +1,266 @@
+#include "binarize_impl.hpp"
+
+namespace bgcode {
+
+using namespace core;
+
+namespace binarize {
+
+// Gcode block read from the source file
+struct TranscodeItem
+{
+    BlockHeader header;
+    std::vector<std::byte> payload;
+    Checksum checksum{ EChecksumType::None };
+};
+
+// Returns the compression required by the given config for the given metadata block type
+static ECompressionType metadata_compression(const BinarizerConfig& config, EBlockType type)
+{
+    switch (type)
+    {
+    case EBlockType::FileMetadata:    { return config.compression.file_metadata; }
+    case EBlockType::PrinterMetadata: { return config.compression.printer_metadata; }
+    case EBlockType::PrintMetadata:   { return config.compression.print_metadata; }
+    case EBlockType::SlicerMetadata:  { return config.compression.slicer_metadata; }
+    default:                          { return ECompressionType::None; }
+    }
+}
+
+// Reads the payload and the checksum of the block with the given header, verifying the checksum.
+// File position must be at the start of the block parameters.
+static EResult read_block(FILE& file, const FileHeader& file_header, TranscodeItem& item)
+{
+    EResult res = read_block_payload(file, item.header, item.payload);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+    const EChecksumType checksum_type = (EChecksumType)file_header.checksum_type;
+    item.checksum = Checksum(checksum_type);
+    res = item.checksum.read(file);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+
+    if (checksum_type != EChecksumType::None) {
+        Checksum cs(checksum_type);
+        update_checksum(cs, item.header);
+        cs.append(item.payload);
+        if (!cs.matches(item.checksum))
+            return EResult::InvalidChecksum;
+    }
+    return EResult::Success;
+}
+
+// Writes the given block, unchanged.
+// The checksum is copied when its type matches, recalculated otherwise.
+static EResult pass_through(FILE& file, const FileHeader& src_header, TranscodeItem& item, EChecksumType checksum_type)
+{
+    if ((EChecksumType)src_header.checksum_type != checksum_type)
+        return write_block(file, item.header, item.payload, checksum_type);
+
+    EResult res = item.header.write(file);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+    if (fwrite(item.payload.data(), 1, item.payload.size(), &file) != item.payload.size() || ferror(&file))
+        return EResult::WriteError;
+    return (checksum_type != EChecksumType::None) ? item.checksum.write(file) : EResult::Success;
+}
+
+// Encodes the given gcode chunks in parallel and writes them in order
+static EResult write_gcode_chunks(FILE& file, const std::vector<std::string>& chunks, const BinarizerConfig& config)
+{
+    std::vector<BlockHeader> headers(chunks.size());
+    std::vector<std::vector<std::byte>> payloads(chunks.size());
+    std::vector<EResult> results(chunks.size(), EResult::Success);
+    parallel_for(chunks.size(), [&](size_t i) {
+        GCodeBlock block;
+        block.encoding_type = (uint16_t)config.gcode_encoding;
+        block.raw_data = chunks[i];
+        results[i] = encode_gcode_block(block, config.compression.gcode, headers[i], payloads[i]);
+    });
+
+    for (size_t i = 0; i < chunks.size(); ++i) {
+        if (results[i] != EResult::Success)
+            return results[i];
+        const EResult res = write_block(file, headers[i], payloads[i], config.checksum);
+        if (res != EResult::Success)
+            // propagate error
+            return res;
+    }
+    return EResult::Success;
+}
+
+BGCODE_BINARIZE_EXPORT EResult transcode(FILE& src_file, FILE& dst_file, const BinarizerConfig& config, size_t max_gcode_block_size)
+{
+    fseek(&src_file, 0, SEEK_END);
+    const long file_size = ftell(&src_file);
+    rewind(&src_file);
+
+    FileHeader src_header;
+    EResult res = read_header(src_file, src_header, nullptr);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+
+    FileHeader dst_header;
+    dst_header.checksum_type = (uint16_t)config.checksum;
+    res = dst_header.write(dst_file);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+
+    // gcode blocks waiting to be transcoded, and decoded gcode waiting to be re-chunked
+    std::vector<TranscodeItem> batch;
+    size_t batch_size = 0;
+    std::string pending_gcode;
+
+    auto flush_gcode = [&](bool last) {
+        if (max_gcode_block_size == 0) {
+            // each gcode block already matching the config is written unchanged,
+            // the others are decoded and encoded again in parallel, replacing their header and payload
+            std::vector<char> matching(batch.size());
+            for (size_t i = 0; i < batch.size(); ++i) {
+                matching[i] = (ECompressionType)batch[i].header.compression == config.compression.gcode &&
+                    load_integer<uint16_t>(batch[i].payload.begin(), batch[i].payload.end()) == (uint16_t)config.gcode_encoding;
+            }
+            std::vector<EResult> results(batch.size(), EResult::Success);
+            parallel_for(batch.size(), [&](size_t i) {
+                if (matching[i])
+                    return;
+                GCodeBlock block;
+                results[i] = block.read_data(batch[i].header, batch[i].payload.data(), batch[i].payload.size());
+                if (results[i] != EResult::Success)
+                    return;
+                block.encoding_type = (uint16_t)config.gcode_encoding;
+                results[i] = encode_gcode_block(block, config.compression.gcode, batch[i].header, batch[i].payload);
+            });
+
+            for (size_t i = 0; i < batch.size(); ++i) {
+                if (results[i] != EResult::Success)
+                    return results[i];
+                const EResult res = matching[i] ? pass_through(dst_file, src_header, batch[i], config.checksum) :
+                    write_block(dst_file, batch[i].header, batch[i].payload, config.checksum);
+                if (res != EResult::Success)
+                    // propagate error
+                    return res;
+            }
+            batch.clear();
+            batch_size = 0;
+            return EResult::Success;
+        }
+
+        // decode in parallel
+        std::vector<std::string> decoded(batch.size());
+        std::vector<EResult> results(batch.size(), EResult::Success);
+        parallel_for(batch.size(), [&](size_t i) {
+            GCodeBlock block;
+            results[i] = block.read_data(batch[i].header, batch[i].payload.data(), batch[i].payload.size());
+            decoded[i] = std::move(block.raw_data);
+        });
+        for (const EResult r : results) {
+            if (r != EResult::Success)
+                return r;
+        }
+        batch.clear();
+        batch_size = 0;
+
+        // re-chunk at line boundaries
+        for (const std::string& gcode : decoded) {
+            pending_gcode += gcode;
+        }
+        std::vector<std::string> chunks;
+        size_t begin = 0;
+        while (pending_gcode.size() - begin > max_gcode_block_size) {
+            const size_t end = pending_gcode.rfind('\n', begin + max_gcode_block_size - 1);
+            if (end == std::string::npos || end < begin)
+                // line longer than the max block size
+                return EResult::WriteError;
+            chunks.emplace_back(pending_gcode, begin, end + 1 - begin);
+            begin = end + 1;
+        }
+        if (last && begin < pending_gcode.size()) {
+            chunks.emplace_back(pending_gcode, begin);
+            begin = pending_gcode.size();
+        }
+        pending_gcode.erase(0, begin);
+        return write_gcode_chunks(dst_file, chunks, config);
+    };
+
+    while (ftell(&src_file) < file_size) {
+        TranscodeItem item;
+        res = read_next_block_header(src_file, src_header, item.header);
+        if (res != EResult::Success)
+            // propagate error
+            return res;
+
+        const EBlockType type = (EBlockType)item.header.type;
+        res = read_block(src_file, src_header, item);
+        if (res != EResult::Success)
+            // propagate error
+            return res;
+
+        if (type == EBlockType::GCode) {
+            batch_size += item.payload.size();
+            batch.emplace_back(std::move(item));
+            if (batch_size >= DEFAULT_SCAN_BATCH_SIZE) {
+                res = flush_gcode(false);
+                if (res != EResult::Success)
+                    // propagate error
+                    return res;
+            }
+            continue;
+        }
+
+        res = flush_gcode(true);
+        if (res != EResult::Success)
+            // propagate error
+            return res;
+
+        // thumbnails have no settings, metadata are passed through when their compression matches
+        if (type == EBlockType::Thumbnail || (ECompressionType)item.header.compression == metadata_compression(config, type)) {
+            res = pass_through(dst_file, src_header, item, config.checksum);
+            if (res != EResult::Success)
+                // propagate error
+                return res;
+            continue;
+        }
+
+        // decode, from the payload already read, and encode again the metadata
+        BaseMetadataBlock* block = nullptr;
+        FileMetadataBlock file_metadata;
+        PrinterMetadataBlock printer_metadata;
+        PrintMetadataBlock print_metadata;
+        SlicerMetadataBlock slicer_metadata;
+        switch (type)
+        {
+        case EBlockType::FileMetadata:    { block = &file_metadata; break; }
+        case EBlockType::PrinterMetadata: { block = &printer_metadata; break; }
+        case EBlockType::PrintMetadata:   { block = &print_metadata; break; }
+        case EBlockType::SlicerMetadata:  { block = &slicer_metadata; break; }
+        default:                          { return EResult::InvalidBlockType; }
+        }
+        res = block->read_data(item.header, item.payload.data(), item.payload.size());
+        if (res != EResult::Success)
+            // propagate error
+            return res;
+        block->encoding_type = (uint16_t)config.metadata_encoding;
+
+        const ECompressionType compression = metadata_compression(config, type);
+        switch (type)
+        {
+        case EBlockType::FileMetadata:    { res = file_metadata.write(dst_file, compression, config.checksum); break; }
+        case EBlockType::PrinterMetadata: { res = printer_metadata.write(dst_file, compression, config.checksum); break; }
+        case EBlockType::PrintMetadata:   { res = print_metadata.write(dst_file, compression, config.checksum); break; }
+        default:                          { res = slicer_metadata.write(dst_file, compression, config.checksum); break; }
+        }
+        if (res != EResult::Success)
+            // propagate error
+            return res;
+    }
+
+    return flush_gcode(true);
+}
+
+}} // namespace bgcode
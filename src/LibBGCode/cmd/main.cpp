@@ -4,10 +4,16 @@
 #include <string_view>
 #include <iostream>
 #include <algorithm>
+#include <memory>
 #include <stdexcept>
 #include <stdlib.h>
 #include <boost/nowide/cstdio.hpp>
 
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif // _WIN32
+
 using namespace bgcode::core;
 using namespace bgcode::binarize;
 using namespace bgcode::convert;
@@ -31,7 +37,8 @@ static const std::vector<Parameter> parameters = {
     { "slicer_metadata_compression"sv, { "None"sv, "Deflate"sv, "Heatshrink_11_4"sv, "Heatshrink_12_4"sv }, (size_t)DefaultBinarizerConfig.compression.slicer_metadata },
     { "gcode_compression"sv, { "None"sv, "Deflate"sv, "Heatshrink_11_4"sv, "Heatshrink_12_4"sv }, (size_t)DefaultBinarizerConfig.compression.gcode },
     { "gcode_encoding"sv, { "None"sv, "MeatPack"sv, "MeatPackComments"sv }, (size_t)DefaultBinarizerConfig.gcode_encoding },
-    { "metadata_encoding"sv, { "INI"sv }, (size_t) DefaultBinarizerConfig.metadata_encoding }
+    { "metadata_encoding"sv, { "INI"sv }, (size_t) DefaultBinarizerConfig.metadata_encoding },
+    { "layer_aligned_gcode_blocks"sv, { "False"sv, "True"sv }, (size_t)DefaultBinarizerConfig.layer_aligned_gcode_blocks }
 };
 
 class ScopedFile
@@ -44,7 +51,17 @@ private:
 };
 
 void show_help() {
-    std::cout << "Usage: bgcode filename [ Binarization parameters ]\n";
+    std::cout << "Usage: bgcode filename [--stats] [ Binarization parameters ]\n";
+    std::cout << "       bgcode split src_filename dst_filename --lines=first-last | --layers=first-last\n";
+    std::cout << "       bgcode merge dst_filename src_filename1 src_filename2 [...] [--glue=gcode_filename]\n";
+    std::cout << "       bgcode diff old_filename new_filename patch_filename\n";
+    std::cout << "       bgcode patch old_filename patch_filename new_filename\n";
+    std::cout << "       bgcode decode < src_filename > dst_filename\n";
+    std::cout << "       bgcode search filename pattern1 [pattern2 ...] [--index=index_filename]\n";
+    std::cout << "       bgcode generate dst_filename [--size=bytes[K|M|G]] [--seed=n] [--moves_per_layer=n] [--long_lines=length[/interval]]\n";
+    std::cout << "                       [--thumbnails=PNG/16x16,QOI/220x124,...|none] [--crlf]\n";
+    std::cout << "\n--trace=filename, accepted by all the commands, saves a Chrome trace (json) of the hot paths, if tracing was built in\n";
+    std::cout << "--stats prints the statistics of the conversion (sizes, compression ratios, time spent into each stage)\n";
     std::cout << "\nBinarization parameters (used only when converting to binary format):\n";
     for (const Parameter& p : parameters) {
         std::cout << "--" << p.name << "=X\n";
@@ -157,17 +174,455 @@ bool parse_args(int argc, const char* argv[], std::string& src_filename, bool& s
                 config.gcode_encoding = (EGCodeEncodingType)value;
             else if (parameter.name == "metadata_encoding")
                 config.metadata_encoding = (EMetadataEncodingType)value;
+            else if (parameter.name == "layer_aligned_gcode_blocks")
+                config.layer_aligned_gcode_blocks = value != 0;
         }
     }
     return true;
 }
 
-int main(int argc, const char* argv[])
+// Parses a range in the form "first-last"
+static bool parse_range(std::string_view str, size_t& first, size_t& last)
+{
+    const size_t pos = str.find('-');
+    if (pos == std::string_view::npos)
+        return false;
+    try {
+        first = std::stoul(std::string(str.substr(0, pos)));
+        last = std::stoul(std::string(str.substr(pos + 1)));
+    }
+    catch (...) {
+        return false;
+    }
+    return first < last;
+}
+
+int split_command(int argc, const char* argv[])
+{
+    if (argc != 5) {
+        std::cout << "Usage: bgcode split src_filename dst_filename --lines=first-last | --layers=first-last\n";
+        std::cout << "Lines and layers are zero based, first is included, last is excluded\n";
+        return EXIT_FAILURE;
+    }
+
+    const std::string_view range_arg = argv[4];
+    const bool by_layers = range_arg.substr(0, 9) == "--layers=";
+    const bool by_lines = range_arg.substr(0, 8) == "--lines=";
+    size_t first;
+    size_t last;
+    if ((!by_layers && !by_lines) || !parse_range(range_arg.substr(by_layers ? 9 : 8), first, last)) {
+        std::cout << "Found invalid range '" << range_arg << "'\n";
+        return EXIT_FAILURE;
+    }
+
+    FILE* src_file = boost::nowide::fopen(argv[2], "rb");
+    if (src_file == nullptr) {
+        std::cout << "Unable to open file '" << argv[2] << "'\n";
+        return EXIT_FAILURE;
+    }
+    ScopedFile scoped_src_file(src_file);
+
+    GCodeIndex index;
+    EResult res = build_gcode_index(*src_file, index);
+    LayerTable table;
+    if (res == EResult::Success && by_layers)
+        res = build_layer_table(*src_file, table);
+    if (res != EResult::Success) {
+        std::cout << "Unable to read the file '" << argv[2] << "'\n";
+        std::cout << "Error: " << translate_result(res) << "\n";
+        return EXIT_FAILURE;
+    }
+
+    FILE* dst_file = boost::nowide::fopen(argv[3], "wb");
+    if (dst_file == nullptr) {
+        std::cout << "Unable to open file '" << argv[3] << "'\n";
+        return EXIT_FAILURE;
+    }
+    ScopedFile scoped_dst_file(dst_file);
+
+    res = by_layers ? split(*src_file, *dst_file, index, table, first, last) : split(*src_file, *dst_file, index, first, last);
+    if (res != EResult::Success) {
+        std::cout << "Unable to split the file '" << argv[2] << "'\n";
+        std::cout << "Error: " << translate_result(res) << "\n";
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "Succesfully generated file '" << argv[3] << "'\n";
+    return EXIT_SUCCESS;
+}
+
+int merge_command(int argc, const char* argv[])
+{
+    std::vector<std::string> src_filenames;
+    std::string glue_filename;
+    for (int i = 3; i < argc; ++i) {
+        const std::string_view a = argv[i];
+        if (a.substr(0, 7) == "--glue=")
+            glue_filename = a.substr(7);
+        else
+            src_filenames.emplace_back(a);
+    }
+    if (argc < 4 || src_filenames.empty()) {
+        std::cout << "Usage: bgcode merge dst_filename src_filename1 src_filename2 [...] [--glue=gcode_filename]\n";
+        return EXIT_FAILURE;
+    }
+
+    // ascii gcode to insert between the files
+    std::string glue;
+    if (!glue_filename.empty()) {
+        FILE* glue_file = boost::nowide::fopen(glue_filename.c_str(), "rb");
+        if (glue_file == nullptr) {
+            std::cout << "Unable to open file '" << glue_filename << "'\n";
+            return EXIT_FAILURE;
+        }
+        ScopedFile scoped_glue_file(glue_file);
+        char buffer[4096];
+        for (size_t rsize = fread(buffer, 1, sizeof(buffer), glue_file); rsize > 0; rsize = fread(buffer, 1, sizeof(buffer), glue_file)) {
+            glue.append(buffer, rsize);
+        }
+    }
+
+    std::vector<FILE*> src_files;
+    std::vector<std::unique_ptr<ScopedFile>> scoped_src_files;
+    for (const std::string& filename : src_filenames) {
+        FILE* src_file = boost::nowide::fopen(filename.c_str(), "rb");
+        if (src_file == nullptr) {
+            std::cout << "Unable to open file '" << filename << "'\n";
+            return EXIT_FAILURE;
+        }
+        scoped_src_files.emplace_back(std::make_unique<ScopedFile>(src_file));
+        src_files.push_back(src_file);
+    }
+
+    FILE* dst_file = boost::nowide::fopen(argv[2], "wb");
+    if (dst_file == nullptr) {
+        std::cout << "Unable to open file '" << argv[2] << "'\n";
+        return EXIT_FAILURE;
+    }
+    ScopedFile scoped_dst_file(dst_file);
+
+    const EResult res = merge(src_files, *dst_file, glue);
+    if (res != EResult::Success) {
+        std::cout << "Unable to merge the files\n";
+        std::cout << "Error: " << translate_result(res) << "\n";
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "Succesfully generated file '" << argv[2] << "'\n";
+    return EXIT_SUCCESS;
+}
+
+// Shared by the diff and patch commands: runs func(file1, file2, file3) on the given files
+template<class Func>
+int three_files_command(int argc, const char* argv[], const char* usage, Func func)
+{
+    if (argc != 5) {
+        std::cout << "Usage: " << usage << "\n";
+        return EXIT_FAILURE;
+    }
+
+    FILE* file1 = boost::nowide::fopen(argv[2], "rb");
+    if (file1 == nullptr) {
+        std::cout << "Unable to open file '" << argv[2] << "'\n";
+        return EXIT_FAILURE;
+    }
+    ScopedFile scoped_file1(file1);
+    FILE* file2 = boost::nowide::fopen(argv[3], "rb");
+    if (file2 == nullptr) {
+        std::cout << "Unable to open file '" << argv[3] << "'\n";
+        return EXIT_FAILURE;
+    }
+    ScopedFile scoped_file2(file2);
+    FILE* file3 = boost::nowide::fopen(argv[4], "wb");
+    if (file3 == nullptr) {
+        std::cout << "Unable to open file '" << argv[4] << "'\n";
+        return EXIT_FAILURE;
+    }
+
+    const EResult res = func(*file1, *file2, *file3);
+    const long size = ftell(file3);
+    fclose(file3);
+    if (res != EResult::Success) {
+        // do not leave an incomplete or corrupted file
+        boost::nowide::remove(argv[4]);
+        std::cout << "Error: " << translate_result(res) << "\n";
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "Succesfully generated file '" << argv[4] << "' (" << size << " bytes)\n";
+    return EXIT_SUCCESS;
+}
+
+// Converts the binary gcode read from stdin to ascii, written to stdout
+int decode_command(int argc)
+{
+    if (argc != 2) {
+        std::cerr << "Usage: bgcode decode < src_filename > dst_filename\n";
+        return EXIT_FAILURE;
+    }
+
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif // _WIN32
+
+    const EResult res = from_binary_to_ascii_stream(*stdin, *stdout, true);
+    if (res != EResult::Success) {
+        std::cerr << "Error: " << translate_result(res) << "\n";
+        return EXIT_FAILURE;
+    }
+    return (fflush(stdout) == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+// Prints the lines of a binary gcode file starting with the given patterns.
+// If an index sidecar file is given, the results cached into it are reused and the new ones are saved into it.
+int search_command(int argc, const char* argv[])
+{
+    std::vector<std::string> patterns;
+    std::string index_filename;
+    for (int i = 3; i < argc; ++i) {
+        const std::string_view a = argv[i];
+        if (a.substr(0, 8) == "--index=")
+            index_filename = a.substr(8);
+        else
+            patterns.emplace_back(a);
+    }
+    if (argc < 4 || patterns.empty()) {
+        std::cout << "Usage: bgcode search filename pattern1 [pattern2 ...] [--index=index_filename]\n";
+        return EXIT_FAILURE;
+    }
+
+    FILE* file = boost::nowide::fopen(argv[2], "rb");
+    if (file == nullptr) {
+        std::cout << "Unable to open file '" << argv[2] << "'\n";
+        return EXIT_FAILURE;
+    }
+    ScopedFile scoped_file(file);
+
+    std::vector<GCodeMatch> matches;
+    EResult res;
+    if (index_filename.empty())
+        res = search_gcode(*file, patterns, matches);
+    else {
+        // the sidecar file is ignored if missing, invalid or stale
+        GCodeIndex index;
+        FILE* index_file = boost::nowide::fopen(index_filename.c_str(), "rb");
+        if (index_file != nullptr) {
+            ScopedFile scoped_index_file(index_file);
+            if (index.read(*index_file) != EResult::Success || verify_gcode_index(*file, index) != EResult::Success)
+                index = GCodeIndex();
+        }
+        res = index.blocks.empty() ? build_gcode_index(*file, index) : EResult::Success;
+        if (res == EResult::Success)
+            res = search_gcode(*file, index, patterns, matches);
+        if (res == EResult::Success) {
+            index_file = boost::nowide::fopen(index_filename.c_str(), "wb");
+            if (index_file == nullptr) {
+                std::cout << "Unable to open file '" << index_filename << "'\n";
+                return EXIT_FAILURE;
+            }
+            ScopedFile scoped_index_file(index_file);
+            res = index.write(*index_file);
+        }
+    }
+    if (res != EResult::Success) {
+        std::cout << "Unable to search the file '" << argv[2] << "'\n";
+        std::cout << "Error: " << translate_result(res) << "\n";
+        return EXIT_FAILURE;
+    }
+
+    for (const GCodeMatch& match : matches) {
+        std::cout << "line " << match.line << " (block " << match.position.block << "): " << match.text << "\n";
+    }
+    return EXIT_SUCCESS;
+}
+
+// Parses a size in bytes, with an optional K, M or G suffix
+static bool parse_size(std::string_view str, uint64_t& size)
+{
+    uint64_t multiplier = 1;
+    if (!str.empty()) {
+        switch (str.back())
+        {
+        case 'K': { multiplier = 1024; break; }
+        case 'M': { multiplier = 1024 * 1024; break; }
+        case 'G': { multiplier = 1024 * 1024 * 1024; break; }
+        default: { break; }
+        }
+        if (multiplier > 1)
+            str.remove_suffix(1);
+    }
+    try {
+        size_t pos;
+        size = std::stoull(std::string(str), &pos) * multiplier;
+        return pos == str.size();
+    }
+    catch (...) {
+        return false;
+    }
+}
+
+// Parses a list of thumbnails in the form "PNG/16x16,QOI/220x124", or "none"
+static bool parse_thumbnails(std::string_view str, std::vector<ThumbnailParams>& thumbnails)
+{
+    thumbnails.clear();
+    if (str == "none")
+        return true;
+    while (!str.empty()) {
+        const size_t end = std::min(str.find(','), str.size());
+        const std::string_view item = str.substr(0, end);
+        str.remove_prefix(std::min(end + 1, str.size()));
+        const size_t slash = item.find('/');
+        const size_t x = item.find('x', slash);
+        if (slash == std::string_view::npos || x == std::string_view::npos)
+            return false;
+        ThumbnailParams params;
+        const std::string_view format = item.substr(0, slash);
+        if (format == "PNG")
+            params.format = (uint16_t)EThumbnailFormat::PNG;
+        else if (format == "JPG")
+            params.format = (uint16_t)EThumbnailFormat::JPG;
+        else if (format == "QOI")
+            params.format = (uint16_t)EThumbnailFormat::QOI;
+        else
+            return false;
+        try {
+            const unsigned long width = std::stoul(std::string(item.substr(slash + 1, x - slash - 1)));
+            const unsigned long height = std::stoul(std::string(item.substr(x + 1)));
+            if (width == 0 || height == 0 || width > 65535 || height > 65535)
+                return false;
+            params.width = (uint16_t)width;
+            params.height = (uint16_t)height;
+        }
+        catch (...) {
+            return false;
+        }
+        thumbnails.push_back(params);
+    }
+    return true;
+}
+
+// Writes a synthetic ascii gcode file, for tests and benchmarks
+int generate_command(int argc, const char* argv[])
 {
+    static const char* usage = "Usage: bgcode generate dst_filename [--size=bytes[K|M|G]] [--seed=n] [--moves_per_layer=n]\n"
+        "       [--long_lines=length[/interval]] [--thumbnails=PNG/16x16,QOI/220x124,...|none] [--crlf]\n";
+    if (argc < 3) {
+        std::cout << usage;
+        return EXIT_FAILURE;
+    }
+
+    GeneratorConfig config;
+    for (int i = 3; i < argc; ++i) {
+        const std::string_view a = argv[i];
+        uint64_t value = 0;
+        bool valid = true;
+        if (a.substr(0, 7) == "--size=")
+            valid = parse_size(a.substr(7), config.size);
+        else if (a.substr(0, 7) == "--seed=") {
+            valid = parse_size(a.substr(7), value);
+            config.seed = (uint32_t)value;
+        }
+        else if (a.substr(0, 18) == "--moves_per_layer=") {
+            valid = parse_size(a.substr(18), value) && value > 0;
+            config.moves_per_layer = (size_t)value;
+        }
+        else if (a.substr(0, 13) == "--long_lines=") {
+            const std::string_view str = a.substr(13);
+            const size_t slash = str.find('/');
+            valid = parse_size(str.substr(0, slash), value);
+            config.long_line_length = (size_t)value;
+            if (valid && slash != std::string_view::npos) {
+                valid = parse_size(str.substr(slash + 1), value) && value > 0;
+                config.long_lines_interval = (size_t)value;
+            }
+        }
+        else if (a.substr(0, 13) == "--thumbnails=")
+            valid = parse_thumbnails(a.substr(13), config.thumbnails);
+        else if (a == "--crlf")
+            config.crlf = true;
+        else
+            valid = false;
+        if (!valid) {
+            std::cout << "Found invalid parameter '" << a << "'\n";
+            std::cout << usage;
+            return EXIT_FAILURE;
+        }
+    }
+
+    FILE* dst_file = boost::nowide::fopen(argv[2], "wb");
+    if (dst_file == nullptr) {
+        std::cout << "Unable to open file '" << argv[2] << "'\n";
+        return EXIT_FAILURE;
+    }
+    ScopedFile scoped_dst_file(dst_file);
+
+    const EResult res = generate_gcode(*dst_file, config);
+    if (res != EResult::Success) {
+        std::cout << "Unable to generate the file '" << argv[2] << "'\n";
+        std::cout << "Error: " << translate_result(res) << "\n";
+        return EXIT_FAILURE;
+    }
+
+    std::cout << "Succesfully generated file '" << argv[2] << "' (" << ftell(dst_file) << " bytes)\n";
+    return EXIT_SUCCESS;
+}
+
+// Prints the statistics of a conversion
+static void show_stats(const ConversionStats& stats)
+{
+    static const std::array<std::string_view, 6> block_types = { "File metadata"sv, "GCode"sv, "Slicer metadata"sv,
+        "Printer metadata"sv, "Print metadata"sv, "Thumbnail"sv };
+    static const std::array<std::string_view, (size_t)ConversionStats::EStage::Count> stages = { "Parse"sv, "MeatPack"sv,
+        "Compression"sv, "Checksum"sv, "IO"sv };
+
+    std::cout << "Statistics\n";
+    std::cout << "Bytes read: " << stats.bytes_read << " - written: " << stats.bytes_written << "\n";
+    for (size_t i = 0; i < stats.blocks.size(); ++i) {
+        const ConversionStats::Blocks& blocks = stats.blocks[i];
+        if (blocks.count == 0)
+            continue;
+        std::cout << block_types[i] << " blocks: " << blocks.count << " - compressed: " << blocks.compressed_size <<
+            " - uncompressed: " << blocks.uncompressed_size << " - ratio: " << stats.compression_ratio((EBlockType)i) << "\n";
+    }
+    std::cout << "Peak block size - compressed: " << stats.peak_compressed_size << " - uncompressed: " << stats.peak_uncompressed_size << "\n";
+    double stages_time = 0.0;
+    for (size_t i = 0; i < stages.size(); ++i) {
+        std::cout << stages[i] << " time: " << stats.stage_times[i] * 1000.0 << " ms\n";
+        stages_time += stats.stage_times[i];
+    }
+    std::cout << "Other time: " << std::max(0.0, stats.total_time - stages_time) * 1000.0 << " ms\n";
+    std::cout << "Total time: " << stats.total_time * 1000.0 << " ms\n";
+}
+
+static int run_command(int argc, const char* argv[])
+{
+    if (argc > 1 && std::string_view(argv[1]) == "split")
+        return split_command(argc, argv);
+    if (argc > 1 && std::string_view(argv[1]) == "merge")
+        return merge_command(argc, argv);
+    if (argc > 1 && std::string_view(argv[1]) == "diff")
+        return three_files_command(argc, argv, "bgcode diff old_filename new_filename patch_filename", make_patch);
+    if (argc > 1 && std::string_view(argv[1]) == "patch")
+        return three_files_command(argc, argv, "bgcode patch old_filename patch_filename new_filename", apply_patch);
+    if (argc > 1 && std::string_view(argv[1]) == "decode")
+        return decode_command(argc);
+    if (argc > 1 && std::string_view(argv[1]) == "search")
+        return search_command(argc, argv);
+    if (argc > 1 && std::string_view(argv[1]) == "generate")
+        return generate_command(argc, argv);
+
+    // --stats is accepted in any position
+    std::vector<const char*> args(argv, argv + argc);
+    auto stats_it = std::find_if(args.begin(), args.end(), [](const char* a) { return std::string_view(a) == "--stats"; });
+    const bool show_statistics = stats_it != args.end();
+    if (show_statistics)
+        args.erase(stats_it);
+
     std::string src_filename;
     bool src_is_binary;
     BinarizerConfig config;
-    if (!parse_args(argc, argv, src_filename, src_is_binary, config))
+    if (!parse_args((int)args.size(), args.data(), src_filename, src_is_binary, config))
         return EXIT_FAILURE;
 
     // Open source file
@@ -195,7 +650,8 @@ int main(int argc, const char* argv[])
     ScopedFile scoped_dst_file(dst_file);
 
     // Perform conversion
-    const EResult res = src_is_binary ? from_binary_to_ascii(*src_file, *dst_file, true) : from_ascii_to_binary(*src_file, *dst_file, config);
+    ConversionStats stats;
+    const EResult res = src_is_binary ? from_binary_to_ascii(*src_file, *dst_file, true, &stats) : from_ascii_to_binary(*src_file, *dst_file, config, &stats);
     if (res == EResult::Success) {
         if (!src_is_binary) {
             std::cout << "Binarization parameters\n";
@@ -217,8 +673,12 @@ int main(int argc, const char* argv[])
                     std::cout << p.values[(size_t)config.gcode_encoding] << "\n";
                 else if (p.name == "metadata_encoding")
                     std::cout << p.values[(size_t)config.metadata_encoding] << "\n";
+                else if (p.name == "layer_aligned_gcode_blocks")
+                    std::cout << p.values[(size_t)config.layer_aligned_gcode_blocks] << "\n";
             }
         }
+        if (show_statistics)
+            show_stats(stats);
         std::cout << "Succesfully generated file '" << dst_filename << "'\n";
     }
     else {
@@ -229,3 +689,32 @@ int main(int argc, const char* argv[])
 
     return EXIT_SUCCESS;
 }
+
+int main(int argc, const char* argv[])
+{
+    // --trace=filename is accepted in any position
+    std::vector<const char*> args(argv, argv + argc);
+    auto trace_it = std::find_if(args.begin(), args.end(), [](const char* a) { return std::string_view(a).substr(0, 8) == "--trace="; });
+    if (trace_it == args.end())
+        return run_command(argc, argv);
+
+    const std::string trace_filename(std::string_view(*trace_it).substr(8));
+    args.erase(trace_it);
+    if (!start_tracing())
+        std::cerr << "Tracing is not available, the library was built without LibBGCode_BUILD_TRACING\n";
+    const int ret = run_command((int)args.size(), args.data());
+
+    FILE* trace_file = boost::nowide::fopen(trace_filename.c_str(), "wb");
+    if (trace_file == nullptr) {
+        std::cerr << "Unable to open file '" << trace_filename << "'\n";
+        return EXIT_FAILURE;
+    }
+    ScopedFile scoped_trace_file(trace_file);
+    const EResult res = stop_tracing(*trace_file);
+    if (res != EResult::Success) {
+        std::cerr << "Unable to save the trace into '" << trace_filename << "'\n";
+        std::cerr << "Error: " << translate_result(res) << "\n";
+        return EXIT_FAILURE;
+    }
+    return ret;
+}
@@ -1,5 +1,7 @@
 #include "convert.hpp"
 #include "binarize/binarize.hpp"
+#include "binarize/binarize_impl.hpp"
+#include "gcode_reader.hpp"
 
 #include <boost/beast/core/detail/base64.hpp>
 
@@ -13,146 +15,6 @@ using namespace core;
 using namespace binarize;
 namespace convert {
 
-class GCodeReader
-{
-public:
-    struct GCodeLine
-    {
-        std::string raw;
-        void reset() { raw.clear(); }
-    };
-
-    GCodeReader(FILE& file) : m_file(file) {}
-
-    typedef std::function<void(GCodeReader&, const GCodeLine&)> ParseLineCallback;
-    typedef std::function<void(const char*, const char*)> InternalParseLineCallback;
-
-    // Returns false if reading the file failed.
-    bool parse(ParseLineCallback callback) {
-        GCodeLine gline;
-        m_parsing = true;
-        return parse_internal([this, &gline, callback](const char* begin, const char* end) {
-              gline.reset();
-              parse_line(begin, end, gline, callback);
-        });
-    }
-
-    void quit_parsing() { m_parsing = false; }
-
-private:
-    FILE& m_file;
-    bool m_parsing{ false };
-
-    bool parse_internal(InternalParseLineCallback parse_line_callback) {
-        // Read the input stream 64kB at a time, extract lines and process them.
-        std::vector<char> buffer(65536 * 10, 0);
-        // Line buffer.
-        std::string gcode_line;
-        size_t file_pos = 0;
-        for (;;) {
-            size_t cnt_read = ::fread(buffer.data(), 1, buffer.size(), &m_file);
-            if (::ferror(&m_file)) {
-                m_parsing = false;
-                return false;
-            }
-            bool eof = cnt_read == 0;
-            auto it = buffer.begin();
-            auto it_bufend = buffer.begin() + cnt_read;
-            while (it != it_bufend || (eof && !gcode_line.empty())) {
-                // Find end of line.
-                bool eol = false;
-                auto it_end = it;
-                for (; it_end != it_bufend && !(eol = *it_end == '\r' || *it_end == '\n'); ++it_end)
-                    ; // silence -Wempty-body
-                // End of line is indicated also if end of file was reached.
-                eol |= eof && it_end == it_bufend;
-                if (eol) {
-                    if (gcode_line.empty())
-                        parse_line_callback(&(*it), &(*it_end));
-                    else {
-                        gcode_line.insert(gcode_line.end(), it, it_end);
-                        parse_line_callback(gcode_line.c_str(), gcode_line.c_str() + gcode_line.size());
-                        gcode_line.clear();
-                    }
-                    if (!m_parsing)
-                        // The callback wishes to exit.
-                        return true;
-                }
-                else
-                    gcode_line.insert(gcode_line.end(), it, it_end);
-                // Skip EOL.
-                it = it_end;
-                if (it != it_bufend && *it == '\r')
-                    ++it;
-                if (it != it_bufend && *it == '\n')
-                    ++it;
-            }
-            if (eof)
-                break;
-            file_pos += cnt_read;
-        }
-        m_parsing = false;
-        return true;
-    }
-
-    const char* parse_line(const char* ptr, const char* end, GCodeLine& gline, ParseLineCallback callback) {
-        std::pair<const char*, const char*> cmd;
-        const char* line_end = parse_line_internal(ptr, end, gline, cmd);
-        callback(*this, gline);
-        return line_end;
-    }
-
-    const char* parse_line_internal(const char* ptr, const char* end, GCodeLine& gline, std::pair<const char*, const char*>& command) {
-        // command and args
-        const char* c = ptr;
-        {
-            // Skip the whitespaces.
-            command.first = skip_whitespaces(c);
-            // Skip the command.
-            c = command.second = skip_word(command.first);
-            // Up to the end of line or comment.
-            while (!is_end_of_gcode_line(*c)) {
-                // Skip whitespaces.
-                c = skip_whitespaces(c);
-                if (is_end_of_gcode_line(*c))
-                    break;
-                // Skip the rest of the word.
-                c = skip_word(c);
-            }
-        }
-
-        // Skip the rest of the line.
-        for (; !is_end_of_line(*c); ++c);
-
-        // Copy the raw string including the comment, without the trailing newlines.
-        if (c > ptr)
-            gline.raw.assign(ptr, c);
-
-        // Skip the trailing newlines.
-        if (*c == '\r')
-            ++c;
-        if (*c == '\n')
-            ++c;
-
-        return c;
-    }
-
-    static bool        is_whitespace(char c) { return c == ' ' || c == '\t'; }
-    static bool        is_end_of_line(char c) { return c == '\r' || c == '\n' || c == 0; }
-    static bool        is_end_of_gcode_line(char c) { return c == ';' || is_end_of_line(c); }
-    static bool        is_end_of_word(char c) { return is_whitespace(c) || is_end_of_gcode_line(c); }
-    static const char* skip_whitespaces(const char* c) {
-        for (; is_whitespace(*c); ++c)
-            ; // silence -Wempty-body
-        return c;
-    }
-    static const char* skip_word(const char* c) {
-        for (; !is_end_of_word(*c); ++c)
-            ; // silence -Wempty-body
-        return c;
-    }
-};
-
 static std::string_view trim(const std::string_view& str)
 {
     if (str.empty())
@@ -179,8 +41,10 @@ static void to_int(const std::string_view& str, Integer& out) {
         out = 0;
 }
 
-BGCODE_CONVERT_EXPORT EResult from_ascii_to_binary(FILE& src_file, FILE& dst_file, const BinarizerConfig& config)
+BGCODE_CONVERT_EXPORT EResult from_ascii_to_binary(FILE& src_file, FILE& dst_file, const BinarizerConfig& config, ConversionStats* stats)
 {
+    const ScopedConversionStats scoped_stats(stats);
+
     using namespace std::literals;
     static constexpr const std::string_view GeneratedByPrusaSlicer = "generated by PrusaSlicer"sv;
 
@@ -563,15 +427,73 @@ BGCODE_CONVERT_EXPORT EResult from_ascii_to_binary(FILE& src_file, FILE& dst_fil
     return EResult::Success;
 }
 
-BGCODE_CONVERT_EXPORT EResult from_binary_to_ascii(FILE& src_file, FILE& dst_file, bool verify_checksum)
+// Returns the ascii representation of the given thumbnail, as a base64 encoded comment
+static std::string thumbnail_to_ascii(const ThumbnailBlock& thumbnail_block)
 {
+    static constexpr const size_t max_row_length = 78;
+    std::string encoded;
+    encoded.resize(boost::beast::detail::base64::encoded_size(thumbnail_block.data.size()));
+    encoded.resize(boost::beast::detail::base64::encode((void*)encoded.data(), (const void*)thumbnail_block.data.data(), thumbnail_block.data.size()));
+    std::string format;
+    switch ((EThumbnailFormat)thumbnail_block.params.format)
+    {
+    default:
+    case EThumbnailFormat::PNG: { format = "thumbnail"; break; }
+    case EThumbnailFormat::JPG: { format = "thumbnail_JPG"; break; }
+    case EThumbnailFormat::QOI: { format = "thumbnail_QOI"; break; }
+    }
+    std::string ret = "\n;\n; " + format + " begin " + std::to_string(thumbnail_block.params.width) + "x" + std::to_string(thumbnail_block.params.height) +
+        " " + std::to_string(encoded.length()) + "\n";
+    size_t begin = 0;
+    while (encoded.size() - begin > max_row_length) {
+        ret += "; " + encoded.substr(begin, max_row_length) + "\n";
+        begin += max_row_length;
+    }
+    if (begin < encoded.size())
+        ret += "; " + encoded.substr(begin) + "\n";
+    ret += "; " + format + " end\n;\n";
+    return ret;
+}
+
+// Returns the given gcode without the lines which are empty once the comments are removed
+static std::string remove_empty_lines(const std::string& data)
+{
+    std::string ret;
+    auto begin_it = data.begin();
+    auto end_it = data.begin();
+    while (end_it != data.end()) {
+        while (end_it != data.end() && *end_it != '\n') {
+            ++end_it;
+        }
+
+        const size_t pos = std::distance(data.begin(), begin_it);
+        const size_t line_length = std::distance(begin_it, end_it);
+        const std::string_view original_line(&data[pos], line_length);
+        const std::string_view reduced_line = uncomment(trim(original_line));
+        if (!reduced_line.empty())
+            ret += std::string(original_line) + "\n";
+        if (end_it == data.end())
+            break;
+        begin_it = ++end_it;
+    }
+
+    return ret;
+}
+
+BGCODE_CONVERT_EXPORT EResult from_binary_to_ascii(FILE& src_file, FILE& dst_file, bool verify_checksum, ConversionStats* stats)
+{
+    const ScopedConversionStats scoped_stats(stats);
+
     // initialize buffer for checksum calculation, if verify_checksum is true
     std::vector<std::byte> checksum_buffer;
     if (verify_checksum)
         checksum_buffer.resize(65535);
 
     auto write_line = [&](const std::string& line) {
+        BGCODE_TRACE_SCOPE("write_to_file");
+        const ScopedConversionStage stage(ConversionStats::EStage::IO);
         const size_t wsize = fwrite(line.data(), 1, line.length(), &dst_file);
+        add_conversion_bytes_written(wsize);
         return !ferror(&dst_file) && wsize == line.length();
     };
 
@@ -656,31 +578,7 @@ BGCODE_CONVERT_EXPORT EResult from_binary_to_ascii(FILE& src_file, FILE& dst_fil
         if (res != EResult::Success)
             // propagate error
             return res;
-        static constexpr const size_t max_row_length = 78;
-        std::string encoded;
-        encoded.resize(boost::beast::detail::base64::encoded_size(thumbnail_block.data.size()));
-        encoded.resize(boost::beast::detail::base64::encode((void*)encoded.data(), (const void*)thumbnail_block.data.data(), thumbnail_block.data.size()));
-        std::string format;
-        switch ((EThumbnailFormat)thumbnail_block.params.format)
-        {
-        default:
-        case EThumbnailFormat::PNG: { format = "thumbnail"; break; }
-        case EThumbnailFormat::JPG: { format = "thumbnail_JPG"; break; }
-        case EThumbnailFormat::QOI: { format = "thumbnail_QOI"; break; }
-        }
-        if (!write_line("\n;\n; " + format + " begin " + std::to_string(thumbnail_block.params.width) + "x" + std::to_string(thumbnail_block.params.height) +
-            " " + std::to_string(encoded.length()) + "\n"))
-            return EResult::WriteError;
-        while (encoded.size() > max_row_length) {
-            if (!write_line("; " + encoded.substr(0, max_row_length) + "\n"))
-                return EResult::WriteError;
-            encoded = encoded.substr(max_row_length);
-        }
-        if (encoded.size() > 0) {
-            if (!write_line("; " + encoded + "\n"))
-                return EResult::WriteError;
-        }
-        if (!write_line("; " + format + " end\n;\n"))
+        if (!write_line(thumbnail_to_ascii(thumbnail_block)))
             return EResult::WriteError;
 
         restore_position = ftell(&src_file);
@@ -693,27 +591,6 @@ BGCODE_CONVERT_EXPORT EResult from_binary_to_ascii(FILE& src_file, FILE& dst_fil
     //
     // convert gcode blocks
     //
-    auto remove_empty_lines = [](const std::string& data) {
-        std::string ret;
-        auto begin_it = data.begin();
-        auto end_it = data.begin();
-        while (end_it != data.end()) {
-            while (end_it != data.end() && *end_it != '\n') {
-                ++end_it;
-            }
-
-          const size_t pos = std::distance(data.begin(), begin_it);
-          const size_t line_length = std::distance(begin_it, end_it);
-          const std::string_view original_line(&data[pos], line_length);
-          const std::string_view reduced_line = uncomment(trim(original_line));
-          if (!reduced_line.empty())
-              ret += std::string(original_line) + "\n";
-          begin_it = ++end_it;
-        }
-
-        return ret;
-    };
-
     if (!write_line("\n"))
         return EResult::WriteError;
     res = skip_block(src_file, file_header, block_header);
@@ -730,7 +607,11 @@ BGCODE_CONVERT_EXPORT EResult from_binary_to_ascii(FILE& src_file, FILE& dst_fil
         if (res != EResult::Success)
             // propagate error
             return res;
-        const std::string out_str = remove_empty_lines(block.raw_data);
+        std::string out_str;
+        {
+            const ScopedConversionStage stage(ConversionStats::EStage::Parse);
+            out_str = remove_empty_lines(block.raw_data);
+        }
         if (!out_str.empty()) {
             if (!write_line(out_str))
                 return EResult::WriteError;
@@ -787,5 +668,169 @@ BGCODE_CONVERT_EXPORT EResult from_binary_to_ascii(FILE& src_file, FILE& dst_fil
     return EResult::Success;
 }
 
+BGCODE_CONVERT_EXPORT EResult from_binary_to_ascii_stream(FILE& src_file, FILE& dst_file, bool verify_checksum)
+{
+    auto write_line = [&](const std::string& line) {
+        const size_t wsize = fwrite(line.data(), 1, line.length(), &dst_file);
+        return !ferror(&dst_file) && wsize == line.length();
+    };
+
+    auto write_metadata = [&](const std::vector<std::pair<std::string, std::string>>& data) {
+        for (const auto& [key, value] : data) {
+            if (!write_line("; " + key + " = " + value + "\n"))
+                return false;
+        }
+        return !ferror(&dst_file);
+    };
+
+    //
+    // read file header
+    //
+    FileHeader file_header;
+    EResult res = file_header.read(src_file, nullptr);
+    if (res != EResult::Success)
+        // propagate error
+        return res;
+    const EChecksumType checksum_type = (EChecksumType)file_header.checksum_type;
+
+    // print and slicer metadata precede the gcode into the binary file, but follow it into the ascii one
+    PrintMetadataBlock print_metadata_block;
+    SlicerMetadataBlock slicer_metadata_block;
+
+    std::optional<EBlockType> previous_type;
+    std::vector<std::byte> payload;
+    while (true) {
+        // stop at end of file, detected without seeking
+        const int c = fgetc(&src_file);
+        if (c == EOF) {
+            if (ferror(&src_file))
+                return EResult::ReadError;
+            break;
+        }
+        ungetc(c, &src_file);
+
+        BlockHeader block_header;
+        res = block_header.read(src_file);
+        if (res != EResult::Success)
+            // propagate error
+            return res;
+        const EBlockType type = (EBlockType)block_header.type;
+        if (!is_valid_block_sequence(previous_type, type))
+            return EResult::InvalidSequenceOfBlocks;
+
+        res = read_block_payload(src_file, block_header, payload);
+        if (res != EResult::Success)
+            // propagate error
+            return res;
+        Checksum checksum(checksum_type);
+        res = checksum.read(src_file);
+        if (res != EResult::Success)
+            // propagate error
+            return res;
+        if (verify_checksum && checksum_type != EChecksumType::None) {
+            Checksum cs(checksum_type);
+            update_checksum(cs, block_header);
+            cs.append(payload);
+            if (!cs.matches(checksum))
+                return EResult::InvalidChecksum;
+        }
+
+        switch (type)
+        {
+        case EBlockType::FileMetadata:
+        {
+            FileMetadataBlock file_metadata_block;
+            res = file_metadata_block.read_data(block_header, payload.data(), payload.size());
+            if (res != EResult::Success)
+                // propagate error
+                return res;
+            auto producer_it = std::find_if(file_metadata_block.raw_data.begin(), file_metadata_block.raw_data.end(),
+                [](const std::pair<std::string, std::string>& item) { return item.first == "Producer"; });
+            const std::string producer_str = (producer_it != file_metadata_block.raw_data.end()) ? producer_it->second : "Unknown";
+            if (!write_line("; generated by " + producer_str + "\n\n\n"))
+                return EResult::WriteError;
+            break;
+        }
+        case EBlockType::PrinterMetadata:
+        {
+            PrinterMetadataBlock printer_metadata_block;
+            res = printer_metadata_block.read_data(block_header, payload.data(), payload.size());
+            if (res != EResult::Success)
+                // propagate error
+                return res;
+            if (!write_metadata(printer_metadata_block.raw_data))
+                return EResult::WriteError;
+            break;
+        }
+        case EBlockType::Thumbnail:
+        {
+            ThumbnailBlock thumbnail_block;
+            res = thumbnail_block.read_data(block_header, payload.data(), payload.size());
+            if (res != EResult::Success)
+                // propagate error
+                return res;
+            if (!write_line(thumbnail_to_ascii(thumbnail_block)))
+                return EResult::WriteError;
+            break;
+        }
+        case EBlockType::PrintMetadata:
+        {
+            res = print_metadata_block.read_data(block_header, payload.data(), payload.size());
+            break;
+        }
+        case EBlockType::SlicerMetadata:
+        {
+            res = slicer_metadata_block.read_data(block_header, payload.data(), payload.size());
+            break;
+        }
+        case EBlockType::GCode:
+        {
+            if (previous_type != EBlockType::GCode && !write_line("\n"))
+                return EResult::WriteError;
+            GCodeBlock block;
+            res = block.read_data(block_header, payload.data(), payload.size());
+            if (res != EResult::Success)
+                // propagate error
+                return res;
+            const std::string out_str = remove_empty_lines(block.raw_data);
+            if (!out_str.empty()) {
+                if (!write_line(out_str))
+                    return EResult::WriteError;
+            }
+            break;
+        }
+        default: { return EResult::InvalidBlockType; }
+        }
+        if (res != EResult::Success)
+            // propagate error
+            return res;
+
+        previous_type = type;
+    }
+
+    if (previous_type != EBlockType::GCode)
+        return EResult::InvalidSequenceOfBlocks;
+
+    //
+    // convert print metadata block
+    //
+    if (!write_line("\n"))
+        return EResult::WriteError;
+    if (!write_metadata(print_metadata_block.raw_data))
+        return EResult::WriteError;
+
+    //
+    // convert slicer metadata block
+    //
+    if (!write_line("\n; prusaslicer_config = begin\n"))
+        return EResult::WriteError;
+    if (!write_metadata(slicer_metadata_block.raw_data))
+        return EResult::WriteError;
+    if (!write_line("; prusaslicer_config = end\n\n"))
+        return EResult::WriteError;
+
+    return EResult::Success;
+}
+
 } // namespace core
 } // namespace bgcode
@@ -8,10 +8,46 @@ namespace bgcode { namespace convert {
 
 // Converts the gcode file contained into src_file from ascii (using the parameters specified with the given config) to binary format
 // and save the results into dst_file,
-extern BGCODE_CONVERT_EXPORT core::EResult from_ascii_to_binary(FILE& src_file, FILE& dst_file, const binarize::BinarizerConfig& config);
+// If stats is not nullptr, it is filled with the statistics of the conversion.
+extern BGCODE_CONVERT_EXPORT core::EResult from_ascii_to_binary(FILE& src_file, FILE& dst_file, const binarize::BinarizerConfig& config,
+    core::ConversionStats* stats = nullptr);
 
 // Converts the gcode file contained into src_file from binary to ascii format and save the results into dst_file
-extern BGCODE_CONVERT_EXPORT core::EResult from_binary_to_ascii(FILE& src_file, FILE& dst_file, bool verify_checksum);
+// If stats is not nullptr, it is filled with the statistics of the conversion.
+extern BGCODE_CONVERT_EXPORT core::EResult from_binary_to_ascii(FILE& src_file, FILE& dst_file, bool verify_checksum,
+    core::ConversionStats* stats = nullptr);
+
+// Converts the gcode file contained into src_file from binary to ascii format and save the results into dst_file,
+// producing the same output as from_binary_to_ascii().
+// src_file is read strictly forward, once, so that it can be a pipe or a socket (f.e. stdin).
+// Blocks are validated while read, so dst_file may contain partial output when an error is returned.
+extern BGCODE_CONVERT_EXPORT core::EResult from_binary_to_ascii_stream(FILE& src_file, FILE& dst_file, bool verify_checksum);
+
+struct BGCODE_CONVERT_EXPORT GeneratorConfig
+{
+    // approximate size of the generated file, in bytes
+    uint64_t size{ 1024 * 1024 };
+    // seed of the pseudo random moves, the same config always generates the same file
+    uint32_t seed{ 0 };
+    // thumbnails, in the order they are emitted
+    // their data is filled with random bytes after the signature of the format, so it does not decode into images
+    std::vector<core::ThumbnailParams> thumbnails{
+        { (uint16_t)core::EThumbnailFormat::PNG, 16, 16 },
+        { (uint16_t)core::EThumbnailFormat::PNG, 220, 124 },
+        { (uint16_t)core::EThumbnailFormat::QOI, 240, 240 },
+        { (uint16_t)core::EThumbnailFormat::JPG, 480, 240 } };
+    // count of extrusion moves per layer, small values produce tiny layer aligned gcode blocks
+    size_t moves_per_layer{ 400 };
+    // when both not zero, a comment line of this length is emitted every long_lines_interval lines
+    size_t long_line_length{ 0 };
+    size_t long_lines_interval{ 1000 };
+    // use "\r\n" line endings
+    bool crlf{ false };
+};
+
+// Writes into dst_file an ascii gcode file, in the format produced by PrusaSlicer, as described by the given config.
+// The file contains the metadata, the thumbnails, the layers of gcode and the slicer config.
+extern BGCODE_CONVERT_EXPORT core::EResult generate_gcode(FILE& dst_file, const GeneratorConfig& config);
 
 }} // bgcode::core
 
@@ -0,0 +1,164 @@
+#ifndef GCODE_READER_HPP
+#define GCODE_READER_HPP
+
+#include "core/core_impl.hpp"
+
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace bgcode { namespace convert {
+
+// Splits an ascii gcode file into lines
+class GCodeReader
+{
+public:
+    struct GCodeLine
+    {
+        std::string raw;
+        void reset() { raw.clear(); }
+    };
+
+    GCodeReader(FILE& file) : m_file(file) {}
+
+    typedef std::function<void(GCodeReader&, const GCodeLine&)> ParseLineCallback;
+    typedef std::function<void(const char*, const char*)> InternalParseLineCallback;
+
+    // Returns false if reading the file failed.
+    bool parse(ParseLineCallback callback) {
+        const core::ScopedConversionStage stage(core::ConversionStats::EStage::Parse);
+        GCodeLine gline;
+        m_parsing = true;
+        return parse_internal([this, &gline, callback](const char* begin, const char* end) {
+              gline.reset();
+              parse_line(begin, end, gline, callback);
+        });
+    }
+
+    void quit_parsing() { m_parsing = false; }
+
+private:
+    FILE& m_file;
+    bool m_parsing{ false };
+
+    bool parse_internal(InternalParseLineCallback parse_line_callback) {
+        BGCODE_TRACE_SCOPE("GCodeReader::parse_internal");
+        // Read the input stream 64kB at a time, extract lines and process them.
+        std::vector<char> buffer(65536 * 10, 0);
+        // Line buffer.
+        std::string gcode_line;
+        size_t file_pos = 0;
+        for (;;) {
+            size_t cnt_read;
+            {
+                BGCODE_TRACE_SCOPE("read_from_file");
+                const core::ScopedConversionStage stage(core::ConversionStats::EStage::IO);
+                cnt_read = ::fread(buffer.data(), 1, buffer.size(), &m_file);
+                core::add_conversion_bytes_read(cnt_read);
+            }
+            if (::ferror(&m_file)) {
+                m_parsing = false;
+                return false;
+            }
+            bool eof = cnt_read == 0;
+            auto it = buffer.begin();
+            auto it_bufend = buffer.begin() + cnt_read;
+            while (it != it_bufend || (eof && !gcode_line.empty())) {
+                // Find end of line.
+                bool eol = false;
+                auto it_end = it;
+                for (; it_end != it_bufend && !(eol = *it_end == '\r' || *it_end == '\n'); ++it_end)
+                    ; // silence -Wempty-body
+                // End of line is indicated also if end of file was reached.
+                eol |= eof && it_end == it_bufend;
+                if (eol) {
+                    if (gcode_line.empty())
+                        parse_line_callback(&(*it), &(*it_end));
+                    else {
+                        gcode_line.insert(gcode_line.end(), it, it_end);
+                        parse_line_callback(gcode_line.c_str(), gcode_line.c_str() + gcode_line.size());
+                        gcode_line.clear();
+                    }
+                    if (!m_parsing)
+                        // The callback wishes to exit.
+                        return true;
+                }
+                else
+                    gcode_line.insert(gcode_line.end(), it, it_end);
+                // Skip EOL.
+                it = it_end;
+                if (it != it_bufend && *it == '\r')
+                    ++it;
+                if (it != it_bufend && *it == '\n')
+                    ++it;
+            }
+            if (eof)
+                break;
+            file_pos += cnt_read;
+        }
+        m_parsing = false;
+        return true;
+    }
+
+    const char* parse_line(const char* ptr, const char* end, GCodeLine& gline, ParseLineCallback callback) {
+        std::pair<const char*, const char*> cmd;
+        const char* line_end = parse_line_internal(ptr, end, gline, cmd);
+        callback(*this, gline);
+        return line_end;
+    }
+
+    const char* parse_line_internal(const char* ptr, const char* end, GCodeLine& gline, std::pair<const char*, const char*>& command) {
+        // command and args
+        const char* c = ptr;
+        {
+            // Skip the whitespaces.
+            command.first = skip_whitespaces(c);
+            // Skip the command.
+            c = command.second = skip_word(command.first);
+            // Up to the end of line or comment.
+            while (!is_end_of_gcode_line(*c)) {
+                // Skip whitespaces.
+                c = skip_whitespaces(c);
+                if (is_end_of_gcode_line(*c))
+                    break;
+                // Skip the rest of the word.
+                c = skip_word(c);
+            }
+        }
+
+        // Skip the rest of the line.
+        for (; !is_end_of_line(*c); ++c);
+
+        // Copy the raw string including the comment, without the trailing newlines.
+        if (c > ptr)
+            gline.raw.assign(ptr, c);
+
+        // Skip the trailing newlines.
+        if (*c == '\r')
+            ++c;
+        if (*c == '\n')
+            ++c;
+
+        return c;
+    }
+
+    static bool        is_whitespace(char c) { return c == ' ' || c == '\t'; }
+    static bool        is_end_of_line(char c) { return c == '\r' || c == '\n' || c == 0; }
+    static bool        is_end_of_gcode_line(char c) { return c == ';' || is_end_of_line(c); }
+    static bool        is_end_of_word(char c) { return is_whitespace(c) || is_end_of_gcode_line(c); }
+    static const char* skip_whitespaces(const char* c) {
+        for (; is_whitespace(*c); ++c)
+            ; // silence -Wempty-body
+        return c;
+    }
+    static const char* skip_word(const char* c) {
+        for (; !is_end_of_word(*c); ++c)
+            ; // silence -Wempty-body
+        return c;
+    }
+};
+
+}} // namespace bgcode::convert
+
+#endif // GCODE_READER_HPP
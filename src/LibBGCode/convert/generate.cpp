@@ -0,0 +1,367 @@
+#include "convert.hpp"
+
+#include <boost/beast/core/detail/base64.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace bgcode {
+using namespace core;
+namespace convert {
+
+// Deterministic pseudo random generator (splitmix64), the results do not depend on the platform
+class Random
+{
+public:
+    explicit Random(uint64_t seed) : m_state(seed) {}
+
+    uint64_t next() {
+        uint64_t z = (m_state += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+
+    // Returns a value in [min, max)
+    double range(double min, double max) { return min + (max - min) * double(next() >> 11) / double(1ull << 53); }
+
+private:
+    uint64_t m_state;
+};
+
+// Buffered writer of gcode lines
+class LineWriter
+{
+public:
+    LineWriter(FILE& file, bool crlf) : m_file(file), m_eol(crlf ? "\r\n" : "\n") {}
+
+    void line(std::string_view str) {
+        m_buffer.append(str);
+        m_buffer.append(m_eol);
+        ++m_lines_count;
+        if (m_buffer.size() >= 65536)
+            flush();
+    }
+
+    bool flush() {
+        if (!m_buffer.empty()) {
+            const size_t wsize = fwrite(m_buffer.data(), 1, m_buffer.size(), &m_file);
+            m_error |= wsize != m_buffer.size() || ferror(&m_file);
+            m_buffer.clear();
+        }
+        return !m_error;
+    }
+
+    size_t lines_count() const { return m_lines_count; }
+
+private:
+    FILE& m_file;
+    std::string_view m_eol;
+    std::string m_buffer;
+    size_t m_lines_count{ 0 };
+    bool m_error{ false };
+};
+
+// Returns the given value without trailing zeros
+static std::string format_value(double value, int decimals)
+{
+    char buf[64];
+    std::snprintf(buf, sizeof(buf), "%.*f", decimals, value);
+    std::string ret(buf);
+    if (ret.find('.') != std::string::npos) {
+        while (ret.back() == '0') { ret.pop_back(); }
+        if (ret.back() == '.')
+            ret.pop_back();
+    }
+    return (ret == "-0") ? "0" : ret;
+}
+
+// Returns the given value formatted as PrusaSlicer does into the gcode moves, also without the leading zero
+static std::string format_coord(double value, int decimals)
+{
+    std::string ret = format_value(value, decimals);
+    if (ret.compare(0, 2, "0.") == 0)
+        ret.erase(0, 1);
+    else if (ret.compare(0, 3, "-0.") == 0)
+        ret.erase(1, 1);
+    return ret;
+}
+
+static std::string format_time(double seconds)
+{
+    const uint64_t s = (uint64_t)seconds;
+    std::string ret;
+    if (s >= 86400)
+        ret += std::to_string(s / 86400) + "d ";
+    if (s >= 3600)
+        ret += std::to_string((s / 3600) % 24) + "h ";
+    if (s >= 60)
+        ret += std::to_string((s / 60) % 60) + "m ";
+    return ret + std::to_string(s % 60) + "s";
+}
+
+// Returns about the size of a compressed image with few colors
+static size_t thumbnail_data_size(const ThumbnailParams& params)
+{
+    return std::max<size_t>(32, size_t(params.width) * size_t(params.height) / 4);
+}
+
+static void write_thumbnail(LineWriter& writer, Random& random, const ThumbnailParams& params)
+{
+    std::string_view format;
+    std::vector<uint8_t> signature;
+    switch ((EThumbnailFormat)params.format)
+    {
+    default:
+    case EThumbnailFormat::PNG: {
+        format = "thumbnail";
+        signature = { 0x89, 'P', 'N', 'G', 0x0d, 0x0a, 0x1a, 0x0a };
+        break;
+    }
+    case EThumbnailFormat::JPG: {
+        format = "thumbnail_JPG";
+        signature = { 0xff, 0xd8, 0xff, 0xe0 };
+        break;
+    }
+    case EThumbnailFormat::QOI: {
+        format = "thumbnail_QOI";
+        signature = { 'q', 'o', 'i', 'f', 0, 0, (uint8_t)(params.width >> 8), (uint8_t)params.width, 0, 0,
+            (uint8_t)(params.height >> 8), (uint8_t)params.height, 3, 0 };
+        break;
+    }
+    }
+
+    const size_t data_size = thumbnail_data_size(params);
+    const size_t encoded_size = boost::beast::detail::base64::encoded_size(data_size);
+
+    writer.line(";");
+    writer.line("; " + std::string(format) + " begin " + std::to_string(params.width) + "x" + std::to_string(params.height) + " " +
+        std::to_string(encoded_size));
+    // 57 bytes are encoded into rows of 76 characters
+    static constexpr const size_t row_data_size = 57;
+    std::vector<uint8_t> row(row_data_size);
+    std::string encoded(boost::beast::detail::base64::encoded_size(row_data_size), '\0');
+    for (size_t offset = 0; offset < data_size; offset += row_data_size) {
+        const size_t size = std::min(row_data_size, data_size - offset);
+        for (size_t i = 0; i < size; ++i) {
+            row[i] = (offset + i < signature.size()) ? signature[offset + i] : (uint8_t)random.next();
+        }
+        const size_t length = boost::beast::detail::base64::encode(encoded.data(), row.data(), size);
+        writer.line("; " + encoded.substr(0, length));
+    }
+    writer.line("; " + std::string(format) + " end");
+    writer.line(";");
+    writer.line("");
+}
+
+// Slicer config, emitted at the end of the file
+static const std::vector<std::pair<std::string_view, std::string_view>> SlicerConfig = {
+    { "avoid_crossing_perimeters", "0" },
+    { "bed_shape", "0x0,180x0,180x180,0x180" },
+    { "bed_temperature", "60" },
+    { "bottom_solid_layers", "4" },
+    { "bridge_speed", "25" },
+    { "brim_width", "0" },
+    { "complete_objects", "0" },
+    { "cooling", "1" },
+    { "default_acceleration", "1250" },
+    { "external_perimeter_speed", "25" },
+    { "extruder_colour", "\"\"" },
+    { "extrusion_multiplier", "1" },
+    { "fan_always_on", "1" },
+    { "filament_diameter", "1.75" },
+    { "filament_settings_id", "\"Prusament PLA\"" },
+    { "filament_type", "PLA" },
+    { "fill_density", "15%" },
+    { "fill_pattern", "grid" },
+    { "first_layer_height", "0.2" },
+    { "first_layer_speed", "20" },
+    { "gcode_flavor", "marlin2" },
+    { "infill_speed", "140" },
+    { "ironing", "0" },
+    { "layer_height", "0.2" },
+    { "max_print_speed", "150" },
+    { "nozzle_diameter", "0.4" },
+    { "perimeter_speed", "45" },
+    { "perimeters", "2" },
+    { "print_settings_id", "\"0.20mm QUALITY @MINI\"" },
+    { "printer_model", "MINI" },
+    { "printer_settings_id", "\"Original Prusa MINI & MINI+\"" },
+    { "retract_length", "3.2" },
+    { "retract_speed", "70" },
+    { "skirts", "1" },
+    { "solid_infill_speed", "80" },
+    { "support_material", "0" },
+    { "temperature", "215" },
+    { "top_solid_layers", "5" },
+    { "travel_speed", "150" },
+    { "wipe", "1" },
+    { "z_offset", "0" }
+};
+
+BGCODE_CONVERT_EXPORT EResult generate_gcode(FILE& dst_file, const GeneratorConfig& config)
+{
+    static constexpr const double Pi = 3.14159265358979323846;
+    static constexpr const double LayerHeight = 0.2;
+    static constexpr const double ExtrusionPerMm = 0.0333;
+    static constexpr const double MoveMaxLength = 10.0;
+    static constexpr const double BedMin = 10.0;
+    static constexpr const double BedMax = 170.0;
+    // average sizes of the lines, used to plan the count of layers
+    static constexpr const uint64_t MoveLineSize = 28;
+    static constexpr const uint64_t LayerHeaderSize = 60;
+    static constexpr const uint64_t TravelSize = 100;
+    static constexpr const uint64_t FixedSize = 3000;
+
+    Random random(config.seed);
+    LineWriter writer(dst_file, config.crlf);
+
+    const size_t moves_per_layer = std::max<size_t>(1, config.moves_per_layer);
+    // a travel, made of 6 lines, every 50 moves
+    const uint64_t travels_per_layer = (moves_per_layer + 49) / 50;
+    uint64_t layer_size = LayerHeaderSize + moves_per_layer * MoveLineSize + travels_per_layer * TravelSize;
+    if (config.long_line_length > 0 && config.long_lines_interval > 0) {
+        const uint64_t layer_lines = 5 + moves_per_layer + 6 * travels_per_layer;
+        layer_size += layer_lines * config.long_line_length / config.long_lines_interval;
+    }
+    uint64_t fixed_size = FixedSize;
+    for (const ThumbnailParams& params : config.thumbnails) {
+        // base64 encoded, in rows of 76 characters
+        fixed_size += thumbnail_data_size(params) * 4 / 3 * 80 / 76;
+    }
+    const size_t layers_count = (size_t)std::max<uint64_t>(1, (config.size - std::min(config.size, fixed_size)) / layer_size);
+
+    // planned totals, reported both into the header and into the footer
+    const double filament_mm = double(layers_count * moves_per_layer) * 0.5 * MoveMaxLength * ExtrusionPerMm;
+    const double filament_cm3 = filament_mm * Pi * 0.875 * 0.875 / 1000.0;
+    const double filament_g = filament_cm3 * 1.24;
+    const double print_time = double(layers_count * moves_per_layer) * 0.12;
+    const double max_layer_z = double(layers_count) * LayerHeight;
+
+    auto metadata = [&writer](std::string_view key, const std::string& value) {
+        writer.line("; " + std::string(key) + " = " + value);
+    };
+
+    // header
+    writer.line("; generated by PrusaSlicer 2.6.0 on 2026-01-01 at 00:00:00 UTC");
+    writer.line("");
+    writer.line("");
+    metadata("printer_model", "MINI");
+    metadata("filament_type", "PLA");
+    metadata("nozzle_diameter", "0.4");
+    metadata("bed_temperature", "60");
+    metadata("brim_width", "0");
+    metadata("fill_density", "15%");
+    metadata("layer_height", format_value(LayerHeight, 2));
+    metadata("temperature", "215");
+    metadata("ironing", "0");
+    metadata("support_material", "0");
+    metadata("max_layer_z", format_value(max_layer_z, 2));
+    metadata("extruder_colour", "\"\"");
+    metadata("filament used [mm]", format_value(filament_mm, 2));
+    metadata("filament used [cm3]", format_value(filament_cm3, 2));
+    metadata("filament used [g]", format_value(filament_g, 2));
+    metadata("filament cost", format_value(filament_g * 0.025, 2));
+    metadata("estimated printing time (normal mode)", format_time(print_time));
+    writer.line("");
+
+    for (const ThumbnailParams& params : config.thumbnails) {
+        write_thumbnail(writer, random, params);
+    }
+
+    writer.line("; external perimeters extrusion width = 0.45mm");
+    writer.line("; perimeters extrusion width = 0.45mm");
+    writer.line("; infill extrusion width = 0.45mm");
+    writer.line("; first layer extrusion width = 0.42mm");
+    writer.line("M73 P0 R" + std::to_string((uint64_t)print_time / 60));
+    writer.line("M201 X2500 Y2500 Z400 E5000");
+    writer.line("M203 X180 Y180 Z12 E80");
+    writer.line("M204 P2000 R1250 T2500");
+    writer.line(";TYPE:Custom");
+    writer.line("M862.3 P \"MINI\"");
+    writer.line("G90");
+    writer.line("M83");
+    writer.line("M104 S215");
+    writer.line("M140 S60");
+    writer.line("M190 S60");
+    writer.line("M109 S215");
+    writer.line("G28");
+    writer.line("G29");
+    writer.line("G92 E0");
+    writer.line("M107");
+
+    // layers
+    static constexpr const std::string_view Types[] = { "Perimeter", "External perimeter", "Internal infill", "Solid infill" };
+    std::string long_line;
+    // an interval of zero disables the long lines, as in the size planning
+    if (config.long_line_length > 0 && config.long_lines_interval > 0)
+        long_line = "; " + std::string(config.long_line_length > 2 ? config.long_line_length - 2 : 0, 'x');
+    size_t next_long_line = writer.lines_count() + config.long_lines_interval;
+    double x = 90.0;
+    double y = 90.0;
+    for (size_t layer = 0; layer < layers_count; ++layer) {
+        const double z = double(layer + 1) * LayerHeight;
+        writer.line(";LAYER_CHANGE");
+        writer.line(";Z:" + format_value(z, 2));
+        writer.line(";HEIGHT:" + format_value(LayerHeight, 2));
+        writer.line("G1 Z" + format_coord(z, 3) + " F720");
+        const uint64_t progress = 100 * layer / layers_count;
+        writer.line("M73 P" + std::to_string(progress) + " R" + std::to_string((uint64_t)(print_time * double(100 - progress) / 6000.0)));
+        for (size_t move = 0; move < moves_per_layer; ++move) {
+            if (move % 50 == 0) {
+                // travel to a new region, with retraction
+                writer.line(";TYPE:" + std::string(Types[(random.next() >> 32) % std::size(Types)]));
+                writer.line(";WIDTH:0.45");
+                writer.line("G1 E-3.2 F4200");
+                x = random.range(BedMin, BedMax);
+                y = random.range(BedMin, BedMax);
+                writer.line("G1 X" + format_coord(x, 3) + " Y" + format_coord(y, 3) + " F9000");
+                writer.line("G1 E3.2 F4200");
+                writer.line("G1 F1800");
+            }
+            const double angle = random.range(0.0, 2.0 * Pi);
+            const double length = random.range(0.0, MoveMaxLength);
+            x = std::clamp(x + length * std::cos(angle), BedMin, BedMax);
+            y = std::clamp(y + length * std::sin(angle), BedMin, BedMax);
+            writer.line("G1 X" + format_coord(x, 3) + " Y" + format_coord(y, 3) + " E" + format_coord(length * ExtrusionPerMm, 5));
+            if (!long_line.empty() && writer.lines_count() >= next_long_line) {
+                writer.line(long_line);
+                next_long_line += config.long_lines_interval;
+            }
+        }
+        if (!writer.flush())
+            return EResult::WriteError;
+    }
+
+    // footer
+    writer.line("G1 Z" + format_coord(max_layer_z + 10.0, 3) + " F720");
+    writer.line("M104 S0");
+    writer.line("M140 S0");
+    writer.line("M107");
+    writer.line("M84");
+    writer.line("M73 P100 R0");
+    writer.line("");
+    metadata("filament used [mm]", format_value(filament_mm, 2));
+    metadata("filament used [cm3]", format_value(filament_cm3, 2));
+    metadata("filament used [g]", format_value(filament_g, 2));
+    metadata("filament cost", format_value(filament_g * 0.025, 2));
+    metadata("total filament used [g]", format_value(filament_g, 2));
+    metadata("total filament cost", format_value(filament_g * 0.025, 2));
+    metadata("estimated printing time (normal mode)", format_time(print_time));
+    metadata("estimated first layer printing time (normal mode)", format_time(print_time / double(layers_count)));
+    writer.line("");
+    metadata("prusaslicer_config", "begin");
+    for (const auto& [key, value] : SlicerConfig) {
+        metadata(key, std::string(value));
+    }
+    metadata("prusaslicer_config", "end");
+
+    return writer.flush() ? EResult::Success : EResult::WriteError;
+}
+
+}} // namespace bgcode::convert
@@ -1,12 +1,30 @@
 #include "core_impl.hpp"
+#include <algorithm>
 #include <cstring>
 
+#ifdef BGCODE_ENABLE_TRACING
+#include <atomic>
+#include <memory>
+#include <mutex>
+#endif // BGCODE_ENABLE_TRACING
+
+#if defined(__linux__) && !defined(__EMSCRIPTEN__)
+#include <sys/sendfile.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+#define BGCODE_HAS_KERNEL_COPY 1
+#endif
+
 namespace bgcode { namespace core {
 
 template<class T>
 static bool write_to_file(FILE& file, const T* data, size_t data_size)
 {
+    BGCODE_TRACE_SCOPE("write_to_file");
+    const ScopedConversionStage stage(ConversionStats::EStage::IO);
     const size_t wsize = fwrite(static_cast<const void*>(data), 1, data_size, &file);
+    add_conversion_bytes_written(wsize);
     return !ferror(&file) && wsize == data_size;
 }
 
@@ -15,16 +33,82 @@ static bool read_from_file(FILE& file, T *data, size_t data_size)
 {
     static_assert(!std::is_const_v<T>, "Type of output buffer cannot be const!");
 
+    BGCODE_TRACE_SCOPE("read_from_file");
+    const ScopedConversionStage stage(ConversionStats::EStage::IO);
     const size_t rsize = fread(static_cast<void *>(data), 1, data_size, &file);
+    add_conversion_bytes_read(rsize);
     return !ferror(&file) && rsize == data_size;
 }
 
+static thread_local ConversionStats* s_conversion_stats = nullptr;
+static thread_local ConversionStats::EStage s_conversion_stage = ConversionStats::EStage::Count;
+static thread_local std::chrono::steady_clock::time_point s_conversion_stage_start;
+
+// Adds the time elapsed since the current stage was entered, or resumed, to the current stage
+static void update_conversion_stage_time()
+{
+    const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (s_conversion_stats != nullptr && s_conversion_stage != ConversionStats::EStage::Count)
+        s_conversion_stats->stage_times[(size_t)s_conversion_stage] += std::chrono::duration<double>(now - s_conversion_stage_start).count();
+    s_conversion_stage_start = now;
+}
+
+ConversionStats* get_conversion_stats() noexcept
+{
+    return s_conversion_stats;
+}
+
+ConversionStats* set_conversion_stats(ConversionStats* stats) noexcept
+{
+    ConversionStats* ret = s_conversion_stats;
+    s_conversion_stats = stats;
+    s_conversion_stage = ConversionStats::EStage::Count;
+    return ret;
+}
+
+ConversionStats::EStage enter_conversion_stage(ConversionStats::EStage stage) noexcept
+{
+    update_conversion_stage_time();
+    const ConversionStats::EStage ret = s_conversion_stage;
+    s_conversion_stage = stage;
+    return ret;
+}
+
+void leave_conversion_stage(ConversionStats::EStage previous) noexcept
+{
+    update_conversion_stage_time();
+    s_conversion_stage = previous;
+}
+
+void add_conversion_block(const BlockHeader& block_header) noexcept
+{
+    if (s_conversion_stats == nullptr || block_header.type >= s_conversion_stats->blocks.size())
+        return;
+
+    const size_t compressed_size = (block_header.compression == (uint16_t)ECompressionType::None) ?
+        block_header.uncompressed_size : block_header.compressed_size;
+    ConversionStats::Blocks& blocks = s_conversion_stats->blocks[block_header.type];
+    ++blocks.count;
+    blocks.compressed_size += compressed_size;
+    blocks.uncompressed_size += block_header.uncompressed_size;
+    s_conversion_stats->peak_compressed_size = std::max<size_t>(s_conversion_stats->peak_compressed_size, compressed_size);
+    s_conversion_stats->peak_uncompressed_size = std::max<size_t>(s_conversion_stats->peak_uncompressed_size, block_header.uncompressed_size);
+}
+
+double ConversionStats::compression_ratio(EBlockType type) const
+{
+    const Blocks& item = blocks[(size_t)type];
+    return (item.uncompressed_size == 0) ? 1.0 : (double)item.compressed_size / (double)item.uncompressed_size;
+}
+
 EResult verify_block_checksum(FILE& file, const FileHeader& file_header,
                               const BlockHeader& block_header, std::byte* buffer, size_t buffer_size)
 {
     if (buffer == nullptr || buffer_size == 0)
         return EResult::InvalidBuffer;
 
+    const ScopedConversionStage stage(ConversionStats::EStage::Checksum);
+
     // No checksum in file, no checking, just return success
     if (file_header.checksum_type == (uint16_t)EChecksumType::None)
         return EResult::Success;
@@ -77,6 +161,11 @@ bool Checksum::matches(Checksum& other)
     return m_checksum == other.m_checksum;
 }
 
+bool Checksum::matches(const std::byte* data, size_t size) const
+{
+    return size == m_size && std::equal(data, data + size, m_checksum.begin());
+}
+
 EResult Checksum::write(FILE& file)
 {
     if (m_type != EChecksumType::None) {
@@ -142,6 +231,11 @@ EResult FileHeader::read(FILE& file, const uint32_t* const max_version)
     return EResult::Success;
 }
 
+size_t FileHeader::get_size() const
+{
+    return sizeof(magic) + sizeof(version) + sizeof(checksum_type);
+}
+
 BlockHeader::BlockHeader(uint16_t type, uint16_t compression, uint32_t uncompressed_size, uint32_t compressed_size)
   : type(type)
   , compression(compression)
@@ -156,7 +250,6 @@ long BlockHeader::get_position() const
 
 EResult BlockHeader::write(FILE& file)
 {
-    m_position = ftell(&file);
     if (!write_to_file(file, &type, sizeof(type)))
         return EResult::WriteError;
     if (!write_to_file(file, &compression, sizeof(compression)))
@@ -253,6 +346,8 @@ BGCODE_CORE_EXPORT std::string_view translate_result(EResult result)
     case EResult::MissingPrinterMetadata:      { return "Missing printer metadata"sv; }
     case EResult::MissingPrintMetadata:        { return "Missing print metadata"sv; }
     case EResult::MissingSlicerMetadata:       { return "Missing slicer metadata"sv; }
+    case EResult::MemoryLimitExceeded:         { return "Memory limit exceeded"sv; }
+    case EResult::IndexMismatch:               { return "Index does not match the file"sv; }
     }
     return std::string_view();
 }
@@ -497,12 +592,89 @@ BGCODE_CORE_EXPORT EResult skip_block_content(FILE& file, const FileHeader& file
     return ferror(&file) ? EResult::ReadError : EResult::Success;
 }
 
+BGCODE_CORE_EXPORT EResult read_block_payload(FILE& file, const BlockHeader& block_header, std::vector<std::byte>& payload)
+{
+    payload.resize(block_payload_size(block_header));
+    if (!read_from_file(file, payload.data(), payload.size()))
+        return EResult::ReadError;
+    return EResult::Success;
+}
+
 BGCODE_CORE_EXPORT EResult skip_block(FILE& file, const FileHeader& file_header, const BlockHeader& block_header)
 {
     fseek(&file, block_header.get_position() + (long)block_header.get_size() + (long)block_content_size(file_header, block_header), SEEK_SET);
     return ferror(&file) ? EResult::ReadError : EResult::Success;
 }
 
+#ifdef BGCODE_HAS_KERNEL_COPY
+// Copies the bytes in kernel space, returns the count of copied bytes
+static size_t kernel_copy(int src_fd, off_t src_position, size_t size, int dst_fd)
+{
+    size_t copied = 0;
+    off_t offset = src_position;
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+    // regular files
+    while (copied < size) {
+        const ssize_t ret = copy_file_range(src_fd, &offset, dst_fd, nullptr, size - copied, 0);
+        if (ret <= 0)
+            break;
+        copied += (size_t)ret;
+    }
+#endif // __GLIBC__
+    // any output file (ex. pipes), or file systems not supporting copy_file_range
+    while (copied < size) {
+        const ssize_t ret = sendfile(dst_fd, src_fd, &offset, size - copied);
+        if (ret <= 0)
+            break;
+        copied += (size_t)ret;
+    }
+    return copied;
+}
+#endif // BGCODE_HAS_KERNEL_COPY
+
+BGCODE_CORE_EXPORT EResult copy_file_bytes(FILE& src_file, long src_position, size_t size, FILE& dst_file)
+{
+    size_t copied = 0;
+#ifdef BGCODE_HAS_KERNEL_COPY
+    // synchronize the output descriptor with the stream, in kernel copies bypass the stdio buffers
+    if (fflush(&dst_file) != 0)
+        return EResult::WriteError;
+    const long dst_position = ftell(&dst_file);
+    const int dst_fd = fileno(&dst_file);
+    if (dst_position >= 0) {
+        if (lseek(dst_fd, (off_t)dst_position, SEEK_SET) == (off_t)dst_position) {
+            copied = kernel_copy(fileno(&src_file), (off_t)src_position, size, dst_fd);
+            // resynchronize the stream with the descriptor
+            if (fseek(&dst_file, dst_position + (long)copied, SEEK_SET) != 0)
+                return EResult::WriteError;
+        }
+    }
+    else if (errno == ESPIPE)
+        // non-seekable output (ex. pipes): the descriptor is written sequentially, the flushed stream stays in sync
+        copied = kernel_copy(fileno(&src_file), (off_t)src_position, size, dst_fd);
+#endif // BGCODE_HAS_KERNEL_COPY
+
+    // buffered copy of the remaining bytes
+    if (fseek(&src_file, src_position + (long)copied, SEEK_SET) != 0)
+        return EResult::ReadError;
+    std::array<std::byte, 65536> buffer;
+    while (copied < size) {
+        const size_t size_to_copy = std::min(size - copied, buffer.size());
+        if (!read_from_file(src_file, buffer.data(), size_to_copy))
+            return EResult::ReadError;
+        if (!write_to_file(dst_file, buffer.data(), size_to_copy))
+            return EResult::WriteError;
+        copied += size_to_copy;
+    }
+    return EResult::Success;
+}
+
+BGCODE_CORE_EXPORT EResult copy_block(FILE& src_file, const FileHeader& file_header, const BlockHeader& block_header, FILE& dst_file)
+{
+    const size_t size = block_header.get_size() + block_content_size(file_header, block_header);
+    return copy_file_bytes(src_file, block_header.get_position(), size, dst_file);
+}
+
 BGCODE_CORE_EXPORT size_t block_payload_size(const BlockHeader& block_header)
 {
     size_t ret = block_parameters_size((EBlockType)block_header.type);
@@ -526,6 +698,108 @@ BGCODE_CORE_EXPORT size_t block_content_size(const FileHeader& file_header, cons
   return block_payload_size(block_header) + checksum_size((EChecksumType)file_header.checksum_type);
 }
 
+#ifdef BGCODE_ENABLE_TRACING
+struct TraceSpan
+{
+    const char* name;
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point end;
+};
+
+// Spans recorded by a thread, shared with the registry so that they survive the thread
+struct TraceBuffer
+{
+    std::mutex mutex;
+    size_t thread_id{ 0 };
+    std::vector<TraceSpan> spans;
+};
+
+static std::atomic<bool> s_tracing{ false };
+static std::mutex s_trace_mutex;
+static std::vector<std::shared_ptr<TraceBuffer>> s_trace_buffers;
+static size_t s_trace_threads_count = 0;
+static std::chrono::steady_clock::time_point s_trace_start;
+
+// Returns the buffer of the calling thread, registering it on first use
+static TraceBuffer& get_trace_buffer()
+{
+    thread_local std::shared_ptr<TraceBuffer> buffer;
+    if (buffer == nullptr) {
+        buffer = std::make_shared<TraceBuffer>();
+        std::lock_guard<std::mutex> lock(s_trace_mutex);
+        buffer->thread_id = ++s_trace_threads_count;
+        s_trace_buffers.push_back(buffer);
+    }
+    return *buffer;
+}
+
+bool is_tracing() noexcept
+{
+    return s_tracing.load(std::memory_order_relaxed);
+}
+
+void add_trace_span(const char* name, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end)
+{
+    TraceBuffer& buffer = get_trace_buffer();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    buffer.spans.push_back({ name, start, end });
+}
+
+BGCODE_CORE_EXPORT bool start_tracing()
+{
+    std::lock_guard<std::mutex> lock(s_trace_mutex);
+    for (const std::shared_ptr<TraceBuffer>& buffer : s_trace_buffers) {
+        std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+        buffer->spans.clear();
+    }
+    s_trace_start = std::chrono::steady_clock::now();
+    s_tracing = true;
+    return true;
+}
+
+BGCODE_CORE_EXPORT EResult stop_tracing(FILE& file)
+{
+    s_tracing = false;
+
+    auto to_us = [](std::chrono::steady_clock::duration duration) {
+        return std::to_string(std::chrono::duration<double, std::micro>(duration).count());
+    };
+
+    std::lock_guard<std::mutex> lock(s_trace_mutex);
+    std::string events;
+    for (const std::shared_ptr<TraceBuffer>& buffer : s_trace_buffers) {
+        std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+        for (const TraceSpan& span : buffer->spans) {
+            if (span.start < s_trace_start)
+                continue;
+            events += events.empty() ? "\n" : ",\n";
+            events += "{\"name\":\"" + std::string(span.name) + "\",\"cat\":\"bgcode\",\"ph\":\"X\",\"ts\":" +
+                to_us(span.start - s_trace_start) + ",\"dur\":" + to_us(span.end - span.start) +
+                ",\"pid\":1,\"tid\":" + std::to_string(buffer->thread_id) + "}";
+        }
+        buffer->spans.clear();
+    }
+    // buffers of the exited threads are no more needed
+    s_trace_buffers.erase(std::remove_if(s_trace_buffers.begin(), s_trace_buffers.end(),
+        [](const std::shared_ptr<TraceBuffer>& buffer) { return buffer.use_count() == 1; }), s_trace_buffers.end());
+
+    const std::string json = "{\"traceEvents\":[" + events + "\n],\"displayTimeUnit\":\"ms\"}\n";
+    return write_to_file(file, json.data(), json.size()) ? EResult::Success : EResult::WriteError;
+}
+#else
+BGCODE_CORE_EXPORT bool start_tracing()
+{
+    return false;
+}
+
+BGCODE_CORE_EXPORT EResult stop_tracing(FILE& file)
+{
+    // no spans recorded
+    const std::string_view json = "{\"traceEvents\":[],\"displayTimeUnit\":\"ms\"}\n";
+    return write_to_file(file, json.data(), json.size()) ? EResult::Success : EResult::WriteError;
+}
+#endif // BGCODE_ENABLE_TRACING
+
 uint32_t bgcode_version() noexcept
 {
     return VERSION;
@@ -46,6 +46,8 @@ enum class EResult : uint16_t
     MissingPrinterMetadata,
     MissingPrintMetadata,
     MissingSlicerMetadata,
+    MemoryLimitExceeded,
+    IndexMismatch,
 };
 
 enum class EChecksumType : uint16_t
@@ -102,6 +104,9 @@ struct BGCODE_CORE_EXPORT FileHeader
 
     EResult write(FILE& file) const;
     EResult read(FILE& file, const uint32_t* const max_version);
+
+    // Returns the size of this FileHeader, in bytes
+    size_t get_size() const;
 };
 
 struct BGCODE_CORE_EXPORT BlockHeader
@@ -115,7 +120,8 @@ struct BGCODE_CORE_EXPORT BlockHeader
     BlockHeader(uint16_t type, uint16_t compression, uint32_t uncompressed_size, uint32_t compressed_size = 0);
 
     // Returns the position of this block in the file.
-    // Position is set by calling write() and read() methods.
+    // Position is set only by calling read() method, it is left unchanged by write().
+    // write() never queries the file position, so that blocks can be written to non-seekable streams (pipes, sockets).
     long get_position() const;
 
     EResult write(FILE& file);
@@ -138,6 +144,51 @@ struct BGCODE_CORE_EXPORT ThumbnailParams
     EResult read(FILE& file);
 };
 
+// Statistics collected while converting a file (see from_ascii_to_binary() and from_binary_to_ascii())
+struct BGCODE_CORE_EXPORT ConversionStats
+{
+    // Stages of the conversion whose time is measured.
+    // The time spent into a stage nested into another one is counted only into the inner stage.
+    enum class EStage : uint8_t
+    {
+        // parsing and formatting of the ascii gcode
+        Parse,
+        // MeatPack encoding and decoding of the gcode
+        MeatPack,
+        // compression and decompression of the data of the blocks
+        Compression,
+        // calculation of the checksums of the blocks
+        Checksum,
+        // reads and writes of the files
+        IO,
+        Count
+    };
+
+    struct Blocks
+    {
+        size_t count{ 0 };
+        // size of the data of the blocks, as stored into the binary file
+        size_t compressed_size{ 0 };
+        // size of the data of the blocks, once uncompressed
+        size_t uncompressed_size{ 0 };
+    };
+
+    size_t bytes_read{ 0 };
+    size_t bytes_written{ 0 };
+    // blocks read or written, by EBlockType
+    std::array<Blocks, 1 + (size_t)EBlockType::Thumbnail> blocks;
+    // time spent into each stage, by EStage, in seconds
+    std::array<double, (size_t)EStage::Count> stage_times{};
+    // time spent by the whole conversion, in seconds
+    double total_time{ 0.0 };
+    // size of the data of the largest block, as stored into the binary file and once uncompressed
+    size_t peak_compressed_size{ 0 };
+    size_t peak_uncompressed_size{ 0 };
+
+    // Returns the ratio between the compressed and the uncompressed size of the data of the blocks with the given type
+    double compression_ratio(EBlockType type) const;
+};
+
 // Returns a string description of the given result
 extern BGCODE_CORE_EXPORT std::string_view translate_result(EResult result);
 
@@ -188,12 +239,36 @@ extern BGCODE_CORE_EXPORT EResult verify_block_checksum(FILE& file, const FileHe
 // - file position will be set at the start of the next block header.
 extern BGCODE_CORE_EXPORT EResult skip_block_content(FILE& file, const FileHeader& file_header, const BlockHeader& block_header);
 
+// Reads the payload (parameters + data) of the block with the given block header.
+// File position must be at the start of the block parameters.
+// If return == EResult::Success:
+// - payload will contain the parameters and the (encoded) data of the block, as stored into the file.
+// - file position will be set at the start of the block checksum.
+extern BGCODE_CORE_EXPORT EResult read_block_payload(FILE& file, const BlockHeader& block_header, std::vector<std::byte>& payload);
+
 // Skips the block with the given block header.
-// File position must be set by a previous call to BlockHeader::write() or BlockHeader::read().
+// Block position must be set by a previous call to BlockHeader::read().
 // If return == EResult::Success:
 // - file position will be set at the start of the next block header.
 extern BGCODE_CORE_EXPORT EResult skip_block(FILE& file, const FileHeader& file_header, const BlockHeader& block_header);
 
+// Copies size bytes, starting at src_position of src_file, to the current position of dst_file.
+// In-kernel copies (copy_file_range/sendfile) are used where available, buffered copies otherwise.
+// dst_file may be non-seekable (ex. a pipe), src_file must be seekable.
+// If return == EResult::Success:
+// - src_file position will be set after the copied bytes.
+// - dst_file position will be set after the copied bytes.
+extern BGCODE_CORE_EXPORT EResult copy_file_bytes(FILE& src_file, long src_position, size_t size, FILE& dst_file);
+
+// Copies the block with the given block header (header + parameters + data + checksum), as raw bytes, from src_file to the
+// current position of dst_file. The payload is not decompressed and the checksum is copied unchanged, so dst_file
+// must use the same checksum type as the given file header.
+// Block position must be set by a previous call to BlockHeader::read().
+// If return == EResult::Success:
+// - src_file position will be set at the start of the next block header.
+// - dst_file position will be set after the copied block.
+extern BGCODE_CORE_EXPORT EResult copy_block(FILE& src_file, const FileHeader& file_header, const BlockHeader& block_header, FILE& dst_file);
+
 // Returns the size of the parameters of the given block type, in bytes.
 extern BGCODE_CORE_EXPORT size_t block_parameters_size(EBlockType type);
 
@@ -206,6 +281,14 @@ extern BGCODE_CORE_EXPORT size_t checksum_size(EChecksumType type);
 // Returns the size of the content (parameters + data + checksum) of the block with the given header, in bytes.
 extern BGCODE_CORE_EXPORT size_t block_content_size(const FileHeader& file_header, const BlockHeader& block_header);
 
+// Starts recording the tracing spans of the hot paths of the library (parsing, encoding, compression, checksums, I/O), on all threads.
+// Returns false if the library was built without tracing (see the LibBGCode_BUILD_TRACING cmake option).
+extern BGCODE_CORE_EXPORT bool start_tracing();
+
+// Stops recording the tracing spans and saves the ones recorded since start_tracing() into the given file,
+// in the Chrome trace event format (json), which can be loaded into chrome://tracing or https://ui.perfetto.dev.
+extern BGCODE_CORE_EXPORT EResult stop_tracing(FILE& file);
+
 // Highest version of the binary format supported by this library instance
 extern BGCODE_CORE_EXPORT uint32_t bgcode_version() noexcept;
 
@@ -1,6 +1,7 @@
 #ifndef CORE_IMPL_HPP
 #define CORE_IMPL_HPP
 
+#include <chrono>
 #include <iterator>
 #include <type_traits>
 #include <climits>
@@ -102,6 +103,42 @@ constexpr auto to_underlying(Enum enumval) noexcept
     return static_cast<std::underlying_type_t<Enum>>(enumval);
 }
 
+#ifdef BGCODE_ENABLE_TRACING
+// Returns true if tracing spans are being recorded
+extern BGCODE_CORE_EXPORT bool is_tracing() noexcept;
+// Records a tracing span of the calling thread, name must be a string literal
+extern BGCODE_CORE_EXPORT void add_trace_span(const char* name, std::chrono::steady_clock::time_point start,
+    std::chrono::steady_clock::time_point end);
+
+// Records a tracing span covering the lifetime of this object, if tracing
+class ScopedTraceSpan
+{
+public:
+    explicit ScopedTraceSpan(const char* name) noexcept
+      : m_name(is_tracing() ? name : nullptr)
+    {
+        if (m_name != nullptr)
+            m_start = std::chrono::steady_clock::now();
+    }
+    ~ScopedTraceSpan() { if (m_name != nullptr) add_trace_span(m_name, m_start, std::chrono::steady_clock::now()); }
+
+    ScopedTraceSpan(const ScopedTraceSpan&) = delete;
+    ScopedTraceSpan& operator=(const ScopedTraceSpan&) = delete;
+
+private:
+    const char* m_name;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+#define BGCODE_TRACE_CONCAT_IMPL(a, b) a##b
+#define BGCODE_TRACE_CONCAT(a, b) BGCODE_TRACE_CONCAT_IMPL(a, b)
+// Records a tracing span with the given name (a string literal) up to the end of the enclosing scope
+#define BGCODE_TRACE_SCOPE(name) const ::bgcode::core::ScopedTraceSpan BGCODE_TRACE_CONCAT(bgcode_trace_span_, __LINE__)(name)
+#else
+// Tracing is not compiled in
+#define BGCODE_TRACE_SCOPE(name)
+#endif // BGCODE_ENABLE_TRACING
+
 class BGCODE_CORE_EXPORT Checksum
 {
 public:
@@ -124,6 +161,8 @@ public:
 
     // Returns true if the given checksum is equal to this one
     bool matches(Checksum& other);
+    // Returns true if the given raw checksum, as stored into the file, is equal to this one
+    bool matches(const std::byte* data, size_t size) const;
 
     EResult write(FILE& file);
     EResult read(FILE& file);
@@ -151,6 +190,7 @@ void Checksum::append(const BufT *data, size_t size)
     if (data == nullptr || size == 0)
         return;
 
+    BGCODE_TRACE_SCOPE("Checksum::append");
     switch (m_type)
     {
     case EChecksumType::None:
@@ -170,6 +210,78 @@ void Checksum::append(const BufT *data, size_t size)
 
 static constexpr auto MAGICi32 = load_integer<uint32_t>(std::begin(MAGIC), std::end(MAGIC));
 
+// Returns the statistics of the conversion running on the calling thread, nullptr if none
+extern BGCODE_CORE_EXPORT ConversionStats* get_conversion_stats() noexcept;
+// Sets the statistics of the conversion running on the calling thread, returns the previous ones
+extern BGCODE_CORE_EXPORT ConversionStats* set_conversion_stats(ConversionStats* stats) noexcept;
+// Starts measuring the given stage of the current conversion, returns the stage being measured before
+extern BGCODE_CORE_EXPORT ConversionStats::EStage enter_conversion_stage(ConversionStats::EStage stage) noexcept;
+// Stops measuring the current stage of the current conversion, resuming the given one
+extern BGCODE_CORE_EXPORT void leave_conversion_stage(ConversionStats::EStage previous) noexcept;
+// Adds the block with the given header, read or written, to the statistics of the current conversion
+extern BGCODE_CORE_EXPORT void add_conversion_block(const BlockHeader& block_header) noexcept;
+
+// Measures the time spent into the given stage of the current conversion, if any, until destroyed
+class ScopedConversionStage
+{
+public:
+    explicit ScopedConversionStage(ConversionStats::EStage stage) noexcept
+      : m_active(get_conversion_stats() != nullptr)
+    {
+        if (m_active)
+            m_previous = enter_conversion_stage(stage);
+    }
+    ~ScopedConversionStage() { if (m_active) leave_conversion_stage(m_previous); }
+
+    ScopedConversionStage(const ScopedConversionStage&) = delete;
+    ScopedConversionStage& operator=(const ScopedConversionStage&) = delete;
+
+private:
+    bool m_active;
+    ConversionStats::EStage m_previous{ ConversionStats::EStage::Count };
+};
+
+// Collects the statistics of the conversion running on the calling thread into the given ones, if not nullptr, until destroyed
+class ScopedConversionStats
+{
+public:
+    explicit ScopedConversionStats(ConversionStats* stats) noexcept
+      : m_stats(stats), m_start(std::chrono::steady_clock::now())
+    {
+        if (m_stats != nullptr)
+            *m_stats = ConversionStats();
+        m_previous = set_conversion_stats(m_stats);
+    }
+    ~ScopedConversionStats()
+    {
+        if (m_stats != nullptr)
+            m_stats->total_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_start).count();
+        set_conversion_stats(m_previous);
+    }
+
+    ScopedConversionStats(const ScopedConversionStats&) = delete;
+    ScopedConversionStats& operator=(const ScopedConversionStats&) = delete;
+
+private:
+    ConversionStats* m_stats;
+    ConversionStats* m_previous{ nullptr };
+    std::chrono::steady_clock::time_point m_start;
+};
+
+// Adds the given bytes to the ones read by the current conversion
+inline void add_conversion_bytes_read(size_t size) noexcept
+{
+    if (ConversionStats* stats = get_conversion_stats())
+        stats->bytes_read += size;
+}
+
+// Adds the given bytes to the ones written by the current conversion
+inline void add_conversion_bytes_written(size_t size) noexcept
+{
+    if (ConversionStats* stats = get_conversion_stats())
+        stats->bytes_written += size;
+}
+
 constexpr auto checksum_types_count() noexcept { auto v = to_underlying(EChecksumType::CRC32); ++v; return v;}
 constexpr auto block_types_count() noexcept { auto v = to_underlying(EBlockType::Thumbnail); ++v; return v; }
 constexpr auto compression_types_count() noexcept { auto v = to_underlying(ECompressionType::Heatshrink_12_4); ++v; return v; }
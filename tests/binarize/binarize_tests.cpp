@@ -2,3 +2,1296 @@
 
 #include "binarize/binarize.hpp"
 
+#include <boost/nowide/cstdio.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <numeric>
+#include <thread>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif // _WIN32
+
+using namespace bgcode::core;
+using namespace bgcode::binarize;
+
+class ScopedFile
+{
+public:
+    explicit ScopedFile(FILE* file) : m_file(file) {}
+    ~ScopedFile() { if (m_file != nullptr) fclose(m_file); }
+private:
+    FILE* m_file{ nullptr };
+};
+
+static std::vector<char> read_file(const std::string& filename)
+{
+    FILE* file = boost::nowide::fopen(filename.c_str(), "rb");
+    REQUIRE(file != nullptr);
+    ScopedFile scoped_file(file);
+    std::vector<char> ret;
+    char buffer[4096];
+    for (size_t rsize = fread(buffer, 1, sizeof(buffer), file); rsize > 0; rsize = fread(buffer, 1, sizeof(buffer), file)) {
+        ret.insert(ret.end(), buffer, buffer + rsize);
+    }
+    return ret;
+}
+
+static std::vector<char> read_stream(FILE& file)
+{
+    rewind(&file);
+    std::vector<char> ret;
+    char buffer[4096];
+    for (size_t rsize = fread(buffer, 1, sizeof(buffer), &file); rsize > 0; rsize = fread(buffer, 1, sizeof(buffer), &file)) {
+        ret.insert(ret.end(), buffer, buffer + rsize);
+    }
+    return ret;
+}
+
+TEST_CASE("MeatPack last line without newline", "[Binarize]")
+{
+    std::cout << "\nTEST: MeatPack last line without newline\n";
+
+    for (const EGCodeEncodingType encoding : { EGCodeEncodingType::MeatPack, EGCodeEncodingType::MeatPackComments }) {
+        FILE* file = tmpfile();
+        REQUIRE(file != nullptr);
+        ScopedFile scoped_file(file);
+
+        GCodeBlock block;
+        block.encoding_type = (uint16_t)encoding;
+        block.raw_data = "G1 X1";
+        REQUIRE(block.write(*file, ECompressionType::None, EChecksumType::CRC32) == EResult::Success);
+
+        rewind(file);
+        FileHeader file_header;
+        file_header.checksum_type = (uint16_t)EChecksumType::CRC32;
+        BlockHeader block_header;
+        REQUIRE(block_header.read(*file) == EResult::Success);
+        GCodeBlock decoded;
+        REQUIRE(decoded.read_data(*file, file_header, block_header) == EResult::Success);
+        // the decoder terminates the line
+        REQUIRE(decoded.raw_data == "G1 X1\n");
+    }
+}
+
+TEST_CASE("GCode index", "[Binarize]")
+{
+    const std::string filename = std::string(TEST_DATA_DIR) + "/mini_cube_b.bgcode";
+    std::cout << "\nTEST: GCode index\n";
+    std::cout << "File:" << filename << "\n";
+
+    const size_t MAX_CHECKSUM_CACHE_SIZE = 2048;
+    std::byte checksum_verify_buffer[MAX_CHECKSUM_CACHE_SIZE];
+
+    FILE* file = boost::nowide::fopen(filename.c_str(), "rb");
+    REQUIRE(file != nullptr);
+    ScopedFile scoped_file(file);
+
+    GCodeIndex index;
+    REQUIRE(build_gcode_index(*file, index, checksum_verify_buffer, sizeof(checksum_verify_buffer)) == EResult::Success);
+    REQUIRE(!index.blocks.empty());
+    std::cout << "GCode blocks: " << index.blocks.size() << " - size: " << index.gcode_size() << " - lines: " << index.lines_count() << "\n";
+
+    // blocks are contiguous into the decoded gcode stream
+    for (size_t i = 1; i < index.blocks.size(); ++i) {
+        REQUIRE(index.blocks[i].offset == index.blocks[i - 1].offset + index.blocks[i - 1].size);
+        REQUIRE(index.blocks[i].first_line == index.blocks[i - 1].first_line + index.blocks[i - 1].lines_count);
+    }
+
+    // offset <-> position round trip
+    GCodePosition position;
+    REQUIRE(!index.offset_to_position(index.gcode_size(), position));
+    for (const size_t offset : { size_t(0), index.blocks.front().size, index.gcode_size() / 2, index.gcode_size() - 1 }) {
+        REQUIRE(index.offset_to_position(offset, position));
+        size_t offset_back;
+        REQUIRE(index.position_to_offset(position, offset_back));
+        REQUIRE(offset == offset_back);
+    }
+
+    // line <-> position round trip, checked against the decoded block
+    for (const size_t line : { size_t(0), index.blocks.front().lines_count, index.lines_count() / 2, index.lines_count() - 1 }) {
+        REQUIRE(line_to_position(*file, index, line, position) == EResult::Success);
+        GCodeBlock block;
+        REQUIRE(read_gcode_block(*file, index, position.block, block) == EResult::Success);
+        REQUIRE((position.offset == 0 || block.raw_data[position.offset - 1] == '\n'));
+        size_t line_back;
+        REQUIRE(position_to_line(*file, index, position, line_back) == EResult::Success);
+        REQUIRE(line == line_back);
+    }
+    REQUIRE(line_to_position(*file, index, index.lines_count(), position) == EResult::BlockNotFound);
+
+    // sidecar round trip
+    FILE* sidecar = tmpfile();
+    REQUIRE(sidecar != nullptr);
+    ScopedFile scoped_sidecar(sidecar);
+    REQUIRE(index.write(*sidecar) == EResult::Success);
+    rewind(sidecar);
+    GCodeIndex loaded;
+    REQUIRE(loaded.read(*sidecar) == EResult::Success);
+    REQUIRE(loaded.file_size == index.file_size);
+    REQUIRE(loaded.fingerprint == index.fingerprint);
+    REQUIRE(loaded.blocks.size() == index.blocks.size());
+    for (size_t i = 0; i < index.blocks.size(); ++i) {
+        REQUIRE(loaded.blocks[i].position == index.blocks[i].position);
+        REQUIRE(loaded.blocks[i].offset == index.blocks[i].offset);
+        REQUIRE(loaded.blocks[i].lines_count == index.blocks[i].lines_count);
+    }
+    REQUIRE(verify_gcode_index(*file, loaded) == EResult::Success);
+
+    // a file modified without changing its size is detected (the last bytes are the checksum of the last block)
+    std::vector<char> data = read_file(filename);
+    data.back() ^= 0x01;
+    FILE* modified_file = tmpfile();
+    REQUIRE(modified_file != nullptr);
+    ScopedFile scoped_modified_file(modified_file);
+    REQUIRE(fwrite(data.data(), 1, data.size(), modified_file) == data.size());
+    REQUIRE(verify_gcode_index(*modified_file, index) == EResult::IndexMismatch);
+    REQUIRE(line_to_position(*modified_file, index, 0, position) == EResult::IndexMismatch);
+    size_t line;
+    REQUIRE(position_to_line(*modified_file, index, { 0, 0 }, line) == EResult::IndexMismatch);
+    std::vector<GCodeMatch> matches;
+    REQUIRE(search_gcode(*modified_file, index, { "M73" }, matches) == EResult::IndexMismatch);
+    REQUIRE(index.searches.empty());
+}
+
+TEST_CASE("Layer table", "[Binarize]")
+{
+    const std::string filename = std::string(TEST_DATA_DIR) + "/mini_cube_b.bgcode";
+    const std::string ref_filename = std::string(TEST_DATA_DIR) + "/mini_cube_b_ref.gcode";
+    std::cout << "\nTEST: Layer table\n";
+    std::cout << "File:" << filename << "\n";
+
+    // count the layer markers of the reference ascii gcode
+    FILE* ref_file = boost::nowide::fopen(ref_filename.c_str(), "rb");
+    REQUIRE(ref_file != nullptr);
+    ScopedFile scoped_ref_file(ref_file);
+    size_t markers_count = 0;
+    char line[1024];
+    while (fgets(line, sizeof(line), ref_file) != nullptr) {
+        if (std::string_view(line).substr(0, 13) == ";LAYER_CHANGE")
+            ++markers_count;
+    }
+
+    FILE* file = boost::nowide::fopen(filename.c_str(), "rb");
+    REQUIRE(file != nullptr);
+    ScopedFile scoped_file(file);
+
+    LayerTable table;
+    REQUIRE(build_layer_table(*file, table, true) == EResult::Success);
+    std::cout << "Layers: " << table.layers.size() << "\n";
+    REQUIRE(table.layers.size() == markers_count);
+
+    for (size_t i = 1; i < table.layers.size(); ++i) {
+        REQUIRE(table.layers[i].z > table.layers[i - 1].z);
+        REQUIRE(table.layers[i].line > table.layers[i - 1].line);
+        REQUIRE(table.layers[i].remaining_time <= table.layers[i - 1].remaining_time);
+    }
+    REQUIRE(table.layers.front().progress >= 0);
+    REQUIRE(table.line_to_layer(0) == -1);
+    REQUIRE(table.line_to_layer(table.layers.back().line) == (int)table.layers.size() - 1);
+
+    // layers start at the markers
+    GCodeIndex index;
+    REQUIRE(build_gcode_index(*file, index) == EResult::Success);
+    for (const size_t id : { size_t(0), table.layers.size() / 2, table.layers.size() - 1 }) {
+        const LayerTable::Layer& layer = table.layers[id];
+        GCodePosition position;
+        REQUIRE(line_to_position(*file, index, layer.line, position) == EResult::Success);
+        REQUIRE(position.block == layer.position.block);
+        REQUIRE(position.offset == layer.position.offset);
+        GCodeBlock block;
+        REQUIRE(read_gcode_block(*file, index, position.block, block) == EResult::Success);
+        REQUIRE(block.raw_data.compare(position.offset, 13, ";LAYER_CHANGE") == 0);
+    }
+
+    // sidecar round trip
+    FILE* sidecar = tmpfile();
+    REQUIRE(sidecar != nullptr);
+    ScopedFile scoped_sidecar(sidecar);
+    REQUIRE(table.write(*sidecar) == EResult::Success);
+    rewind(sidecar);
+    LayerTable loaded;
+    REQUIRE(loaded.read(*sidecar) == EResult::Success);
+    REQUIRE(loaded.file_size == table.file_size);
+    REQUIRE(loaded.fingerprint == table.fingerprint);
+    REQUIRE(loaded.fingerprint == index.fingerprint);
+    REQUIRE(loaded.layers.size() == table.layers.size());
+    for (size_t i = 0; i < table.layers.size(); ++i) {
+        REQUIRE(loaded.layers[i].z == table.layers[i].z);
+        REQUIRE(loaded.layers[i].line == table.layers[i].line);
+        REQUIRE(loaded.layers[i].remaining_time == table.layers[i].remaining_time);
+    }
+}
+
+TEST_CASE("Layer aligned gcode blocks", "[Binarize]")
+{
+    std::cout << "\nTEST: Layer aligned gcode blocks\n";
+
+    FILE* file = tmpfile();
+    REQUIRE(file != nullptr);
+    ScopedFile scoped_file(file);
+
+    Binarizer binarizer;
+    binarizer.set_enabled(true);
+    binarizer.set_max_gcode_cache_size(8192);
+    BinaryData& binary_data = binarizer.get_binary_data();
+    binary_data.printer_metadata.raw_data.emplace_back("printer_model", "MK4");
+    binary_data.print_metadata.raw_data.emplace_back("filament used [mm]", "1.0");
+    binary_data.slicer_metadata.raw_data.emplace_back("layer_height", "0.2");
+
+    BinarizerConfig config;
+    config.layer_aligned_gcode_blocks = true;
+    config.min_gcode_block_size = 1024;
+    REQUIRE(binarizer.initialize(*file, config) == EResult::Success);
+
+    // layers of growing size, the last ones don't fit into a single block
+    const size_t layers_count = 40;
+    REQUIRE(binarizer.append_gcode("G28\nG1 Z5 F720\n") == EResult::Success);
+    for (size_t i = 0; i < layers_count; ++i) {
+        const std::string z = std::to_string(0.2 * (i + 1));
+        std::string layer = ";LAYER_CHANGE\n;Z:" + z + "\nG1 Z" + z + "\n";
+        for (size_t j = 0; j < 10 * (i + 1); ++j) {
+            layer += "G1 X" + std::to_string(j % 100) + " Y" + std::to_string(i) + " E0.1\n";
+        }
+        REQUIRE(binarizer.append_gcode(layer) == EResult::Success);
+    }
+    REQUIRE(binarizer.finalize() == EResult::Success);
+
+    GCodeIndex index;
+    REQUIRE(build_gcode_index(*file, index) == EResult::Success);
+    for (const GCodeIndex::Block& block : index.blocks) {
+        REQUIRE(block.size <= binarizer.get_max_gcode_cache_size());
+    }
+
+    // each layer starts a block, unless it follows a block smaller than the min size
+    LayerTable table;
+    REQUIRE(build_layer_table(*file, table) == EResult::Success);
+    REQUIRE(table.layers.size() == layers_count);
+    size_t aligned_count = 0;
+    for (const LayerTable::Layer& layer : table.layers) {
+        REQUIRE((layer.position.offset == 0 || layer.position.offset < config.min_gcode_block_size));
+        if (layer.position.offset == 0)
+            ++aligned_count;
+    }
+    REQUIRE(aligned_count > layers_count / 2);
+    REQUIRE(table.layers.back().position.offset == 0);
+}
+
+TEST_CASE("Append gcode blocks", "[Binarize]")
+{
+    const std::string filename = std::string(TEST_DATA_DIR) + "/mini_cube_b.bgcode";
+    std::cout << "\nTEST: Append gcode blocks\n";
+    std::cout << "File:" << filename << "\n";
+
+    // work on a copy of the file
+    const std::vector<char> original = read_file(filename);
+    FILE* file = tmpfile();
+    REQUIRE(file != nullptr);
+    ScopedFile scoped_file(file);
+    REQUIRE(fwrite(original.data(), 1, original.size(), file) == original.size());
+
+    GCodeIndex index;
+    REQUIRE(build_gcode_index(*file, index) == EResult::Success);
+    const size_t original_blocks_count = index.blocks.size();
+
+    const std::string end_gcode = "; appended end sequence\nG1 Z50 F720\nM104 S0\nM140 S0\nM84\n";
+    Binarizer binarizer;
+    binarizer.set_enabled(true);
+    REQUIRE(binarizer.initialize_append(*file) == EResult::Success);
+    REQUIRE(binarizer.append_gcode(end_gcode) == EResult::Success);
+    REQUIRE(binarizer.finalize() == EResult::Success);
+
+    // existing blocks are untouched
+    rewind(file);
+    std::vector<char> head(original.size());
+    REQUIRE(fread(head.data(), 1, head.size(), file) == head.size());
+    REQUIRE(head == original);
+
+    // the file is still valid and ends with the appended gcode
+    std::byte checksum_verify_buffer[2048];
+    REQUIRE(is_valid_binary_gcode(*file, true, checksum_verify_buffer, sizeof(checksum_verify_buffer)) == EResult::Success);
+    REQUIRE(build_gcode_index(*file, index, checksum_verify_buffer, sizeof(checksum_verify_buffer)) == EResult::Success);
+    REQUIRE(index.blocks.size() == original_blocks_count + 1);
+    GCodeBlock block;
+    REQUIRE(read_gcode_block(*file, index, index.blocks.size() - 1, block) == EResult::Success);
+    REQUIRE(block.raw_data == end_gcode);
+
+    // truncated files are rejected
+    FILE* truncated = tmpfile();
+    REQUIRE(truncated != nullptr);
+    ScopedFile scoped_truncated(truncated);
+    REQUIRE(fwrite(original.data(), 1, original.size() - 10, truncated) == original.size() - 10);
+    REQUIRE(binarizer.initialize_append(*truncated) != EResult::Success);
+}
+
+static std::string decode_gcode_stream(FILE& file)
+{
+    GCodeIndex index;
+    REQUIRE(build_gcode_index(file, index) == EResult::Success);
+    std::string ret;
+    for (size_t i = 0; i < index.blocks.size(); ++i) {
+        GCodeBlock block;
+        REQUIRE(read_gcode_block(file, index, i, block) == EResult::Success);
+        ret += block.raw_data;
+    }
+    return ret;
+}
+
+TEST_CASE("Transcode", "[Binarize]")
+{
+    const std::string filename = std::string(TEST_DATA_DIR) + "/mini_cube_b.bgcode";
+    std::cout << "\nTEST: Transcode\n";
+    std::cout << "File:" << filename << "\n";
+
+    FILE* src_file = boost::nowide::fopen(filename.c_str(), "rb");
+    REQUIRE(src_file != nullptr);
+    ScopedFile scoped_src_file(src_file);
+    fseek(src_file, 0, SEEK_END);
+    const long src_size = ftell(src_file);
+
+    // same settings as the source file, all the blocks are passed through
+    BinarizerConfig config;
+    config.compression.slicer_metadata = ECompressionType::Deflate;
+    config.compression.gcode = ECompressionType::Heatshrink_12_4;
+    config.gcode_encoding = EGCodeEncodingType::MeatPackComments;
+    FILE* same_file = tmpfile();
+    REQUIRE(same_file != nullptr);
+    ScopedFile scoped_same_file(same_file);
+    REQUIRE(transcode(*src_file, *same_file, config) == EResult::Success);
+    REQUIRE(ftell(same_file) == src_size);
+
+    // only the first gcode block differs from the config, the following ones are passed through
+    FILE* mixed_file = tmpfile();
+    REQUIRE(mixed_file != nullptr);
+    ScopedFile scoped_mixed_file(mixed_file);
+    rewind(src_file);
+    FileHeader file_header;
+    REQUIRE(read_header(*src_file, file_header, nullptr) == EResult::Success);
+    REQUIRE(file_header.write(*mixed_file) == EResult::Success);
+    bool gcode_found = false;
+    while (ftell(src_file) < src_size) {
+        BlockHeader block_header;
+        REQUIRE(read_next_block_header(*src_file, file_header, block_header) == EResult::Success);
+        if ((EBlockType)block_header.type == EBlockType::GCode && !gcode_found) {
+            GCodeBlock block;
+            REQUIRE(block.read_data(*src_file, file_header, block_header) == EResult::Success);
+            block.encoding_type = (uint16_t)EGCodeEncodingType::None;
+            REQUIRE(block.write(*mixed_file, ECompressionType::None, (EChecksumType)file_header.checksum_type) == EResult::Success);
+            gcode_found = true;
+        }
+        else
+            REQUIRE(copy_block(*src_file, file_header, block_header, *mixed_file) == EResult::Success);
+    }
+    REQUIRE(ftell(mixed_file) > src_size);
+    FILE* unmixed_file = tmpfile();
+    REQUIRE(unmixed_file != nullptr);
+    ScopedFile scoped_unmixed_file(unmixed_file);
+    REQUIRE(transcode(*mixed_file, *unmixed_file, config) == EResult::Success);
+    // the blocks following the first gcode block are identical to the source ones
+    auto tail = [](FILE& file) {
+        const std::vector<char> data = read_stream(file);
+        FileHeader header;
+        REQUIRE(read_header(file, header, nullptr) == EResult::Success);
+        BlockHeader block_header;
+        REQUIRE(read_next_block_header(file, header, block_header, EBlockType::GCode) == EResult::Success);
+        REQUIRE(skip_block(file, header, block_header) == EResult::Success);
+        return std::vector<char>(data.begin() + ftell(&file), data.end());
+    };
+    const std::vector<char> src_tail = tail(*src_file);
+    REQUIRE(src_tail.size() > 0);
+    REQUIRE(tail(*unmixed_file) == src_tail);
+
+    // different settings, re-chunked gcode
+    config.compression.slicer_metadata = ECompressionType::None;
+    config.compression.gcode = ECompressionType::Deflate;
+    config.gcode_encoding = EGCodeEncodingType::None;
+    const size_t max_block_size = 16384;
+    FILE* dst_file = tmpfile();
+    REQUIRE(dst_file != nullptr);
+    ScopedFile scoped_dst_file(dst_file);
+    REQUIRE(transcode(*src_file, *dst_file, config, max_block_size) == EResult::Success);
+
+    std::byte checksum_verify_buffer[2048];
+    REQUIRE(is_valid_binary_gcode(*dst_file, true, checksum_verify_buffer, sizeof(checksum_verify_buffer)) == EResult::Success);
+    GCodeIndex index;
+    REQUIRE(build_gcode_index(*dst_file, index) == EResult::Success);
+    for (const GCodeIndex::Block& block : index.blocks) {
+        REQUIRE(block.size <= max_block_size);
+    }
+    REQUIRE(decode_gcode_stream(*dst_file) == decode_gcode_stream(*src_file));
+}
+
+static void read_print_metadata(FILE& file, PrintMetadataBlock& block)
+{
+    rewind(&file);
+    FileHeader file_header;
+    REQUIRE(read_header(file, file_header, nullptr) == EResult::Success);
+    BlockHeader block_header;
+    REQUIRE(read_next_block_header(file, file_header, block_header, EBlockType::PrintMetadata) == EResult::Success);
+    REQUIRE(block.read_data(file, file_header, block_header) == EResult::Success);
+}
+
+TEST_CASE("Update metadata", "[Binarize]")
+{
+    const std::string filename = std::string(TEST_DATA_DIR) + "/mini_cube_b.bgcode";
+    std::cout << "\nTEST: Update metadata\n";
+    std::cout << "File:" << filename << "\n";
+
+    const std::vector<char> original = read_file(filename);
+    FILE* file = tmpfile();
+    REQUIRE(file != nullptr);
+    ScopedFile scoped_file(file);
+    REQUIRE(fwrite(original.data(), 1, original.size(), file) == original.size());
+    const std::string gcode = decode_gcode_stream(*file);
+
+    // growing block, the rest of the file is shifted
+    PrintMetadataBlock print_metadata;
+    read_print_metadata(*file, print_metadata);
+    print_metadata.raw_data.emplace_back("job_id", "1234");
+    const size_t padding = 64;
+    REQUIRE(update_metadata(*file, EBlockType::PrintMetadata, print_metadata.raw_data, padding) == EResult::Success);
+    fseek(file, 0, SEEK_END);
+    const long file_size = ftell(file);
+    REQUIRE(file_size > (long)original.size());
+
+    std::byte checksum_verify_buffer[2048];
+    REQUIRE(is_valid_binary_gcode(*file, true, checksum_verify_buffer, sizeof(checksum_verify_buffer)) == EResult::Success);
+    REQUIRE(decode_gcode_stream(*file) == gcode);
+    PrintMetadataBlock updated;
+    read_print_metadata(*file, updated);
+    REQUIRE(updated.raw_data == print_metadata.raw_data);
+
+    // edits fitting into the padding are done in place
+    print_metadata.raw_data.back().second = "5678";
+    print_metadata.raw_data.emplace_back("cost", "1.25");
+    REQUIRE(update_metadata(*file, EBlockType::PrintMetadata, print_metadata.raw_data) == EResult::Success);
+    fseek(file, 0, SEEK_END);
+    REQUIRE(ftell(file) == file_size);
+    REQUIRE(is_valid_binary_gcode(*file, true, checksum_verify_buffer, sizeof(checksum_verify_buffer)) == EResult::Success);
+    updated.raw_data.clear();
+    read_print_metadata(*file, updated);
+    REQUIRE(updated.raw_data == print_metadata.raw_data);
+
+    // shrinking block
+    print_metadata.raw_data.resize(1);
+    REQUIRE(update_metadata(*file, EBlockType::PrintMetadata, print_metadata.raw_data) == EResult::Success);
+    fseek(file, 0, SEEK_END);
+    REQUIRE(ftell(file) == file_size);
+    updated.raw_data.clear();
+    read_print_metadata(*file, updated);
+    REQUIRE(updated.raw_data == print_metadata.raw_data);
+    REQUIRE(update_metadata(*file, EBlockType::Thumbnail, print_metadata.raw_data) == EResult::InvalidBlockType);
+
+    // compressed blocks are always resized
+    REQUIRE(update_metadata(*file, EBlockType::SlicerMetadata, { { "layer_height", "0.2" } }) == EResult::Success);
+    fseek(file, 0, SEEK_END);
+    REQUIRE(ftell(file) < file_size);
+    REQUIRE(is_valid_binary_gcode(*file, true, checksum_verify_buffer, sizeof(checksum_verify_buffer)) == EResult::Success);
+    REQUIRE(decode_gcode_stream(*file) == gcode);
+}
+
+TEST_CASE("Late metadata", "[Binarize]")
+{
+    std::cout << "\nTEST: Late metadata\n";
+
+    FILE* file = tmpfile();
+    REQUIRE(file != nullptr);
+    ScopedFile scoped_file(file);
+
+    // print metadata are known only once the whole gcode has been streamed
+    Binarizer binarizer;
+    binarizer.set_enabled(true);
+    BinaryData& binary_data = binarizer.get_binary_data();
+    binary_data.printer_metadata.raw_data.emplace_back("printer_model", "MK4");
+    binary_data.slicer_metadata.raw_data.emplace_back("layer_height", "0.2");
+
+    BinarizerConfig config;
+    config.late_metadata_capacity = 256;
+    REQUIRE(binarizer.initialize(*file, config) == EResult::Success);
+    std::string gcode;
+    for (size_t i = 0; i < 1000; ++i) {
+        gcode += "G1 X" + std::to_string(i % 100) + " Y" + std::to_string(i / 100) + " E0.1\n";
+    }
+    REQUIRE(binarizer.append_gcode(gcode) == EResult::Success);
+    binary_data.print_metadata.raw_data.emplace_back("filament used [mm]", "100.0");
+    binary_data.print_metadata.raw_data.emplace_back("estimated printing time (normal mode)", "1m 40s");
+    REQUIRE(binarizer.finalize() == EResult::Success);
+
+    std::byte checksum_verify_buffer[2048];
+    REQUIRE(is_valid_binary_gcode(*file, true, checksum_verify_buffer, sizeof(checksum_verify_buffer)) == EResult::Success);
+    REQUIRE(decode_gcode_stream(*file) == gcode);
+    PrintMetadataBlock print_metadata;
+    read_print_metadata(*file, print_metadata);
+    REQUIRE(print_metadata.raw_data == binary_data.print_metadata.raw_data);
+
+    // metadata not fitting into the reserved size
+    FILE* overflow = tmpfile();
+    REQUIRE(overflow != nullptr);
+    ScopedFile scoped_overflow(overflow);
+    config.late_metadata_capacity = 16;
+    REQUIRE(binarizer.initialize(*overflow, config) == EResult::Success);
+    REQUIRE(binarizer.append_gcode(gcode) == EResult::Success);
+    binary_data.print_metadata.raw_data.emplace_back("total layers count", "10");
+    REQUIRE(binarizer.finalize() == EResult::MetadataEncodingError);
+
+    // metadata still missing at the end
+    FILE* missing = tmpfile();
+    REQUIRE(missing != nullptr);
+    ScopedFile scoped_missing(missing);
+    binary_data.print_metadata.raw_data.clear();
+    REQUIRE(binarizer.initialize(*missing, config) == EResult::Success);
+    REQUIRE(binarizer.finalize() == EResult::MissingPrintMetadata);
+}
+
+// Writes a small binary gcode with the given config, print metadata are completed after the gcode
+static void binarize_small_gcode(FILE& file, const BinarizerConfig& config)
+{
+    Binarizer binarizer;
+    binarizer.set_enabled(true);
+    BinaryData& binary_data = binarizer.get_binary_data();
+    binary_data.printer_metadata.raw_data.emplace_back("printer_model", "MK4");
+    binary_data.print_metadata.raw_data.emplace_back("filament used [mm]", "1.0");
+    binary_data.slicer_metadata.raw_data.emplace_back("layer_height", "0.2");
+    ThumbnailBlock& thumbnail = binary_data.thumbnails.emplace_back();
+    thumbnail.params = { (uint16_t)EThumbnailFormat::PNG, 16, 16 };
+    thumbnail.data = std::vector<std::byte>(100, std::byte{ 0x55 });
+
+    REQUIRE(binarizer.initialize(file, config) == EResult::Success);
+    for (size_t i = 0; i < 200; ++i) {
+        REQUIRE(binarizer.append_gcode("G1 X" + std::to_string(i % 100) + " Y" + std::to_string(i / 100) + " E0.1\n") == EResult::Success);
+    }
+    binary_data.print_metadata.raw_data.emplace_back("estimated printing time (normal mode)", "10s");
+    REQUIRE(binarizer.finalize() == EResult::Success);
+}
+
+TEST_CASE("Non-seekable output", "[Binarize]")
+{
+    std::cout << "\nTEST: Non-seekable output\n";
+
+    BinarizerConfig config;
+    FILE* file = tmpfile();
+    REQUIRE(file != nullptr);
+    ScopedFile scoped_file(file);
+    binarize_small_gcode(*file, config);
+    const std::vector<char> expected = read_stream(*file);
+
+#ifndef _WIN32
+    // the output is small enough to fit into the pipe buffer, no reader thread is needed
+    int fds[2];
+    REQUIRE(pipe(fds) == 0);
+    FILE* pipe_in = fdopen(fds[1], "wb");
+    REQUIRE(pipe_in != nullptr);
+    binarize_small_gcode(*pipe_in, config);
+    REQUIRE(fclose(pipe_in) == 0);
+
+    std::vector<char> piped;
+    char buffer[4096];
+    for (ssize_t rsize = read(fds[0], buffer, sizeof(buffer)); rsize > 0; rsize = read(fds[0], buffer, sizeof(buffer))) {
+        piped.insert(piped.end(), buffer, buffer + rsize);
+    }
+    close(fds[0]);
+    REQUIRE(piped == expected);
+#endif // _WIN32
+
+    // late metadata are placed by the tracked positions, also when the file does not start with the binary gcode
+    const std::string prefix = "; binary gcode follows\n";
+    config.late_metadata_capacity = 128;
+    FILE* late_file = tmpfile();
+    REQUIRE(late_file != nullptr);
+    ScopedFile scoped_late_file(late_file);
+    REQUIRE(fwrite(prefix.data(), 1, prefix.size(), late_file) == prefix.size());
+    binarize_small_gcode(*late_file, config);
+    const std::vector<char> late = read_stream(*late_file);
+    REQUIRE(std::equal(prefix.begin(), prefix.end(), late.begin()));
+
+    FILE* late_copy = tmpfile();
+    REQUIRE(late_copy != nullptr);
+    ScopedFile scoped_late_copy(late_copy);
+    REQUIRE(fwrite(late.data() + prefix.size(), 1, late.size() - prefix.size(), late_copy) == late.size() - prefix.size());
+    std::byte checksum_verify_buffer[2048];
+    REQUIRE(is_valid_binary_gcode(*late_copy, true, checksum_verify_buffer, sizeof(checksum_verify_buffer)) == EResult::Success);
+    PrintMetadataBlock print_metadata;
+    read_print_metadata(*late_copy, print_metadata);
+    REQUIRE(print_metadata.raw_data.size() == 2);
+}
+
+TEST_CASE("Push parser", "[Binarize]")
+{
+    const std::string filename = std::string(TEST_DATA_DIR) + "/mini_cube_b.bgcode";
+    std::cout << "\nTEST: Push parser\n";
+    std::cout << "File:" << filename << "\n";
+
+    const std::vector<char> data = read_file(filename);
+    const std::byte* bytes = reinterpret_cast<const std::byte*>(data.data());
+
+    size_t blocks_count = 0;
+    size_t checksums_count = 0;
+    size_t gcode_blocks_count = 0;
+    std::vector<EBlockType> metadata_types;
+    PushParser::Events events;
+    events.block = [&](const BlockHeader& block_header, size_t position, const std::vector<std::byte>& payload) {
+        REQUIRE(payload.size() == block_payload_size(block_header));
+        REQUIRE(position + block_header.get_size() + payload.size() <= data.size());
+        ++blocks_count;
+        if ((EBlockType)block_header.type == EBlockType::GCode)
+            ++gcode_blocks_count;
+    };
+    events.checksum_ok = [&](const BlockHeader&, size_t) { ++checksums_count; };
+    events.metadata = [&](EBlockType type, const BaseMetadataBlock& metadata) {
+        REQUIRE(!metadata.raw_data.empty());
+        metadata_types.push_back(type);
+    };
+
+    // fed in chunks of odd sizes, splitting headers and checksums
+    PushParser parser(events);
+    for (size_t begin = 0; begin < data.size(); begin += 7) {
+        REQUIRE(parser.feed(bytes + begin, std::min<size_t>(7, data.size() - begin)) == EResult::Success);
+    }
+    REQUIRE(parser.finish() == EResult::Success);
+    REQUIRE(parser.get_position() == data.size());
+    REQUIRE(parser.get_blocks_count() == blocks_count);
+    REQUIRE(checksums_count == blocks_count);
+    GCodeIndex index;
+    FILE* file = boost::nowide::fopen(filename.c_str(), "rb");
+    REQUIRE(file != nullptr);
+    ScopedFile scoped_file(file);
+    REQUIRE(build_gcode_index(*file, index) == EResult::Success);
+    REQUIRE(gcode_blocks_count == index.blocks.size());
+    REQUIRE(metadata_types.size() == 4);
+    REQUIRE(metadata_types.back() == EBlockType::SlicerMetadata);
+
+    // whole file at once
+    parser.reset();
+    REQUIRE(parser.feed(bytes, data.size()) == EResult::Success);
+    REQUIRE(parser.finish() == EResult::Success);
+
+    // incomplete file
+    parser.reset();
+    REQUIRE(parser.feed(bytes, data.size() - 1) == EResult::Success);
+    REQUIRE(parser.finish() == EResult::InvalidBinaryGCodeFile);
+
+    // corrupted byte, detected by the checksum of the block containing it
+    std::vector<char> corrupted = data;
+    corrupted[corrupted.size() / 2] ^= 0x01;
+    parser.reset();
+    const EResult res = parser.feed(reinterpret_cast<const std::byte*>(corrupted.data()), corrupted.size());
+    REQUIRE(res != EResult::Success);
+    REQUIRE(parser.get_position() < corrupted.size());
+    REQUIRE(parser.feed(bytes, 1) == res);
+    REQUIRE(parser.finish() == res);
+
+    // not a binary gcode file
+    const std::string text = "G1 X10 Y10\n";
+    parser.reset();
+    REQUIRE(parser.feed(reinterpret_cast<const std::byte*>(text.data()), text.size()) == EResult::InvalidMagicNumber);
+
+    // uncompressed block following a compressed one, reported without the compressed size of the previous block
+    FILE* mixed_file = tmpfile();
+    REQUIRE(mixed_file != nullptr);
+    ScopedFile scoped_mixed_file(mixed_file);
+    FileHeader file_header;
+    file_header.checksum_type = (uint16_t)EChecksumType::CRC32;
+    REQUIRE(file_header.write(*mixed_file) == EResult::Success);
+    FileMetadataBlock file_metadata;
+    file_metadata.raw_data = { { "Producer", "test" } };
+    REQUIRE(file_metadata.write(*mixed_file, ECompressionType::Deflate, EChecksumType::CRC32) == EResult::Success);
+    PrinterMetadataBlock printer_metadata;
+    printer_metadata.raw_data = { { "printer_model", "MK4" } };
+    REQUIRE(printer_metadata.write(*mixed_file, ECompressionType::None, EChecksumType::CRC32) == EResult::Success);
+    const std::vector<char> mixed = read_stream(*mixed_file);
+    std::vector<BlockHeader> block_headers;
+    PushParser::Events mixed_events;
+    mixed_events.block = [&](const BlockHeader& block_header, size_t, const std::vector<std::byte>&) {
+        block_headers.push_back(block_header);
+    };
+    PushParser mixed_parser(mixed_events);
+    REQUIRE(mixed_parser.feed(reinterpret_cast<const std::byte*>(mixed.data()), mixed.size()) == EResult::Success);
+    REQUIRE(block_headers.size() == 2);
+    REQUIRE(block_headers[0].compressed_size > 0);
+    REQUIRE(block_headers[1].compression == (uint16_t)ECompressionType::None);
+    REQUIRE(block_headers[1].compressed_size == 0);
+}
+
+TEST_CASE("Concurrent reader", "[Binarize]")
+{
+    const std::string filename = std::string(TEST_DATA_DIR) + "/mini_cube_b.bgcode";
+    std::cout << "\nTEST: Concurrent reader\n";
+    std::cout << "File:" << filename << "\n";
+
+    FILE* file = boost::nowide::fopen(filename.c_str(), "rb");
+    REQUIRE(file != nullptr);
+    ScopedFile scoped_file(file);
+    const std::string gcode = decode_gcode_stream(*file);
+    rewind(file);
+
+    Reader reader;
+    REQUIRE(reader.open(*file, true) == EResult::Success);
+    REQUIRE(ftell(file) == 0);
+    REQUIRE(reader.get_file_header().checksum_type == (uint16_t)EChecksumType::CRC32);
+    std::vector<size_t> gcode_blocks;
+    for (size_t i = 0; i < reader.get_blocks().size(); ++i) {
+        if ((EBlockType)reader.get_blocks()[i].header.type == EBlockType::GCode)
+            gcode_blocks.push_back(i);
+    }
+    REQUIRE(!gcode_blocks.empty());
+
+    // every thread decodes all the gcode blocks, starting from a different one
+    const size_t threads_count = 4;
+    std::vector<std::vector<std::string>> decoded(threads_count, std::vector<std::string>(gcode_blocks.size()));
+    std::vector<EResult> results(threads_count, EResult::Success);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < threads_count; ++t) {
+        threads.emplace_back([&, t]() {
+            for (size_t i = 0; i < gcode_blocks.size(); ++i) {
+                const size_t id = (i + t * gcode_blocks.size() / threads_count) % gcode_blocks.size();
+                GCodeBlock block;
+                const EResult res = reader.read_block(gcode_blocks[id], block);
+                if (res != EResult::Success)
+                    results[t] = res;
+                decoded[t][id] = std::move(block.raw_data);
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    for (size_t t = 0; t < threads_count; ++t) {
+        REQUIRE(results[t] == EResult::Success);
+        std::string stream;
+        for (const std::string& data : decoded[t]) {
+            stream += data;
+        }
+        REQUIRE(stream == gcode);
+    }
+    // the reads did not move the position of the file, which is still usable by the caller
+    std::array<char, 4> magic;
+    REQUIRE(fread(magic.data(), 1, magic.size(), file) == magic.size());
+    REQUIRE(std::string(magic.data(), magic.size()) == "GCDE");
+
+    // metadata and block types
+    const int print_metadata_id = reader.find_block(EBlockType::PrintMetadata);
+    REQUIRE(print_metadata_id >= 0);
+    PrintMetadataBlock print_metadata;
+    REQUIRE(reader.read_block((size_t)print_metadata_id, print_metadata) == EResult::Success);
+    PrintMetadataBlock expected;
+    read_print_metadata(*file, expected);
+    REQUIRE(print_metadata.raw_data == expected.raw_data);
+    GCodeBlock block;
+    REQUIRE(reader.read_block((size_t)print_metadata_id, block) == EResult::InvalidBlockType);
+    REQUIRE(reader.read_block(reader.get_blocks().size(), block) == EResult::BlockNotFound);
+}
+
+TEST_CASE("Bounded memory reader", "[Binarize]")
+{
+    const std::string filename = std::string(TEST_DATA_DIR) + "/mini_cube_b.bgcode";
+    std::cout << "\nTEST: Bounded memory reader\n";
+    std::cout << "File:" << filename << "\n";
+
+    FILE* src_file = boost::nowide::fopen(filename.c_str(), "rb");
+    REQUIRE(src_file != nullptr);
+    ScopedFile scoped_src_file(src_file);
+
+    // deflate compressed copy, the source file uses heatshrink
+    BinarizerConfig config;
+    config.compression.gcode = ECompressionType::Deflate;
+    config.gcode_encoding = EGCodeEncodingType::MeatPack;
+    FILE* deflate_file = tmpfile();
+    REQUIRE(deflate_file != nullptr);
+    ScopedFile scoped_deflate_file(deflate_file);
+    REQUIRE(transcode(*src_file, *deflate_file, config) == EResult::Success);
+    fflush(deflate_file);
+
+    for (FILE* file : { src_file, deflate_file }) {
+        const std::string gcode = decode_gcode_stream(*file);
+        Reader reader;
+        REQUIRE(reader.open(*file, true) == EResult::Success);
+
+        // chunked decoding, with chunks smaller than the blocks
+        std::string chunked;
+        for (size_t i = 0; i < reader.get_blocks().size(); ++i) {
+            if ((EBlockType)reader.get_blocks()[i].header.type == EBlockType::GCode)
+                REQUIRE(reader.read_gcode_block_chunked(i, [&](const std::string& data) { chunked += data; }, 100) == EResult::Success);
+        }
+        REQUIRE(chunked == gcode);
+
+        // unlimited, tight and loose in-flight budgets
+        for (size_t max_in_flight_size : { 0, 1024, 1024 * 1024 }) {
+            Reader::MemoryLimits limits;
+            limits.max_in_flight_size = max_in_flight_size;
+            reader.set_memory_limits(limits);
+            std::string stream;
+            size_t last_block_id = 0;
+            REQUIRE(reader.for_each_gcode_block([&](size_t block_id, const std::string& data) {
+                REQUIRE(block_id >= last_block_id);
+                last_block_id = block_id;
+                stream += data;
+            }) == EResult::Success);
+            REQUIRE(stream == gcode);
+        }
+
+        // blocks over the limits are not read into memory
+        const int gcode_id = reader.find_block(EBlockType::GCode);
+        REQUIRE(gcode_id >= 0);
+        Reader::MemoryLimits limits;
+        limits.max_uncompressed_size = 1;
+        reader.set_memory_limits(limits);
+        GCodeBlock block;
+        REQUIRE(reader.read_block((size_t)gcode_id, block) == EResult::MemoryLimitExceeded);
+        limits.max_uncompressed_size = 0;
+        limits.max_block_size = 1;
+        reader.set_memory_limits(limits);
+        std::vector<std::byte> payload;
+        REQUIRE(reader.read_block_payload((size_t)gcode_id, payload) == EResult::MemoryLimitExceeded);
+        std::string stream;
+        REQUIRE(reader.for_each_gcode_block([&](size_t, const std::string& data) { stream += data; }) == EResult::Success);
+        REQUIRE(stream == gcode);
+    }
+
+    // corrupt uncompressed size of the first gcode block
+    Reader reader;
+    REQUIRE(reader.open(*deflate_file) == EResult::Success);
+    const int gcode_id = reader.find_block(EBlockType::GCode);
+    REQUIRE(gcode_id >= 0);
+    const long uncompressed_size_position = (long)reader.get_blocks()[gcode_id].position + 2 * sizeof(uint16_t);
+    auto set_uncompressed_size = [&](uint32_t size) {
+        REQUIRE(fseek(deflate_file, uncompressed_size_position, SEEK_SET) == 0);
+        REQUIRE(fwrite(&size, sizeof(size), 1, deflate_file) == 1);
+        fflush(deflate_file);
+        REQUIRE(reader.open(*deflate_file) == EResult::Success);
+    };
+
+    // huge size, rejected before allocating
+    set_uncompressed_size(0xFFFFFFFF);
+    Reader::MemoryLimits limits;
+    limits.max_uncompressed_size = 16 * 1024 * 1024;
+    reader.set_memory_limits(limits);
+    GCodeBlock block;
+    REQUIRE(reader.read_block((size_t)gcode_id, block) == EResult::MemoryLimitExceeded);
+
+    // small size, decompression must not write past it
+    set_uncompressed_size(10);
+    REQUIRE(reader.read_block((size_t)gcode_id, block) == EResult::DataUncompressionError);
+    REQUIRE(reader.read_gcode_block_chunked((size_t)gcode_id, [](const std::string&) {}) == EResult::DataUncompressionError);
+}
+
+TEST_CASE("Print statistics", "[Binarize]")
+{
+    const std::string filename = std::string(TEST_DATA_DIR) + "/mini_cube_b.bgcode";
+    std::cout << "\nTEST: Print statistics\n";
+    std::cout << "File:" << filename << "\n";
+
+    FILE* src_file = boost::nowide::fopen(filename.c_str(), "rb");
+    REQUIRE(src_file != nullptr);
+    ScopedFile scoped_src_file(src_file);
+    PrintStatistics stats;
+    REQUIRE(compute_print_statistics(*src_file, stats, true) == EResult::Success);
+    REQUIRE(stats.moves_count > 0);
+    REQUIRE(stats.tool_changes == 0);
+    // filament used [mm] = 986.61
+    REQUIRE(std::abs(stats.extruded_length - stats.retracted_length - 986.61) < 10.0);
+    REQUIRE(stats.min[2] == Approx(0.2));
+    REQUIRE(stats.max[2] == Approx(18.05));
+    double features_time = 0.0;
+    for (const PrintStatistics::Feature& feature : stats.features) {
+        features_time += feature.time;
+    }
+    REQUIRE(features_time == Approx(stats.time));
+    REQUIRE(std::find_if(stats.features.begin(), stats.features.end(),
+        [](const PrintStatistics::Feature& f) { return f.name == "External perimeter"; }) != stats.features.end());
+
+    // the state carried between blocks must not depend on where the blocks are split
+    BinarizerConfig config;
+    config.compression.gcode = ECompressionType::None;
+    config.gcode_encoding = EGCodeEncodingType::MeatPackComments;
+    FILE* small_blocks_file = tmpfile();
+    REQUIRE(small_blocks_file != nullptr);
+    ScopedFile scoped_small_blocks_file(small_blocks_file);
+    REQUIRE(transcode(*src_file, *small_blocks_file, config, 300) == EResult::Success);
+    PrintStatistics small_blocks_stats;
+    REQUIRE(compute_print_statistics(*small_blocks_file, small_blocks_stats) == EResult::Success);
+    REQUIRE(small_blocks_stats.moves_count == stats.moves_count);
+    REQUIRE(small_blocks_stats.extruded_length == Approx(stats.extruded_length));
+    REQUIRE(small_blocks_stats.travel_distance == Approx(stats.travel_distance));
+    REQUIRE(small_blocks_stats.time == Approx(stats.time));
+    REQUIRE(small_blocks_stats.min == stats.min);
+    REQUIRE(small_blocks_stats.max == stats.max);
+    REQUIRE(small_blocks_stats.features.size() == stats.features.size());
+    for (size_t i = 0; i < stats.features.size(); ++i) {
+        REQUIRE(small_blocks_stats.features[i].name == stats.features[i].name);
+        REQUIRE(small_blocks_stats.features[i].time == Approx(stats.features[i].time));
+        REQUIRE(small_blocks_stats.features[i].extrusion == Approx(stats.features[i].extrusion));
+    }
+
+    // one line per block, with modes, relative moves and tools changing across blocks
+    Binarizer binarizer;
+    binarizer.set_enabled(true);
+    binarizer.set_max_gcode_cache_size(32);
+    BinaryData& binary_data = binarizer.get_binary_data();
+    binary_data.printer_metadata.raw_data.emplace_back("printer_model", "MK4");
+    binary_data.print_metadata.raw_data.emplace_back("filament used [mm]", "2.0");
+    binary_data.slicer_metadata.raw_data.emplace_back("layer_height", "0.2");
+    FILE* lines_file = tmpfile();
+    REQUIRE(lines_file != nullptr);
+    ScopedFile scoped_lines_file(lines_file);
+    REQUIRE(binarizer.initialize(*lines_file, BinarizerConfig()) == EResult::Success);
+    REQUIRE(binarizer.append_gcode("M83\nG1 X10 Y0 F600\n;TYPE:Perimeter\nG1 Y10 E1 F1200\nG91\nG1 X-10 E1\n"
+        "G90\nM83\nT1\nG1 E-0.5 F1800\nT0\nG4 S2\nG92 X0\nG1 X5\n") == EResult::Success);
+    REQUIRE(binarizer.finalize() == EResult::Success);
+    PrintStatistics lines_stats;
+    REQUIRE(compute_print_statistics(*lines_file, lines_stats) == EResult::Success);
+    REQUIRE(lines_stats.moves_count == 5);
+    REQUIRE(lines_stats.extruded_length == Approx(2.0));
+    REQUIRE(lines_stats.retracted_length == Approx(0.5));
+    REQUIRE(lines_stats.extrusion_distance == Approx(20.0));
+    REQUIRE(lines_stats.travel_distance == Approx(15.0));
+    REQUIRE(lines_stats.tool_changes == 1);
+    REQUIRE(lines_stats.min == std::array<double, 3>{ 0.0, 0.0, 0.0 });
+    REQUIRE(lines_stats.max == std::array<double, 3>{ 10.0, 10.0, 0.0 });
+    REQUIRE(lines_stats.features.size() == 2);
+    REQUIRE(lines_stats.features[0].name.empty());
+    REQUIRE(lines_stats.features[0].time == Approx(1.0));
+    REQUIRE(lines_stats.features[1].name == "Perimeter");
+    REQUIRE(lines_stats.features[1].extrusion == Approx(2.0));
+    REQUIRE(lines_stats.features[1].time == Approx(0.5 + 0.5 + 0.5 / 30.0 + 2.0 + 5.0 / 30.0));
+}
+
+TEST_CASE("Toolpath", "[Binarize]")
+{
+    const std::string filename = std::string(TEST_DATA_DIR) + "/mini_cube_b.bgcode";
+    std::cout << "\nTEST: Toolpath\n";
+    std::cout << "File:" << filename << "\n";
+
+    FILE* src_file = boost::nowide::fopen(filename.c_str(), "rb");
+    REQUIRE(src_file != nullptr);
+    ScopedFile scoped_src_file(src_file);
+    Toolpath toolpath;
+    REQUIRE(extract_toolpath(*src_file, toolpath, 0.0f, true) == EResult::Success);
+    const size_t points_count = toolpath.points_count();
+    REQUIRE(points_count > 0);
+    REQUIRE(toolpath.y.size() == points_count);
+    REQUIRE(toolpath.z.size() == points_count);
+    REQUIRE(toolpath.e.size() == points_count);
+    REQUIRE(toolpath.feature.size() == points_count);
+    REQUIRE(toolpath.layer.size() == points_count);
+    REQUIRE(!toolpath.polylines.empty());
+    REQUIRE(toolpath.polylines.front() == 0);
+    for (size_t i = 1; i < toolpath.polylines.size(); ++i) {
+        REQUIRE(toolpath.polylines[i] >= toolpath.polylines[i - 1] + 2);
+    }
+    REQUIRE(toolpath.polylines.back() + 2 <= points_count);
+
+    // same extent as the extruding moves, one layer per marker
+    PrintStatistics stats;
+    REQUIRE(compute_print_statistics(*src_file, stats) == EResult::Success);
+    REQUIRE(*std::min_element(toolpath.x.begin(), toolpath.x.end()) == Approx(stats.min[0]));
+    REQUIRE(*std::max_element(toolpath.y.begin(), toolpath.y.end()) == Approx(stats.max[1]));
+    REQUIRE(*std::max_element(toolpath.z.begin(), toolpath.z.end()) == Approx(stats.max[2]));
+    LayerTable table;
+    REQUIRE(build_layer_table(*src_file, table) == EResult::Success);
+    REQUIRE(toolpath.layer.back() == table.layers.size());
+    REQUIRE(std::find(toolpath.features.begin(), toolpath.features.end(), "External perimeter") != toolpath.features.end());
+
+    // the state carried between blocks must not depend on where the blocks are split
+    BinarizerConfig config;
+    config.compression.gcode = ECompressionType::None;
+    config.gcode_encoding = EGCodeEncodingType::MeatPackComments;
+    FILE* small_blocks_file = tmpfile();
+    REQUIRE(small_blocks_file != nullptr);
+    ScopedFile scoped_small_blocks_file(small_blocks_file);
+    REQUIRE(transcode(*src_file, *small_blocks_file, config, 300) == EResult::Success);
+    Toolpath small_blocks_toolpath;
+    REQUIRE(extract_toolpath(*small_blocks_file, small_blocks_toolpath) == EResult::Success);
+    REQUIRE(small_blocks_toolpath.polylines == toolpath.polylines);
+    REQUIRE(small_blocks_toolpath.x == toolpath.x);
+    REQUIRE(small_blocks_toolpath.y == toolpath.y);
+    REQUIRE(small_blocks_toolpath.z == toolpath.z);
+    REQUIRE(small_blocks_toolpath.feature == toolpath.feature);
+    REQUIRE(small_blocks_toolpath.layer == toolpath.layer);
+
+    // decimation keeps the polylines and the extruded filament
+    REQUIRE(extract_toolpath(*src_file, small_blocks_toolpath, 1.0f) == EResult::Success);
+    REQUIRE(small_blocks_toolpath.points_count() < points_count);
+    REQUIRE(small_blocks_toolpath.polylines.size() == toolpath.polylines.size());
+    const double e = std::accumulate(toolpath.e.begin(), toolpath.e.end(), 0.0);
+    REQUIRE(std::accumulate(small_blocks_toolpath.e.begin(), small_blocks_toolpath.e.end(), 0.0) == Approx(e));
+
+    // one line per block, with polylines, modes and arcs crossing blocks
+    Binarizer binarizer;
+    binarizer.set_enabled(true);
+    binarizer.set_max_gcode_cache_size(32);
+    BinaryData& binary_data = binarizer.get_binary_data();
+    binary_data.printer_metadata.raw_data.emplace_back("printer_model", "MK4");
+    binary_data.print_metadata.raw_data.emplace_back("filament used [mm]", "4.0");
+    binary_data.slicer_metadata.raw_data.emplace_back("layer_height", "0.2");
+    FILE* lines_file = tmpfile();
+    REQUIRE(lines_file != nullptr);
+    ScopedFile scoped_lines_file(lines_file);
+    REQUIRE(binarizer.initialize(*lines_file, BinarizerConfig()) == EResult::Success);
+    REQUIRE(binarizer.append_gcode("G90\nM83\nG1 X10 Y0 F600\n;TYPE:Perimeter\nG1 X20 E1\nG3 X10 Y0 I-5 J0 E1\nG91\nG1 Y10 E1\n"
+        "G90\nM82\nG92 E0\nG1 X0 Y10 E0.5\n;LAYER_CHANGE\nG1 X5 Y5 Z0.4\nG1 X6 Y5 E1\n") == EResult::Success);
+    REQUIRE(binarizer.finalize() == EResult::Success);
+    REQUIRE(extract_toolpath(*lines_file, toolpath) == EResult::Success);
+    REQUIRE(toolpath.points_count() == 42);
+    REQUIRE(toolpath.polylines == std::vector<uint32_t>{ 0, 40 });
+    REQUIRE(toolpath.features == std::vector<std::string>{ "", "Perimeter" });
+    REQUIRE(std::all_of(toolpath.feature.begin(), toolpath.feature.end(), [](uint16_t f) { return f == 1; }));
+    REQUIRE(toolpath.x[19] == Approx(15.0f));
+    REQUIRE(toolpath.y[19] == Approx(5.0f));
+    REQUIRE(toolpath.x[39] == Approx(0.0f));
+    REQUIRE(toolpath.y[39] == Approx(10.0f));
+    REQUIRE(toolpath.e[39] == Approx(0.5f));
+    REQUIRE(std::accumulate(toolpath.e.begin(), toolpath.e.begin() + 40, 0.0) == Approx(3.5));
+    REQUIRE(toolpath.x[40] == Approx(5.0f));
+    REQUIRE(toolpath.z[41] == Approx(0.4f));
+    REQUIRE(toolpath.e[41] == Approx(0.5f));
+    REQUIRE(toolpath.layer[39] == 0);
+    REQUIRE(toolpath.layer[41] == 1);
+}
+
+TEST_CASE("Search", "[Binarize]")
+{
+    const std::string filename = std::string(TEST_DATA_DIR) + "/mini_cube_b.bgcode";
+    std::cout << "\nTEST: Search\n";
+    std::cout << "File:" << filename << "\n";
+
+    FILE* src_file = boost::nowide::fopen(filename.c_str(), "rb");
+    REQUIRE(src_file != nullptr);
+    ScopedFile scoped_src_file(src_file);
+    const std::vector<std::string> patterns = { "M73", "M10", ";LAYER_CHANGE", "M7" };
+    std::vector<GCodeMatch> matches;
+    REQUIRE(search_gcode(*src_file, patterns, matches, true) == EResult::Success);
+    REQUIRE(!matches.empty());
+
+    // same lines found scanning the decoded gcode stream
+    const std::string gcode = decode_gcode_stream(*src_file);
+    std::vector<std::pair<size_t, std::string>> expected;
+    size_t line_id = 0;
+    for (size_t begin = 0; begin < gcode.size(); ++line_id) {
+        const size_t end = std::min(gcode.find('\n', begin), gcode.size());
+        const std::string line = gcode.substr(begin, end - begin);
+        for (const std::string& pattern : patterns) {
+            if (line.compare(0, pattern.size(), pattern) == 0 &&
+                (line.size() == pattern.size() || line[pattern.size()] < '0' || line[pattern.size()] > '9')) {
+                expected.emplace_back(line_id, line);
+                break;
+            }
+        }
+        begin = end + 1;
+    }
+    REQUIRE(matches.size() == expected.size());
+    GCodeIndex index;
+    REQUIRE(build_gcode_index(*src_file, index) == EResult::Success);
+    for (size_t i = 0; i < matches.size(); ++i) {
+        REQUIRE(matches[i].line == expected[i].first);
+        REQUIRE(matches[i].text == expected[i].second);
+        GCodePosition position;
+        REQUIRE(line_to_position(*src_file, index, matches[i].line, position) == EResult::Success);
+        REQUIRE(position.block == matches[i].position.block);
+        REQUIRE(position.offset == matches[i].position.offset);
+    }
+
+    // results cached into the index, and saved into the sidecar file
+    std::vector<GCodeMatch> cached_matches;
+    REQUIRE(search_gcode(*src_file, index, { "M73" }, cached_matches, true) == EResult::Success);
+    REQUIRE(index.searches.size() == 1);
+    REQUIRE(search_gcode(*src_file, index, patterns, cached_matches) == EResult::Success);
+    REQUIRE(index.searches.size() == patterns.size());
+    REQUIRE(cached_matches.size() == matches.size());
+    FILE* sidecar = tmpfile();
+    REQUIRE(sidecar != nullptr);
+    ScopedFile scoped_sidecar(sidecar);
+    REQUIRE(index.write(*sidecar) == EResult::Success);
+    rewind(sidecar);
+    GCodeIndex loaded;
+    REQUIRE(loaded.read(*sidecar) == EResult::Success);
+    REQUIRE(loaded.searches.size() == index.searches.size());
+    // a corrupted string size is detected (the first pattern follows the blocks and the count of the searches)
+    FILE* corrupted_sidecar = tmpfile();
+    REQUIRE(corrupted_sidecar != nullptr);
+    ScopedFile scoped_corrupted_sidecar(corrupted_sidecar);
+    REQUIRE(index.write(*corrupted_sidecar) == EResult::Success);
+    REQUIRE(fseek(corrupted_sidecar, (long)(4 + 4 + 8 + 8 + 8 + index.blocks.size() * 5 * 8 + 8), SEEK_SET) == 0);
+    const uint64_t corrupted_size = UINT64_MAX / 2;
+    REQUIRE(fwrite(&corrupted_size, 1, sizeof(corrupted_size), corrupted_sidecar) == sizeof(corrupted_size));
+    rewind(corrupted_sidecar);
+    GCodeIndex corrupted;
+    REQUIRE(corrupted.read(*corrupted_sidecar) == EResult::ReadError);
+    // cached patterns are not searched again
+    REQUIRE(search_gcode(*src_file, loaded, { ";LAYER_CHANGE", "M73" }, cached_matches) == EResult::Success);
+    REQUIRE(loaded.searches.size() == index.searches.size());
+    REQUIRE(cached_matches.size() == loaded.searches[";LAYER_CHANGE"].size() + loaded.searches["M73"].size());
+    for (size_t i = 1; i < cached_matches.size(); ++i) {
+        REQUIRE(cached_matches[i].line > cached_matches[i - 1].line);
+    }
+    // the cached results are not returned for another file
+    FILE* empty_file = tmpfile();
+    REQUIRE(empty_file != nullptr);
+    ScopedFile scoped_empty_file(empty_file);
+    REQUIRE(search_gcode(*empty_file, loaded, { ";LAYER_CHANGE", "M73" }, cached_matches) == EResult::IndexMismatch);
+}
+
+TEST_CASE("Split", "[Binarize]")
+{
+    const std::string filename = std::string(TEST_DATA_DIR) + "/mini_cube_b.bgcode";
+    std::cout << "\nTEST: Split\n";
+    std::cout << "File:" << filename << "\n";
+
+    FILE* src_file = boost::nowide::fopen(filename.c_str(), "rb");
+    REQUIRE(src_file != nullptr);
+    ScopedFile scoped_src_file(src_file);
+
+    GCodeIndex index;
+    REQUIRE(build_gcode_index(*src_file, index) == EResult::Success);
+    LayerTable table;
+    REQUIRE(build_layer_table(*src_file, table) == EResult::Success);
+    const std::string gcode = decode_gcode_stream(*src_file);
+
+    std::byte checksum_verify_buffer[2048];
+    auto check_split = [&](FILE& dst_file, size_t first_line, size_t last_line) {
+        REQUIRE(is_valid_binary_gcode(dst_file, true, checksum_verify_buffer, sizeof(checksum_verify_buffer)) == EResult::Success);
+        GCodePosition first;
+        REQUIRE(line_to_position(*src_file, index, first_line, first) == EResult::Success);
+        size_t begin;
+        REQUIRE(index.position_to_offset(first, begin));
+        size_t end = gcode.size();
+        GCodePosition last;
+        if (line_to_position(*src_file, index, last_line, last) == EResult::Success)
+            REQUIRE(index.position_to_offset(last, end));
+        REQUIRE(decode_gcode_stream(dst_file) == gcode.substr(begin, end - begin));
+    };
+
+    // line range, spanning several blocks
+    const size_t first_line = index.blocks[1].first_line + 3;
+    const size_t last_line = index.blocks[3].first_line + 5;
+    FILE* lines_file = tmpfile();
+    REQUIRE(lines_file != nullptr);
+    ScopedFile scoped_lines_file(lines_file);
+    REQUIRE(split(*src_file, *lines_file, index, first_line, last_line) == EResult::Success);
+    check_split(*lines_file, first_line, last_line);
+
+    // layer range, up to the end of the file
+    FILE* layers_file = tmpfile();
+    REQUIRE(layers_file != nullptr);
+    ScopedFile scoped_layers_file(layers_file);
+    const size_t first_layer = table.layers.size() / 2;
+    REQUIRE(split(*src_file, *layers_file, index, table, first_layer, table.layers.size()) == EResult::Success);
+    check_split(*layers_file, table.layers[first_layer].line, index.lines_count());
+
+    REQUIRE(split(*src_file, *layers_file, index, table, 2, 2) == EResult::BlockNotFound);
+
+    // index and layer table not matching the file, nothing is written
+    std::vector<char> data = read_file(filename);
+    data.back() ^= 0x01;
+    FILE* modified_file = tmpfile();
+    REQUIRE(modified_file != nullptr);
+    ScopedFile scoped_modified_file(modified_file);
+    REQUIRE(fwrite(data.data(), 1, data.size(), modified_file) == data.size());
+    FILE* mismatch_file = tmpfile();
+    REQUIRE(mismatch_file != nullptr);
+    ScopedFile scoped_mismatch_file(mismatch_file);
+    REQUIRE(split(*modified_file, *mismatch_file, index, first_line, last_line) == EResult::IndexMismatch);
+    REQUIRE(split(*modified_file, *mismatch_file, index, table, first_layer, table.layers.size()) == EResult::IndexMismatch);
+    LayerTable stale_table = table;
+    stale_table.fingerprint ^= 1;
+    REQUIRE(split(*src_file, *mismatch_file, index, stale_table, first_layer, table.layers.size()) == EResult::IndexMismatch);
+    REQUIRE(read_stream(*mismatch_file).empty());
+}
+
+TEST_CASE("Merge", "[Binarize]")
+{
+    const std::string filename = std::string(TEST_DATA_DIR) + "/mini_cube_b.bgcode";
+    std::cout << "\nTEST: Merge\n";
+    std::cout << "File:" << filename << "\n";
+
+    FILE* src_file = boost::nowide::fopen(filename.c_str(), "rb");
+    REQUIRE(src_file != nullptr);
+    ScopedFile scoped_src_file(src_file);
+    const std::string gcode = decode_gcode_stream(*src_file);
+
+    FILE* dst_file = tmpfile();
+    REQUIRE(dst_file != nullptr);
+    ScopedFile scoped_dst_file(dst_file);
+    const std::string glue = "G1 Z100 F720\nM84";
+    REQUIRE(merge({ src_file, src_file }, *dst_file, glue) == EResult::Success);
+
+    std::byte checksum_verify_buffer[2048];
+    REQUIRE(is_valid_binary_gcode(*dst_file, true, checksum_verify_buffer, sizeof(checksum_verify_buffer)) == EResult::Success);
+    REQUIRE(decode_gcode_stream(*dst_file) == gcode + glue + "\n" + gcode);
+
+    PrintMetadataBlock print_metadata;
+    read_print_metadata(*dst_file, print_metadata);
+    auto value = [&print_metadata](const std::string& key) {
+        auto it = std::find_if(print_metadata.raw_data.begin(), print_metadata.raw_data.end(),
+            [&key](const auto& item) { return item.first == key; });
+        return (it != print_metadata.raw_data.end()) ? it->second : std::string();
+    };
+    REQUIRE(value("filament used [mm]") == "1973.22");
+    REQUIRE(value("filament cost") == "0.16");
+    REQUIRE(value("estimated printing time (normal mode)") == "1h 4m 12s");
+
+    // non additive values are taken from the first file
+    REQUIRE(value("estimated first layer printing time (normal mode)") == "1m 8s");
+}
+
+TEST_CASE("Patch", "[Binarize]")
+{
+    const std::string filename = std::string(TEST_DATA_DIR) + "/mini_cube_b.bgcode";
+    std::cout << "\nTEST: Patch\n";
+    std::cout << "File:" << filename << "\n";
+
+    FILE* old_file = boost::nowide::fopen(filename.c_str(), "rb");
+    REQUIRE(old_file != nullptr);
+    ScopedFile scoped_old_file(old_file);
+
+    // new file with different print metadata, all the following blocks are shifted
+    const std::vector<char> original = read_file(filename);
+    FILE* new_file = tmpfile();
+    REQUIRE(new_file != nullptr);
+    ScopedFile scoped_new_file(new_file);
+    REQUIRE(fwrite(original.data(), 1, original.size(), new_file) == original.size());
+    REQUIRE(update_metadata(*new_file, EBlockType::PrintMetadata, { { "filament used [mm]", "1000.00" } }) == EResult::Success);
+
+    FILE* patch_file = tmpfile();
+    REQUIRE(patch_file != nullptr);
+    ScopedFile scoped_patch_file(patch_file);
+    REQUIRE(make_patch(*old_file, *new_file, *patch_file) == EResult::Success);
+    const long patch_size = ftell(patch_file);
+    std::cout << "File size: " << original.size() << " - patch size: " << patch_size << "\n";
+    REQUIRE(patch_size < (long)original.size() / 10);
+
+    // the patch rebuilds the new file
+    FILE* patched_file = tmpfile();
+    REQUIRE(patched_file != nullptr);
+    ScopedFile scoped_patched_file(patched_file);
+    rewind(patch_file);
+    REQUIRE(apply_patch(*old_file, *patch_file, *patched_file) == EResult::Success);
+    fseek(new_file, 0, SEEK_END);
+    const size_t new_size = (size_t)ftell(new_file);
+    REQUIRE(ftell(patched_file) == (long)new_size);
+    rewind(new_file);
+    rewind(patched_file);
+    std::vector<char> expected(new_size);
+    REQUIRE(fread(expected.data(), 1, new_size, new_file) == new_size);
+    std::vector<char> patched(new_size);
+    REQUIRE(fread(patched.data(), 1, new_size, patched_file) == new_size);
+    REQUIRE(patched == expected);
+
+    // the patch is refused on a different base
+    FILE* wrong_file = tmpfile();
+    REQUIRE(wrong_file != nullptr);
+    ScopedFile scoped_wrong_file(wrong_file);
+    rewind(patch_file);
+    REQUIRE(apply_patch(*new_file, *patch_file, *wrong_file) == EResult::InvalidChecksum);
+
+    // a corrupted patch is detected by the hash of the rebuilt file
+    // (the stored file header follows magic, version and 4 integers)
+    FILE* corrupted_file = tmpfile();
+    REQUIRE(corrupted_file != nullptr);
+    ScopedFile scoped_corrupted_file(corrupted_file);
+    REQUIRE(fseek(patch_file, 4 + 4 + 4 * 8, SEEK_SET) == 0);
+    REQUIRE(fputc('X', patch_file) != EOF);
+    rewind(patch_file);
+    REQUIRE(apply_patch(*old_file, *patch_file, *corrupted_file) == EResult::InvalidChecksum);
+}
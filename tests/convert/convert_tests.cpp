@@ -2,7 +2,9 @@
 
 #include "convert/convert.hpp"
 
+#include <algorithm>
 #include <fstream>
+#include <numeric>
 
 #include <boost/nowide/cstdio.hpp>
 
@@ -118,6 +120,67 @@ TEST_CASE("Convert from binary to ascii", "[Convert]")
     compare_text_files(dst_filename, check_filename);
 }
 
+static std::vector<char> read_stream(FILE& file)
+{
+    rewind(&file);
+    std::vector<char> ret;
+    char buffer[4096];
+    for (size_t rsize = fread(buffer, 1, sizeof(buffer), &file); rsize > 0; rsize = fread(buffer, 1, sizeof(buffer), &file)) {
+        ret.insert(ret.end(), buffer, buffer + rsize);
+    }
+    return ret;
+}
+
+TEST_CASE("Convert from binary to ascii stream", "[Convert]")
+{
+    std::cout << "\nTEST: Convert from binary to ascii stream\n";
+
+    const std::string src_filename = std::string(TEST_DATA_DIR) + "/mini_cube_b.bgcode";
+
+    // reference output
+    FILE* src_file = boost::nowide::fopen(src_filename.c_str(), "rb");
+    REQUIRE(src_file != nullptr);
+    ScopedFile scoped_src_file(src_file);
+    FILE* expected_file = tmpfile();
+    REQUIRE(expected_file != nullptr);
+    ScopedFile scoped_expected_file(expected_file);
+    REQUIRE(from_binary_to_ascii(*src_file, *expected_file, true) == EResult::Success);
+    const std::vector<char> expected = read_stream(*expected_file);
+
+    // the source is read through a pipe when available, so that any seek would fail
+#ifdef _WIN32
+    FILE* stream = boost::nowide::fopen(src_filename.c_str(), "rb");
+#else
+    FILE* stream = popen(("cat '" + src_filename + "'").c_str(), "r");
+#endif // _WIN32
+    REQUIRE(stream != nullptr);
+    FILE* dst_file = tmpfile();
+    REQUIRE(dst_file != nullptr);
+    ScopedFile scoped_dst_file(dst_file);
+    const EResult res = from_binary_to_ascii_stream(*stream, *dst_file, true);
+#ifdef _WIN32
+    fclose(stream);
+#else
+    pclose(stream);
+#endif // _WIN32
+    REQUIRE(res == EResult::Success);
+    REQUIRE(read_stream(*dst_file) == expected);
+
+    // truncated files are rejected
+    rewind(src_file);
+    std::vector<char> data = read_stream(*src_file);
+    data.resize(data.size() - 10);
+    FILE* truncated = tmpfile();
+    REQUIRE(truncated != nullptr);
+    ScopedFile scoped_truncated(truncated);
+    REQUIRE(fwrite(data.data(), 1, data.size(), truncated) == data.size());
+    rewind(truncated);
+    FILE* discarded = tmpfile();
+    REQUIRE(discarded != nullptr);
+    ScopedFile scoped_discarded(discarded);
+    REQUIRE(from_binary_to_ascii_stream(*truncated, *discarded, true) != EResult::Success);
+}
+
 TEST_CASE("Convert from ascii to binary", "[Convert]")
 {
     std::cout << "\nTEST: Convert from ascii to binary\n";
@@ -144,3 +207,124 @@ TEST_CASE("Convert from ascii to binary", "[Convert]")
     // compare results
     compare_text_files(ba_dst_filename, ab_src_filename);
 }
+
+TEST_CASE("Conversion statistics", "[Convert]")
+{
+    std::cout << "\nTEST: Conversion statistics\n";
+
+    const std::string src_filename = std::string(TEST_DATA_DIR) + "/mini_cube_b_ref.gcode";
+    FILE* src_file = boost::nowide::fopen(src_filename.c_str(), "rb");
+    REQUIRE(src_file != nullptr);
+    ScopedFile scoped_src_file(src_file);
+    fseek(src_file, 0, SEEK_END);
+    const size_t src_size = (size_t)ftell(src_file);
+    rewind(src_file);
+
+    BinarizerConfig config;
+    config.compression.gcode = ECompressionType::Heatshrink_12_4;
+    config.gcode_encoding = EGCodeEncodingType::MeatPackComments;
+    FILE* binary_file = tmpfile();
+    REQUIRE(binary_file != nullptr);
+    ScopedFile scoped_binary_file(binary_file);
+    ConversionStats stats;
+    REQUIRE(from_ascii_to_binary(*src_file, *binary_file, config, &stats) == EResult::Success);
+    // the source is parsed twice
+    REQUIRE(stats.bytes_read == 2 * src_size);
+    REQUIRE(stats.bytes_written == (size_t)ftell(binary_file));
+    const ConversionStats::Blocks& gcode_blocks = stats.blocks[(size_t)EBlockType::GCode];
+    REQUIRE(gcode_blocks.count > 0);
+    REQUIRE(gcode_blocks.compressed_size < gcode_blocks.uncompressed_size);
+    REQUIRE(stats.compression_ratio(EBlockType::GCode) < 1.0);
+    REQUIRE(stats.blocks[(size_t)EBlockType::PrinterMetadata].count == 1);
+    REQUIRE(stats.blocks[(size_t)EBlockType::SlicerMetadata].count == 1);
+    REQUIRE(stats.peak_uncompressed_size >= gcode_blocks.uncompressed_size / gcode_blocks.count);
+    REQUIRE(stats.stage_times[(size_t)ConversionStats::EStage::Parse] > 0.0);
+    REQUIRE(stats.stage_times[(size_t)ConversionStats::EStage::MeatPack] > 0.0);
+    REQUIRE(stats.stage_times[(size_t)ConversionStats::EStage::Compression] > 0.0);
+    REQUIRE(stats.stage_times[(size_t)ConversionStats::EStage::Checksum] > 0.0);
+    const double stages_time = std::accumulate(stats.stage_times.begin(), stats.stage_times.end(), 0.0);
+    REQUIRE(stages_time <= stats.total_time);
+
+    // the same blocks are read back
+    FILE* ascii_file = tmpfile();
+    REQUIRE(ascii_file != nullptr);
+    ScopedFile scoped_ascii_file(ascii_file);
+    ConversionStats back_stats;
+    REQUIRE(from_binary_to_ascii(*binary_file, *ascii_file, true, &back_stats) == EResult::Success);
+    REQUIRE(back_stats.bytes_written == (size_t)ftell(ascii_file));
+    REQUIRE(back_stats.blocks[(size_t)EBlockType::GCode].count == gcode_blocks.count);
+    REQUIRE(back_stats.blocks[(size_t)EBlockType::GCode].compressed_size == gcode_blocks.compressed_size);
+    REQUIRE(back_stats.peak_uncompressed_size == stats.peak_uncompressed_size);
+    REQUIRE(back_stats.stage_times[(size_t)ConversionStats::EStage::Compression] > 0.0);
+}
+
+TEST_CASE("Generate gcode", "[Convert]")
+{
+    std::cout << "\nTEST: Generate gcode\n";
+
+    auto generate = [](const GeneratorConfig& config) {
+        FILE* file = tmpfile();
+        REQUIRE(file != nullptr);
+        ScopedFile scoped_file(file);
+        REQUIRE(generate_gcode(*file, config) == EResult::Success);
+        return read_stream(*file);
+    };
+
+    auto convert = [](const std::vector<char>& gcode, const BinarizerConfig& config, ConversionStats& stats) {
+        FILE* src_file = tmpfile();
+        REQUIRE(src_file != nullptr);
+        ScopedFile scoped_src_file(src_file);
+        REQUIRE(fwrite(gcode.data(), 1, gcode.size(), src_file) == gcode.size());
+        rewind(src_file);
+        FILE* dst_file = tmpfile();
+        REQUIRE(dst_file != nullptr);
+        ScopedFile scoped_dst_file(dst_file);
+        return from_ascii_to_binary(*src_file, *dst_file, config, &stats);
+    };
+
+    GeneratorConfig config;
+    config.size = 256 * 1024;
+    const std::vector<char> gcode = generate(config);
+    REQUIRE(gcode.size() > config.size / 2);
+    REQUIRE(gcode.size() < config.size * 2);
+    // the same config generates the same file
+    REQUIRE(generate(config) == gcode);
+    config.seed = 1;
+    REQUIRE(generate(config) != gcode);
+
+    ConversionStats stats;
+    REQUIRE(convert(gcode, BinarizerConfig(), stats) == EResult::Success);
+    REQUIRE(stats.blocks[(size_t)EBlockType::Thumbnail].count == config.thumbnails.size());
+    REQUIRE(stats.blocks[(size_t)EBlockType::PrinterMetadata].count == 1);
+    REQUIRE(stats.blocks[(size_t)EBlockType::SlicerMetadata].count == 1);
+
+    // long lines with a zero interval are disabled
+    GeneratorConfig no_long_lines_config = config;
+    no_long_lines_config.long_line_length = 8192;
+    no_long_lines_config.long_lines_interval = 0;
+    const std::vector<char> no_long_lines_gcode = generate(no_long_lines_config);
+    REQUIRE(no_long_lines_gcode.size() < config.size * 2);
+    const std::string no_long_comment(no_long_lines_config.long_line_length - 2, 'x');
+    REQUIRE(std::search(no_long_lines_gcode.begin(), no_long_lines_gcode.end(), no_long_comment.begin(), no_long_comment.end()) ==
+        no_long_lines_gcode.end());
+
+    // pathological cases
+    config.size = 2 * 1024 * 1024;
+    config.crlf = true;
+    config.moves_per_layer = 2;
+    config.long_line_length = 8192;
+    config.long_lines_interval = 100;
+    config.thumbnails.push_back({ (uint16_t)EThumbnailFormat::PNG, 2000, 2000 });
+    const std::vector<char> crlf_gcode = generate(config);
+    const std::string long_comment(config.long_line_length - 2, 'x');
+    REQUIRE(std::search(crlf_gcode.begin(), crlf_gcode.end(), long_comment.begin(), long_comment.end()) != crlf_gcode.end());
+    BinarizerConfig binarizer_config;
+    binarizer_config.layer_aligned_gcode_blocks = true;
+    binarizer_config.min_gcode_block_size = 1;
+    REQUIRE(convert(crlf_gcode, binarizer_config, stats) == EResult::Success);
+    REQUIRE(stats.blocks[(size_t)EBlockType::Thumbnail].count == config.thumbnails.size());
+    // one tiny block per layer
+    const ConversionStats::Blocks& gcode_blocks = stats.blocks[(size_t)EBlockType::GCode];
+    REQUIRE(gcode_blocks.count > 100);
+    REQUIRE(gcode_blocks.uncompressed_size / gcode_blocks.count < 4096);
+}
@@ -4,6 +4,13 @@
 
 #include <boost/nowide/cstdio.hpp>
 
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif // _WIN32
+
 using namespace bgcode::core;
 
 class ScopedFile
@@ -194,3 +201,140 @@ static std::string thumbnail_format_as_string(EThumbnailFormat type)
              break;
      } while (true);
  }
+
+ TEST_CASE("Raw block copy", "[Core]")
+ {
+     const std::string filename = std::string(TEST_DATA_DIR) + "/mini_cube_b.bgcode";
+     std::cout << "\nTEST: Raw block copy\n";
+     std::cout << "File:" << filename << "\n";
+
+     const size_t MAX_CHECKSUM_CACHE_SIZE = 2048;
+     std::byte checksum_verify_buffer[MAX_CHECKSUM_CACHE_SIZE];
+
+     FILE* file = boost::nowide::fopen(filename.c_str(), "rb");
+     REQUIRE(file != nullptr);
+     ScopedFile scoped_file(file);
+
+     fseek(file, 0, SEEK_END);
+     const long file_size = ftell(file);
+     rewind(file);
+
+     FILE* dst_file = tmpfile();
+     REQUIRE(dst_file != nullptr);
+     ScopedFile scoped_dst_file(dst_file);
+
+     FileHeader file_header;
+     REQUIRE(read_header(*file, file_header, nullptr) == EResult::Success);
+     REQUIRE(file_header.write(*dst_file) == EResult::Success);
+
+     // copy all the blocks, skipping thumbnails
+     long thumbnails_size = 0;
+     BlockHeader block_header;
+     while (ftell(file) < file_size) {
+         REQUIRE(read_next_block_header(*file, file_header, block_header) == EResult::Success);
+         if ((EBlockType)block_header.type == EBlockType::Thumbnail) {
+             thumbnails_size += (long)(block_header.get_size() + block_content_size(file_header, block_header));
+             REQUIRE(skip_block(*file, file_header, block_header) == EResult::Success);
+         }
+         else
+             REQUIRE(copy_block(*file, file_header, block_header, *dst_file) == EResult::Success);
+     }
+
+     REQUIRE(ftell(dst_file) == file_size - thumbnails_size);
+     REQUIRE(is_valid_binary_gcode(*dst_file, true, checksum_verify_buffer, sizeof(checksum_verify_buffer)) == EResult::Success);
+
+#ifndef _WIN32
+     // non-seekable output, the file is larger than the pipe buffer so it is read by another thread
+     int fds[2];
+     REQUIRE(pipe(fds) == 0);
+     std::vector<char> piped;
+     std::thread reader([&piped, fd = fds[0]]() {
+         char buffer[4096];
+         for (ssize_t rsize = read(fd, buffer, sizeof(buffer)); rsize > 0; rsize = read(fd, buffer, sizeof(buffer))) {
+             piped.insert(piped.end(), buffer, buffer + rsize);
+         }
+         close(fd);
+     });
+     FILE* pipe_in = fdopen(fds[1], "wb");
+     REQUIRE(pipe_in != nullptr);
+     const char prefix[] = "prefix";
+     REQUIRE(fwrite(prefix, 1, sizeof(prefix), pipe_in) == sizeof(prefix));
+     const EResult res = copy_file_bytes(*file, 0, (size_t)file_size, *pipe_in);
+     fclose(pipe_in);
+     reader.join();
+     REQUIRE(res == EResult::Success);
+     std::vector<char> expected(prefix, prefix + sizeof(prefix));
+     expected.resize(sizeof(prefix) + (size_t)file_size);
+     rewind(file);
+     REQUIRE(fread(expected.data() + sizeof(prefix), 1, (size_t)file_size, file) == (size_t)file_size);
+     REQUIRE(piped == expected);
+#endif // _WIN32
+ }
+
+ TEST_CASE("Block header position", "[Core]")
+ {
+     std::cout << "\nTEST: Block header position\n";
+
+     FILE* file = tmpfile();
+     REQUIRE(file != nullptr);
+     ScopedFile scoped_file(file);
+
+     FileHeader file_header;
+     file_header.checksum_type = (uint16_t)EChecksumType::None;
+     REQUIRE(file_header.write(*file) == EResult::Success);
+     const long block_position = ftell(file);
+     REQUIRE(block_position > 0);
+
+     // write() leaves the position unchanged
+     BlockHeader written((uint16_t)EBlockType::GCode, (uint16_t)ECompressionType::None, 0);
+     REQUIRE(written.write(*file) == EResult::Success);
+     REQUIRE(written.get_position() == 0);
+
+     // read() sets the position
+     REQUIRE(fseek(file, block_position, SEEK_SET) == 0);
+     BlockHeader read;
+     REQUIRE(read.read(*file) == EResult::Success);
+     REQUIRE(read.get_position() == block_position);
+     REQUIRE(read.type == written.type);
+ }
+
+ TEST_CASE("Tracing", "[Core]")
+ {
+     const std::string filename = std::string(TEST_DATA_DIR) + "/mini_cube_b.bgcode";
+     std::cout << "\nTEST: Tracing\n";
+     std::cout << "File:" << filename << "\n";
+
+     const size_t MAX_CHECKSUM_CACHE_SIZE = 2048;
+     std::byte checksum_verify_buffer[MAX_CHECKSUM_CACHE_SIZE];
+
+     FILE* file = boost::nowide::fopen(filename.c_str(), "rb");
+     REQUIRE(file != nullptr);
+     ScopedFile scoped_file(file);
+
+     const bool tracing = start_tracing();
+     std::cout << "Tracing built in: " << (tracing ? "yes" : "no") << "\n";
+     FileHeader file_header;
+     REQUIRE(read_header(*file, file_header, nullptr) == EResult::Success);
+     BlockHeader block_header;
+     REQUIRE(read_next_block_header(*file, file_header, block_header, checksum_verify_buffer, sizeof(checksum_verify_buffer)) == EResult::Success);
+
+     FILE* trace_file = tmpfile();
+     REQUIRE(trace_file != nullptr);
+     ScopedFile scoped_trace_file(trace_file);
+     REQUIRE(stop_tracing(*trace_file) == EResult::Success);
+     const size_t trace_size = (size_t)ftell(trace_file);
+     rewind(trace_file);
+     std::string trace(trace_size, '\0');
+     REQUIRE(fread(trace.data(), 1, trace.size(), trace_file) == trace.size());
+     REQUIRE(trace.find("{\"traceEvents\":[") == 0);
+     REQUIRE((trace.find("\"name\":\"Checksum::append\"") != std::string::npos) == tracing);
+     REQUIRE((trace.find("\"name\":\"read_from_file\"") != std::string::npos) == tracing);
+
+     // spans are recorded only while tracing
+     REQUIRE(read_header(*file, file_header, nullptr) == EResult::Success);
+     FILE* empty_trace_file = tmpfile();
+     REQUIRE(empty_trace_file != nullptr);
+     ScopedFile scoped_empty_trace_file(empty_trace_file);
+     REQUIRE(stop_tracing(*empty_trace_file) == EResult::Success);
+     REQUIRE(ftell(empty_trace_file) < 64);
+ }
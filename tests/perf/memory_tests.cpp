@@ -0,0 +1,237 @@
+#include <catch_main.hpp>
+
+#include "convert/convert.hpp"
+
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <string>
+
+using namespace bgcode::core;
+using namespace bgcode::binarize;
+using namespace bgcode::convert;
+
+// Peak memory of the conversions and of the block reads of a large generated file.
+// The budgets are relative to the max size of the blocks, so that buffering the whole file, or a part of it
+// growing with the file size, makes the tests fail.
+
+// Allocated bytes, tracked by the global operator new/delete
+static std::atomic<size_t> s_allocated_size{ 0 };
+static std::atomic<size_t> s_peak_allocated_size{ 0 };
+// room for the size of the allocation, keeping the alignment of the returned pointers
+static constexpr const size_t ALLOCATION_HEADER_SIZE = alignof(std::max_align_t);
+
+void* operator new(size_t size)
+{
+    void* ptr = std::malloc(size + ALLOCATION_HEADER_SIZE);
+    if (ptr == nullptr)
+        throw std::bad_alloc();
+    *static_cast<size_t*>(ptr) = size;
+    const size_t allocated_size = s_allocated_size.fetch_add(size) + size;
+    size_t peak = s_peak_allocated_size.load();
+    while (allocated_size > peak && !s_peak_allocated_size.compare_exchange_weak(peak, allocated_size)) {}
+    return static_cast<std::byte*>(ptr) + ALLOCATION_HEADER_SIZE;
+}
+
+void operator delete(void* ptr) noexcept
+{
+    if (ptr == nullptr)
+        return;
+    void* header = static_cast<std::byte*>(ptr) - ALLOCATION_HEADER_SIZE;
+    s_allocated_size.fetch_sub(*static_cast<size_t*>(header));
+    std::free(header);
+}
+
+void operator delete(void* ptr, size_t) noexcept { operator delete(ptr); }
+
+class ScopedFile
+{
+public:
+    explicit ScopedFile(FILE* file) : m_file(file) {}
+    ~ScopedFile() { if (m_file != nullptr) fclose(m_file); }
+private:
+    FILE* m_file{ nullptr };
+};
+
+static constexpr const uint64_t CORPUS_SIZE = 24 * 1024 * 1024;
+// max size of the gcode blocks written by the binarizer
+static constexpr const size_t MAX_BLOCK_SIZE = 65536;
+// budget of the allocated bytes, as a count of blocks
+static constexpr const size_t ALLOCATION_BUDGET = 32 * MAX_BLOCK_SIZE;
+// overhead of the allocator and of the stdio buffers in the resident set
+static constexpr const size_t RSS_OVERHEAD = 8 * 1024 * 1024;
+// budget of the growth of the resident set
+static constexpr const size_t RSS_BUDGET = ALLOCATION_BUDGET + RSS_OVERHEAD;
+// max size of the batches of the Reader without memory limits (DEFAULT_SCAN_BATCH_SIZE)
+static constexpr const size_t DEFAULT_BATCH_SIZE = 16 * 1024 * 1024;
+
+#ifdef __linux__
+// Returns the value of the given field of /proc/self/status, in bytes
+static size_t read_status_field(const std::string& field)
+{
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, field.size() + 1, field + ":") == 0)
+            return (size_t)std::atoll(line.c_str() + field.size() + 1) * 1024;
+    }
+    return 0;
+}
+#endif // __linux__
+
+// Peak memory used by the given operation
+class MemoryProbe
+{
+public:
+    MemoryProbe() {
+        s_peak_allocated_size = s_allocated_size.load();
+        m_allocated_size = s_allocated_size.load();
+#ifdef __linux__
+        // resets the peak resident set size (VmHWM), not available on older kernels
+        std::ofstream clear_refs("/proc/self/clear_refs");
+        clear_refs << "5";
+        clear_refs.close();
+        m_rss = read_status_field("VmRSS");
+        m_rss_available = clear_refs.good() && m_rss > 0 && read_status_field("VmHWM") <= m_rss + 1024 * 1024;
+#endif // __linux__
+    }
+
+    size_t peak_allocated_size() const { return s_peak_allocated_size.load() - m_allocated_size; }
+
+    // returns false if the peak resident set size is not available
+    bool peak_rss_growth(size_t& growth) const {
+#ifdef __linux__
+        if (!m_rss_available)
+            return false;
+        const size_t peak = read_status_field("VmHWM");
+        growth = (peak > m_rss) ? peak - m_rss : 0;
+        return true;
+#else
+        return false;
+#endif // __linux__
+    }
+
+    void check(const std::string& name, size_t allocation_budget = ALLOCATION_BUDGET) const {
+        std::cout << name << ": peak allocated " << peak_allocated_size() / 1024 << " KB";
+        size_t rss_growth = 0;
+        const bool rss_available = peak_rss_growth(rss_growth);
+        if (rss_available)
+            std::cout << ", peak RSS growth " << rss_growth / 1024 << " KB";
+        std::cout << "\n";
+        INFO(name);
+        CHECK(peak_allocated_size() <= allocation_budget);
+        if (rss_available)
+            CHECK(rss_growth <= allocation_budget + RSS_OVERHEAD);
+    }
+
+private:
+    size_t m_allocated_size{ 0 };
+    size_t m_rss{ 0 };
+    bool m_rss_available{ false };
+};
+
+static size_t file_size(FILE& file)
+{
+    fseek(&file, 0, SEEK_END);
+    const size_t size = (size_t)ftell(&file);
+    rewind(&file);
+    return size;
+}
+
+TEST_CASE("Conversions peak memory", "[Memory]")
+{
+    std::cout << "\nTEST: Conversions peak memory\n";
+
+    FILE* ascii_file = tmpfile();
+    REQUIRE(ascii_file != nullptr);
+    ScopedFile scoped_ascii_file(ascii_file);
+    GeneratorConfig generator_config;
+    generator_config.size = CORPUS_SIZE;
+    REQUIRE(generate_gcode(*ascii_file, generator_config) == EResult::Success);
+    // the budgets must be far below the file size, to catch the whole file buffering
+    REQUIRE(file_size(*ascii_file) > 2 * RSS_BUDGET);
+
+    BinarizerConfig config;
+    config.compression.gcode = ECompressionType::Heatshrink_12_4;
+    config.gcode_encoding = EGCodeEncodingType::MeatPackComments;
+    FILE* binary_file = tmpfile();
+    REQUIRE(binary_file != nullptr);
+    ScopedFile scoped_binary_file(binary_file);
+    {
+        const MemoryProbe probe;
+        REQUIRE(from_ascii_to_binary(*ascii_file, *binary_file, config) == EResult::Success);
+        probe.check("from_ascii_to_binary");
+    }
+
+    FILE* back_file = tmpfile();
+    REQUIRE(back_file != nullptr);
+    ScopedFile scoped_back_file(back_file);
+    {
+        rewind(binary_file);
+        const MemoryProbe probe;
+        REQUIRE(from_binary_to_ascii(*binary_file, *back_file, true) == EResult::Success);
+        probe.check("from_binary_to_ascii");
+    }
+
+    {
+        rewind(binary_file);
+        rewind(back_file);
+        const MemoryProbe probe;
+        REQUIRE(from_binary_to_ascii_stream(*binary_file, *back_file, true) == EResult::Success);
+        probe.check("from_binary_to_ascii_stream");
+    }
+
+    {
+        const size_t binary_size = file_size(*binary_file);
+        const MemoryProbe probe;
+        FileHeader file_header;
+        REQUIRE(read_header(*binary_file, file_header, nullptr) == EResult::Success);
+        BlockHeader block_header;
+        size_t gcode_blocks_count = 0;
+        while (read_next_block_header(*binary_file, file_header, block_header) == EResult::Success) {
+            if ((EBlockType)block_header.type == EBlockType::GCode) {
+                GCodeBlock block;
+                REQUIRE(block.read_data(*binary_file, file_header, block_header) == EResult::Success);
+                REQUIRE(block.raw_data.size() <= MAX_BLOCK_SIZE);
+                ++gcode_blocks_count;
+            }
+            else
+                REQUIRE(skip_block_content(*binary_file, file_header, block_header) == EResult::Success);
+            if ((size_t)ftell(binary_file) == binary_size)
+                break;
+        }
+        REQUIRE(gcode_blocks_count > 100);
+        probe.check("block reads");
+    }
+
+    {
+        rewind(binary_file);
+        const MemoryProbe probe;
+        Reader reader;
+        REQUIRE(reader.open(*binary_file) == EResult::Success);
+        Reader::MemoryLimits limits;
+        limits.max_in_flight_size = 8 * MAX_BLOCK_SIZE;
+        reader.set_memory_limits(limits);
+        size_t gcode_size = 0;
+        REQUIRE(reader.for_each_gcode_block([&gcode_size](size_t, const std::string& data) { gcode_size += data.size(); }) ==
+            EResult::Success);
+        REQUIRE(gcode_size > 0);
+        probe.check("Reader::for_each_gcode_block");
+    }
+
+    {
+        rewind(binary_file);
+        const MemoryProbe probe;
+        Reader reader;
+        REQUIRE(reader.open(*binary_file) == EResult::Success);
+        // default limits, the batches are capped anyway
+        size_t gcode_size = 0;
+        REQUIRE(reader.for_each_gcode_block([&gcode_size](size_t, const std::string& data) { gcode_size += data.size(); }) ==
+            EResult::Success);
+        const size_t budget = DEFAULT_BATCH_SIZE + 2 * ALLOCATION_BUDGET;
+        REQUIRE(gcode_size > budget);
+        probe.check("Reader::for_each_gcode_block (default limits)", budget);
+    }
+}
@@ -0,0 +1,247 @@
+#include <catch_main.hpp>
+
+#include "convert/convert.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <regex>
+#include <sstream>
+
+using namespace bgcode::core;
+using namespace bgcode::binarize;
+using namespace bgcode::convert;
+
+// Throughput and size of the conversions of the generated corpus, with the given gcode compression and encoding.
+// The results are compared against the baseline saved into PERF_BASELINE_FILE.
+// Set the environment variable BGCODE_PERF_UPDATE_BASELINE to save the measured results as the new baseline.
+
+static constexpr const uint64_t CORPUS_SIZE = 4 * 1024 * 1024;
+static constexpr const uint32_t CORPUS_SEED = 0;
+// conversions are repeated, the fastest one is taken
+#ifdef NDEBUG
+static constexpr const size_t RUNS_COUNT = 2;
+#else
+// the throughput is not checked in non optimized builds
+static constexpr const size_t RUNS_COUNT = 1;
+#endif // NDEBUG
+
+static const std::vector<std::pair<std::string, ECompressionType>> Compressions = {
+    { "None", ECompressionType::None },
+    { "Deflate", ECompressionType::Deflate },
+    { "Heatshrink_11_4", ECompressionType::Heatshrink_11_4 },
+    { "Heatshrink_12_4", ECompressionType::Heatshrink_12_4 }
+};
+
+static const std::vector<std::pair<std::string, EGCodeEncodingType>> Encodings = {
+    { "None", EGCodeEncodingType::None },
+    { "MeatPack", EGCodeEncodingType::MeatPack },
+    { "MeatPackComments", EGCodeEncodingType::MeatPackComments }
+};
+
+class ScopedFile
+{
+public:
+    explicit ScopedFile(FILE* file) : m_file(file) {}
+    ~ScopedFile() { if (m_file != nullptr) fclose(m_file); }
+private:
+    FILE* m_file{ nullptr };
+};
+
+struct PerfResult
+{
+    std::string compression;
+    std::string encoding;
+    size_t binary_size{ 0 };
+    // MB/s of ascii gcode
+    double ascii_to_binary_mbs{ 0.0 };
+    double binary_to_ascii_mbs{ 0.0 };
+};
+
+struct PerfBaseline
+{
+    // relative tolerances
+    double size_tolerance{ 0.02 };
+    double throughput_tolerance{ 0.5 };
+    std::vector<PerfResult> results;
+
+    const PerfResult* find(const std::string& compression, const std::string& encoding) const {
+        for (const PerfResult& result : results) {
+            if (result.compression == compression && result.encoding == encoding)
+                return &result;
+        }
+        return nullptr;
+    }
+};
+
+// Reads the baseline, saved with write_baseline()
+static bool read_baseline(const std::string& filename, PerfBaseline& baseline)
+{
+    std::ifstream file(filename);
+    if (!file.good())
+        return false;
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    const std::string data = buffer.str();
+
+    // the file contains flat objects only, the pairs of each object are collected
+    const std::regex object_regex(R"(\{[^{}]*\})");
+    const std::regex pair_regex(R"re("(\w+)"\s*:\s*(?:"([^"]*)"|([-+0-9.eE]+)))re");
+    for (auto it = std::sregex_iterator(data.begin(), data.end(), object_regex); it != std::sregex_iterator(); ++it) {
+        const std::string object = it->str();
+        PerfResult result;
+        bool is_result = false;
+        for (auto p = std::sregex_iterator(object.begin(), object.end(), pair_regex); p != std::sregex_iterator(); ++p) {
+            const std::string key = (*p)[1];
+            const std::string text = (*p)[2];
+            const double number = (*p)[3].matched ? std::atof((*p)[3].str().c_str()) : 0.0;
+            if (key == "size")
+                baseline.size_tolerance = number;
+            else if (key == "throughput")
+                baseline.throughput_tolerance = number;
+            else if (key == "compression") {
+                result.compression = text;
+                is_result = true;
+            }
+            else if (key == "encoding")
+                result.encoding = text;
+            else if (key == "binary_size")
+                result.binary_size = (size_t)number;
+            else if (key == "ascii_to_binary_mbs")
+                result.ascii_to_binary_mbs = number;
+            else if (key == "binary_to_ascii_mbs")
+                result.binary_to_ascii_mbs = number;
+        }
+        if (is_result)
+            baseline.results.push_back(result);
+    }
+    return true;
+}
+
+static bool write_baseline(const std::string& filename, const PerfBaseline& baseline)
+{
+    std::ofstream file(filename);
+    if (!file.good())
+        return false;
+    file << "{\n";
+    file << "  \"corpus\": { \"size\": " << CORPUS_SIZE << ", \"seed\": " << CORPUS_SEED << " },\n";
+    file << "  \"tolerance\": { \"size\": " << baseline.size_tolerance << ", \"throughput\": " << baseline.throughput_tolerance << " },\n";
+    file << "  \"results\": [\n";
+    for (size_t i = 0; i < baseline.results.size(); ++i) {
+        const PerfResult& r = baseline.results[i];
+        file << "    { \"compression\": \"" << r.compression << "\", \"encoding\": \"" << r.encoding << "\", \"binary_size\": " <<
+            r.binary_size << ", \"ascii_to_binary_mbs\": " << std::round(r.ascii_to_binary_mbs * 10.0) / 10.0 <<
+            ", \"binary_to_ascii_mbs\": " << std::round(r.binary_to_ascii_mbs * 10.0) / 10.0 << " }" <<
+            (i + 1 < baseline.results.size() ? "," : "") << "\n";
+    }
+    file << "  ]\n";
+    file << "}\n";
+    return file.good();
+}
+
+static size_t file_size(FILE& file)
+{
+    fseek(&file, 0, SEEK_END);
+    const size_t size = (size_t)ftell(&file);
+    rewind(&file);
+    return size;
+}
+
+// Returns the fastest time of the given conversion, in seconds
+template<class Fn>
+static double measure(Fn&& convert)
+{
+    double best = 0.0;
+    for (size_t i = 0; i < RUNS_COUNT; ++i) {
+        const auto start = std::chrono::steady_clock::now();
+        REQUIRE(convert() == EResult::Success);
+        const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (i == 0 || elapsed < best)
+            best = elapsed;
+    }
+    return best;
+}
+
+TEST_CASE("Conversion throughput", "[Perf]")
+{
+    std::cout << "\nTEST: Conversion throughput\n";
+
+    FILE* ascii_file = tmpfile();
+    REQUIRE(ascii_file != nullptr);
+    ScopedFile scoped_ascii_file(ascii_file);
+    GeneratorConfig generator_config;
+    generator_config.size = CORPUS_SIZE;
+    generator_config.seed = CORPUS_SEED;
+    REQUIRE(generate_gcode(*ascii_file, generator_config) == EResult::Success);
+    const size_t ascii_size = file_size(*ascii_file);
+    const double ascii_mb = double(ascii_size) / (1024.0 * 1024.0);
+
+    PerfBaseline measured;
+    for (const auto& [compression_name, compression] : Compressions) {
+        for (const auto& [encoding_name, encoding] : Encodings) {
+            BinarizerConfig config;
+            config.compression.gcode = compression;
+            config.gcode_encoding = encoding;
+
+            FILE* binary_file = tmpfile();
+            REQUIRE(binary_file != nullptr);
+            ScopedFile scoped_binary_file(binary_file);
+            const double ascii_to_binary_time = measure([&]() {
+                rewind(ascii_file);
+                rewind(binary_file);
+                return from_ascii_to_binary(*ascii_file, *binary_file, config);
+            });
+            const size_t binary_size = (size_t)ftell(binary_file);
+
+            FILE* back_file = tmpfile();
+            REQUIRE(back_file != nullptr);
+            ScopedFile scoped_back_file(back_file);
+            const double binary_to_ascii_time = measure([&]() {
+                rewind(binary_file);
+                rewind(back_file);
+                return from_binary_to_ascii(*binary_file, *back_file, false);
+            });
+
+            PerfResult& result = measured.results.emplace_back();
+            result.compression = compression_name;
+            result.encoding = encoding_name;
+            result.binary_size = binary_size;
+            result.ascii_to_binary_mbs = ascii_mb / ascii_to_binary_time;
+            result.binary_to_ascii_mbs = ascii_mb / binary_to_ascii_time;
+            std::cout << compression_name << " + " << encoding_name << ": " << binary_size << " bytes, ascii to binary " <<
+                result.ascii_to_binary_mbs << " MB/s, binary to ascii " << result.binary_to_ascii_mbs << " MB/s\n";
+        }
+    }
+
+    if (std::getenv("BGCODE_PERF_UPDATE_BASELINE") != nullptr) {
+        PerfBaseline baseline;
+        read_baseline(PERF_BASELINE_FILE, baseline);
+        measured.size_tolerance = baseline.size_tolerance;
+        measured.throughput_tolerance = baseline.throughput_tolerance;
+        REQUIRE(write_baseline(PERF_BASELINE_FILE, measured));
+        std::cout << "Baseline saved into " << PERF_BASELINE_FILE << "\n";
+        return;
+    }
+
+    PerfBaseline baseline;
+    REQUIRE(read_baseline(PERF_BASELINE_FILE, baseline));
+    for (const PerfResult& result : measured.results) {
+        INFO(result.compression << " + " << result.encoding);
+        const PerfResult* expected = baseline.find(result.compression, result.encoding);
+        REQUIRE(expected != nullptr);
+        // the corpus is deterministic, so the sizes change only when the format or the codecs change
+        CHECK(double(result.binary_size) <= double(expected->binary_size) * (1.0 + baseline.size_tolerance));
+        CHECK(double(result.binary_size) >= double(expected->binary_size) * (1.0 - baseline.size_tolerance));
+#ifdef NDEBUG
+        CHECK(result.ascii_to_binary_mbs >= expected->ascii_to_binary_mbs * (1.0 - baseline.throughput_tolerance));
+        CHECK(result.binary_to_ascii_mbs >= expected->binary_to_ascii_mbs * (1.0 - baseline.throughput_tolerance));
+#else
+        // the baseline throughput is measured with optimized builds
+        if (result.ascii_to_binary_mbs < expected->ascii_to_binary_mbs * (1.0 - baseline.throughput_tolerance) ||
+            result.binary_to_ascii_mbs < expected->binary_to_ascii_mbs * (1.0 - baseline.throughput_tolerance))
+            WARN("Throughput below the baseline, not checked in non optimized builds");
+#endif // NDEBUG
+    }
+}